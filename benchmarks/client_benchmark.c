@@ -0,0 +1,501 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "loopback_broker.h"
+
+#include <aws/mqtt/client.h>
+
+#include <aws/io/channel_bootstrap.h>
+#include <aws/io/event_loop.h>
+#include <aws/io/host_resolver.h>
+#include <aws/io/socket.h>
+
+#include <aws/common/clock.h>
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Publishes as fast as a fixed number of publishes in flight allows, against the in-process loopback broker, and
+ * reports throughput and publish-to-ack latency. The latency of each publish runs from just before the call to
+ * publish to its on_complete: for QoS 0 that's when it's written, for QoS 1 PUBACK and for QoS 2 PUBCOMP.
+ *
+ * Each sweep varies one of payload size, QoS, publishes in flight and subscription count from the same baseline.
+ * With subscriptions, the broker sends every publish back, so the client also matches each one against the tree.
+ */
+
+enum {
+    S_EVENT_LOOP_THREADS = 2,
+    /* Each scenario sends about this many payload bytes, within the message count limits */
+    S_TARGET_BYTES = 64 * 1024 * 1024,
+    S_MIN_MESSAGES = 2000,
+    S_MAX_MESSAGES = 50000,
+    /* Subscriptions are made this many to a SUBSCRIBE */
+    S_SUBSCRIBE_BATCH = 64,
+};
+
+static const char *s_publish_topic = "bench/load";
+
+struct scenario {
+    const char *sweep;
+    size_t payload_size;
+    enum aws_mqtt_qos qos;
+    size_t in_flight;
+    size_t subscriptions;
+};
+
+struct bench_state;
+
+/* Passed to each publish's on_complete */
+struct publish_record {
+    struct bench_state *state;
+    uint64_t start_ns;
+};
+
+struct bench_state {
+    struct aws_allocator *allocator;
+    struct aws_mutex mutex;
+    struct aws_condition_variable signal;
+
+    struct aws_mqtt_client_connection *connection;
+
+    /* Everything below is protected by mutex */
+    bool connected;
+    bool disconnected;
+    int error_code;
+    size_t subscribes_outstanding;
+    size_t in_flight;
+    size_t completed;
+    size_t echoes_received;
+
+    struct publish_record *records;
+    /* Latency of each completed publish, in completion order */
+    uint64_t *latencies_ns;
+};
+
+static uint64_t s_now(void) {
+    uint64_t now = 0;
+    aws_high_res_clock_get_ticks(&now);
+    return now;
+}
+
+/*******************************************************************************
+ * Callbacks
+ ******************************************************************************/
+
+static void s_signal(struct bench_state *state) {
+    aws_condition_variable_notify_all(&state->signal);
+    aws_mutex_unlock(&state->mutex);
+}
+
+static void s_on_connection_complete(
+    struct aws_mqtt_client_connection *connection,
+    int error_code,
+    enum aws_mqtt_connect_return_code return_code,
+    bool session_present,
+    void *userdata) {
+
+    (void)connection;
+    (void)session_present;
+
+    struct bench_state *state = userdata;
+
+    aws_mutex_lock(&state->mutex);
+    state->connected = true;
+    if (error_code || return_code != AWS_MQTT_CONNECT_ACCEPTED) {
+        state->error_code = error_code ? error_code : AWS_ERROR_UNKNOWN;
+    }
+    s_signal(state);
+}
+
+static void s_on_disconnect(struct aws_mqtt_client_connection *connection, void *userdata) {
+
+    (void)connection;
+
+    struct bench_state *state = userdata;
+
+    aws_mutex_lock(&state->mutex);
+    state->disconnected = true;
+    s_signal(state);
+}
+
+static void s_on_suback(
+    struct aws_mqtt_client_connection *connection,
+    uint16_t packet_id,
+    const struct aws_array_list *topic_subacks,
+    int error_code,
+    void *userdata) {
+
+    (void)connection;
+    (void)packet_id;
+    (void)topic_subacks;
+
+    struct bench_state *state = userdata;
+
+    aws_mutex_lock(&state->mutex);
+    --state->subscribes_outstanding;
+    if (error_code) {
+        state->error_code = error_code;
+    }
+    s_signal(state);
+}
+
+static void s_on_echo(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_byte_cursor *topic,
+    const struct aws_byte_cursor *payload,
+    void *userdata) {
+
+    (void)connection;
+    (void)topic;
+    (void)payload;
+
+    struct bench_state *state = userdata;
+
+    aws_mutex_lock(&state->mutex);
+    ++state->echoes_received;
+    s_signal(state);
+}
+
+static void s_on_publish_complete(
+    struct aws_mqtt_client_connection *connection,
+    uint16_t packet_id,
+    int error_code,
+    void *userdata) {
+
+    (void)connection;
+    (void)packet_id;
+
+    const uint64_t now = s_now();
+    struct publish_record *record = userdata;
+    struct bench_state *state = record->state;
+
+    aws_mutex_lock(&state->mutex);
+    state->latencies_ns[state->completed++] = now - record->start_ns;
+    --state->in_flight;
+    if (error_code) {
+        state->error_code = error_code;
+    }
+    s_signal(state);
+}
+
+/*******************************************************************************
+ * Scenario
+ ******************************************************************************/
+
+static int s_compare_u64(const void *a, const void *b) {
+    const uint64_t lhs = *(const uint64_t *)a;
+    const uint64_t rhs = *(const uint64_t *)b;
+    return lhs < rhs ? -1 : lhs > rhs;
+}
+
+static double s_percentile_us(const uint64_t *sorted, size_t count, size_t per_thousand) {
+    size_t idx = count * per_thousand / 1000;
+    if (idx >= count) {
+        idx = count - 1;
+    }
+    return (double)sorted[idx] / 1000.0;
+}
+
+/* Wait until the connection is up, then make the scenario's subscriptions */
+static int s_connect_and_subscribe(
+    struct bench_state *state,
+    struct aws_mqtt_client *client,
+    uint16_t port,
+    const struct scenario *scenario) {
+
+    struct aws_socket_options socket_options;
+    AWS_ZERO_STRUCT(socket_options);
+    socket_options.connect_timeout_ms = 3000;
+    socket_options.type = AWS_SOCKET_STREAM;
+    socket_options.domain = AWS_SOCKET_IPV4;
+
+    state->connection = aws_mqtt_client_connection_new(client);
+    if (!state->connection) {
+        return AWS_OP_ERR;
+    }
+
+    struct aws_mqtt_connection_options options = {
+        .host_name = aws_byte_cursor_from_c_str("127.0.0.1"),
+        .port = port,
+        .socket_options = &socket_options,
+        .client_id = aws_byte_cursor_from_c_str("aws-c-mqtt-benchmark"),
+        .on_connection_complete = s_on_connection_complete,
+        .user_data = state,
+        .clean_session = true,
+        .write_batch_max_bytes = 16 * 1024,
+    };
+    if (aws_mqtt_client_connection_connect(state->connection, &options)) {
+        return AWS_OP_ERR;
+    }
+
+    aws_mutex_lock(&state->mutex);
+    while (!state->connected) {
+        aws_condition_variable_wait(&state->signal, &state->mutex);
+    }
+    aws_mutex_unlock(&state->mutex);
+    if (state->error_code) {
+        return aws_raise_error(state->error_code);
+    }
+
+    if (!scenario->subscriptions) {
+        return AWS_OP_SUCCESS;
+    }
+
+    /* One subscription matches the published topic, the rest only make the tree bigger */
+    char filters[S_SUBSCRIBE_BATCH][64];
+    struct aws_mqtt_topic_subscription subscriptions[S_SUBSCRIBE_BATCH];
+    struct aws_array_list list;
+    aws_array_list_init_static(&list, subscriptions, S_SUBSCRIBE_BATCH, sizeof(struct aws_mqtt_topic_subscription));
+
+    for (size_t made = 0; made < scenario->subscriptions;) {
+        aws_array_list_clear(&list);
+        for (size_t i = 0; i < S_SUBSCRIBE_BATCH && made < scenario->subscriptions; ++i, ++made) {
+            struct aws_mqtt_topic_subscription subscription = {
+                .qos = AWS_MQTT_QOS_AT_MOST_ONCE,
+                .on_publish = s_on_echo,
+                .on_publish_ud = state,
+            };
+            if (made == 0) {
+                subscription.topic = aws_byte_cursor_from_c_str(s_publish_topic);
+            } else {
+                snprintf(filters[i], sizeof(filters[i]), "bench/tree/%d/+", (int)made);
+                subscription.topic = aws_byte_cursor_from_c_str(filters[i]);
+            }
+            aws_array_list_push_back(&list, &subscription);
+        }
+
+        aws_mutex_lock(&state->mutex);
+        ++state->subscribes_outstanding;
+        aws_mutex_unlock(&state->mutex);
+
+        if (!aws_mqtt_client_connection_subscribe_multiple(state->connection, &list, s_on_suback, state)) {
+            return AWS_OP_ERR;
+        }
+
+        /* The filters are copied, but the buffers are reused for the next batch only once this one is acked */
+        aws_mutex_lock(&state->mutex);
+        while (state->subscribes_outstanding) {
+            aws_condition_variable_wait(&state->signal, &state->mutex);
+        }
+        aws_mutex_unlock(&state->mutex);
+    }
+
+    return state->error_code ? aws_raise_error(state->error_code) : AWS_OP_SUCCESS;
+}
+
+static int s_run_scenario(struct aws_mqtt_client *client, uint16_t port, const struct scenario *scenario) {
+
+    size_t count = S_TARGET_BYTES / (scenario->payload_size ? scenario->payload_size : 1);
+    count = count < S_MIN_MESSAGES ? S_MIN_MESSAGES : count > S_MAX_MESSAGES ? S_MAX_MESSAGES : count;
+
+    struct bench_state state;
+    AWS_ZERO_STRUCT(state);
+    state.allocator = client->allocator;
+    aws_mutex_init(&state.mutex);
+    aws_condition_variable_init(&state.signal);
+
+    int result = AWS_OP_ERR;
+    uint8_t *payload = aws_mem_acquire(state.allocator, scenario->payload_size ? scenario->payload_size : 1);
+    state.records = aws_mem_acquire(state.allocator, sizeof(struct publish_record) * count);
+    state.latencies_ns = aws_mem_acquire(state.allocator, sizeof(uint64_t) * count);
+    if (!payload || !state.records || !state.latencies_ns) {
+        goto clean_up;
+    }
+    memset(payload, 'x', scenario->payload_size);
+
+    if (s_connect_and_subscribe(&state, client, port, scenario)) {
+        goto disconnect;
+    }
+
+    const struct aws_byte_cursor topic = aws_byte_cursor_from_c_str(s_publish_topic);
+    const struct aws_byte_cursor payload_cur = aws_byte_cursor_from_array(payload, scenario->payload_size);
+
+    const uint64_t start_ns = s_now();
+    for (size_t i = 0; i < count; ++i) {
+        aws_mutex_lock(&state.mutex);
+        while (state.in_flight >= scenario->in_flight) {
+            aws_condition_variable_wait(&state.signal, &state.mutex);
+        }
+        ++state.in_flight;
+        aws_mutex_unlock(&state.mutex);
+
+        state.records[i].state = &state;
+        state.records[i].start_ns = s_now();
+        if (!aws_mqtt_client_connection_publish(
+                state.connection,
+                &topic,
+                scenario->qos,
+                false,
+                &payload_cur,
+                s_on_publish_complete,
+                &state.records[i])) {
+            goto disconnect;
+        }
+    }
+
+    const size_t echoes_expected = scenario->subscriptions ? count : 0;
+    aws_mutex_lock(&state.mutex);
+    while (state.completed < count || state.echoes_received < echoes_expected) {
+        aws_condition_variable_wait(&state.signal, &state.mutex);
+    }
+    aws_mutex_unlock(&state.mutex);
+    const uint64_t elapsed_ns = s_now() - start_ns;
+
+    if (state.error_code) {
+        aws_raise_error(state.error_code);
+        goto disconnect;
+    }
+
+    qsort(state.latencies_ns, count, sizeof(uint64_t), s_compare_u64);
+    printf(
+        "%-14s %8d %4d %9d %8d %7d %12.0f %10.1f %10.1f %10.1f\n",
+        scenario->sweep,
+        (int)scenario->payload_size,
+        (int)scenario->qos,
+        (int)scenario->in_flight,
+        (int)scenario->subscriptions,
+        (int)count,
+        (double)count * 1e9 / (double)elapsed_ns,
+        s_percentile_us(state.latencies_ns, count, 500),
+        s_percentile_us(state.latencies_ns, count, 990),
+        s_percentile_us(state.latencies_ns, count, 999));
+
+    result = AWS_OP_SUCCESS;
+
+disconnect:
+    if (result) {
+        fprintf(stderr, "%s scenario failed: %s\n", scenario->sweep, aws_error_name(aws_last_error()));
+    }
+    if (state.connection) {
+        if (state.connected && !aws_mqtt_client_connection_disconnect(state.connection, s_on_disconnect, &state)) {
+            aws_mutex_lock(&state.mutex);
+            while (!state.disconnected) {
+                aws_condition_variable_wait(&state.signal, &state.mutex);
+            }
+            aws_mutex_unlock(&state.mutex);
+        }
+        aws_mqtt_client_connection_destroy(state.connection);
+    }
+
+clean_up:
+    aws_mem_release(state.allocator, state.latencies_ns);
+    aws_mem_release(state.allocator, state.records);
+    aws_mem_release(state.allocator, payload);
+    aws_condition_variable_clean_up(&state.signal);
+    aws_mutex_clean_up(&state.mutex);
+
+    return result;
+}
+
+/*******************************************************************************
+ * Main
+ ******************************************************************************/
+
+static const struct scenario s_scenarios[] = {
+    {"payload", 16, AWS_MQTT_QOS_AT_LEAST_ONCE, 64, 0},
+    {"payload", 256, AWS_MQTT_QOS_AT_LEAST_ONCE, 64, 0},
+    {"payload", 4096, AWS_MQTT_QOS_AT_LEAST_ONCE, 64, 0},
+    {"payload", 65536, AWS_MQTT_QOS_AT_LEAST_ONCE, 64, 0},
+
+    {"qos", 256, AWS_MQTT_QOS_AT_MOST_ONCE, 64, 0},
+    {"qos", 256, AWS_MQTT_QOS_AT_LEAST_ONCE, 64, 0},
+    {"qos", 256, AWS_MQTT_QOS_EXACTLY_ONCE, 64, 0},
+
+    {"in-flight", 256, AWS_MQTT_QOS_AT_LEAST_ONCE, 1, 0},
+    {"in-flight", 256, AWS_MQTT_QOS_AT_LEAST_ONCE, 8, 0},
+    {"in-flight", 256, AWS_MQTT_QOS_AT_LEAST_ONCE, 64, 0},
+    {"in-flight", 256, AWS_MQTT_QOS_AT_LEAST_ONCE, 512, 0},
+
+    {"subscriptions", 256, AWS_MQTT_QOS_AT_LEAST_ONCE, 64, 1},
+    {"subscriptions", 256, AWS_MQTT_QOS_AT_LEAST_ONCE, 64, 1000},
+    {"subscriptions", 256, AWS_MQTT_QOS_AT_LEAST_ONCE, 64, 10000},
+};
+
+int main(void) {
+
+    struct aws_allocator *allocator = aws_default_allocator();
+    aws_mqtt_library_init(allocator);
+
+    int result = 1;
+
+    struct aws_event_loop_group el_group;
+    if (aws_event_loop_group_default_init(&el_group, allocator, S_EVENT_LOOP_THREADS)) {
+        fprintf(stderr, "Failed to start event loops\n");
+        goto clean_up_library;
+    }
+
+    struct aws_host_resolver resolver;
+    if (aws_host_resolver_init_default(&resolver, allocator, 8, &el_group)) {
+        goto clean_up_el_group;
+    }
+
+    struct aws_client_bootstrap *bootstrap = aws_client_bootstrap_new(allocator, &el_group, &resolver, NULL);
+    if (!bootstrap) {
+        goto clean_up_resolver;
+    }
+
+    struct aws_mqtt_client client;
+    if (aws_mqtt_client_init(&client, allocator, bootstrap)) {
+        goto clean_up_bootstrap;
+    }
+
+    struct loopback_broker *broker = loopback_broker_new(allocator, &el_group);
+    if (!broker) {
+        goto clean_up_client;
+    }
+
+    printf(
+        "%-14s %8s %4s %9s %8s %7s %12s %10s %10s %10s\n",
+        "sweep",
+        "payload",
+        "qos",
+        "in-flight",
+        "subs",
+        "msgs",
+        "msgs/sec",
+        "p50 us",
+        "p99 us",
+        "p999 us");
+
+    result = 0;
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(s_scenarios); ++i) {
+        if (s_run_scenario(&client, loopback_broker_get_port(broker), &s_scenarios[i])) {
+            result = 1;
+        }
+    }
+
+    loopback_broker_destroy(broker);
+
+clean_up_client:
+    aws_mqtt_client_clean_up(&client);
+
+clean_up_bootstrap:
+    aws_client_bootstrap_release(bootstrap);
+
+clean_up_resolver:
+    aws_host_resolver_clean_up(&resolver);
+
+clean_up_el_group:
+    aws_event_loop_group_clean_up(&el_group);
+
+clean_up_library:
+    aws_mqtt_library_clean_up();
+
+    return result;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/mqtt.h>
+
+/*
+ * Topic validation and remaining length decoding as they were before being rewritten, for codec_benchmark.c to
+ * compare against. Validation splits the topic and searches each part for each wildcard, decoding reads a byte at a
+ * time.
+ */
+
+bool baseline_is_valid_topic(const struct aws_byte_cursor *topic, bool is_filter);
+int baseline_fixed_header_get_packet_size(struct aws_byte_cursor cur, size_t *packet_size);
+
+bool baseline_is_valid_topic(const struct aws_byte_cursor *topic, bool is_filter) {
+
+    if (!topic->ptr || !topic->len) {
+        return false;
+    }
+
+    if (memchr(topic->ptr, 0, topic->len)) {
+        return false;
+    }
+
+    if (topic->len > 65535) {
+        return false;
+    }
+
+    bool saw_hash = false;
+
+    struct aws_byte_cursor topic_part;
+    AWS_ZERO_STRUCT(topic_part);
+    while (aws_byte_cursor_next_split(topic, '/', &topic_part)) {
+
+        if (saw_hash) {
+            return false;
+        }
+
+        if (topic_part.len == 0) {
+            continue;
+        }
+
+        if (memchr(topic_part.ptr, '+', topic_part.len)) {
+            if (!is_filter || topic_part.len > 1) {
+                return false;
+            }
+        }
+
+        if (memchr(topic_part.ptr, '#', topic_part.len)) {
+            if (!is_filter || topic_part.len > 1) {
+                return false;
+            }
+            saw_hash = true;
+        }
+    }
+
+    return true;
+}
+
+int baseline_fixed_header_get_packet_size(struct aws_byte_cursor cur, size_t *packet_size) {
+
+    const size_t total_len = cur.len;
+    aws_byte_cursor_advance(&cur, 1);
+
+    size_t multiplier = 1;
+    size_t remaining_length = 0;
+    while (true) {
+        uint8_t encoded_byte;
+        if (!aws_byte_cursor_read_u8(&cur, &encoded_byte)) {
+            return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+        }
+
+        remaining_length += (encoded_byte & 127) * multiplier;
+        multiplier *= 128;
+
+        if (!(encoded_byte & 128)) {
+            break;
+        }
+        if (multiplier > 128 * 128 * 128) {
+            return aws_raise_error(AWS_ERROR_MQTT_INVALID_REMAINING_LENGTH);
+        }
+    }
+
+    *packet_size = (total_len - cur.len) + remaining_length;
+    return AWS_OP_SUCCESS;
+}
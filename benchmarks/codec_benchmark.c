@@ -0,0 +1,471 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/mqtt.h>
+
+#include <aws/mqtt/private/fixed_header.h>
+#include <aws/mqtt/private/packet_framer.h>
+#include <aws/mqtt/private/packets.h>
+#include <aws/mqtt/private/topic_tree.h>
+
+#include <aws/common/clock.h>
+#include <aws/common/string.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+
+/**
+ * Times topic validation and remaining length decoding against the byte at a time implementations they replaced,
+ * then the packet encoders, decoders and topic tree dispatch on their own.
+ */
+
+enum { S_ITERATIONS = 2000000 };
+
+/* Results are accumulated here so the compiler can't throw the work away */
+static volatile size_t s_sink;
+
+/* The implementations being replaced, in codec_baseline.c so they're called the same way the library is */
+bool baseline_is_valid_topic(const struct aws_byte_cursor *topic, bool is_filter);
+int baseline_fixed_header_get_packet_size(struct aws_byte_cursor cur, size_t *packet_size);
+
+/*******************************************************************************
+ * Timing
+ ******************************************************************************/
+
+static uint64_t s_now(void) {
+    uint64_t now = 0;
+    aws_high_res_clock_get_ticks(&now);
+    return now;
+}
+
+static void s_report(const char *name, uint64_t baseline_ns, uint64_t current_ns) {
+    printf(
+        "%-28s baseline %7.2f ns/op   current %7.2f ns/op   %5.2fx\n",
+        name,
+        (double)baseline_ns / S_ITERATIONS,
+        (double)current_ns / S_ITERATIONS,
+        current_ns ? (double)baseline_ns / (double)current_ns : 0.0);
+}
+
+static void s_bench_topic(const char *name, const char *topic_str, bool is_filter) {
+
+    const struct aws_byte_cursor topic = aws_byte_cursor_from_c_str(topic_str);
+
+    size_t valid = 0;
+    uint64_t start = s_now();
+    for (size_t i = 0; i < S_ITERATIONS; ++i) {
+        valid += baseline_is_valid_topic(&topic, is_filter);
+    }
+    const uint64_t baseline_ns = s_now() - start;
+
+    start = s_now();
+    for (size_t i = 0; i < S_ITERATIONS; ++i) {
+        valid += is_filter ? aws_mqtt_is_valid_topic_filter(&topic) : aws_mqtt_is_valid_topic(&topic);
+    }
+    const uint64_t current_ns = s_now() - start;
+
+    if (valid != 0 && valid != 2 * (size_t)S_ITERATIONS) {
+        printf("%s: validators disagree\n", name);
+    }
+    s_sink += valid;
+    s_report(name, baseline_ns, current_ns);
+}
+
+enum { S_HEADER_COUNT = 4096 };
+
+/* Each header is followed by the start of a body, like a packet in a read buffer would be */
+static uint8_t s_headers[S_HEADER_COUNT][16];
+
+/* Decode S_HEADER_COUNT headers with remaining lengths picked at random from lengths, over and over. With more than
+ * one size the branch predictor can't learn the sizes, like when reading real traffic. */
+static void s_bench_remaining_length(const char *name, const size_t *lengths, size_t length_count) {
+
+    uint32_t random = 1;
+    for (size_t i = 0; i < S_HEADER_COUNT; ++i) {
+        random = random * 1103515245 + 12345;
+        const struct aws_mqtt_fixed_header header = {
+            .packet_type = AWS_MQTT_PACKET_PUBLISH,
+            .remaining_length = lengths[(random >> 16) % length_count],
+        };
+
+        struct aws_byte_buf buf = aws_byte_buf_from_array(s_headers[i], sizeof(s_headers[i]));
+        buf.len = 0;
+        aws_mqtt_fixed_header_encode(&buf, &header);
+    }
+
+    size_t total = 0;
+    size_t packet_size = 0;
+    uint64_t start = s_now();
+    for (size_t i = 0; i < S_ITERATIONS; ++i) {
+        const size_t idx = i % S_HEADER_COUNT;
+        baseline_fixed_header_get_packet_size(
+            aws_byte_cursor_from_array(s_headers[idx], sizeof(s_headers[idx])), &packet_size);
+        total += packet_size;
+    }
+    const uint64_t baseline_ns = s_now() - start;
+
+    start = s_now();
+    for (size_t i = 0; i < S_ITERATIONS; ++i) {
+        const size_t idx = i % S_HEADER_COUNT;
+        aws_mqtt_fixed_header_get_packet_size(
+            aws_byte_cursor_from_array(s_headers[idx], sizeof(s_headers[idx])), &packet_size);
+        total -= packet_size;
+    }
+    const uint64_t current_ns = s_now() - start;
+
+    if (total != 0) {
+        printf("%s: decoders disagree\n", name);
+    }
+    s_sink += total;
+    s_report(name, baseline_ns, current_ns);
+}
+
+static void s_report_single(const char *name, uint64_t elapsed_ns, size_t iterations) {
+    printf("%-28s %9.2f ns/op\n", name, (double)elapsed_ns / (double)iterations);
+}
+
+/*******************************************************************************
+ * Encoders
+ ******************************************************************************/
+
+enum { S_ENCODE_ITERATIONS = 1000000 };
+
+static uint8_t s_encode_storage[70 * 1024];
+static uint8_t s_payload[64 * 1024];
+
+static void s_bench_publish_encode(const char *name, size_t payload_size, bool headers_only) {
+
+    struct aws_mqtt_packet_publish publish;
+    aws_mqtt_packet_publish_init(
+        &publish,
+        false,
+        AWS_MQTT_QOS_AT_LEAST_ONCE,
+        false,
+        aws_byte_cursor_from_c_str("devices/f3a9c2d1/telemetry/temperature"),
+        42,
+        aws_byte_cursor_from_array(s_payload, payload_size));
+
+    struct aws_byte_buf buf = aws_byte_buf_from_empty_array(s_encode_storage, sizeof(s_encode_storage));
+    const uint64_t start = s_now();
+    for (size_t i = 0; i < S_ENCODE_ITERATIONS; ++i) {
+        buf.len = 0;
+        if (headers_only) {
+            aws_mqtt_packet_publish_encode_headers(&buf, &publish);
+        } else {
+            aws_mqtt_packet_publish_encode(&buf, &publish);
+        }
+        s_sink += buf.len;
+    }
+    s_report_single(name, s_now() - start, S_ENCODE_ITERATIONS);
+}
+
+static void s_bench_encoders(struct aws_allocator *allocator) {
+
+    s_bench_publish_encode("publish headers", 0, true);
+    s_bench_publish_encode("publish, 16 byte payload", 16, false);
+    s_bench_publish_encode("publish, 1k payload", 1024, false);
+    s_bench_publish_encode("publish, 64k payload", sizeof(s_payload), false);
+
+    struct aws_byte_buf buf = aws_byte_buf_from_empty_array(s_encode_storage, sizeof(s_encode_storage));
+
+    struct aws_mqtt_packet_ack puback;
+    aws_mqtt_packet_puback_init(&puback, 42);
+    uint64_t start = s_now();
+    for (size_t i = 0; i < S_ENCODE_ITERATIONS; ++i) {
+        buf.len = 0;
+        aws_mqtt_packet_ack_encode(&buf, &puback);
+        s_sink += buf.len;
+    }
+    s_report_single("puback", s_now() - start, S_ENCODE_ITERATIONS);
+
+    struct aws_mqtt_packet_subscribe subscribe;
+    aws_mqtt_packet_subscribe_init(&subscribe, allocator, 42);
+    aws_mqtt_packet_subscribe_add_topic(&subscribe, aws_byte_cursor_from_c_str("devices/+/telemetry/#"), 1);
+    aws_mqtt_packet_subscribe_add_topic(&subscribe, aws_byte_cursor_from_c_str("devices/f3a9c2d1/commands"), 1);
+    aws_mqtt_packet_subscribe_add_topic(&subscribe, aws_byte_cursor_from_c_str("broadcast/#"), 0);
+    start = s_now();
+    for (size_t i = 0; i < S_ENCODE_ITERATIONS; ++i) {
+        buf.len = 0;
+        aws_mqtt_packet_subscribe_encode(&buf, &subscribe);
+        s_sink += buf.len;
+    }
+    s_report_single("subscribe, 3 filters", s_now() - start, S_ENCODE_ITERATIONS);
+    aws_mqtt_packet_subscribe_clean_up(&subscribe);
+
+    struct aws_mqtt_packet_connect connect;
+    aws_mqtt_packet_connect_init(&connect, aws_byte_cursor_from_c_str("aws-c-mqtt-benchmark"), true, 60);
+    aws_mqtt_packet_connect_add_credentials(
+        &connect, aws_byte_cursor_from_c_str("user"), aws_byte_cursor_from_c_str("password"));
+    start = s_now();
+    for (size_t i = 0; i < S_ENCODE_ITERATIONS; ++i) {
+        buf.len = 0;
+        aws_mqtt_packet_connect_encode(&buf, &connect);
+        s_sink += buf.len;
+    }
+    s_report_single("connect, with credentials", s_now() - start, S_ENCODE_ITERATIONS);
+}
+
+/*******************************************************************************
+ * Decoders
+ ******************************************************************************/
+
+enum { S_DECODE_ITERATIONS = 1000000 };
+
+static void s_report_throughput(const char *name, uint64_t elapsed_ns, size_t packets, size_t bytes) {
+    const double seconds = (double)elapsed_ns / 1e9;
+    printf(
+        "%-28s %9.2f Mpackets/s %9.2f MB/s\n",
+        name,
+        (double)packets / seconds / 1e6,
+        (double)bytes / seconds / 1e6);
+}
+
+typedef int(s_decode_fn)(struct aws_byte_cursor *cur, void *packet);
+
+static int s_decode_fixed_header(struct aws_byte_cursor *cur, void *packet) {
+    return aws_mqtt_fixed_header_decode(cur, packet);
+}
+
+static int s_decode_publish(struct aws_byte_cursor *cur, void *packet) {
+    return aws_mqtt_packet_publish_decode(cur, packet);
+}
+
+static int s_decode_subscribe(struct aws_byte_cursor *cur, void *packet) {
+    struct aws_mqtt_packet_subscribe *subscribe = packet;
+    aws_array_list_clear(&subscribe->topic_filters);
+    return aws_mqtt_packet_subscribe_decode(cur, subscribe);
+}
+
+static int s_decode_connect(struct aws_byte_cursor *cur, void *packet) {
+    return aws_mqtt_packet_connect_decode(cur, packet);
+}
+
+static void s_bench_decode(const char *name, const struct aws_byte_buf *encoded, s_decode_fn *decode, void *packet) {
+
+    const uint64_t start = s_now();
+    for (size_t i = 0; i < S_DECODE_ITERATIONS; ++i) {
+        struct aws_byte_cursor cur = aws_byte_cursor_from_buf(encoded);
+        if (decode(&cur, packet)) {
+            printf("%s: decode failed\n", name);
+            return;
+        }
+        s_sink += cur.len;
+    }
+    s_report_throughput(name, s_now() - start, S_DECODE_ITERATIONS, S_DECODE_ITERATIONS * encoded->len);
+}
+
+static void s_encode_publish(struct aws_byte_buf *buf, size_t payload_size) {
+
+    struct aws_mqtt_packet_publish publish;
+    aws_mqtt_packet_publish_init(
+        &publish,
+        false,
+        AWS_MQTT_QOS_AT_LEAST_ONCE,
+        false,
+        aws_byte_cursor_from_c_str("devices/f3a9c2d1/telemetry/temperature"),
+        42,
+        aws_byte_cursor_from_array(s_payload, payload_size));
+    aws_mqtt_packet_publish_encode(buf, &publish);
+}
+
+static int s_count_packet(struct aws_byte_cursor packet, void *userdata) {
+    size_t *count = userdata;
+    ++*count;
+    s_sink += packet.len;
+    return AWS_OP_SUCCESS;
+}
+
+/* A stream of publishes framed in pieces of piece_size, for how much splitting packets across reads costs */
+static void s_bench_framing(
+    struct aws_allocator *allocator,
+    const char *name,
+    const struct aws_byte_buf *stream,
+    size_t stream_packets,
+    size_t piece_size) {
+
+    struct aws_mqtt_packet_framer framer;
+    aws_mqtt_packet_framer_init(&framer, allocator);
+
+    const size_t repeats = S_DECODE_ITERATIONS / stream_packets;
+    size_t packets = 0;
+    const uint64_t start = s_now();
+    for (size_t i = 0; i < repeats; ++i) {
+        struct aws_byte_cursor data = aws_byte_cursor_from_buf(stream);
+        while (data.len) {
+            const size_t len = data.len < piece_size ? data.len : piece_size;
+            aws_mqtt_packet_framer_process(&framer, aws_byte_cursor_advance(&data, len), s_count_packet, &packets);
+        }
+    }
+    const uint64_t elapsed_ns = s_now() - start;
+
+    if (packets != repeats * stream_packets) {
+        printf("%s: framed %d of %d packets\n", name, (int)packets, (int)(repeats * stream_packets));
+    }
+    s_report_throughput(name, elapsed_ns, packets, repeats * stream->len);
+
+    aws_mqtt_packet_framer_clean_up(&framer);
+}
+
+static void s_bench_decoders(struct aws_allocator *allocator) {
+
+    struct aws_byte_buf encoded;
+    aws_byte_buf_init(&encoded, allocator, 2 * 1024);
+
+    s_encode_publish(&encoded, 16);
+    struct aws_mqtt_fixed_header header;
+    s_bench_decode("fixed header", &encoded, s_decode_fixed_header, &header);
+
+    struct aws_mqtt_packet_publish publish;
+    s_bench_decode("publish, 16 byte payload", &encoded, s_decode_publish, &publish);
+    encoded.len = 0;
+    s_encode_publish(&encoded, 1024);
+    s_bench_decode("publish, 1k payload", &encoded, s_decode_publish, &publish);
+
+    struct aws_mqtt_packet_subscribe subscribe;
+    aws_mqtt_packet_subscribe_init(&subscribe, allocator, 42);
+    aws_mqtt_packet_subscribe_add_topic(&subscribe, aws_byte_cursor_from_c_str("devices/+/telemetry/#"), 1);
+    aws_mqtt_packet_subscribe_add_topic(&subscribe, aws_byte_cursor_from_c_str("devices/f3a9c2d1/commands"), 1);
+    aws_mqtt_packet_subscribe_add_topic(&subscribe, aws_byte_cursor_from_c_str("broadcast/#"), 0);
+    encoded.len = 0;
+    aws_mqtt_packet_subscribe_encode(&encoded, &subscribe);
+    s_bench_decode("subscribe, 3 filters", &encoded, s_decode_subscribe, &subscribe);
+    aws_mqtt_packet_subscribe_clean_up(&subscribe);
+
+    struct aws_mqtt_packet_connect connect;
+    aws_mqtt_packet_connect_init(&connect, aws_byte_cursor_from_c_str("aws-c-mqtt-benchmark"), true, 60);
+    aws_mqtt_packet_connect_add_credentials(
+        &connect, aws_byte_cursor_from_c_str("user"), aws_byte_cursor_from_c_str("password"));
+    encoded.len = 0;
+    aws_mqtt_packet_connect_encode(&encoded, &connect);
+    s_bench_decode("connect, with credentials", &encoded, s_decode_connect, &connect);
+
+    aws_byte_buf_clean_up(&encoded);
+
+    /* 1000 publishes, alternating small and 1k payloads */
+    enum { S_STREAM_PACKETS = 1000 };
+    struct aws_byte_buf stream;
+    aws_byte_buf_init(&stream, allocator, S_STREAM_PACKETS * 1100);
+    for (size_t i = 0; i < S_STREAM_PACKETS; ++i) {
+        s_encode_publish(&stream, i % 2 ? 1024 : 16);
+    }
+
+    s_bench_framing(allocator, "framing, 64k reads", &stream, S_STREAM_PACKETS, 64 * 1024);
+    s_bench_framing(allocator, "framing, 1460 byte reads", &stream, S_STREAM_PACKETS, 1460);
+    s_bench_framing(allocator, "framing, 7 byte reads", &stream, S_STREAM_PACKETS, 7);
+
+    aws_byte_buf_clean_up(&stream);
+}
+
+/*******************************************************************************
+ * Topic Tree
+ ******************************************************************************/
+
+enum { S_DISPATCH_ITERATIONS = 1000000 };
+
+static void s_on_dispatch(const struct aws_byte_cursor *topic, const struct aws_byte_cursor *payload, void *userdata) {
+    (void)topic;
+    (void)payload;
+    (void)userdata;
+    ++s_sink;
+}
+
+/* Dispatch a publish matching two of subscription_count subscriptions, one exact and one with a wildcard */
+static void s_bench_tree_publish(
+    struct aws_allocator *allocator,
+    const char *name,
+    size_t subscription_count,
+    size_t match_cache_size) {
+
+    struct aws_mqtt_topic_tree tree;
+    aws_mqtt_topic_tree_init_arena(&tree, allocator);
+    aws_mqtt_topic_tree_set_match_cache_size(&tree, match_cache_size);
+
+    char filter[64];
+    for (size_t i = 0; i < subscription_count; ++i) {
+        if (i == 0) {
+            snprintf(filter, sizeof(filter), "devices/f3a9c2d1/telemetry/temperature");
+        } else if (i == 1) {
+            snprintf(filter, sizeof(filter), "devices/+/telemetry/#");
+        } else {
+            snprintf(filter, sizeof(filter), "devices/%d/telemetry/%s", (int)i, i % 2 ? "+" : "temperature");
+        }
+        struct aws_string *topic_filter = aws_string_new_from_c_str(allocator, filter);
+        aws_mqtt_topic_tree_insert(&tree, topic_filter, AWS_MQTT_QOS_AT_MOST_ONCE, s_on_dispatch, NULL, NULL);
+        aws_string_destroy(topic_filter);
+    }
+
+    struct aws_mqtt_packet_publish publish;
+    aws_mqtt_packet_publish_init(
+        &publish,
+        false,
+        AWS_MQTT_QOS_AT_MOST_ONCE,
+        false,
+        aws_byte_cursor_from_c_str("devices/f3a9c2d1/telemetry/temperature"),
+        0,
+        aws_byte_cursor_from_array(s_payload, 16));
+
+    const uint64_t start = s_now();
+    for (size_t i = 0; i < S_DISPATCH_ITERATIONS; ++i) {
+        aws_mqtt_topic_tree_publish(&tree, &publish);
+    }
+    s_report_single(name, s_now() - start, S_DISPATCH_ITERATIONS);
+
+    aws_mqtt_topic_tree_clean_up(&tree);
+}
+
+int main(void) {
+
+    struct aws_allocator *allocator = aws_default_allocator();
+    aws_mqtt_library_init(allocator);
+
+    printf("%d iterations each\n\n", S_ITERATIONS);
+
+    s_bench_topic("topic, short", "dev/42/temp", false);
+    s_bench_topic("topic, typical", "devices/f3a9c2d1/telemetry/temperature", false);
+    s_bench_topic(
+        "topic, long",
+        "organisation/region/site/building/floor/room/rack/device/f3a9c2d1-77b0-4e1c/sensors/temperature/celsius",
+        false);
+    s_bench_topic("filter, wildcards", "devices/+/telemetry/#", true);
+    s_bench_topic("filter, long", "organisation/region/site/building/floor/room/rack/device/+/sensors/#", true);
+
+    printf("\n");
+
+    const size_t lengths[] = {100, 1000, 100000, 10000000};
+    s_bench_remaining_length("remaining length, 1 byte", &lengths[0], 1);
+    s_bench_remaining_length("remaining length, 2 bytes", &lengths[1], 1);
+    s_bench_remaining_length("remaining length, 3 bytes", &lengths[2], 1);
+    s_bench_remaining_length("remaining length, 4 bytes", &lengths[3], 1);
+    s_bench_remaining_length("remaining length, mixed", lengths, AWS_ARRAY_SIZE(lengths));
+
+    printf("\n");
+
+    s_bench_encoders(allocator);
+
+    printf("\n");
+
+    s_bench_decoders(allocator);
+
+    printf("\n");
+
+    s_bench_tree_publish(allocator, "tree publish, 2 subs", 2, 0);
+    s_bench_tree_publish(allocator, "tree publish, 1k subs", 1000, 0);
+    s_bench_tree_publish(allocator, "tree publish, 100k subs", 100000, 0);
+    s_bench_tree_publish(allocator, "tree publish, 100k cached", 100000, 16);
+
+    aws_mqtt_library_clean_up();
+
+    return 0;
+}
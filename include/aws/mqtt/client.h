@@ -37,6 +37,8 @@ struct aws_mqtt_client {
 };
 
 struct aws_mqtt_client_connection;
+struct aws_mqtt_connection_group;
+struct aws_mqtt_publish_template;
 
 /** Callback called when a request roundtrip is complete (QoS0 immediately, QoS1 on PUBACK, QoS2 on PUBCOMP). */
 typedef void(aws_mqtt_op_complete_fn)(
@@ -73,6 +75,9 @@ typedef void(aws_mqtt_client_on_connection_resumed_fn)(
     bool session_present,
     void *userdata);
 
+/** Called when every publish held back by the connection's in-flight window has been started */
+typedef void(aws_mqtt_client_on_window_available_fn)(struct aws_mqtt_client_connection *connection, void *userdata);
+
 /** Called when a multi-topic subscription request is complete */
 typedef void(aws_mqtt_suback_multi_fn)(
     struct aws_mqtt_client_connection *connection,
@@ -97,6 +102,24 @@ typedef void(aws_mqtt_client_publish_received_fn)(
     const struct aws_byte_cursor *payload,
     void *userdata);
 
+/**
+ * Called to write part of a streamed publish payload.
+ * Exactly length bytes, starting offset bytes into the payload, must be appended to dest.
+ * The same range may be requested again, QoS 1 and 2 publishes are resent until acknowledged.
+ *
+ * Return AWS_OP_SUCCESS, or AWS_OP_ERR with an error raised to fail the publish.
+ */
+typedef int(aws_mqtt_publish_payload_fn)(struct aws_byte_buf *dest, size_t offset, size_t length, void *userdata);
+
+/** Delivers the publishes dispatched to one subscription. Must be called exactly once per executor call. */
+typedef void(aws_mqtt_dispatch_run_fn)(void *run_arg);
+
+/**
+ * Called from the channel's thread to have run(run_arg) called on some other thread.
+ * Return AWS_OP_ERR if it can't be, and the publishes are delivered on the channel's thread instead.
+ */
+typedef int(aws_mqtt_dispatch_executor_fn)(aws_mqtt_dispatch_run_fn *run, void *run_arg, void *userdata);
+
 /* Called when a connection is closed, right before any resources are deleted */
 typedef void(aws_mqtt_client_on_disconnect_fn)(struct aws_mqtt_client_connection *connection, void *userdata);
 
@@ -110,6 +133,57 @@ struct aws_mqtt_topic_subscription {
     void *on_publish_ud;
 };
 
+/** Passed to publish_multiple(), one per PUBLISH packet */
+struct aws_mqtt_publish_message {
+    struct aws_byte_cursor topic;
+    enum aws_mqtt_qos qos;
+    bool retain;
+    struct aws_byte_cursor payload;
+};
+
+enum {
+    /* Size of the per packet type counters in aws_mqtt_connection_stats, indexed by control packet type (1 is
+     * CONNECT, 14 is DISCONNECT) */
+    AWS_MQTT_STATS_PACKET_TYPE_COUNT = 16,
+    /* Number of buckets in aws_mqtt_connection_stats.ack_latency */
+    AWS_MQTT_STATS_ACK_LATENCY_BUCKET_COUNT = 32,
+};
+
+/**
+ * Filled in by aws_mqtt_client_connection_get_stats(). Counters start at 0 when the connection is created and keep
+ * counting across reconnects, gauges are the value at the time of the call.
+ */
+struct aws_mqtt_connection_stats {
+    /* Packets fully written to and read from the channel, by control packet type */
+    uint64_t packets_sent[AWS_MQTT_STATS_PACKET_TYPE_COUNT];
+    uint64_t packets_received[AWS_MQTT_STATS_PACKET_TYPE_COUNT];
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+
+    /* Number of times a request was sent again because its ack didn't arrive in time or the connection was lost */
+    uint64_t retries;
+
+    /* Gauge: requests created and not yet complete */
+    uint64_t requests_in_flight;
+    /* Gauge: requests waiting for the connection to come online before they can be sent */
+    uint64_t pending_requests;
+    /* Gauge: same as aws_mqtt_client_connection_get_queued_bytes() */
+    uint64_t queued_bytes;
+
+    /* Round trip time of the last PINGREQ to be answered, 0 if none has been */
+    uint64_t last_ping_rtt_ns;
+    /* Moving average of ping round trips, weighing each new one by 1/8. Unless ping_timeout_ms is set, waiting 4 times
+     * this long (and at least 3 seconds) for a PINGRESP, with nothing else read meanwhile, drops the connection. */
+    uint64_t smoothed_ping_rtt_ns;
+    /* Channel clock time the last PINGRESP arrived at, 0 if none has */
+    uint64_t last_pingresp_timestamp;
+
+    /* Time from first sending a PUBLISH (QoS 1 and 2), SUBSCRIBE or UNSUBSCRIBE to its final ack.
+     * Bucket 0 counts acks under 1 microsecond, bucket i counts acks in [2^(i-1), 2^i) microseconds and the last
+     * bucket counts everything slower. */
+    uint64_t ack_latency[AWS_MQTT_STATS_ACK_LATENCY_BUCKET_COUNT];
+};
+
 /**
  * host_name                 The server name to connect to. This resource may be freed immediately on return.
  * port                      The port on the server to connect to
@@ -120,16 +194,60 @@ struct aws_mqtt_topic_subscription {
  *                           This is copied into the connection
  *                           Pass NULL to connect without TLS (NOT RECOMMENDED)
  * clean_session             True to discard all server session data and start fresh
- * keep_alive_time_secs      The keep alive value to place in the CONNECT PACKET, a PING will automatically
- *                           be sent at this interval as well. If you specify 0, defaults will be used
- *                           and a ping will be sent once per 60 minutes.
+ * keep_alive_time_secs      The keep alive value to place in the CONNECT PACKET. A PING will automatically be
+ *                           sent once nothing has been sent, or nothing has been received, for this long. Traffic
+ *                           both ways keeps the connection alive without pings. If you specify 0, defaults will be
+ *                           used and the interval is 60 minutes.
  * ping_timeout_ms           Network connection is re-established if a ping response is not received within
- *                           this amount of time (milliseconds). If you specify 0, a default value of 3 seconds is used.
+ *                           this amount of time (milliseconds). Anything else received meanwhile, or consumers
+ *                           holding on to the whole read window, restarts the wait. If you specify 0, 4 times the
+ *                           smoothed round trip of earlier pings is used, and at least 3 seconds, or the keep-alive
+ *                           interval until a ping has been answered.
  *                           Alternatively, tcp keep-alive may be away to accomplish this in a more efficient
  * (low-power) scenario, but keep-alive options may not work the same way on every platform and OS version.
  * on_connection_complete    The callback to fire when the connection attempt completes
  * user_data                  Passed to the userdata param of on_connection_complete
  */
+/* How the wait between reconnect attempts grows, see aws_mqtt_client_connection_set_reconnect_backoff */
+enum aws_mqtt_reconnect_backoff {
+    /* Double every attempt, from the min timeout up to the max */
+    AWS_MQTT_RECONNECT_BACKOFF_EXPONENTIAL,
+    /* A random wait between the min timeout and 3 times the last wait, up to the max */
+    AWS_MQTT_RECONNECT_BACKOFF_DECORRELATED_JITTER,
+};
+
+/* When publishes delivered through aws_mqtt_client_connection_set_dispatch are acknowledged */
+enum aws_mqtt_dispatch_ack_policy {
+    /* PUBACK or PUBREC as soon as the publish has been handed off, like inline delivery */
+    AWS_MQTT_DISPATCH_ACK_ON_RECEIPT,
+    /* Only once every subscription's callback has returned, so the server resends whatever was never handled */
+    AWS_MQTT_DISPATCH_ACK_ON_COMPLETE,
+};
+
+struct aws_mqtt_dispatch_options {
+    /* Runs the callbacks. If NULL, a pool of thread_count threads owned by the connection does. */
+    aws_mqtt_dispatch_executor_fn *executor;
+    void *executor_ud;
+    /* Only used without an executor, 0 is 1 */
+    size_t thread_count;
+    enum aws_mqtt_dispatch_ack_policy ack_policy;
+};
+
+struct aws_mqtt_spool_options {
+    /* File the spool is kept in, created if it doesn't exist */
+    const char *path;
+    /* Size of the file. Anything spooled in it by an earlier process is dropped if this changes. */
+    size_t max_bytes;
+    /* Spooled publishes sent but not yet acked, at most. 0 is 16. */
+    size_t max_in_flight;
+    /* Times a spooled publish may fail before it's dropped from the spool and completed with the error, at most 255.
+     * Losing the connection doesn't count. 0 is 5. */
+    size_t max_attempts;
+    /* Flush every spooled publish to disk before it's accepted, so it survives a crash of the whole machine and not
+     * just of the process */
+    bool sync;
+};
+
 struct aws_mqtt_connection_options {
     struct aws_byte_cursor host_name;
     uint16_t port;
@@ -141,6 +259,31 @@ struct aws_mqtt_connection_options {
     aws_mqtt_client_on_connection_complete_fn *on_connection_complete;
     void *user_data;
     bool clean_session;
+    /* Packets up to this size are coalesced into messages of this size before being written. 0 disables batching. */
+    size_t write_batch_max_bytes;
+    /* How long a batched packet may wait to be written. 0 writes at the end of the current event loop tick. */
+    uint32_t write_batch_max_delay_ms;
+    /* Number of distinct publish topics to remember the matching subscriptions of. 0 disables the cache. */
+    size_t publish_match_cache_size;
+    /* Most QoS 1 and 2 publishes awaiting an ack at once, any more are queued until one completes. 0 is unlimited. */
+    uint16_t max_in_flight_publishes;
+    /* Most requests resent per burst when a session resumes after a reconnect. The rest follow in later bursts, and
+     * anything new waits behind them. 0 resends everything at once. */
+    size_t replay_burst_size;
+    /* How long to wait between replay bursts. 0 sends the next burst on the next event loop tick. */
+    uint32_t replay_burst_interval_ms;
+    /* Keep subscriptions across automatic reconnects, even with clean_session, and whenever the server resumes without
+     * a session, subscribe to all of them again in as few SUBSCRIBE packets as possible. */
+    bool auto_resubscribe;
+    /* Largest SUBSCRIBE packet auto_resubscribe sends, fixed header included. 0 is the largest MQTT allows. */
+    size_t resubscribe_max_packet_size;
+    /* Bytes that may be read from the server before they've been handled, see
+     * aws_mqtt_client_connection_hold_read_window. Payloads handed to the dispatch set up by
+     * aws_mqtt_client_connection_set_dispatch count until they've been handled. 0 reads as fast as the server sends. */
+    size_t read_window_initial_bytes;
+    /* The window doubles, up to this, whenever a full window is read while consumers hold no more than half of it.
+     * Anything under read_window_initial_bytes keeps the window at that size. */
+    size_t read_window_max_bytes;
 };
 
 AWS_EXTERN_C_BEGIN
@@ -218,11 +361,11 @@ int aws_mqtt_client_connection_set_login(
 /**
  * Sets the minimum and maximum reconnect timeouts.
  *
- * The time between reconnect attempts will start at min and multipy by 2 until max is reached.
+ * The time between reconnect attempts will start at min and grow, by default multiplying by 2, until max is reached.
  *
  * \param[in] connection    The connection object
- * \param[in] min_timeout   The timeout to start with
- * \param[in] max_timeout   The highest allowable wait time between reconnect attempts
+ * \param[in] min_timeout   The timeout to start with, in seconds
+ * \param[in] max_timeout   The highest allowable wait time between reconnect attempts, in seconds
  */
 AWS_MQTT_API
 int aws_mqtt_client_connection_set_reconnect_timeout(
@@ -230,6 +373,80 @@ int aws_mqtt_client_connection_set_reconnect_timeout(
     uint64_t min_timeout,
     uint64_t max_timeout);
 
+/**
+ * Sets how the time between reconnect attempts grows from the min timeout to the max.
+ *
+ * Defaults to AWS_MQTT_RECONNECT_BACKOFF_EXPONENTIAL. When many clients lose their connections at once, such as when
+ * a server restarts, AWS_MQTT_RECONNECT_BACKOFF_DECORRELATED_JITTER spreads their attempts out instead of having
+ * them all come back at the same moments.
+ *
+ * \param[in] connection    The connection object
+ * \param[in] backoff       How the wait grows after each failed attempt
+ */
+AWS_MQTT_API
+int aws_mqtt_client_connection_set_reconnect_backoff(
+    struct aws_mqtt_client_connection *connection,
+    enum aws_mqtt_reconnect_backoff backoff);
+
+/**
+ * Moves publish callbacks off the channel's thread, so slow handlers don't hold up reading, acks and keep-alive.
+ *
+ * Each received publish is copied once and handed to every matching subscription. Each subscription still gets its
+ * publishes one at a time, in the order they arrived, while different subscriptions may run concurrently. A
+ * subscription's on_cleanup is called once anything dispatched to it has been handled, which may be on the
+ * executor's thread. With an executor of its own, everything it was given must have run before the connection is
+ * destroyed.
+ *
+ * May only be set once, while disconnected.
+ *
+ * \param[in] connection    The connection object
+ * \param[in] options       Where callbacks run and when their publishes are acknowledged
+ */
+AWS_MQTT_API
+int aws_mqtt_client_connection_set_dispatch(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_mqtt_dispatch_options *options);
+
+/**
+ * Keeps QoS 1 and 2 publishes made with aws_mqtt_client_connection_publish_spooled in a memory-mapped file until
+ * they're acknowledged, so they outlast both a long time offline and a restart. Only max_in_flight of them are
+ * handed to the connection at a time, the rest stay on disk instead of in memory.
+ *
+ * Whatever an earlier process spooled in the same file and never got acknowledged is sent again, in order, once
+ * connected. So is whatever a disconnect interrupted.
+ *
+ * May only be set once, while disconnected.
+ *
+ * \param[in] connection    The connection object
+ * \param[in] options       Where the spool is kept and how big it is
+ */
+AWS_MQTT_API
+int aws_mqtt_client_connection_set_spool(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_mqtt_spool_options *options);
+
+/**
+ * Keep size bytes of the read window closed until they're given back with
+ * aws_mqtt_client_connection_release_read_window. Call it from an on_publish callback with the payload length of a
+ * publish that's passed on to be handled later, so the server can't send more than the window while consumers are
+ * behind. Safe to call from any thread. Does nothing unless read_window_initial_bytes was set.
+ *
+ * \param[in] connection    The connection object
+ * \param[in] size          Bytes to hold
+ */
+AWS_MQTT_API
+int aws_mqtt_client_connection_hold_read_window(struct aws_mqtt_client_connection *connection, size_t size);
+
+/**
+ * Reopen size bytes of the read window held by aws_mqtt_client_connection_hold_read_window, once they've been
+ * handled. Safe to call from any thread.
+ *
+ * \param[in] connection    The connection object
+ * \param[in] size          Bytes to release
+ */
+AWS_MQTT_API
+int aws_mqtt_client_connection_release_read_window(struct aws_mqtt_client_connection *connection, size_t size);
+
 /**
  * Sets the callbacks to call when a connection is interrupted and resumed.
  *
@@ -247,6 +464,21 @@ int aws_mqtt_client_connection_set_connection_interruption_handlers(
     aws_mqtt_client_on_connection_resumed_fn *on_resumed,
     void *on_resumed_ud);
 
+/**
+ * Sets the callback to call when publishes stop being held back by the in-flight window
+ * (see max_in_flight_publishes in aws_mqtt_connection_options). It is only called after at least one publish has
+ * been queued, once the queue has emptied again. Called from the connection's event loop thread.
+ *
+ * \param[in] connection            The connection object
+ * \param[in] on_window_available   The function to call when the queue of held back publishes empties
+ * \param[in] on_window_available_ud Userdata for on_window_available
+ */
+AWS_MQTT_API
+int aws_mqtt_client_connection_set_on_window_available_handler(
+    struct aws_mqtt_client_connection *connection,
+    aws_mqtt_client_on_window_available_fn *on_window_available,
+    void *on_window_available_ud);
+
 /**
  * Opens the actual connection defined by aws_mqtt_client_connection_new.
  * Once the connection is opened, on_connack will be called.
@@ -296,6 +528,7 @@ int aws_mqtt_client_connection_disconnect(
 
 /**
  * Subscribe to topic filters. on_publish will be called when a PUBLISH matching each topic_filter is received.
+ * Filters already subscribed to on this connection are shared, see aws_mqtt_client_connection_subscribe.
  *
  * \param[in] connection    The connection to subscribe on
  * \param[in] topics        An array_list of aws_mqtt_topic_subscriptions (NOT pointers) describing the requests.
@@ -314,6 +547,11 @@ uint16_t aws_mqtt_client_connection_subscribe_multiple(
 /**
  * Subscribe to a single topic filter. on_publish will be called when a PUBLISH matching topic_filter is received.
  *
+ * Subscribing to a filter already subscribed to on this connection adds on_publish alongside the callbacks there,
+ * rather than replacing them. If the server has already granted the filter at qos or higher, no SUBSCRIBE is sent
+ * and on_suback is called without waiting on the server. Otherwise, say while the first SUBACK is still on its way,
+ * a SUBSCRIBE is sent for this one too.
+ *
  * \param[in] connection    The connection to subscribe on
  * \param[in] topic_filter  The topic filter to subscribe on.  This resource must persist until on_suback.
  * \param[in] qos           The maximum QoS of messages to recieve
@@ -337,7 +575,7 @@ uint16_t aws_mqtt_client_connection_subscribe(
     void *on_suback_ud);
 
 /**
- * Unsubscribe to a topic filter.
+ * Unsubscribe to a topic filter, removing every subscription to it.
  *
  * \param[in] connection        The connection to unsubscribe on
  * \param[in] topic_filter      The topic filter to unsubscribe on. This resource must persist until on_unsuback.
@@ -353,6 +591,27 @@ uint16_t aws_mqtt_client_connection_unsubscribe(
     aws_mqtt_op_complete_fn *on_unsuback,
     void *on_unsuback_ud);
 
+/**
+ * Remove only the subscription to a topic filter that was made with on_publish_ud, leaving any others sharing the
+ * filter in place. UNSUBSCRIBE is only sent once the last one leaves, until then on_unsuback is called without waiting
+ * on the server. If there's no such subscription, nothing is sent and on_unsuback is called the same way.
+ *
+ * \param[in] connection        The connection to unsubscribe on
+ * \param[in] topic_filter      The topic filter to unsubscribe on. This resource must persist until on_unsuback.
+ * \param[in] on_publish_ud     The on_publish_ud the subscription was made with
+ * \param[in] on_unsuback       Called once the subscription is removed
+ * \param[in] on_unsuback_ud    Passed to on_unsuback
+ *
+ * \returns The packet id of the unsubscribe request if successfully started, otherwise 0.
+ */
+AWS_MQTT_API
+uint16_t aws_mqtt_client_connection_unsubscribe_one(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_byte_cursor *topic_filter,
+    void *on_publish_ud,
+    aws_mqtt_op_complete_fn *on_unsuback,
+    void *on_unsuback_ud);
+
 /**
  * Send a PUBLSIH packet over connection.
  *
@@ -378,8 +637,208 @@ uint16_t aws_mqtt_client_connection_publish(
     void *userdata);
 
 /**
- * Sends a PINGREQ packet to the server to keep the connection alive.
- * If a PINGRESP is not received within a reasonable period of time, the connection will be closed.
+ * Send a PUBLISH packet over connection, like aws_mqtt_client_connection_publish, but with the topic and payload
+ * copied before this returns so the caller can reuse their memory right away. Copies of up to 256 bytes in all are
+ * kept in the connection's pooled request memory, so the common small publish costs no allocation at all.
+ *
+ * \param[in] connection    The connection to publish on
+ * \param[in] topic         The topic to publish on, copied
+ * \param[in] qos           The requested QoS of the packet
+ * \param[in] retain        True to have the server save the packet, and send to all new subscriptions matching topic
+ * \param[in] payload       The data to send as the payload of the publish, copied
+ * \param[in] on_complete   Called as in aws_mqtt_client_connection_publish
+ *
+ * \returns The packet id of the publish packet if successfully sent, otherwise 0.
+ */
+AWS_MQTT_API
+uint16_t aws_mqtt_client_connection_publish_copy(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_byte_cursor *topic,
+    enum aws_mqtt_qos qos,
+    bool retain,
+    const struct aws_byte_cursor *payload,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata);
+
+/**
+ * Send a PUBLISH packet over connection, pulling the payload from payload_fn as it's written instead of from one
+ * contiguous buffer. This allows large payloads to be sent straight from a file or ring buffer.
+ *
+ * \param[in] connection    The connection to publish on
+ * \param[in] topic         The topic to publish on
+ * \param[in] qos           The requested QoS of the packet
+ * \param[in] retain        True to have the server save the packet, and send to all new subscriptions matching topic
+ * \param[in] payload_size  The total size of the payload
+ * \param[in] payload_fn    Called on the connection's thread to fill in the payload, one message worth at a time.
+ *                          Must stay valid until on_complete is called.
+ * \param[in] payload_ud    Passed to payload_fn
+ * \param[in] on_complete   For QoS 0, called as soon as the packet is sent
+ *                          For QoS 1, called when PUBACK is received
+ *                          For QoS 2, called when PUBCOMP is received
+ *
+ * \returns The packet id of the publish packet if successfully sent, otherwise 0.
+ */
+AWS_MQTT_API
+uint16_t aws_mqtt_client_connection_publish_streaming(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_byte_cursor *topic,
+    enum aws_mqtt_qos qos,
+    bool retain,
+    size_t payload_size,
+    aws_mqtt_publish_payload_fn *payload_fn,
+    void *payload_ud,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata);
+
+/**
+ * Send several PUBLISH packets over connection at once. Every topic is validated before anything is sent, and the
+ * packets are handed to the connection's thread together, so they're written in as few messages as possible.
+ *
+ * \param[in] connection    The connection to publish on
+ * \param[in] messages      An array_list of aws_mqtt_publish_messages (NOT pointers) to send, in order.
+ *                          The topics and payloads must stay valid until each one's on_complete is called.
+ * \param[out] packet_ids   If not NULL, filled in with the packet id of each message, in the same order
+ * \param[in] on_complete   Called once for each message, as in aws_mqtt_client_connection_publish
+ *
+ * \returns AWS_OP_SUCCESS if every message was accepted, otherwise AWS_OP_ERR and aws_last_error() is set.
+ *              On failure none of the messages are sent and on_complete is never called.
+ */
+AWS_MQTT_API
+int aws_mqtt_client_connection_publish_multiple(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_array_list *messages,
+    uint16_t *packet_ids,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata);
+
+/**
+ * Copy a QoS 1 or 2 publish into the spool set up by aws_mqtt_client_connection_set_spool, to be sent in order
+ * behind everything already there. May be called from any thread, connected or not.
+ *
+ * \param[in] connection    The connection to publish on
+ * \param[in] topic         The topic to publish on
+ * \param[in] qos           The requested QoS of the packet, AWS_MQTT_QOS_AT_LEAST_ONCE or AWS_MQTT_QOS_EXACTLY_ONCE
+ * \param[in] retain        True to have the server save the packet, as in aws_mqtt_client_connection_publish
+ * \param[in] payload       The data to send as the payload of the publish, copied into the spool
+ * \param[in] on_complete   Called once the publish is acknowledged, with the packet id it was finally sent with, or
+ *                          with the error it last failed with once it has failed max_attempts times and is dropped.
+ *                          Never called if this process exits first, even though the publish is still sent later.
+ *
+ * \returns AWS_OP_SUCCESS if the publish was spooled, otherwise AWS_OP_ERR and aws_last_error() is set.
+ *              AWS_ERROR_MQTT_SPOOL_FULL if there's no room left until more of the spool is acknowledged.
+ */
+AWS_MQTT_API
+int aws_mqtt_client_connection_publish_spooled(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_byte_cursor *topic,
+    enum aws_mqtt_qos qos,
+    bool retain,
+    const struct aws_byte_cursor *payload,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata);
+
+/**
+ * Create a template for publishing to the same topic over and over. The topic is validated and encoded once, so
+ * each publish made from the template only has to add the packet id and payload. A template isn't tied to any one
+ * connection, and may be used from any thread.
+ *
+ * \param[in] allocator The allocator to use for the template
+ * \param[in] topic     The topic to publish on, copied into the template
+ * \param[in] qos       The requested QoS of every packet
+ * \param[in] retain    True to have the server save every packet, as in aws_mqtt_client_connection_publish
+ *
+ * \returns The new template, or NULL and aws_last_error() is set.
+ */
+AWS_MQTT_API
+struct aws_mqtt_publish_template *aws_mqtt_publish_template_new(
+    struct aws_allocator *allocator,
+    const struct aws_byte_cursor *topic,
+    enum aws_mqtt_qos qos,
+    bool retain);
+
+/**
+ * Destroy a template. Every publish made from it must have completed first.
+ */
+AWS_MQTT_API
+void aws_mqtt_publish_template_destroy(struct aws_mqtt_publish_template *tmpl);
+
+/**
+ * Send a PUBLISH packet made from a template over connection.
+ *
+ * \param[in] connection    The connection to publish on
+ * \param[in] tmpl          The topic, QoS and retain flag to publish with. Must stay valid until on_complete is called.
+ * \param[in] payload       The data to send as the payload of the publish
+ * \param[in] on_complete   Called as in aws_mqtt_client_connection_publish
+ *
+ * \returns The packet id of the publish packet if successfully sent, otherwise 0.
+ */
+AWS_MQTT_API
+uint16_t aws_mqtt_client_connection_publish_template(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_mqtt_publish_template *tmpl,
+    const struct aws_byte_cursor *payload,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata);
+
+/**
+ * Create a group of connections that can be published to all at once. The group keeps track of which event loop each
+ * member's channel runs on, so a group-wide publish costs one task per event loop instead of one per connection.
+ *
+ * \param[in] client    The client the group's connections are created on
+ *
+ * \returns The new group, or NULL and aws_last_error() is set.
+ */
+AWS_MQTT_API
+struct aws_mqtt_connection_group *aws_mqtt_connection_group_new(struct aws_mqtt_client *client);
+
+/**
+ * Destroy a group. Every connection created from it must have been destroyed first. Group publishes that haven't
+ * reached every event loop yet may still be pending, the group's memory is only freed once they have.
+ */
+AWS_MQTT_API
+void aws_mqtt_connection_group_destroy(struct aws_mqtt_connection_group *group);
+
+/**
+ * Create a new connection on the group's client, as aws_mqtt_client_connection_new does, that belongs to the group
+ * for as long as it exists. It takes part in group publishes whenever it's connected.
+ *
+ * \param[in] group     The group the connection belongs to
+ *
+ * \returns The new connection, or NULL and aws_last_error() is set.
+ */
+AWS_MQTT_API
+struct aws_mqtt_client_connection *aws_mqtt_connection_group_new_connection(struct aws_mqtt_connection_group *group);
+
+/**
+ * Publish the same message on every connection in the group that is connected when the publish reaches its event
+ * loop. The topic is validated and encoded once, and the payload is copied once, for the whole group.
+ * Safe to call from any thread.
+ *
+ * \param[in] group         The group to publish to
+ * \param[in] topic         The topic to publish on
+ * \param[in] qos           The requested QoS of the packet
+ * \param[in] retain        Whether the servers should retain the message
+ * \param[in] payload       The data to send as the payload of each publish, copied before this returns
+ * \param[in] on_complete   Called once per connection published on, as in aws_mqtt_client_connection_publish
+ * \param[in] userdata      Passed to on_complete
+ *
+ * \returns AWS_OP_SUCCESS if the publish was handed to the group's event loops, otherwise AWS_OP_ERR and
+ *          aws_last_error() is set.
+ */
+AWS_MQTT_API
+int aws_mqtt_connection_group_publish(
+    struct aws_mqtt_connection_group *group,
+    const struct aws_byte_cursor *topic,
+    enum aws_mqtt_qos qos,
+    bool retain,
+    const struct aws_byte_cursor *payload,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata);
+
+/**
+ * Sends a PINGREQ packet to the server to keep the connection alive, unless one is already waiting on its PINGRESP.
+ * If a PINGRESP is not received within a reasonable period of time, the connection will be closed. Not needed for
+ * keep-alive, which pings on its own whenever the connection has gone quiet.
  *
  * \params[in] connection   The connection to ping on
  *
@@ -389,6 +848,31 @@ uint16_t aws_mqtt_client_connection_publish(
 AWS_MQTT_API
 int aws_mqtt_client_connection_ping(struct aws_mqtt_client_connection *connection);
 
+/**
+ * Gets the number of topic and payload bytes of publishes that have been accepted but not yet written to the
+ * connection, including any held back by the in-flight window. Producers can use this to stop publishing before too
+ * much piles up in memory. Safe to call from any thread.
+ *
+ * \params[in] connection   The connection to check
+ *
+ * \returns The number of bytes waiting to be sent
+ */
+AWS_MQTT_API
+size_t aws_mqtt_client_connection_get_queued_bytes(const struct aws_mqtt_client_connection *connection);
+
+/**
+ * Takes a snapshot of the connection's counters and gauges, see aws_mqtt_connection_stats.
+ * Safe to call from any thread. Each value is read on its own, so values updated while the snapshot is being taken
+ * may be slightly out of step with each other.
+ *
+ * \params[in] connection   The connection to get statistics for
+ * \params[out] stats       Filled in with the connection's current statistics
+ */
+AWS_MQTT_API
+void aws_mqtt_client_connection_get_stats(
+    const struct aws_mqtt_client_connection *connection,
+    struct aws_mqtt_connection_stats *stats);
+
 AWS_EXTERN_C_END
 
 #endif /* AWS_MQTT_CLIENT_H */
@@ -54,6 +54,9 @@ enum aws_mqtt_error {
     AWS_ERROR_MQTT_PROTOCOL_ERROR,
     AWS_ERROR_MQTT_NOT_CONNECTED,
     AWS_ERROR_MQTT_ALREADY_CONNECTED,
+    AWS_ERROR_MQTT_NO_PACKET_ID_AVAILABLE,
+    AWS_ERROR_MQTT_SPOOL_FULL,
+    AWS_ERROR_MQTT_CONNECTION_DESTROYED,
 
     AWS_ERROR_END_MQTT_RANGE = 0x1800,
 };
@@ -0,0 +1,75 @@
+#ifndef AWS_MQTT_PRIVATE_ARENA_H
+#define AWS_MQTT_PRIVATE_ARENA_H
+
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/mqtt.h>
+
+#include <aws/common/linked_list.h>
+
+enum {
+    /* Size of the blocks small allocations are carved from */
+    AWS_MQTT_ARENA_PAGE_SIZE = 16 * 1024,
+    /* Number of fixed allocation sizes, anything larger than the biggest goes straight to the backing allocator */
+    AWS_MQTT_ARENA_SIZE_CLASS_COUNT = 8,
+};
+
+struct aws_mqtt_arena_page;
+
+/**
+ * Slab allocator for lots of small, similarly sized, long-lived objects (like topic tree nodes).
+ *
+ * Small allocations are rounded up to a size class and carved out of pages acquired from the backing allocator.
+ * Released blocks go on a free list per size class and are reused before the page is bumped again, pages are never
+ * given back until clean up. Allocations too large for any size class are passed through to the backing allocator,
+ * but are still tracked so that clean up releases everything, whether or not it was released individually.
+ *
+ * Use arena->allocator anywhere an aws_allocator is expected. It is not thread safe.
+ */
+struct aws_mqtt_arena {
+    struct aws_allocator allocator;
+    struct aws_allocator *backing;
+
+    /* Every page acquired, most recent first */
+    struct aws_mqtt_arena_page *pages;
+    /* Unused space at the end of the most recent page */
+    uint8_t *page_cursor;
+    uint8_t *page_end;
+
+    /* Released blocks of each size class, linked through their first bytes */
+    void *free_lists[AWS_MQTT_ARENA_SIZE_CLASS_COUNT];
+
+    /* Allocations too large for any size class */
+    struct aws_linked_list large_allocations;
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Initialize an empty arena. Nothing is acquired from backing until the first allocation.
+ * The arena must not be moved after init, its allocator points back at it.
+ */
+AWS_MQTT_API void aws_mqtt_arena_init(struct aws_mqtt_arena *arena, struct aws_allocator *backing);
+
+/**
+ * Release every page and large allocation back to the backing allocator in one go.
+ * All memory allocated from the arena is invalid afterwards.
+ */
+AWS_MQTT_API void aws_mqtt_arena_clean_up(struct aws_mqtt_arena *arena);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_MQTT_PRIVATE_ARENA_H */
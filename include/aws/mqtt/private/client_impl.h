@@ -19,6 +19,14 @@
 #include <aws/mqtt/client.h>
 
 #include <aws/mqtt/private/fixed_header.h>
+#include <aws/mqtt/private/mpsc_queue.h>
+#include <aws/mqtt/private/packet_framer.h>
+#include <aws/mqtt/private/packet_id_allocator.h>
+#include <aws/mqtt/private/packet_id_set.h>
+#include <aws/mqtt/private/packet_id_table.h>
+#include <aws/mqtt/private/recycle_pool.h>
+#include <aws/mqtt/private/spool.h>
+#include <aws/mqtt/private/thread_pool.h>
 #include <aws/mqtt/private/topic_tree.h>
 
 #include <aws/common/hash_table.h>
@@ -66,17 +74,36 @@ typedef enum aws_mqtt_client_request_state(
     aws_mqtt_send_request_fn)(uint16_t message_id, bool is_first_attempt, void *userdata);
 
 struct aws_mqtt_outstanding_request {
+    /* In the connection's retries list, its pending_requests or replay list, or its in-flight window queue */
     struct aws_linked_list_node list_node;
+    /* Used while waiting in the connection's submission queue */
+    struct aws_mqtt_mpsc_queue_node submission_node;
 
     struct aws_allocator *allocator;
     struct aws_mqtt_client_connection *connection;
 
-    struct aws_channel_task timeout_task;
+    /* When to send again if still not complete, only meaningful while retrying */
+    uint64_t retry_timestamp;
+    /* When first sent, for the ack latency stats. 0 until then. */
+    uint64_t sent_timestamp;
+    /* Counted in the connection's queued_bytes until first sent */
+    size_t queued_bytes;
 
     uint16_t message_id;
     bool initiated;
     bool completed;
     bool cancelled;
+    /* If true, list_node is in the connection's retries list */
+    bool retrying;
+    /* If true, this request came from the connection's requests_pool, otherwise from shared_requests_pool */
+    bool from_pool;
+    /* If true, this request takes up a slot in the connection's in-flight window */
+    bool windowed;
+    /* If true, this is a QoS 2 publish the server has sent PUBREC for. It's resent as PUBREL until PUBCOMP. */
+    bool released;
+    /* If true, on_complete is called with AWS_ERROR_MQTT_CONNECTION_DESTROYED if a disconnect or destroy drops the
+     * request before it completes. Otherwise it's dropped silently. */
+    bool complete_on_drop;
     aws_mqtt_send_request_fn *send_request;
     void *send_request_ud;
     aws_mqtt_op_complete_fn *on_complete;
@@ -95,6 +122,12 @@ struct aws_mqtt_client_connection {
 
     struct aws_mqtt_client *client;
 
+    /* The group the connection was created from, if any */
+    struct aws_mqtt_connection_group *group;
+    /* The group shard the current channel is in, and the node linking it there. Only used from the channel's thread. */
+    struct aws_mqtt_connection_group_shard *group_shard;
+    struct aws_linked_list_node group_node;
+
     /* The host information */
     struct aws_string *host_name;
     uint16_t port;
@@ -110,6 +143,8 @@ struct aws_mqtt_client_connection {
     void *on_interrupted_ud;
     aws_mqtt_client_on_connection_resumed_fn *on_resumed;
     void *on_resumed_ud;
+    aws_mqtt_client_on_window_available_fn *on_window_available;
+    void *on_window_available_ud;
 
     /* The state of the connection */
     enum aws_mqtt_client_connection_state state;
@@ -117,40 +152,217 @@ struct aws_mqtt_client_connection {
     /* Channel handler information */
     struct aws_channel_handler handler;
     struct aws_channel_slot *slot;
+    /* The channel slot is in, for scheduling tasks on from other threads, see mqtt_schedule_task_once. Set once the
+     * handler is in place and cleared when the channel has shut down, both under lock, and held in between. */
+    struct {
+        struct aws_mutex lock;
+        struct aws_channel *channel;
+    } shared_channel;
 
     /* Keeps track of all open subscriptions */
     struct aws_mqtt_topic_tree subscriptions;
+    /* Applied to subscriptions whenever it is (re)initialized */
+    size_t publish_match_cache_size;
 
-    /* aws_mqtt_outstanding_request */
+    /* aws_mqtt_outstanding_request, only used from the channel's thread */
     struct aws_memory_pool requests_pool;
+    /* aws_mqtt_outstanding_request created off the channel's thread. Safe to use from any thread. */
+    struct aws_mqtt_recycle_pool shared_requests_pool;
+    /* Task args of publish, subscribe and unsubscribe requests, which are created on any thread and freed on the
+     * channel's thread. Safe to use from any thread. Only the args are pooled: a subscribe still allocates its
+     * subscription record and filter copy, since they live as long as the subscription does. */
     struct {
-        /* uint16_t (packet id) -> aws_mqtt_outstanding_request */
-        struct aws_hash_table table;
-        struct aws_mutex mutex;
-    } outstanding_requests;
+        struct aws_mqtt_recycle_pool publish;
+        /* Publish args with room for a copy of a small topic and payload after them */
+        struct aws_mqtt_recycle_pool publish_copy;
+        struct aws_mqtt_recycle_pool subscribe;
+        struct aws_mqtt_recycle_pool unsubscribe;
+    } args_pools;
+    /* Ids of every request that has been created but not completed. Safe to use from any thread. */
+    struct aws_mqtt_packet_id_allocator packet_ids;
+    /* uint16_t (packet id) -> aws_mqtt_outstanding_request, only used from the channel's thread */
+    struct aws_mqtt_packet_id_table outstanding_requests;
+    /* Ids of QoS 2 publishes that have been delivered, but not yet released by the server's PUBREL.
+     * Part of the session state, so it's kept across reconnects unless the server starts a new session. */
+    struct aws_mqtt_packet_id_set inbound_qos2_ids;
+    /* Requests created off the channel's thread, waiting for the channel's thread to pick them up */
+    struct {
+        struct aws_mqtt_mpsc_queue queue;
+        /* Set while drain_task is scheduled, so any number of submissions only schedule one task */
+        struct aws_atomic_var drain_scheduled;
+        struct aws_channel_task drain_task;
+    } submissions;
+    /* Requests waiting for an ack, in the order they are due to be sent again. Every request waits the same
+     * request_timeout_ns, so new ones always go on the back and the list stays sorted without any searching.
+     * One task, scheduled for the front request, drives all of them. Only used from the channel's thread. */
+    struct {
+        struct aws_linked_list list;
+        struct aws_channel_task task;
+        /* When task is scheduled to run, or 0 if it isn't scheduled */
+        uint64_t task_timestamp;
+    } retries;
     /* List of all requests that cannot be scheduled until the connection comes online */
     struct {
         struct aws_linked_list list;
         struct aws_mutex mutex;
     } pending_requests;
+    /* Publish callbacks run off the channel's thread, see aws_mqtt_client_connection_set_dispatch */
+    struct {
+        bool enabled;
+        enum aws_mqtt_dispatch_ack_policy ack_policy;
+        aws_mqtt_dispatch_executor_fn *executor;
+        void *executor_ud;
+        /* Runs the callbacks when there's no executor, only initialized then */
+        struct aws_mqtt_thread_pool pool;
+        /* Guards every subscription's queue of dispatched publishes */
+        struct aws_mutex lock;
+        /* Subscriptions with dispatched publishes still to handle, must be none by destroy */
+        struct aws_atomic_var in_flight;
+        /* Publishes handled by every subscription, waiting for the channel's thread to send their acks */
+        struct aws_mqtt_mpsc_queue acks;
+        struct aws_atomic_var acks_drain_scheduled;
+        struct aws_channel_task acks_drain_task;
+        /* QoS 2 publishes whose deferred PUBREC hasn't been sent, by packet id. Only used from the channel's thread. */
+        struct aws_mqtt_packet_id_table unacked_qos2;
+    } dispatch;
+    /* Publishes kept on disk until acked, see aws_mqtt_client_connection_set_spool */
+    struct {
+        bool enabled;
+        /* Guards spool, which publish_spooled appends to from any thread */
+        struct aws_mutex lock;
+        struct aws_mqtt_spool spool;
+        /* One per publish taken from the spool and not yet acked, the rest are free. Only used from the channel's
+         * thread. */
+        struct aws_mqtt_spool_slot *slots;
+        struct aws_linked_list free_slots;
+        struct aws_atomic_var pump_scheduled;
+        struct aws_channel_task pump_task;
+    } spool;
+    /* Requests being resent after a CONNACK, burst_size at a time so a long backlog doesn't hold up the event loop or
+     * flood the fresh connection in one go. New requests queue up behind them. Only used from the channel's thread. */
+    struct {
+        struct aws_linked_list list;
+        struct aws_channel_task task;
+        bool scheduled;
+        /* Set while a burst is being written, so it all goes out in as few messages as possible */
+        bool in_burst;
+        /* 0 is unlimited */
+        size_t burst_size;
+        uint64_t burst_interval_ns;
+    } replay;
+    /* Windowed requests in the outstanding table are limited to max, the rest wait in queue (unencoded and without
+     * an entry in the table) until one finishes. Only used from the channel's thread. */
+    struct {
+        struct aws_linked_list queue;
+        size_t in_flight;
+        /* 0 is unlimited */
+        size_t max;
+        /* Set while the queue is being started, so finishing a request from within doesn't start it again */
+        bool draining;
+        /* Set when a request has to be queued, so on_window_available is only called after that happens */
+        bool blocked;
+    } window;
+    /* How much the server may send that hasn't been handled yet, see read_window_initial_bytes. Only used from the
+     * channel's thread, except for the pending atomics. */
+    struct {
+        /* 0 leaves the window wide open, and nothing else here is used */
+        size_t initial;
+        size_t max;
+        size_t size;
+        /* Bytes consumers are holding on to */
+        size_t held;
+        /* Held bytes that haven't been kept out of the window yet */
+        size_t debt;
+        /* Held bytes read from an earlier channel */
+        size_t stale;
+        /* Read since the window last grew */
+        size_t read_since_growth;
+        /* Holds and releases from any thread, waiting for the channel's thread to account for them */
+        struct aws_atomic_var pending_holds;
+        struct aws_atomic_var pending_releases;
+        struct aws_atomic_var update_scheduled;
+        struct aws_channel_task update_task;
+    } read_window;
+    /* Sum of queued_bytes of every request, safe to use from any thread */
+    struct aws_atomic_var queued_bytes;
     struct aws_mqtt_reconnect_task *reconnect_task;
-    struct aws_channel_task ping_task;
 
-    uint64_t last_pingresp_timestamp;
+    /* PINGREQ is only sent once nothing has been written or nothing has been read for a whole keep-alive interval.
+     * Only used from the channel's thread, except for ping_now_scheduled. */
+    struct {
+        struct aws_channel_task task;
+        /* Channel clock times a message last went out and last came in */
+        uint64_t last_write_timestamp;
+        uint64_t last_read_timestamp;
+        /* When the PINGREQ still waiting on its PINGRESP was sent, 0 if none is */
+        uint64_t pingreq_timestamp;
+        /* When consumers last let go of a read window they were holding all of, 0 if they haven't */
+        uint64_t window_opened_timestamp;
+        /* Moving average of ping round trips, 0 until one completes */
+        uint64_t smoothed_rtt_ns;
+        /* Set from ping_timeout_ms, 0 to go by smoothed_rtt_ns, or the keep-alive interval until there is one */
+        uint64_t timeout_ns;
+        /* For aws_mqtt_client_connection_ping */
+        struct aws_atomic_var ping_now_scheduled;
+        struct aws_channel_task ping_now_task;
+    } keep_alive;
+
+    /* Small packets are encoded back to back into one message, which is sent when full or when flush_task runs.
+     * Only used from the channel's thread. */
+    struct {
+        struct aws_io_message *message;
+        /* The message the packet currently being encoded goes into, and the offset that packet starts at */
+        struct aws_io_message *open_message;
+        size_t open_start;
+        struct aws_channel_task flush_task;
+        bool flush_scheduled;
+        /* Packets bigger than this are sent in their own message, 0 disables batching */
+        size_t max_bytes;
+        uint64_t max_delay_ns;
+        /* Bytes of the packet being written that haven't been sent yet, and its type. Only a streamed publish
+         * takes more than one begin/end to write. */
+        size_t packet_bytes_left;
+        enum aws_mqtt_packet_type packet_type;
+    } write_batch;
+
+    /* Backs aws_mqtt_client_connection_get_stats. The atomics are only written from the channel's thread, with
+     * relaxed ordering since nothing else is synchronized through them, and may be read from any thread. */
+    struct {
+        struct aws_atomic_var packets_sent[AWS_MQTT_STATS_PACKET_TYPE_COUNT];
+        struct aws_atomic_var packets_received[AWS_MQTT_STATS_PACKET_TYPE_COUNT];
+        struct aws_atomic_var bytes_sent;
+        struct aws_atomic_var bytes_received;
+        struct aws_atomic_var retries;
+        struct aws_atomic_var pending_requests;
+        struct aws_atomic_var ack_latency[AWS_MQTT_STATS_ACK_LATENCY_BUCKET_COUNT];
+        /* Channel clock times and round trips don't fit an atomic where size_t is 32 bits, so they're locked */
+        struct {
+            struct aws_mutex lock;
+            uint64_t last_rtt_ns;
+            uint64_t smoothed_rtt_ns;
+            uint64_t last_pingresp_timestamp;
+        } ping;
+    } stats;
 
     struct {
-        uint64_t current;      /* seconds */
+        uint64_t current;      /* milliseconds */
         uint64_t min;          /* seconds */
         uint64_t max;          /* seconds */
-        uint64_t next_attempt; /* milliseconds */
+        uint64_t next_attempt; /* nanoseconds */
+        enum aws_mqtt_reconnect_backoff backoff;
+        /* xorshift64* state for the jitter, never 0 */
+        uint64_t random_state;
     } reconnect_timeouts;
 
-    /* If an incomplete packet arrives, store the data here. */
-    struct aws_byte_buf pending_packet;
+    /* Splits incoming messages into packets, holding on to packets split across messages */
+    struct aws_mqtt_packet_framer framer;
 
     /* Connect parameters */
     struct aws_byte_buf client_id;
     bool clean_session;
+    bool auto_resubscribe;
+    /* Most a resubscribe SUBSCRIBE's remaining length may be */
+    size_t resubscribe_max_remaining_length;
     uint16_t keep_alive_time_secs;
     uint64_t request_timeout_ns;
     struct aws_string *username;
@@ -175,14 +387,129 @@ struct aws_io_message *mqtt_get_message_for_packet(
     struct aws_mqtt_client_connection *connection,
     struct aws_mqtt_fixed_header *header);
 
+/* Set the channel other threads schedule tasks on, or clear it with NULL. Must be called from the channel's thread. */
+AWS_MQTT_API void mqtt_shared_channel_set(struct aws_mqtt_client_connection *connection, struct aws_channel *channel);
+
+/* Schedule task on the connection's channel, delay_ns from now, unless *scheduled is already set or there's no
+ channel. *scheduled is set if the task was scheduled, and task_fn must clear it before doing anything else (whether
+ it runs or is cancelled). Checked and set under the same lock as the channel, so once it's been cleared nothing is
+ scheduled on a channel that's gone, and what task_fn would have done is left to the next CONNACK. Safe to call from
+ any thread. */
+AWS_MQTT_API void mqtt_schedule_task_once(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_atomic_var *scheduled,
+    struct aws_channel_task *task,
+    aws_channel_task_fn *task_fn,
+    uint64_t delay_ns);
+
+/* Get a buffer to encode the packet described by header into. Small packets are appended to the connection's write
+ batch, anything else gets a message of its own. Returns NULL with an error raised on failure.
+ Every successful call must be followed by mqtt_packet_write_end or mqtt_packet_write_abort.
+ Must be called from the channel's thread. */
+AWS_MQTT_API struct aws_byte_buf *mqtt_packet_write_begin(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_mqtt_fixed_header *header);
+
+/* Send the packet encoded since mqtt_packet_write_begin, or leave it in the write batch to be flushed later. */
+AWS_MQTT_API int mqtt_packet_write_end(struct aws_mqtt_client_connection *connection);
+
+/* Discard whatever was encoded since mqtt_packet_write_begin. */
+AWS_MQTT_API void mqtt_packet_write_abort(struct aws_mqtt_client_connection *connection);
+
+/* Send the write batch now instead of waiting for it to fill up or time out. */
+AWS_MQTT_API int mqtt_packet_write_flush(struct aws_mqtt_client_connection *connection);
+
 /* This function registers a new outstanding request, calls send_request
- and returns the message identifier to use (or 0 on error). */
+ and returns the message identifier to use (or 0 on error).
+ May be called from any thread. Off the channel's thread, the request is queued and send_request
+ is called from the channel's thread once the queue is drained.
+ If windowed, the request waits for room in the in-flight window before send_request is first called.
+ queued_bytes is added to the connection's queued bytes until then. */
 AWS_MQTT_API uint16_t mqtt_create_request(
     struct aws_mqtt_client_connection *connection,
     aws_mqtt_send_request_fn *send_request,
     void *send_request_ud,
     aws_mqtt_op_complete_fn *on_complete,
-    void *on_complete_ud);
+    void *on_complete_ud,
+    bool windowed,
+    size_t queued_bytes);
+
+/* Everything mqtt_create_request takes to describe a request, for creating several at once */
+struct aws_mqtt_request_options {
+    aws_mqtt_send_request_fn *send_request;
+    void *send_request_ud;
+    aws_mqtt_op_complete_fn *on_complete;
+    void *on_complete_ud;
+    bool windowed;
+    size_t queued_bytes;
+    bool complete_on_drop;
+};
+
+/* As mqtt_create_request, for requests that need more than its arguments describe */
+AWS_MQTT_API uint16_t mqtt_create_request_with_options(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_mqtt_request_options *options);
+
+/* Create count requests as mqtt_create_request would, writing their message identifiers to message_ids.
+ Either every request is created or none are. Off the channel's thread, they're all handed to the channel's thread
+ together, to be started by one drain of the submission queue. Once created, any failure to start a request is
+ reported through its on_complete. */
+AWS_MQTT_API int mqtt_create_requests(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_mqtt_request_options *options,
+    size_t count,
+    uint16_t *message_ids);
+
+/* Return a request's memory once it's no longer referenced. */
+AWS_MQTT_API void mqtt_request_release(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_mqtt_outstanding_request *request);
+
+/* Hand any requests waiting in the submission queue to the channel. Must be called from the channel's thread. */
+AWS_MQTT_API void mqtt_submit_queued_requests(struct aws_mqtt_client_connection *connection);
+
+/* Hand a received publish to the callbacks of every matching subscription, as set up by
+ aws_mqtt_client_connection_set_dispatch. If ack is deferred until they've all run, it's sent from then on and
+ *ack_deferred is set, otherwise the caller sends it. Must be called from the channel's thread. */
+AWS_MQTT_API int mqtt_dispatch_publish(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_mqtt_packet_publish *publish,
+    const struct aws_mqtt_packet_ack *ack,
+    bool *ack_deferred);
+
+/* Send the acks of dispatched publishes that have been handled, dropping any from before the current connection.
+ Must be called from the channel's thread. */
+AWS_MQTT_API void mqtt_dispatch_send_acks(struct aws_mqtt_client_connection *connection);
+
+/* If a resent QoS 2 publish's first copy is still being handled with its PUBREC deferred, have that PUBREC sent on
+ this connection once it's done and return true, so the resend isn't acked before it. Must be called from the
+ channel's thread. */
+AWS_MQTT_API bool mqtt_dispatch_defer_duplicate_ack(struct aws_mqtt_client_connection *connection, uint16_t packet_id);
+
+/* Send a PINGREQ soon, unless one is already waiting on its PINGRESP. Safe to call from any thread while
+ connected. */
+AWS_MQTT_API void mqtt_keep_alive_ping_now(struct aws_mqtt_client_connection *connection);
+
+/* Start a new channel's read window afresh. Must be called before the handler is set on its slot. */
+AWS_MQTT_API void mqtt_read_window_reset(struct aws_mqtt_client_connection *connection);
+
+/* Keep size bytes of the read window closed, or reopen them. Safe to call from any thread. */
+AWS_MQTT_API void mqtt_read_window_hold(struct aws_mqtt_client_connection *connection, size_t size);
+AWS_MQTT_API void mqtt_read_window_release(struct aws_mqtt_client_connection *connection, size_t size);
+
+/* Start as many spooled publishes as there are free slots for. Must be called from the channel's thread. */
+AWS_MQTT_API void mqtt_spool_pump(struct aws_mqtt_client_connection *connection);
+
+/* Record what the server granted each filter of SUBSCRIBE packet_id in the topic tree, from the return codes of its
+ SUBACK. Must be called from the channel's thread, before the request completes. */
+AWS_MQTT_API void mqtt_subscribe_acked(
+    struct aws_mqtt_client_connection *connection,
+    uint16_t packet_id,
+    struct aws_byte_cursor return_codes);
+
+/* Subscribe again to everything in the connection's topic tree, once the server has resumed without a session.
+ Must be called from the channel's thread. */
+AWS_MQTT_API void mqtt_resubscribe_all(struct aws_mqtt_client_connection *connection);
 
 /* Call when an ack packet comes back from the server. */
 AWS_MQTT_API void mqtt_request_complete(
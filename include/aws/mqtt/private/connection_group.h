@@ -0,0 +1,75 @@
+#ifndef AWS_MQTT_PRIVATE_CONNECTION_GROUP_H
+#define AWS_MQTT_PRIVATE_CONNECTION_GROUP_H
+
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/client.h>
+
+#include <aws/common/atomics.h>
+#include <aws/common/linked_list.h>
+
+struct aws_channel;
+struct aws_event_loop;
+
+/* The members of a group whose channels run on one event loop */
+struct aws_mqtt_connection_group_shard {
+    struct aws_event_loop *loop;
+    /* aws_mqtt_client_connection, linked through group_node. Only used from loop's thread. */
+    struct aws_linked_list connections;
+};
+
+/**
+ * Connections must all be destroyed before the group is, but group publishes that are still on their way to a shard
+ * don't have to be: one reference belongs to whoever created the group, and each scheduled shard task holds another.
+ * The group and its shards are freed once destroy has been called and the last of those tasks has run or been
+ * cancelled.
+ */
+struct aws_mqtt_connection_group {
+    struct aws_allocator *allocator;
+    struct aws_mqtt_client *client;
+    struct aws_atomic_var ref_count;
+    /* Connections created from the group that haven't been destroyed yet */
+    struct aws_atomic_var connection_count;
+    /* One per event loop in the client's bootstrap, in the same order */
+    struct aws_mqtt_connection_group_shard *shards;
+    size_t shard_count;
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Add connection to the shard of the event loop channel runs on, once its channel is set up.
+ * Must be called from the channel's thread.
+ */
+AWS_MQTT_API void aws_mqtt_connection_group_join(
+    struct aws_mqtt_connection_group *group,
+    struct aws_mqtt_client_connection *connection,
+    struct aws_channel *channel);
+
+/**
+ * Take connection out of its shard, when its channel shuts down. Does nothing if it never joined one.
+ * Must be called from the channel's thread.
+ */
+AWS_MQTT_API void aws_mqtt_connection_group_leave(struct aws_mqtt_client_connection *connection);
+
+/**
+ * Forget a connection created from group, when it's destroyed.
+ */
+AWS_MQTT_API void aws_mqtt_connection_group_release(struct aws_mqtt_connection_group *group);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_MQTT_PRIVATE_CONNECTION_GROUP_H */
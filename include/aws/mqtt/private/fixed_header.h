@@ -69,4 +69,10 @@ AWS_MQTT_API int aws_mqtt_fixed_header_encode(struct aws_byte_buf *buf, const st
  */
 AWS_MQTT_API int aws_mqtt_fixed_header_decode(struct aws_byte_cursor *cur, struct aws_mqtt_fixed_header *header);
 
+/**
+ * Get the total size of the packet at the start of cur from its fixed header, without requiring the rest of the packet
+ * to be there. Raises AWS_ERROR_SHORT_BUFFER if the fixed header itself is incomplete.
+ */
+AWS_MQTT_API int aws_mqtt_fixed_header_get_packet_size(struct aws_byte_cursor cur, size_t *packet_size);
+
 #endif /* AWS_MQTT_PRIVATE_FIXED_HEADER_H */
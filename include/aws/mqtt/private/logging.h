@@ -0,0 +1,92 @@
+#ifndef AWS_MQTT_PRIVATE_LOGGING_H
+#define AWS_MQTT_PRIVATE_LOGGING_H
+
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/mqtt.h>
+
+#include <aws/common/logging.h>
+
+/*
+ * Logging used by the MQTT sources. Each AWS_MQTT_LOGF_<LEVEL> is AWS_LOGF_<LEVEL>, unless the level is more verbose
+ * than AWS_MQTT_STATIC_LOG_LEVEL, in which case the statement is compiled out entirely: no level check, and its
+ * arguments are never evaluated. Set AWS_MQTT_STATIC_LOG_LEVEL through the AWS_MQTT_STRIP_LOGS_BELOW CMake option.
+ */
+
+/* Same values as enum aws_log_level, usable in #if */
+#define AWS_MQTT_LOG_LEVEL_NONE 0
+#define AWS_MQTT_LOG_LEVEL_FATAL 1
+#define AWS_MQTT_LOG_LEVEL_ERROR 2
+#define AWS_MQTT_LOG_LEVEL_WARN 3
+#define AWS_MQTT_LOG_LEVEL_INFO 4
+#define AWS_MQTT_LOG_LEVEL_DEBUG 5
+#define AWS_MQTT_LOG_LEVEL_TRACE 6
+
+#ifndef AWS_MQTT_STATIC_LOG_LEVEL
+#    define AWS_MQTT_STATIC_LOG_LEVEL AWS_MQTT_LOG_LEVEL_TRACE
+#endif
+
+/* Never actually called. Stripped statements still pass their arguments here from dead code, so anything that is
+ * only used for logging doesn't become an unused variable. */
+AWS_STATIC_IMPL void aws_mqtt_log_stripped(aws_log_subject_t subject, const char *format, ...) {
+    (void)subject;
+    (void)format;
+}
+
+#define AWS_MQTT_LOGF_STRIPPED(...)                                                                                    \
+    do {                                                                                                               \
+        if (0) {                                                                                                       \
+            aws_mqtt_log_stripped(__VA_ARGS__);                                                                        \
+        }                                                                                                              \
+    } while (0)
+
+#if AWS_MQTT_STATIC_LOG_LEVEL >= AWS_MQTT_LOG_LEVEL_FATAL
+#    define AWS_MQTT_LOGF_FATAL(...) AWS_LOGF_FATAL(__VA_ARGS__)
+#else
+#    define AWS_MQTT_LOGF_FATAL(...) AWS_MQTT_LOGF_STRIPPED(__VA_ARGS__)
+#endif
+
+#if AWS_MQTT_STATIC_LOG_LEVEL >= AWS_MQTT_LOG_LEVEL_ERROR
+#    define AWS_MQTT_LOGF_ERROR(...) AWS_LOGF_ERROR(__VA_ARGS__)
+#else
+#    define AWS_MQTT_LOGF_ERROR(...) AWS_MQTT_LOGF_STRIPPED(__VA_ARGS__)
+#endif
+
+#if AWS_MQTT_STATIC_LOG_LEVEL >= AWS_MQTT_LOG_LEVEL_WARN
+#    define AWS_MQTT_LOGF_WARN(...) AWS_LOGF_WARN(__VA_ARGS__)
+#else
+#    define AWS_MQTT_LOGF_WARN(...) AWS_MQTT_LOGF_STRIPPED(__VA_ARGS__)
+#endif
+
+#if AWS_MQTT_STATIC_LOG_LEVEL >= AWS_MQTT_LOG_LEVEL_INFO
+#    define AWS_MQTT_LOGF_INFO(...) AWS_LOGF_INFO(__VA_ARGS__)
+#else
+#    define AWS_MQTT_LOGF_INFO(...) AWS_MQTT_LOGF_STRIPPED(__VA_ARGS__)
+#endif
+
+#if AWS_MQTT_STATIC_LOG_LEVEL >= AWS_MQTT_LOG_LEVEL_DEBUG
+#    define AWS_MQTT_LOGF_DEBUG(...) AWS_LOGF_DEBUG(__VA_ARGS__)
+#else
+#    define AWS_MQTT_LOGF_DEBUG(...) AWS_MQTT_LOGF_STRIPPED(__VA_ARGS__)
+#endif
+
+#if AWS_MQTT_STATIC_LOG_LEVEL >= AWS_MQTT_LOG_LEVEL_TRACE
+#    define AWS_MQTT_LOGF_TRACE(...) AWS_LOGF_TRACE(__VA_ARGS__)
+#else
+#    define AWS_MQTT_LOGF_TRACE(...) AWS_MQTT_LOGF_STRIPPED(__VA_ARGS__)
+#endif
+
+#endif /* AWS_MQTT_PRIVATE_LOGGING_H */
@@ -0,0 +1,68 @@
+#ifndef AWS_MQTT_PRIVATE_MPSC_QUEUE_H
+#define AWS_MQTT_PRIVATE_MPSC_QUEUE_H
+
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/mqtt.h>
+
+#include <aws/common/atomics.h>
+
+/* Embed in the struct to be queued, and use AWS_CONTAINER_OF to get back to it. */
+struct aws_mqtt_mpsc_queue_node {
+    struct aws_atomic_var next;
+};
+
+/**
+ * Intrusive, unbounded, lock-free multi-producer single-consumer FIFO.
+ *
+ * Any number of threads may push concurrently without blocking each other. Only one thread at a time may pop.
+ * Since a push publishes itself in two steps, pop may briefly report the queue as busy (returns NULL while
+ * aws_mqtt_mpsc_queue_is_empty() is false) when it catches a producer in the middle of a push.
+ *
+ * The queue must not be moved after init, it contains a node the queue points at.
+ */
+struct aws_mqtt_mpsc_queue {
+    /* Most recently pushed node, swapped by producers */
+    struct aws_atomic_var head;
+    /* Next node to pop, only touched by the consumer */
+    struct aws_mqtt_mpsc_queue_node *tail;
+    struct aws_mqtt_mpsc_queue_node stub;
+};
+
+AWS_EXTERN_C_BEGIN
+
+AWS_MQTT_API void aws_mqtt_mpsc_queue_init(struct aws_mqtt_mpsc_queue *queue);
+
+/**
+ * Push a node onto the queue. Safe to call from any thread.
+ */
+AWS_MQTT_API void aws_mqtt_mpsc_queue_push(struct aws_mqtt_mpsc_queue *queue, struct aws_mqtt_mpsc_queue_node *node);
+
+/**
+ * Pop the oldest node. Consumer only.
+ *
+ * \returns the node, or NULL if the queue is empty or a push is in progress.
+ */
+AWS_MQTT_API struct aws_mqtt_mpsc_queue_node *aws_mqtt_mpsc_queue_pop(struct aws_mqtt_mpsc_queue *queue);
+
+/**
+ * Check if there is nothing in the queue, including pushes still in progress. Consumer only.
+ */
+AWS_MQTT_API bool aws_mqtt_mpsc_queue_is_empty(const struct aws_mqtt_mpsc_queue *queue);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_MQTT_PRIVATE_MPSC_QUEUE_H */
@@ -0,0 +1,63 @@
+#ifndef AWS_MQTT_PRIVATE_PACKET_FRAMER_H
+#define AWS_MQTT_PRIVATE_PACKET_FRAMER_H
+
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/mqtt.h>
+
+#include <aws/common/byte_buf.h>
+
+/* Called with exactly one whole packet, fixed header included. Returning AWS_OP_ERR stops processing. */
+typedef int(aws_mqtt_packet_framer_on_packet_fn)(struct aws_byte_cursor packet, void *userdata);
+
+/**
+ * Splits a stream of bytes, arriving in pieces of any size, back into packets. Packets that arrive whole are passed on
+ * straight out of the data they arrived in, only packets split across pieces are copied.
+ */
+struct aws_mqtt_packet_framer {
+    struct aws_allocator *allocator;
+    /* If an incomplete packet arrives, store the data here. The buffer is reused for every split packet. */
+    struct aws_byte_buf pending;
+    /* Full size of the packet in pending, or 0 if its fixed header hasn't been fully received yet */
+    size_t pending_size;
+};
+
+AWS_EXTERN_C_BEGIN
+
+AWS_MQTT_API void aws_mqtt_packet_framer_init(struct aws_mqtt_packet_framer *framer, struct aws_allocator *allocator);
+
+AWS_MQTT_API void aws_mqtt_packet_framer_clean_up(struct aws_mqtt_packet_framer *framer);
+
+/**
+ * Drop any partial packet, for when the stream starts over. Keeps the buffer.
+ */
+AWS_MQTT_API void aws_mqtt_packet_framer_reset(struct aws_mqtt_packet_framer *framer);
+
+/**
+ * Call on_packet for every packet completed by data, in order, and keep whatever is left of a packet that data ends
+ * part way through.
+ *
+ * \returns AWS_OP_ERR if a fixed header is malformed or on_packet fails, in which case the stream can't be continued.
+ */
+AWS_MQTT_API int aws_mqtt_packet_framer_process(
+    struct aws_mqtt_packet_framer *framer,
+    struct aws_byte_cursor data,
+    aws_mqtt_packet_framer_on_packet_fn *on_packet,
+    void *userdata);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_MQTT_PRIVATE_PACKET_FRAMER_H */
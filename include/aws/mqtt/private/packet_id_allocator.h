@@ -0,0 +1,79 @@
+#ifndef AWS_MQTT_PRIVATE_PACKET_ID_ALLOCATOR_H
+#define AWS_MQTT_PRIVATE_PACKET_ID_ALLOCATOR_H
+
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/mqtt.h>
+
+#include <aws/common/atomics.h>
+
+/* One bit per possible packet identifier (0 - UINT16_MAX), packed into atomic words */
+enum {
+    AWS_MQTT_PACKET_ID_BITS_PER_WORD = sizeof(size_t) * 8,
+    AWS_MQTT_PACKET_ID_WORD_COUNT = (UINT16_MAX + 1) / AWS_MQTT_PACKET_ID_BITS_PER_WORD,
+};
+
+/**
+ * Hands out MQTT packet identifiers [MQTT-2.3.1].
+ *
+ * Ids in use are tracked in a bitmap, and the search for a free id starts just past the most recently acquired id.
+ * This keeps acquire and release O(1) in the common case, and means a released id is not handed out again until
+ * every other id has been tried, so a late ack can't be matched against a newer request.
+ *
+ * Acquire and release are lock-free and may be called from any thread.
+ */
+struct aws_mqtt_packet_id_allocator {
+    struct aws_atomic_var in_use[AWS_MQTT_PACKET_ID_WORD_COUNT];
+    /* The id to start the next search at. A hint only, races on it are harmless. */
+    struct aws_atomic_var next_id;
+    /* Number of ids currently acquired, reserved before searching so a search always has a free bit to find */
+    struct aws_atomic_var in_use_count;
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Initialize an allocator with every id available.
+ */
+AWS_MQTT_API void aws_mqtt_packet_id_allocator_init(struct aws_mqtt_packet_id_allocator *allocator);
+
+/**
+ * Acquire an unused packet id.
+ *
+ * \returns the acquired id, or 0 with AWS_ERROR_MQTT_NO_PACKET_ID_AVAILABLE raised if all ids are in use.
+ */
+AWS_MQTT_API uint16_t aws_mqtt_packet_id_allocator_acquire(struct aws_mqtt_packet_id_allocator *allocator);
+
+/**
+ * Return a previously acquired packet id.
+ */
+AWS_MQTT_API void aws_mqtt_packet_id_allocator_release(struct aws_mqtt_packet_id_allocator *allocator, uint16_t id);
+
+/**
+ * Check whether an id is currently acquired.
+ */
+AWS_MQTT_API bool aws_mqtt_packet_id_allocator_is_in_use(
+    const struct aws_mqtt_packet_id_allocator *allocator,
+    uint16_t id);
+
+/**
+ * Get the number of ids currently acquired.
+ */
+AWS_MQTT_API size_t aws_mqtt_packet_id_allocator_get_in_use_count(const struct aws_mqtt_packet_id_allocator *allocator);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_MQTT_PRIVATE_PACKET_ID_ALLOCATOR_H */
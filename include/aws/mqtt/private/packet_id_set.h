@@ -0,0 +1,76 @@
+#ifndef AWS_MQTT_PRIVATE_PACKET_ID_SET_H
+#define AWS_MQTT_PRIVATE_PACKET_ID_SET_H
+
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/mqtt.h>
+
+/* One bit per possible packet identifier (0 - UINT16_MAX) */
+enum {
+    AWS_MQTT_PACKET_ID_SET_BITS_PER_WORD = 64,
+    AWS_MQTT_PACKET_ID_SET_WORD_COUNT = (UINT16_MAX + 1) / AWS_MQTT_PACKET_ID_SET_BITS_PER_WORD,
+};
+
+/**
+ * Set of packet identifiers, one bit each, for remembering which ids a peer has in some state.
+ *
+ * Every operation is O(1) and nothing is ever allocated, so it can't fail. Clearing a set that's already empty is
+ * free as well. It is not thread safe.
+ */
+struct aws_mqtt_packet_id_set {
+    uint64_t words[AWS_MQTT_PACKET_ID_SET_WORD_COUNT];
+    size_t count;
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Initialize an empty set.
+ */
+AWS_MQTT_API void aws_mqtt_packet_id_set_init(struct aws_mqtt_packet_id_set *set);
+
+/**
+ * Add an id to the set.
+ *
+ * \returns true if the id was added, false if it was already in the set.
+ */
+AWS_MQTT_API bool aws_mqtt_packet_id_set_add(struct aws_mqtt_packet_id_set *set, uint16_t id);
+
+/**
+ * Remove an id from the set.
+ *
+ * \returns true if the id was removed, false if it wasn't in the set.
+ */
+AWS_MQTT_API bool aws_mqtt_packet_id_set_remove(struct aws_mqtt_packet_id_set *set, uint16_t id);
+
+/**
+ * Check whether an id is in the set.
+ */
+AWS_MQTT_API bool aws_mqtt_packet_id_set_contains(const struct aws_mqtt_packet_id_set *set, uint16_t id);
+
+/**
+ * Get the number of ids in the set.
+ */
+AWS_MQTT_API size_t aws_mqtt_packet_id_set_get_count(const struct aws_mqtt_packet_id_set *set);
+
+/**
+ * Remove every id from the set.
+ */
+AWS_MQTT_API void aws_mqtt_packet_id_set_clear(struct aws_mqtt_packet_id_set *set);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_MQTT_PRIVATE_PACKET_ID_SET_H */
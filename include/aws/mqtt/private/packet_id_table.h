@@ -0,0 +1,98 @@
+#ifndef AWS_MQTT_PRIVATE_PACKET_ID_TABLE_H
+#define AWS_MQTT_PRIVATE_PACKET_ID_TABLE_H
+
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/mqtt.h>
+
+#include <aws/common/hash_table.h>
+
+enum {
+    AWS_MQTT_PACKET_ID_TABLE_PAGE_SIZE = 256,
+    AWS_MQTT_PACKET_ID_TABLE_PAGE_COUNT = (UINT16_MAX + 1) / AWS_MQTT_PACKET_ID_TABLE_PAGE_SIZE,
+};
+
+struct aws_mqtt_packet_id_table_page {
+    void *values[AWS_MQTT_PACKET_ID_TABLE_PAGE_SIZE];
+    /* Number of non-NULL entries in values */
+    size_t count;
+};
+
+/**
+ * Maps packet identifiers to values by indexing directly on the id.
+ *
+ * The id space is split into pages of 256 entries which are only allocated while they hold a value,
+ * so a connection with few requests in flight only has a page or two allocated.
+ */
+struct aws_mqtt_packet_id_table {
+    struct aws_allocator *allocator;
+    struct aws_mqtt_packet_id_table_page *pages[AWS_MQTT_PACKET_ID_TABLE_PAGE_COUNT];
+    size_t entry_count;
+    /* Called on every value by clear and clean_up. May be NULL. */
+    aws_hash_callback_destroy_fn *destroy_value_fn;
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Initialize an empty table. No memory is allocated until the first put.
+ */
+AWS_MQTT_API void aws_mqtt_packet_id_table_init(
+    struct aws_mqtt_packet_id_table *table,
+    struct aws_allocator *allocator,
+    aws_hash_callback_destroy_fn *destroy_value_fn);
+
+/**
+ * Destroy every value and free all memory held by the table.
+ */
+AWS_MQTT_API void aws_mqtt_packet_id_table_clean_up(struct aws_mqtt_packet_id_table *table);
+
+/**
+ * Store value at id, replacing (without destroying) any existing value.
+ *
+ * \returns AWS_OP_SUCCESS, or AWS_OP_ERR if a page could not be allocated.
+ */
+AWS_MQTT_API int aws_mqtt_packet_id_table_put(struct aws_mqtt_packet_id_table *table, uint16_t id, void *value);
+
+/**
+ * Remove the value at id without destroying it.
+ *
+ * \returns the value that was removed, or NULL if there wasn't one.
+ */
+AWS_MQTT_API void *aws_mqtt_packet_id_table_remove(struct aws_mqtt_packet_id_table *table, uint16_t id);
+
+/**
+ * Destroy and remove every value, releasing all pages.
+ */
+AWS_MQTT_API void aws_mqtt_packet_id_table_clear(struct aws_mqtt_packet_id_table *table);
+
+/**
+ * Get the value stored at id, or NULL.
+ */
+AWS_STATIC_IMPL void *aws_mqtt_packet_id_table_find(const struct aws_mqtt_packet_id_table *table, uint16_t id) {
+
+    const struct aws_mqtt_packet_id_table_page *page = table->pages[id / AWS_MQTT_PACKET_ID_TABLE_PAGE_SIZE];
+    return page ? page->values[id % AWS_MQTT_PACKET_ID_TABLE_PAGE_SIZE] : NULL;
+}
+
+AWS_STATIC_IMPL size_t aws_mqtt_packet_id_table_get_entry_count(const struct aws_mqtt_packet_id_table *table) {
+
+    return table->entry_count;
+}
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_MQTT_PRIVATE_PACKET_ID_TABLE_H */
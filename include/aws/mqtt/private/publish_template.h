@@ -0,0 +1,61 @@
+#ifndef AWS_MQTT_PRIVATE_PUBLISH_TEMPLATE_H
+#define AWS_MQTT_PRIVATE_PUBLISH_TEMPLATE_H
+
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/client.h>
+
+#include <aws/mqtt/private/fixed_header.h>
+
+/**
+ * Everything about a PUBLISH that doesn't change from one packet to the next (see
+ * aws_mqtt_publish_template_new). The topic is validated once and kept already length prefixed, so encoding a
+ * packet from a template is the fixed header, one copy of the topic and the packet id.
+ */
+struct aws_mqtt_publish_template {
+    struct aws_allocator *allocator;
+    enum aws_mqtt_qos qos;
+    bool retain;
+    /* The topic without its length prefix, points into encoded_topic */
+    struct aws_byte_cursor topic;
+    /* The topic exactly as it goes in the variable header [MQTT-3.3.2.1] */
+    struct aws_byte_cursor encoded_topic;
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Fill in the fixed header of a PUBLISH made from tmpl with payload_size bytes of payload.
+ */
+AWS_MQTT_API void aws_mqtt_publish_template_init_header(
+    const struct aws_mqtt_publish_template *tmpl,
+    bool dup,
+    size_t payload_size,
+    struct aws_mqtt_fixed_header *header);
+
+/**
+ * Write the fixed and variable headers of a PUBLISH made from tmpl, everything but the payload.
+ * header must come from aws_mqtt_publish_template_init_header. packet_id is ignored for QoS 0.
+ */
+AWS_MQTT_API int aws_mqtt_publish_template_encode_headers(
+    struct aws_byte_buf *buf,
+    const struct aws_mqtt_publish_template *tmpl,
+    const struct aws_mqtt_fixed_header *header,
+    uint16_t packet_id);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_MQTT_PRIVATE_PUBLISH_TEMPLATE_H */
@@ -0,0 +1,79 @@
+#ifndef AWS_MQTT_PRIVATE_RECYCLE_POOL_H
+#define AWS_MQTT_PRIVATE_RECYCLE_POOL_H
+
+
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/mqtt.h>
+
+#include <aws/common/atomics.h>
+
+/**
+ * Cache of fixed size blocks that can be acquired and released from any thread without taking a lock.
+ *
+ * Released blocks are pushed onto a lock-free stack, linked through their first bytes, and handed back out before
+ * anything new is acquired from the allocator. Only one thread pops at a time: a thread that finds another one
+ * popping doesn't wait, it goes straight to the allocator. Since the only thread that can remove a block is the one
+ * popping, a block can't be taken and put back underneath it, which is what makes the stack safe without tagging.
+ *
+ * At most max_cached blocks are kept, anything released beyond that goes back to the allocator. Blocks are plain
+ * allocations of block_size, so the pool doesn't have to outlive them, any block can be freed with the allocator.
+ */
+struct aws_mqtt_recycle_pool {
+    struct aws_allocator *allocator;
+    size_t block_size;
+    size_t max_cached;
+
+    /* Most recently released block */
+    struct aws_atomic_var head;
+    /* Set while a thread is popping from head */
+    struct aws_atomic_var popping;
+    /* Blocks on the stack, may briefly run ahead of what's actually linked in */
+    struct aws_atomic_var cached_count;
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Initialize an empty pool. Nothing is acquired until the first block is.
+ */
+AWS_MQTT_API void aws_mqtt_recycle_pool_init(
+    struct aws_mqtt_recycle_pool *pool,
+    struct aws_allocator *allocator,
+    size_t block_size,
+    size_t max_cached);
+
+/**
+ * Free every cached block. No other thread may be using the pool.
+ * Blocks still acquired may be released to the allocator directly, or to the pool after it's initialized again.
+ */
+AWS_MQTT_API void aws_mqtt_recycle_pool_clean_up(struct aws_mqtt_recycle_pool *pool);
+
+/**
+ * Get a block of block_size bytes, reusing a released block if one is free. Safe to call from any thread.
+ *
+ * \returns the block, or NULL and aws_last_error() is set if the allocator fails.
+ */
+AWS_MQTT_API void *aws_mqtt_recycle_pool_acquire(struct aws_mqtt_recycle_pool *pool);
+
+/**
+ * Return a block from aws_mqtt_recycle_pool_acquire. Safe to call from any thread.
+ */
+AWS_MQTT_API void aws_mqtt_recycle_pool_release(struct aws_mqtt_recycle_pool *pool, void *block);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_MQTT_PRIVATE_RECYCLE_POOL_H */
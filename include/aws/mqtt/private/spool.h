@@ -0,0 +1,134 @@
+#ifndef AWS_MQTT_PRIVATE_SPOOL_H
+#define AWS_MQTT_PRIVATE_SPOOL_H
+
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/client.h>
+
+#include <aws/common/hash_table.h>
+
+/* A file mapped into memory. Implemented per platform, in source/posix and source/windows. */
+struct aws_mqtt_spool_file {
+    uint8_t *data;
+    size_t size;
+    /* Whatever the platform needs to unmap and close it */
+    void *impl;
+};
+
+/**
+ * An append-only ring of publishes in a memory-mapped file, so they survive both a long outage and a restart.
+ *
+ * Records are appended at the tail and handed out in order by take. Once acked, the space they took up is reclaimed as
+ * soon as every record before them has been acked too. Records never move, so what take returns stays valid until the
+ * record is acked. Not thread safe.
+ */
+struct aws_mqtt_spool {
+    struct aws_allocator *allocator;
+    struct aws_mqtt_spool_file file;
+    struct aws_mqtt_spool_file_header *header;
+    uint8_t *records;
+    size_t capacity;
+    /* Written through to every append, so it's on disk before append returns */
+    bool sync;
+    /* Failed sends a record gets before fail drops it, 0 for no limit. Counted in the file, so at most 255. */
+    uint8_t max_attempts;
+
+    /* Positions count bytes appended over the spool's whole life, so they only ever grow. The record at position p
+     * starts at records + p % capacity. */
+    /* Oldest record not acked yet, kept in the header */
+    uint64_t head;
+    /* Where the next record goes */
+    uint64_t tail;
+    /* Oldest record that hasn't been taken */
+    uint64_t next;
+    /* Records that haven't been acked */
+    size_t count;
+    /* Callbacks of the records appended since open, by position. Only this process can call them, so they're kept
+     * here rather than in the file, and records recovered by open have none. */
+    struct aws_hash_table callbacks;
+};
+
+/* One spooled publish */
+struct aws_mqtt_spool_publish {
+    /* Identifies the record, set by take */
+    uint64_t position;
+    struct aws_byte_cursor topic;
+    struct aws_byte_cursor payload;
+    enum aws_mqtt_qos qos;
+    bool retain;
+    /* Kept in memory until the record is acked, so NULL for a record recovered by open */
+    aws_mqtt_op_complete_fn *on_complete;
+    void *userdata;
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Map size bytes of the file at path, creating it or resizing it to size as needed.
+ */
+AWS_MQTT_API int aws_mqtt_spool_file_open(struct aws_mqtt_spool_file *file, const char *path, size_t size);
+
+AWS_MQTT_API void aws_mqtt_spool_file_close(struct aws_mqtt_spool_file *file);
+
+/**
+ * Write length bytes from offset out to disk, returning once they're there.
+ */
+AWS_MQTT_API int aws_mqtt_spool_file_sync(struct aws_mqtt_spool_file *file, size_t offset, size_t length);
+
+/**
+ * Open the spool kept in the file at path, picking up every record it still holds. Records that were taken but not
+ * acked can be taken again, without a callback. A new file, or one of a different size, starts out empty.
+ */
+AWS_MQTT_API int aws_mqtt_spool_open(
+    struct aws_mqtt_spool *spool,
+    struct aws_allocator *allocator,
+    const char *path,
+    size_t size,
+    bool sync);
+
+AWS_MQTT_API void aws_mqtt_spool_close(struct aws_mqtt_spool *spool);
+
+/**
+ * Copy publish to the tail of the spool. Raises AWS_ERROR_MQTT_SPOOL_FULL if there isn't room for it.
+ */
+AWS_MQTT_API int aws_mqtt_spool_append(struct aws_mqtt_spool *spool, const struct aws_mqtt_spool_publish *publish);
+
+/**
+ * Hand out the oldest record that hasn't been taken yet, or return false if there's none. Its topic and payload point
+ * into the spool, valid until it's acked.
+ */
+AWS_MQTT_API bool aws_mqtt_spool_take(struct aws_mqtt_spool *spool, struct aws_mqtt_spool_publish *publish);
+
+/**
+ * Done with a taken record, its space is reclaimed once every record before it is done too.
+ */
+AWS_MQTT_API void aws_mqtt_spool_ack(struct aws_mqtt_spool *spool, uint64_t position);
+
+/**
+ * Give a taken record back, to be taken again before anything after it. For when it was never really tried, say
+ * because the connection went away, so it doesn't count as an attempt.
+ */
+AWS_MQTT_API void aws_mqtt_spool_requeue(struct aws_mqtt_spool *spool, uint64_t position);
+
+/**
+ * Give a taken record back after a failed attempt to send it, to be taken again before anything after it. Once it has
+ * failed max_attempts times it's dropped instead, as if acked, and this returns true.
+ */
+AWS_MQTT_API bool aws_mqtt_spool_fail(struct aws_mqtt_spool *spool, uint64_t position);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_MQTT_PRIVATE_SPOOL_H */
@@ -0,0 +1,81 @@
+#ifndef AWS_MQTT_PRIVATE_THREAD_POOL_H
+#define AWS_MQTT_PRIVATE_THREAD_POOL_H
+
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/mqtt.h>
+
+#include <aws/common/condition_variable.h>
+#include <aws/common/linked_list.h>
+#include <aws/common/mutex.h>
+
+struct aws_thread;
+
+struct aws_mqtt_thread_pool_job;
+
+typedef void(aws_mqtt_thread_pool_job_fn)(struct aws_mqtt_thread_pool_job *job);
+
+/* Embed in whatever the job works on, and use AWS_CONTAINER_OF to get back to it */
+struct aws_mqtt_thread_pool_job {
+    struct aws_linked_list_node node;
+    aws_mqtt_thread_pool_job_fn *fn;
+};
+
+/**
+ * Fixed set of threads running submitted jobs in the order they were submitted. Nothing is allocated per job, jobs
+ * are linked into one queue, so a job may be submitted again once it has started running (even from itself).
+ */
+struct aws_mqtt_thread_pool {
+    struct aws_allocator *allocator;
+
+    struct aws_mutex lock;
+    /* Signalled when a job is queued or the pool is shutting down */
+    struct aws_condition_variable signal;
+    /* aws_mqtt_thread_pool_job, guarded by lock */
+    struct aws_linked_list jobs;
+    /* Guarded by lock. Once set, threads exit as soon as jobs is empty. */
+    bool shutting_down;
+
+    struct aws_thread *threads;
+    size_t thread_count;
+};
+
+AWS_EXTERN_C_BEGIN
+
+/**
+ * Start thread_count threads, all waiting for jobs.
+ *
+ * \returns AWS_OP_SUCCESS, or AWS_OP_ERR with aws_last_error() set, with nothing left to clean up.
+ */
+AWS_MQTT_API int aws_mqtt_thread_pool_init(
+    struct aws_mqtt_thread_pool *pool,
+    struct aws_allocator *allocator,
+    size_t thread_count);
+
+/**
+ * Run every job submitted so far, along with any they submit, then stop and join the threads.
+ * Must not be called from one of the pool's threads.
+ */
+AWS_MQTT_API void aws_mqtt_thread_pool_clean_up(struct aws_mqtt_thread_pool *pool);
+
+/**
+ * Queue job to run on one of the pool's threads. Safe to call from any thread, job->fn must be set.
+ */
+AWS_MQTT_API void aws_mqtt_thread_pool_submit(struct aws_mqtt_thread_pool *pool, struct aws_mqtt_thread_pool_job *job);
+
+AWS_EXTERN_C_END
+
+#endif /* AWS_MQTT_PRIVATE_THREAD_POOL_H */
@@ -20,39 +20,80 @@
 
 #include <aws/mqtt/private/packets.h>
 
+struct aws_mqtt_arena;
+struct aws_mqtt_topic_tree_match_cache;
+
 /** Type of function called when a publish recieved matches a subscription */
 typedef void(aws_mqtt_publish_received_fn)(
     const struct aws_byte_cursor *topic,
     const struct aws_byte_cursor *payload,
     void *user_data);
 
+/* How many children a node stores inline before switching to a hash table */
+enum { AWS_MQTT_TOPIC_NODE_INLINE_CHILDREN = 8 };
+
+/* One callback subscribed to a topic filter. Any number of them can share a filter. */
+struct aws_mqtt_topic_subscriber {
+    struct aws_mqtt_topic_subscriber *next;
+    /* The QoS this subscriber asked for */
+    enum aws_mqtt_qos qos;
+    aws_mqtt_publish_received_fn *callback;
+    aws_mqtt_userdata_cleanup_fn *cleanup;
+    void *userdata;
+};
+
 struct aws_mqtt_topic_node {
 
     /* This node's part of the topic filter. If in another node's subtopics, this is the key. */
     struct aws_byte_cursor topic;
 
+    /* Wildcard children are kept apart from the rest, so matching only has to check for NULL */
+    struct aws_mqtt_topic_node *single_level_wildcard; /* '+' */
+    struct aws_mqtt_topic_node *multi_level_wildcard;  /* '#' */
+
+    /* Number of children, not counting the wildcards */
+    size_t child_count;
+
     /**
-     * aws_byte_cursor -> aws_mqtt_topic_node
-     * '#' and '+' are special values in here
+     * Until there are more than AWS_MQTT_TOPIC_NODE_INLINE_CHILDREN children, they are kept in inline_children,
+     * sorted by topic length and then by bytes. After that they all live in subtopics instead.
      */
+    struct aws_mqtt_topic_node *inline_children[AWS_MQTT_TOPIC_NODE_INLINE_CHILDREN];
+    /* aws_byte_cursor -> aws_mqtt_topic_node, only initialized if children_hashed */
     struct aws_hash_table subtopics;
+    bool children_hashed;
 
     /* The entire topic filter. If !owns_topic_filter, this topic_filter belongs to someone else. */
     const struct aws_string *topic_filter;
     bool owns_topic_filter;
 
     /* The following will only be populated if the node IS a subscription */
-    /* Max QoS to deliver. */
+    /* Max QoS to deliver, the highest any subscriber asked for. */
     enum aws_mqtt_qos qos;
-    /* Callback to call on message recieved */
-    aws_mqtt_publish_received_fn *callback;
-    aws_mqtt_userdata_cleanup_fn *cleanup;
-    void *userdata;
+    /* Called on message recieved, in the order they subscribed */
+    struct aws_mqtt_topic_subscriber *subscribers;
+    size_t subscriber_count;
+    /* What the server last granted for this filter, see aws_mqtt_topic_tree_set_granted. Until a SUBACK says so, or
+     * if it refused, granted is false. */
+    bool granted;
+    enum aws_mqtt_qos granted_qos;
 };
 
+/**
+ * Type of function called for each subscription matching a topic.
+ * Return false to stop visiting matches.
+ */
+typedef bool(aws_mqtt_topic_tree_visit_fn)(const struct aws_mqtt_topic_node *subscription, void *user_data);
+
 struct aws_mqtt_topic_tree {
     struct aws_mqtt_topic_node *root;
     struct aws_allocator *allocator;
+    /* Only set if the tree was initialized with aws_mqtt_topic_tree_init_arena, allocator is then arena's */
+    struct aws_mqtt_arena *arena;
+    /* Bumped by every commit, so anything remembering matches knows when they might have changed */
+    uint64_t generation;
+    /* Only set if enabled with aws_mqtt_topic_tree_set_match_cache_size */
+    struct aws_mqtt_topic_tree_match_cache *match_cache;
 };
 
 /**
@@ -66,18 +107,37 @@ extern AWS_MQTT_API size_t aws_mqtt_topic_tree_action_size;
  * Note that calling init allocates root.
  */
 AWS_MQTT_API int aws_mqtt_topic_tree_init(struct aws_mqtt_topic_tree *tree, struct aws_allocator *allocator);
+/**
+ * Initialize a topic tree that carves its nodes, child tables and topic filters out of an arena of its own,
+ * with allocator only backing the arena. This avoids lots of small allocations for large subscription sets, and
+ * clean up releases the whole tree in bulk instead of node by node.
+ */
+AWS_MQTT_API int aws_mqtt_topic_tree_init_arena(struct aws_mqtt_topic_tree *tree, struct aws_allocator *allocator);
 /**
  * Cleanup and deallocate an entire topic tree.
  */
 AWS_MQTT_API void aws_mqtt_topic_tree_clean_up(struct aws_mqtt_topic_tree *tree);
 
+/**
+ * Enable, resize or (with max_topics 0) disable the publish match cache.
+ *
+ * The cache remembers which subscriptions matched the max_topics most recently published topic names, evicting the
+ * least recently used. A publish on a cached topic then skips the walk down the tree. Any commit invalidates every
+ * cached entry, so this pays off when subscriptions change far less often than publishes arrive.
+ *
+ * \returns AWS_OP_SUCCESS on success, AWS_OP_ERR with aws_last_error() populated if the cache couldn't be created.
+ */
+AWS_MQTT_API int aws_mqtt_topic_tree_set_match_cache_size(struct aws_mqtt_topic_tree *tree, size_t max_topics);
+
 /**
  * Insert a new topic filter into the subscription tree (subscribe).
+ * If topic_filter is already in the tree, callback is added to the subscribers already there instead of replacing them.
  *
  * \param[in]  tree         The tree to insert into.
  * \param[in]  transaction  The transaction to add the insert action to.
  *                          Must be initialized with aws_mqtt_topic_tree_action_size as item size.
  * \param[in]  topic_filter The topic filter to subscribe on. May contain wildcards.
+ *                          The tree keeps its own copy, the caller still owns topic_filter.
  * \param[in]  callback     The callback to call on a publish with a matching topic.
  * \param[in]  connection   The connection object to pass to the callback. This is a void* to support client and server
  *                          connections in the future.
@@ -97,7 +157,7 @@ AWS_MQTT_API int aws_mqtt_topic_tree_transaction_insert(
     void *userdata);
 
 /**
- * Remove a topic filter from the subscription tree (unsubscribe).
+ * Remove a topic filter from the subscription tree (unsubscribe), along with every subscriber to it.
  *
  * \param[in]  tree         The tree to remove from.
  * \param[in]  transaction  The transaction to add the insert action to.
@@ -113,6 +173,25 @@ AWS_MQTT_API int aws_mqtt_topic_tree_transaction_remove(
     struct aws_array_list *transaction,
     const struct aws_byte_cursor *topic_filter);
 
+/**
+ * Remove only the subscriber with userdata from a topic filter. The filter itself is removed with its last subscriber.
+ * If no subscriber to the filter has userdata, committing the removal does nothing.
+ *
+ * \param[in]  tree         The tree to remove from.
+ * \param[in]  transaction  The transaction to add the remove action to.
+ *                          Must be initialized with aws_mqtt_topic_tree_action_size as item size.
+ * \param[in]  topic_filter The filter to remove from (must be exactly the same as the topic_filter passed to insert).
+ * \param[in]  userdata     The userdata the subscriber was inserted with.
+ *
+ * \returns AWS_OP_SUCCESS on successful removal, AWS_OP_ERR with aws_last_error() populated on failure.
+ *          If AWS_OP_ERR is returned, aws_mqtt_topic_tree_transaction_rollback should be called to prevent leaks.
+ */
+AWS_MQTT_API int aws_mqtt_topic_tree_transaction_remove_subscriber(
+    struct aws_mqtt_topic_tree *tree,
+    struct aws_array_list *transaction,
+    const struct aws_byte_cursor *topic_filter,
+    const void *userdata);
+
 AWS_MQTT_API void aws_mqtt_topic_tree_transaction_commit(
     struct aws_mqtt_topic_tree *tree,
     struct aws_array_list *transaction);
@@ -126,6 +205,7 @@ AWS_MQTT_API void aws_mqtt_topic_tree_transaction_roll_back(
  *
  * \param[in]  tree         The tree to insert into.
  * \param[in]  topic_filter The topic filter to subscribe on. May contain wildcards.
+ *                          The tree keeps its own copy, the caller still owns topic_filter.
  * \param[in]  callback     The callback to call on a publish with a matching topic.
  * \param[in]  connection   The connection object to pass to the callback. This is a void* to support client and server
  *                          connections in the future.
@@ -146,6 +226,34 @@ int aws_mqtt_topic_tree_insert(
 AWS_MQTT_API
 int aws_mqtt_topic_tree_remove(struct aws_mqtt_topic_tree *tree, const struct aws_byte_cursor *topic_filter);
 
+AWS_MQTT_API
+int aws_mqtt_topic_tree_remove_subscriber(
+    struct aws_mqtt_topic_tree *tree,
+    const struct aws_byte_cursor *topic_filter,
+    const void *userdata);
+
+/**
+ * Find the subscription to exactly topic_filter, wildcards and all. Returns NULL if nothing subscribed to it.
+ */
+AWS_MQTT_API const struct aws_mqtt_topic_node *aws_mqtt_topic_tree_find(
+    const struct aws_mqtt_topic_tree *tree,
+    const struct aws_byte_cursor *topic_filter);
+
+/**
+ * Record whether the server granted the subscription to exactly topic_filter, and at what QoS. Does nothing if nothing
+ * is subscribed to it. Reset whenever the filter gets its first subscriber.
+ */
+AWS_MQTT_API void aws_mqtt_topic_tree_set_granted(
+    struct aws_mqtt_topic_tree *tree,
+    const struct aws_byte_cursor *topic_filter,
+    bool granted,
+    enum aws_mqtt_qos granted_qos);
+
+/**
+ * Get the number of children of a node, including wildcards.
+ */
+AWS_MQTT_API size_t aws_mqtt_topic_node_get_child_count(const struct aws_mqtt_topic_node *node);
+
 /**
  * Dispatches a publish packet to all subscriptions matching the publish topic.
  *
@@ -157,4 +265,58 @@ int aws_mqtt_topic_tree_remove(struct aws_mqtt_topic_tree *tree, const struct aw
 int AWS_MQTT_API
     aws_mqtt_topic_tree_publish(const struct aws_mqtt_topic_tree *tree, struct aws_mqtt_packet_publish *pub);
 
+/**
+ * Calls visitor with each subscription matching a topic, without calling the subscriptions' callbacks.
+ * Matches come in the same order aws_mqtt_topic_tree_publish would call them in. A filter is visited once, however many
+ * subscribers share it.
+ *
+ * The topic is split into levels once up front and the tree is walked with an explicit stack, so deeply nested topics
+ * don't recurse. Neither allocates unless the topic has an unreasonable number of levels.
+ * The tree must not be modified by visitor.
+ *
+ * \param[in] tree      The tree to match against.
+ * \param[in] topic     The topic to match. MUST NOT contain wildcards.
+ * \param[in] visitor   Called once per matching subscription.
+ * \param[in] user_data Passed to visitor.
+ *
+ * \returns AWS_OP_SUCCESS once all matches were visited (or visitor stopped early),
+ *          AWS_OP_ERR with aws_last_error() populated on failure.
+ */
+AWS_MQTT_API int aws_mqtt_topic_tree_visit_matches(
+    const struct aws_mqtt_topic_tree *tree,
+    const struct aws_byte_cursor *topic,
+    aws_mqtt_topic_tree_visit_fn *visitor,
+    void *user_data);
+
+/**
+ * Finds the subscriptions matching a topic and stores them in a caller provided array, so they can be deduplicated,
+ * batched or handed to another thread without matching again.
+ *
+ * \param[in]  tree        The tree to match against.
+ * \param[in]  topic       The topic to match. MUST NOT contain wildcards.
+ * \param[out] matches     Filled with the first max_matches matching subscriptions.
+ * \param[in]  max_matches Number of entries in matches.
+ * \param[out] match_count Total number of matching subscriptions, which may be more than max_matches.
+ *
+ * \returns AWS_OP_SUCCESS on success, AWS_OP_ERR with aws_last_error() populated on failure.
+ */
+AWS_MQTT_API int aws_mqtt_topic_tree_collect_matches(
+    const struct aws_mqtt_topic_tree *tree,
+    const struct aws_byte_cursor *topic,
+    const struct aws_mqtt_topic_node **matches,
+    size_t max_matches,
+    size_t *match_count);
+
+/**
+ * Visits every subscription in the tree, in no particular order. The tree must not be modified by visitor.
+ *
+ * \param[in] tree      The tree to walk.
+ * \param[in] visitor   Called once per subscription, return false to stop early.
+ * \param[in] user_data Passed to visitor.
+ */
+AWS_MQTT_API void aws_mqtt_topic_tree_iterate(
+    const struct aws_mqtt_topic_tree *tree,
+    aws_mqtt_topic_tree_visit_fn *visitor,
+    void *user_data);
+
 #endif /* AWS_MQTT_PRIVATE_TOPIC_TREE_H */
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/arena.h>
+
+/* Usable bytes in a block of each size class. Every class is a multiple of 32, so blocks stay aligned. */
+static const size_t s_size_classes[AWS_MQTT_ARENA_SIZE_CLASS_COUNT] = {32, 64, 96, 128, 192, 256, 384, 512};
+
+enum { S_LARGE_ALLOCATION = AWS_MQTT_ARENA_SIZE_CLASS_COUNT };
+
+struct aws_mqtt_arena_page {
+    struct aws_mqtt_arena_page *next;
+    size_t reserved; /* Keeps the first block as aligned as the page itself */
+};
+
+/* Sits directly in front of every allocation handed out */
+struct arena_block_header {
+    /* Index into s_size_classes, or S_LARGE_ALLOCATION */
+    size_t size_class;
+    /* Size that was asked for, so realloc knows how much to copy */
+    size_t size;
+};
+
+struct arena_large_allocation {
+    struct aws_linked_list_node node;
+    struct arena_block_header header;
+};
+
+struct arena_free_block {
+    struct arena_free_block *next;
+};
+
+static struct arena_block_header *s_header_from_ptr(void *ptr) {
+    return (struct arena_block_header *)((uint8_t *)ptr - sizeof(struct arena_block_header));
+}
+
+static size_t s_size_class_for(size_t size) {
+
+    for (size_t i = 0; i < AWS_MQTT_ARENA_SIZE_CLASS_COUNT; ++i) {
+        if (size <= s_size_classes[i]) {
+            return i;
+        }
+    }
+    return S_LARGE_ALLOCATION;
+}
+
+/*******************************************************************************
+ * Allocator
+ ******************************************************************************/
+
+static void *s_large_acquire(struct aws_mqtt_arena *arena, size_t size) {
+
+    struct arena_large_allocation *large =
+        aws_mem_acquire(arena->backing, sizeof(struct arena_large_allocation) + size);
+    if (!large) {
+        return NULL;
+    }
+
+    large->header.size_class = S_LARGE_ALLOCATION;
+    large->header.size = size;
+    aws_linked_list_push_back(&arena->large_allocations, &large->node);
+
+    return &large->header + 1;
+}
+
+static void *s_arena_mem_acquire(struct aws_allocator *allocator, size_t size) {
+
+    struct aws_mqtt_arena *arena = allocator->impl;
+
+    const size_t size_class = s_size_class_for(size);
+    if (size_class == S_LARGE_ALLOCATION) {
+        return s_large_acquire(arena, size);
+    }
+
+    struct arena_block_header *header = NULL;
+
+    struct arena_free_block *free_block = arena->free_lists[size_class];
+    if (free_block) {
+        arena->free_lists[size_class] = free_block->next;
+        header = s_header_from_ptr(free_block);
+
+    } else {
+        const size_t block_size = sizeof(struct arena_block_header) + s_size_classes[size_class];
+
+        if ((size_t)(arena->page_end - arena->page_cursor) < block_size) {
+            /* Whatever is left of the current page is abandoned, it's less than one block */
+            struct aws_mqtt_arena_page *page = aws_mem_acquire(arena->backing, AWS_MQTT_ARENA_PAGE_SIZE);
+            if (!page) {
+                return NULL;
+            }
+            page->next = arena->pages;
+            arena->pages = page;
+            arena->page_cursor = (uint8_t *)(page + 1);
+            arena->page_end = (uint8_t *)page + AWS_MQTT_ARENA_PAGE_SIZE;
+        }
+
+        header = (struct arena_block_header *)arena->page_cursor;
+        arena->page_cursor += block_size;
+    }
+
+    header->size_class = size_class;
+    header->size = size;
+
+    return header + 1;
+}
+
+static void s_arena_mem_release(struct aws_allocator *allocator, void *ptr) {
+
+    struct aws_mqtt_arena *arena = allocator->impl;
+    struct arena_block_header *header = s_header_from_ptr(ptr);
+
+    if (header->size_class == S_LARGE_ALLOCATION) {
+        struct arena_large_allocation *large = AWS_CONTAINER_OF(header, struct arena_large_allocation, header);
+        aws_linked_list_remove(&large->node);
+        aws_mem_release(arena->backing, large);
+        return;
+    }
+
+    AWS_ASSERT(header->size_class < AWS_MQTT_ARENA_SIZE_CLASS_COUNT);
+
+    struct arena_free_block *free_block = ptr;
+    free_block->next = arena->free_lists[header->size_class];
+    arena->free_lists[header->size_class] = free_block;
+}
+
+static void *s_arena_mem_realloc(struct aws_allocator *allocator, void *oldptr, size_t oldsize, size_t newsize) {
+
+    if (!oldptr) {
+        return s_arena_mem_acquire(allocator, newsize);
+    }
+
+    struct arena_block_header *header = s_header_from_ptr(oldptr);
+    AWS_ASSERT(header->size == oldsize);
+    (void)oldsize;
+
+    /* Still fits the block it's in */
+    if (header->size_class != S_LARGE_ALLOCATION && newsize <= s_size_classes[header->size_class]) {
+        header->size = newsize;
+        return oldptr;
+    }
+
+    void *newptr = s_arena_mem_acquire(allocator, newsize);
+    if (!newptr) {
+        return NULL;
+    }
+    memcpy(newptr, oldptr, header->size < newsize ? header->size : newsize);
+    s_arena_mem_release(allocator, oldptr);
+
+    return newptr;
+}
+
+/*******************************************************************************
+ * Init
+ ******************************************************************************/
+
+void aws_mqtt_arena_init(struct aws_mqtt_arena *arena, struct aws_allocator *backing) {
+
+    AWS_ASSERT(arena);
+    AWS_ASSERT(backing);
+
+    AWS_ZERO_STRUCT(*arena);
+    arena->allocator.mem_acquire = s_arena_mem_acquire;
+    arena->allocator.mem_release = s_arena_mem_release;
+    arena->allocator.mem_realloc = s_arena_mem_realloc;
+    arena->allocator.impl = arena;
+    arena->backing = backing;
+    aws_linked_list_init(&arena->large_allocations);
+}
+
+/*******************************************************************************
+ * Clean Up
+ ******************************************************************************/
+
+void aws_mqtt_arena_clean_up(struct aws_mqtt_arena *arena) {
+
+    AWS_ASSERT(arena);
+
+    while (!aws_linked_list_empty(&arena->large_allocations)) {
+        struct aws_linked_list_node *node = aws_linked_list_pop_front(&arena->large_allocations);
+        aws_mem_release(arena->backing, AWS_CONTAINER_OF(node, struct arena_large_allocation, node));
+    }
+
+    struct aws_mqtt_arena_page *page = arena->pages;
+    while (page) {
+        struct aws_mqtt_arena_page *next = page->next;
+        aws_mem_release(arena->backing, page);
+        page = next;
+    }
+
+    AWS_ZERO_STRUCT(*arena);
+}
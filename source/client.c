@@ -15,16 +15,20 @@
 #include <aws/mqtt/client.h>
 
 #include <aws/mqtt/private/client_impl.h>
+#include <aws/mqtt/private/connection_group.h>
+#include <aws/mqtt/private/logging.h>
 #include <aws/mqtt/private/packets.h>
+#include <aws/mqtt/private/publish_template.h>
 #include <aws/mqtt/private/topic_tree.h>
 
 #include <aws/io/channel_bootstrap.h>
 #include <aws/io/event_loop.h>
-#include <aws/io/logging.h>
 #include <aws/io/socket.h>
 #include <aws/io/tls_channel_handler.h>
 
 #include <aws/common/clock.h>
+#include <aws/common/device_random.h>
+#include <aws/common/math.h>
 #include <aws/common/task_scheduler.h>
 
 #include <inttypes.h>
@@ -36,6 +40,22 @@
 /* 3 seconds */
 static const uint64_t s_default_request_timeout_ns = 3000000000;
 
+/* Largest remaining length an MQTT packet can have */
+static const size_t s_max_remaining_length = 268435455;
+
+/* Most blocks each of the connection's recycle pools keeps around for reuse */
+static const size_t s_recycle_pool_max_cached = 128;
+
+/* Most topic and payload bytes publish_copy keeps in a pooled arg, anything bigger gets an allocation of its own */
+static const size_t s_publish_copy_inline_max = 256;
+
+/* The task args aren't defined until their operations below */
+static void s_args_pools_init(struct aws_mqtt_client_connection *connection);
+static void s_stats_init(struct aws_mqtt_client_connection *connection);
+static void s_dispatch_clean_up(struct aws_mqtt_client_connection *connection);
+static void s_spool_clean_up(struct aws_mqtt_client_connection *connection);
+static void s_args_pools_clean_up(struct aws_mqtt_client_connection *connection);
+
 /*******************************************************************************
  * Client Init
  ******************************************************************************/
@@ -45,7 +65,7 @@ int aws_mqtt_client_init(
     struct aws_allocator *allocator,
     struct aws_client_bootstrap *bootstrap) {
 
-    AWS_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "client=%p: Initalizing MQTT client", (void *)client);
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "client=%p: Initalizing MQTT client", (void *)client);
 
     AWS_ZERO_STRUCT(*client);
     client->allocator = allocator;
@@ -60,7 +80,7 @@ int aws_mqtt_client_init(
 
 void aws_mqtt_client_clean_up(struct aws_mqtt_client *client) {
 
-    AWS_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "client=%p: Cleaning up MQTT client", (void *)client);
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "client=%p: Cleaning up MQTT client", (void *)client);
 
     AWS_ZERO_STRUCT(*client);
 }
@@ -76,26 +96,34 @@ static void s_mqtt_client_shutdown(
 
     struct aws_mqtt_client_connection *connection = user_data;
 
-    AWS_LOGF_TRACE(
+    AWS_MQTT_LOGF_TRACE(
         AWS_LS_MQTT_CLIENT, "id=%p: Channel has been shutdown with error code %d", (void *)connection, error_code);
 
+    aws_mqtt_connection_group_leave(connection);
+
+    /* Nothing can be scheduled on the channel from other threads from here on */
+    mqtt_shared_channel_set(connection, NULL);
+
+    /* If there was a slot and we were connecting, the socket at least managed to connect (and was likely hung up
+     * gracefully during setup) so this should behave like a dropped connection. Stop being connected before the slot
+     * goes, so nothing that checks the state goes looking for it. */
+    const bool interrupted = connection->state == AWS_MQTT_CLIENT_STATE_CONNECTED ||
+                             (connection->slot && connection->state == AWS_MQTT_CLIENT_STATE_CONNECTING);
+    if (interrupted) {
+        connection->state = AWS_MQTT_CLIENT_STATE_RECONNECTING;
+    }
+
     /* Always clear slot, as that's what's been shutdown */
     if (connection->slot) {
-        if (connection->state == AWS_MQTT_CLIENT_STATE_CONNECTING) {
-            /* if there was a slot and we were connecting, the socket at least
-             * managed to connect (and was likely hung up gracefully during setup)
-             * so this should behave like a dropped connection */
-            connection->state = AWS_MQTT_CLIENT_STATE_CONNECTED;
-        }
         aws_channel_slot_remove(connection->slot);
         connection->slot = NULL;
     }
 
-    if (connection->state == AWS_MQTT_CLIENT_STATE_RECONNECTING) {
+    if (connection->state == AWS_MQTT_CLIENT_STATE_RECONNECTING && !interrupted) {
         /* If reconnect attempt failed, schedule the next attempt */
         struct aws_event_loop *el = aws_event_loop_group_get_next_loop(connection->client->bootstrap->event_loop_group);
 
-        AWS_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: Reconnect failed, retrying", (void *)connection);
+        AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: Reconnect failed, retrying", (void *)connection);
 
         aws_event_loop_schedule_task_future(
             el, &connection->reconnect_task->task, connection->reconnect_timeouts.next_attempt);
@@ -104,19 +132,19 @@ static void s_mqtt_client_shutdown(
 
         connection->state = AWS_MQTT_CLIENT_STATE_DISCONNECTED;
 
-        AWS_LOGF_DEBUG(
+        AWS_MQTT_LOGF_DEBUG(
             AWS_LS_MQTT_CLIENT,
             "id=%p: Disconnect completed, clearing request queue and calling callback",
             (void *)connection);
 
         /* Successfully shutdown, so clear the outstanding requests */
-        aws_hash_table_clear(&connection->outstanding_requests.table);
+        aws_mqtt_packet_id_table_clear(&connection->outstanding_requests);
 
         MQTT_CLIENT_CALL_CALLBACK(connection, on_disconnect);
 
     } else if (connection->state == AWS_MQTT_CLIENT_STATE_CONNECTING) {
 
-        AWS_LOGF_TRACE(
+        AWS_MQTT_LOGF_TRACE(
             AWS_LS_MQTT_CLIENT, "id=%p: Initial connection attempt failed, calling callback", (void *)connection);
 
         connection->state = AWS_MQTT_CLIENT_STATE_DISCONNECTED;
@@ -125,18 +153,16 @@ static void s_mqtt_client_shutdown(
     } else {
 
         AWS_ASSERT(
-            connection->state == AWS_MQTT_CLIENT_STATE_CONNECTED ||
             connection->state == AWS_MQTT_CLIENT_STATE_RECONNECTING ||
             connection->state == AWS_MQTT_CLIENT_STATE_DISCONNECTED);
 
-        if (connection->state == AWS_MQTT_CLIENT_STATE_CONNECTED) {
+        if (interrupted) {
 
-            AWS_LOGF_DEBUG(
+            AWS_MQTT_LOGF_DEBUG(
                 AWS_LS_MQTT_CLIENT,
                 "id=%p: Connection lost, calling callback and attempting reconnect",
                 (void *)connection);
 
-            connection->state = AWS_MQTT_CLIENT_STATE_RECONNECTING;
             MQTT_CLIENT_CALL_CALLBACK_ARGS(connection, on_interrupted, error_code);
         }
 
@@ -148,7 +174,7 @@ static void s_mqtt_client_shutdown(
         /* This will only be true if the user called disconnect from the on_interrupted callback */
         if (connection->state == AWS_MQTT_CLIENT_STATE_DISCONNECTING) {
 
-            AWS_LOGF_TRACE(
+            AWS_MQTT_LOGF_TRACE(
                 AWS_LS_MQTT_CLIENT,
                 "id=%p: Caller requested disconnect from on_interrupted callback, aborting reconnect",
                 (void *)connection);
@@ -188,17 +214,21 @@ static void s_mqtt_client_init(
         return;
     }
 
-    AWS_LOGF_DEBUG(
+    AWS_MQTT_LOGF_DEBUG(
         AWS_LS_MQTT_CLIENT, "id=%p: Connection successfully opened, sending CONNECT packet", (void *)connection);
 
     /* Reset the current timeout timer */
-    connection->reconnect_timeouts.current = connection->reconnect_timeouts.min;
+    connection->reconnect_timeouts.current =
+        aws_timestamp_convert(connection->reconnect_timeouts.min, AWS_TIMESTAMP_SECS, AWS_TIMESTAMP_MILLIS, NULL);
+
+    /* Drop any partial packet left over from the last channel */
+    aws_mqtt_packet_framer_reset(&connection->framer);
 
     /* Create the slot and handler */
     connection->slot = aws_channel_slot_new(channel);
 
     if (!connection->slot) {
-        AWS_LOGF_ERROR(
+        AWS_MQTT_LOGF_ERROR(
             AWS_LS_MQTT_CLIENT,
             "id=%p: Failed to create new slot, something has gone horribly wrong",
             (void *)connection);
@@ -207,7 +237,14 @@ static void s_mqtt_client_init(
     }
 
     aws_channel_slot_insert_end(channel, connection->slot);
+    /* Before the handler is set, which is when the channel asks for its window */
+    mqtt_read_window_reset(connection);
     aws_channel_slot_set_handler(connection->slot, &connection->handler);
+    mqtt_shared_channel_set(connection, channel);
+
+    if (connection->group) {
+        aws_mqtt_connection_group_join(connection->group, connection, channel);
+    }
 
     /* Send the connect packet */
     struct aws_mqtt_packet_connect connect;
@@ -241,22 +278,25 @@ static void s_mqtt_client_init(
         aws_mqtt_packet_connect_add_credentials(&connect, username_cur, password_cur);
     }
 
-    struct aws_io_message *message = mqtt_get_message_for_packet(connection, &connect.fixed_header);
-    if (!message) {
+    struct aws_byte_buf *buf = mqtt_packet_write_begin(connection, &connect.fixed_header);
+    if (!buf) {
 
-        AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to get message from pool", (void *)connection);
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to get message from pool", (void *)connection);
         goto handle_error;
     }
 
-    if (aws_mqtt_packet_connect_encode(&message->message_data, &connect)) {
+    if (aws_mqtt_packet_connect_encode(buf, &connect)) {
 
-        AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to encode CONNECT packet", (void *)connection);
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to encode CONNECT packet", (void *)connection);
+        mqtt_packet_write_abort(connection);
         goto handle_error;
     }
 
-    if (aws_channel_slot_send_message(connection->slot, message, AWS_CHANNEL_DIR_WRITE)) {
+    /* Nothing else can be sent until the CONNACK arrives, so don't wait for the batch to fill */
+    if (mqtt_packet_write_end(connection) || mqtt_packet_write_flush(connection)) {
 
-        AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to send encoded CONNECT packet upstream", (void *)connection);
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT, "id=%p: Failed to send encoded CONNECT packet upstream", (void *)connection);
         goto handle_error;
     }
 
@@ -264,10 +304,39 @@ static void s_mqtt_client_init(
 
 handle_error:
     MQTT_CLIENT_CALL_CALLBACK_ARGS(connection, on_connection_complete, aws_last_error(), 0, false);
+}
+
+/* xorshift64*, plenty for spreading out retries and far cheaper than asking the OS every attempt */
+static uint64_t s_reconnect_random(struct aws_mqtt_client_connection *connection) {
+
+    uint64_t x = connection->reconnect_timeouts.random_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    connection->reconnect_timeouts.random_state = x;
+    return x * UINT64_C(0x2545F4914F6CDD1D);
+}
 
-    if (message) {
-        aws_mem_release(message->allocator, message);
+/* Pick the wait before the attempt after next, from the one before the next attempt */
+static void s_reconnect_timeout_advance(struct aws_mqtt_client_connection *connection) {
+
+    const uint64_t min =
+        aws_timestamp_convert(connection->reconnect_timeouts.min, AWS_TIMESTAMP_SECS, AWS_TIMESTAMP_MILLIS, NULL);
+    const uint64_t max =
+        aws_timestamp_convert(connection->reconnect_timeouts.max, AWS_TIMESTAMP_SECS, AWS_TIMESTAMP_MILLIS, NULL);
+    uint64_t current = connection->reconnect_timeouts.current;
+
+    /* Check before multipying to avoid potential overflow */
+    if (connection->reconnect_timeouts.backoff == AWS_MQTT_RECONNECT_BACKOFF_DECORRELATED_JITTER) {
+        const uint64_t upper = current > max / 3 ? max : current * 3;
+        current = upper > min ? min + s_reconnect_random(connection) % (upper - min + 1) : min;
+    } else if (current > max / 2) {
+        current = max;
+    } else {
+        current *= 2;
     }
+
+    connection->reconnect_timeouts.current = current < max ? current : max;
 }
 
 static void s_attempt_reconect(struct aws_task *task, void *userdata, enum aws_task_status status) {
@@ -282,20 +351,15 @@ static void s_attempt_reconect(struct aws_task *task, void *userdata, enum aws_t
 
         aws_high_res_clock_get_ticks(&connection->reconnect_timeouts.next_attempt);
         connection->reconnect_timeouts.next_attempt += aws_timestamp_convert(
-            connection->reconnect_timeouts.current, AWS_TIMESTAMP_SECS, AWS_TIMESTAMP_NANOS, NULL);
+            connection->reconnect_timeouts.current, AWS_TIMESTAMP_MILLIS, AWS_TIMESTAMP_NANOS, NULL);
 
-        AWS_LOGF_TRACE(
+        AWS_MQTT_LOGF_TRACE(
             AWS_LS_MQTT_CLIENT,
-            "id=%p: Attempting reconnect, if it fails next attempt will be in %" PRIu64 " seconds",
+            "id=%p: Attempting reconnect, if it fails next attempt will be in %" PRIu64 " milliseconds",
             (void *)connection,
             connection->reconnect_timeouts.current);
 
-        /* Check before multipying to avoid potential overflow */
-        if (connection->reconnect_timeouts.current > connection->reconnect_timeouts.max / 2) {
-            connection->reconnect_timeouts.current = connection->reconnect_timeouts.max;
-        } else {
-            connection->reconnect_timeouts.current *= 2;
-        }
+        s_reconnect_timeout_advance(connection);
 
         if (aws_mqtt_client_connection_reconnect(
                 connection, connection->on_connection_complete, connection->on_connection_complete_ud)) {
@@ -313,20 +377,30 @@ static void s_attempt_reconect(struct aws_task *task, void *userdata, enum aws_t
     }
 }
 
-static uint64_t s_hash_uint16_t(const void *item) {
-    return *(uint16_t *)item;
-}
+/* Let a request that asked for it know it's being dropped before it could complete */
+static void s_request_drop(struct aws_mqtt_outstanding_request *request) {
 
-static bool s_uint16_t_eq(const void *a, const void *b) {
-    return *(uint16_t *)a == *(uint16_t *)b;
+    if (request->complete_on_drop && !request->completed) {
+        request->completed = true;
+        request->on_complete(
+            request->connection, request->message_id, AWS_ERROR_MQTT_CONNECTION_DESTROYED, request->on_complete_ud);
+    }
 }
 
 static void s_outstanding_request_destroy(void *item) {
     struct aws_mqtt_outstanding_request *request = item;
 
+    aws_mqtt_packet_id_allocator_release(&request->connection->packet_ids, request->message_id);
+
+    if (request->windowed) {
+        --request->connection->window.in_flight;
+    }
+
+    s_request_drop(request);
+
     if (request->cancelled) {
         /* Task ran as cancelled already, clean up the memory */
-        aws_memory_pool_release(&request->connection->requests_pool, request);
+        mqtt_request_release(request->connection, request);
     } else {
         /* Signal task to clean up request */
         request->cancelled = true;
@@ -344,7 +418,7 @@ struct aws_mqtt_client_connection *aws_mqtt_client_connection_new(struct aws_mqt
         return NULL;
     }
 
-    AWS_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Creating new connection", (void *)connection);
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Creating new connection", (void *)connection);
 
     /* Initialize the client */
     AWS_ZERO_STRUCT(*connection);
@@ -353,41 +427,72 @@ struct aws_mqtt_client_connection *aws_mqtt_client_connection_new(struct aws_mqt
     connection->state = AWS_MQTT_CLIENT_STATE_DISCONNECTED;
     connection->reconnect_timeouts.min = 1;
     connection->reconnect_timeouts.max = 128;
-    aws_mutex_init(&connection->outstanding_requests.mutex);
+    connection->reconnect_timeouts.backoff = AWS_MQTT_RECONNECT_BACKOFF_EXPONENTIAL;
+    /* Seeded per connection, so connections that drop together don't pick the same waits */
+    uint64_t seed = 0;
+    if (aws_device_random_u64(&seed) || !seed) {
+        aws_high_res_clock_get_ticks(&seed);
+        seed ^= (uint64_t)(uintptr_t)connection;
+    }
+    connection->reconnect_timeouts.random_state = seed ? seed : 1;
+    aws_mqtt_packet_id_allocator_init(&connection->packet_ids);
+    aws_mqtt_packet_framer_init(&connection->framer, connection->allocator);
+    aws_mqtt_packet_id_set_init(&connection->inbound_qos2_ids);
+    aws_mqtt_mpsc_queue_init(&connection->submissions.queue);
+    aws_atomic_init_int(&connection->submissions.drain_scheduled, false);
+    aws_linked_list_init(&connection->retries.list);
     aws_linked_list_init(&connection->pending_requests.list);
+    aws_linked_list_init(&connection->replay.list);
+    aws_linked_list_init(&connection->window.queue);
+    aws_atomic_init_int(&connection->queued_bytes, 0);
+    aws_atomic_init_int(&connection->read_window.pending_holds, 0);
+    aws_atomic_init_int(&connection->read_window.pending_releases, 0);
+    aws_atomic_init_int(&connection->read_window.update_scheduled, false);
+    aws_atomic_init_int(&connection->keep_alive.ping_now_scheduled, false);
+    s_stats_init(connection);
 
     if (aws_mutex_init(&connection->pending_requests.mutex)) {
 
-        AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to initialize pending_requests mutex", (void *)connection);
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT, "id=%p: Failed to initialize pending_requests mutex", (void *)connection);
         goto failed_init_pending_requests_mutex;
     }
 
-    if (aws_mqtt_topic_tree_init(&connection->subscriptions, connection->allocator)) {
+    if (aws_mutex_init(&connection->shared_channel.lock)) {
+
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to initialize shared_channel mutex", (void *)connection);
+        goto failed_init_shared_channel_mutex;
+    }
+
+    if (aws_mutex_init(&connection->stats.ping.lock)) {
+
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to initialize ping stats mutex", (void *)connection);
+        goto failed_init_ping_stats_mutex;
+    }
+
+    if (aws_mqtt_topic_tree_init_arena(&connection->subscriptions, connection->allocator)) {
 
-        AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to initialize subscriptions topic_tree", (void *)connection);
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT, "id=%p: Failed to initialize subscriptions topic_tree", (void *)connection);
         goto failed_init_subscriptions;
     }
 
     if (aws_memory_pool_init(
             &connection->requests_pool, connection->allocator, 32, sizeof(struct aws_mqtt_outstanding_request))) {
 
-        AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to initialize request pool", (void *)connection);
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to initialize request pool", (void *)connection);
         goto failed_init_request_pool;
     }
 
-    if (aws_hash_table_init(
-            &connection->outstanding_requests.table,
-            connection->allocator,
-            sizeof(struct aws_mqtt_outstanding_request *),
-            s_hash_uint16_t,
-            s_uint16_t_eq,
-            NULL,
-            &s_outstanding_request_destroy)) {
+    aws_mqtt_recycle_pool_init(
+        &connection->shared_requests_pool,
+        connection->allocator,
+        sizeof(struct aws_mqtt_outstanding_request),
+        s_recycle_pool_max_cached);
+    s_args_pools_init(connection);
 
-        AWS_LOGF_ERROR(
-            AWS_LS_MQTT_CLIENT, "id=%p: Failed to initialize outstanding requests table", (void *)connection);
-        goto failed_init_outstanding_requests_table;
-    }
+    aws_mqtt_packet_id_table_init(
+        &connection->outstanding_requests, connection->allocator, &s_outstanding_request_destroy);
 
     /* Initialize the handler */
     connection->handler.alloc = connection->allocator;
@@ -396,14 +501,17 @@ struct aws_mqtt_client_connection *aws_mqtt_client_connection_new(struct aws_mqt
 
     return connection;
 
-failed_init_outstanding_requests_table:
-    aws_memory_pool_clean_up(&connection->requests_pool);
-
 failed_init_request_pool:
     aws_mqtt_topic_tree_clean_up(&connection->subscriptions);
 
 failed_init_subscriptions:
-    aws_mutex_clean_up(&connection->outstanding_requests.mutex);
+    aws_mutex_clean_up(&connection->stats.ping.lock);
+
+failed_init_ping_stats_mutex:
+    aws_mutex_clean_up(&connection->shared_channel.lock);
+
+failed_init_shared_channel_mutex:
+    aws_mutex_clean_up(&connection->pending_requests.mutex);
 
 failed_init_pending_requests_mutex:
     aws_mem_release(client->allocator, connection);
@@ -420,7 +528,7 @@ void aws_mqtt_client_connection_destroy(struct aws_mqtt_client_connection *conne
     AWS_ASSERT(connection);
     AWS_ASSERT(connection->state == AWS_MQTT_CLIENT_STATE_DISCONNECTED);
 
-    AWS_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Destroying connection", (void *)connection);
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Destroying connection", (void *)connection);
 
     aws_string_destroy(connection->host_name);
 
@@ -441,18 +549,65 @@ void aws_mqtt_client_connection_destroy(struct aws_mqtt_client_connection *conne
     /* Clear the client_id */
     aws_byte_buf_clean_up(&connection->client_id);
 
+    /* Free the read reassembly buffer */
+    aws_mqtt_packet_framer_clean_up(&connection->framer);
+
+    /* Before the subscriptions, so nothing is still being delivered to them */
+    s_dispatch_clean_up(connection);
+
     /* Free all of the active subscriptions */
     aws_mqtt_topic_tree_clean_up(&connection->subscriptions);
 
     /* Cleanup outstanding requests */
-    aws_hash_table_clean_up(&connection->outstanding_requests.table);
+    aws_mqtt_packet_id_table_clean_up(&connection->outstanding_requests);
+
+    /* Requests parked waiting for a connection have no task left to free them */
+    while (!aws_linked_list_empty(&connection->pending_requests.list)) {
+        struct aws_linked_list_node *current = aws_linked_list_pop_front(&connection->pending_requests.list);
+        struct aws_mqtt_outstanding_request *request =
+            AWS_CONTAINER_OF(current, struct aws_mqtt_outstanding_request, list_node);
+        mqtt_request_release(connection, request);
+    }
+
+    /* Free requests the in-flight window never let through, they were never given a table entry */
+    while (!aws_linked_list_empty(&connection->window.queue)) {
+        struct aws_linked_list_node *current = aws_linked_list_pop_front(&connection->window.queue);
+        struct aws_mqtt_outstanding_request *request =
+            AWS_CONTAINER_OF(current, struct aws_mqtt_outstanding_request, list_node);
+        aws_mqtt_packet_id_allocator_release(&connection->packet_ids, request->message_id);
+        s_request_drop(request);
+        mqtt_request_release(connection, request);
+    }
+
+    /* Free requests submitted from other threads that never reached the channel */
+    struct aws_mqtt_mpsc_queue_node *node = NULL;
+    while ((node = aws_mqtt_mpsc_queue_pop(&connection->submissions.queue))) {
+        struct aws_mqtt_outstanding_request *request =
+            AWS_CONTAINER_OF(node, struct aws_mqtt_outstanding_request, submission_node);
+        aws_mqtt_packet_id_allocator_release(&connection->packet_ids, request->message_id);
+        s_request_drop(request);
+        mqtt_request_release(connection, request);
+    }
     aws_memory_pool_clean_up(&connection->requests_pool);
+    aws_mqtt_recycle_pool_clean_up(&connection->shared_requests_pool);
+    s_args_pools_clean_up(connection);
+
+    /* After the requests, which were reading out of it */
+    s_spool_clean_up(connection);
 
     if (connection->slot) {
         aws_channel_slot_remove(connection->slot);
     }
+    AWS_ASSERT(!connection->shared_channel.channel);
+    aws_mutex_clean_up(&connection->shared_channel.lock);
+    aws_mutex_clean_up(&connection->stats.ping.lock);
     aws_tls_connection_options_clean_up(&connection->tls_options);
 
+    if (connection->group) {
+        aws_mqtt_connection_group_leave(connection);
+        aws_mqtt_connection_group_release(connection->group);
+    }
+
     /* Frees all allocated memory */
     aws_mem_release(connection->allocator, connection);
 }
@@ -468,20 +623,20 @@ int aws_mqtt_client_connection_set_will(
     bool retain,
     const struct aws_byte_cursor *payload) {
 
-    AWS_LOGF_TRACE(
+    AWS_MQTT_LOGF_TRACE(
         AWS_LS_MQTT_CLIENT,
         "id=%p: Setting last will with topic \"" PRInSTR "\"",
         (void *)connection,
         AWS_BYTE_CURSOR_PRI(*topic));
 
     if (!aws_mqtt_is_valid_topic(topic)) {
-        AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Will topic is invalid", (void *)connection);
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Will topic is invalid", (void *)connection);
         return aws_raise_error(AWS_ERROR_MQTT_INVALID_TOPIC);
     }
 
     struct aws_byte_buf topic_buf = aws_byte_buf_from_array(topic->ptr, topic->len);
     if (aws_byte_buf_init_copy(&connection->will.topic, connection->allocator, &topic_buf)) {
-        AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to copy will topic", (void *)connection);
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to copy will topic", (void *)connection);
         goto cleanup;
     }
 
@@ -490,7 +645,7 @@ int aws_mqtt_client_connection_set_will(
 
     struct aws_byte_buf payload_buf = aws_byte_buf_from_array(payload->ptr, payload->len);
     if (aws_byte_buf_init_copy(&connection->will.payload, connection->allocator, &payload_buf)) {
-        AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to copy will body", (void *)connection);
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to copy will body", (void *)connection);
         goto cleanup;
     }
 
@@ -511,18 +666,18 @@ int aws_mqtt_client_connection_set_login(
     AWS_ASSERT(connection);
     AWS_ASSERT(username);
 
-    AWS_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: Setting username and password", (void *)connection);
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: Setting username and password", (void *)connection);
 
     connection->username = aws_string_new_from_array(connection->allocator, username->ptr, username->len);
     if (!connection->username) {
-        AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to copy username", (void *)connection);
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to copy username", (void *)connection);
         return AWS_OP_ERR;
     }
 
     if (password) {
         connection->password = aws_string_new_from_array(connection->allocator, password->ptr, password->len);
         if (!connection->password) {
-            AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to copy password", (void *)connection);
+            AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to copy password", (void *)connection);
             aws_string_destroy(connection->username);
             return AWS_OP_ERR;
         }
@@ -538,7 +693,7 @@ int aws_mqtt_client_connection_set_reconnect_timeout(
 
     AWS_ASSERT(connection);
 
-    AWS_LOGF_TRACE(
+    AWS_MQTT_LOGF_TRACE(
         AWS_LS_MQTT_CLIENT,
         "id=%p: Setting reconnect timeouts min: %" PRIu64 " max: %" PRIu64,
         (void *)connection,
@@ -551,6 +706,24 @@ int aws_mqtt_client_connection_set_reconnect_timeout(
     return AWS_OP_SUCCESS;
 }
 
+int aws_mqtt_client_connection_set_reconnect_backoff(
+    struct aws_mqtt_client_connection *connection,
+    enum aws_mqtt_reconnect_backoff backoff) {
+
+    AWS_ASSERT(connection);
+
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: Setting reconnect backoff %d", (void *)connection, (int)backoff);
+
+    if (backoff != AWS_MQTT_RECONNECT_BACKOFF_EXPONENTIAL &&
+        backoff != AWS_MQTT_RECONNECT_BACKOFF_DECORRELATED_JITTER) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    connection->reconnect_timeouts.backoff = backoff;
+
+    return AWS_OP_SUCCESS;
+}
+
 int aws_mqtt_client_connection_set_connection_interruption_handlers(
     struct aws_mqtt_client_connection *connection,
     aws_mqtt_client_on_connection_interrupted_fn *on_interrupted,
@@ -558,7 +731,7 @@ int aws_mqtt_client_connection_set_connection_interruption_handlers(
     aws_mqtt_client_on_connection_resumed_fn *on_resumed,
     void *on_resumed_ud) {
 
-    AWS_LOGF_TRACE(
+    AWS_MQTT_LOGF_TRACE(
         AWS_LS_MQTT_CLIENT, "id=%p: Setting connection interrupted and resumed handlers", (void *)connection);
 
     connection->on_interrupted = on_interrupted;
@@ -569,15 +742,56 @@ int aws_mqtt_client_connection_set_connection_interruption_handlers(
     return AWS_OP_SUCCESS;
 }
 
+int aws_mqtt_client_connection_set_on_window_available_handler(
+    struct aws_mqtt_client_connection *connection,
+    aws_mqtt_client_on_window_available_fn *on_window_available,
+    void *on_window_available_ud) {
+
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: Setting window available handler", (void *)connection);
+
+    connection->on_window_available = on_window_available;
+    connection->on_window_available_ud = on_window_available_ud;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_mqtt_client_connection_hold_read_window(struct aws_mqtt_client_connection *connection, size_t size) {
+
+    AWS_ASSERT(connection);
+
+    mqtt_read_window_hold(connection, size);
+    return AWS_OP_SUCCESS;
+}
+
+int aws_mqtt_client_connection_release_read_window(struct aws_mqtt_client_connection *connection, size_t size) {
+
+    AWS_ASSERT(connection);
+
+    mqtt_read_window_release(connection, size);
+    return AWS_OP_SUCCESS;
+}
+
 /*******************************************************************************
  * Connect
  ******************************************************************************/
 
+static void s_apply_publish_match_cache_size(struct aws_mqtt_client_connection *connection) {
+
+    if (aws_mqtt_topic_tree_set_match_cache_size(&connection->subscriptions, connection->publish_match_cache_size)) {
+        /* Publishes are still matched without it, just not as quickly */
+        AWS_MQTT_LOGF_WARN(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Failed to create publish match cache, error %d",
+            (void *)connection,
+            aws_last_error());
+    }
+}
+
 int aws_mqtt_client_connection_connect(
     struct aws_mqtt_client_connection *connection,
     const struct aws_mqtt_connection_options *connection_options) {
 
-    AWS_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: Opening connection", (void *)connection);
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: Opening connection", (void *)connection);
 
     if (connection->state != AWS_MQTT_CLIENT_STATE_DISCONNECTED) {
         return aws_raise_error(AWS_ERROR_MQTT_ALREADY_CONNECTED);
@@ -593,21 +807,46 @@ int aws_mqtt_client_connection_connect(
     connection->socket_options = *connection_options->socket_options;
     connection->state = AWS_MQTT_CLIENT_STATE_CONNECTING;
     connection->clean_session = connection_options->clean_session;
+    connection->auto_resubscribe = connection_options->auto_resubscribe;
+    connection->resubscribe_max_remaining_length = s_max_remaining_length;
+    if (connection_options->resubscribe_max_packet_size) {
+        /* Leave room for the largest fixed header, and at least the packet id */
+        const size_t max_packet_size = connection_options->resubscribe_max_packet_size;
+        connection->resubscribe_max_remaining_length = max_packet_size > 7 ? max_packet_size - 5 : 2;
+        if (connection->resubscribe_max_remaining_length > s_max_remaining_length) {
+            connection->resubscribe_max_remaining_length = s_max_remaining_length;
+        }
+    }
     connection->keep_alive_time_secs = connection_options->keep_alive_time_secs;
     connection->connection_count = 0;
+    connection->write_batch.max_bytes = connection_options->write_batch_max_bytes;
+    connection->write_batch.max_delay_ns = aws_timestamp_convert(
+        (uint64_t)connection_options->write_batch_max_delay_ms, AWS_TIMESTAMP_MILLIS, AWS_TIMESTAMP_NANOS, NULL);
+    connection->publish_match_cache_size = connection_options->publish_match_cache_size;
+    connection->window.max = connection_options->max_in_flight_publishes;
+    connection->replay.burst_size = connection_options->replay_burst_size;
+    connection->replay.burst_interval_ns = aws_timestamp_convert(
+        (uint64_t)connection_options->replay_burst_interval_ms, AWS_TIMESTAMP_MILLIS, AWS_TIMESTAMP_NANOS, NULL);
+    connection->read_window.initial = connection_options->read_window_initial_bytes;
+    connection->read_window.max = connection_options->read_window_max_bytes > connection->read_window.initial
+                                      ? connection_options->read_window_max_bytes
+                                      : connection->read_window.initial;
+    s_apply_publish_match_cache_size(connection);
 
     if (!connection_options->ping_timeout_ms) {
         connection->request_timeout_ns = s_default_request_timeout_ns;
+        connection->keep_alive.timeout_ns = 0;
     } else {
         connection->request_timeout_ns = aws_timestamp_convert(
             (uint64_t)connection_options->ping_timeout_ms, AWS_TIMESTAMP_MILLIS, AWS_TIMESTAMP_NANOS, NULL);
+        connection->keep_alive.timeout_ns = connection->request_timeout_ns;
     }
 
     /* Cheat and set the tls_options host_name to our copy if they're the same */
     if (connection_options->tls_options) {
         if (aws_tls_connection_options_copy(&connection->tls_options, connection_options->tls_options)) {
 
-            AWS_LOGF_ERROR(
+            AWS_MQTT_LOGF_ERROR(
                 AWS_LS_MQTT_CLIENT, "id=%p: Failed to copy TLS Connection Options into connection", (void *)connection);
             return AWS_OP_ERR;
         }
@@ -617,7 +856,7 @@ int aws_mqtt_client_connection_connect(
             if (aws_tls_connection_options_set_server_name(
                     &connection->tls_options, connection->allocator, &host_name_cur)) {
 
-                AWS_LOGF_ERROR(
+                AWS_MQTT_LOGF_ERROR(
                     AWS_LS_MQTT_CLIENT, "id=%p: Failed to set TLS Connection Options server name", (void *)connection);
                 goto error;
             }
@@ -636,7 +875,7 @@ int aws_mqtt_client_connection_connect(
     AWS_ASSERT(!connection->reconnect_task);
     connection->reconnect_task = aws_mem_acquire(connection->allocator, sizeof(struct aws_mqtt_reconnect_task));
     if (!connection->reconnect_task) {
-        AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to allocate reconnect task", (void *)connection);
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to allocate reconnect task", (void *)connection);
         goto error;
     }
     aws_atomic_init_ptr(&connection->reconnect_task->connection_ptr, connection);
@@ -647,7 +886,7 @@ int aws_mqtt_client_connection_connect(
     struct aws_byte_buf client_id_buf =
         aws_byte_buf_from_array(connection_options->client_id.ptr, connection_options->client_id.len);
     if (aws_byte_buf_init_copy(&connection->client_id, connection->allocator, &client_id_buf)) {
-        AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to copy client_id into connection", (void *)connection);
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to copy client_id into connection", (void *)connection);
         goto client_id_alloc_failed;
     }
 
@@ -682,11 +921,14 @@ int aws_mqtt_client_connection_reconnect(
     connection->on_connection_complete = on_connection_complete;
     connection->on_connection_complete_ud = userdata;
 
-    if (connection->clean_session) {
+    const bool resubscribing =
+        connection->auto_resubscribe && connection->state == AWS_MQTT_CLIENT_STATE_RECONNECTING;
+    if (connection->clean_session && !resubscribing) {
         /* If clean_session is set, all subscriptions will be reset by the server,
         so we can clean the local tree out too. */
         aws_mqtt_topic_tree_clean_up(&connection->subscriptions);
-        aws_mqtt_topic_tree_init(&connection->subscriptions, connection->allocator);
+        aws_mqtt_topic_tree_init_arena(&connection->subscriptions, connection->allocator);
+        s_apply_publish_match_cache_size(connection);
     }
 
     int result = 0;
@@ -712,7 +954,7 @@ int aws_mqtt_client_connection_reconnect(
     }
     if (result) {
         /* Connection attempt failed */
-        AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to begin connection routine", (void *)connection);
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Failed to begin connection routine", (void *)connection);
         return AWS_OP_ERR;
     }
 
@@ -731,7 +973,7 @@ int aws_mqtt_client_connection_disconnect(
     if (connection->state == AWS_MQTT_CLIENT_STATE_CONNECTED ||
         connection->state == AWS_MQTT_CLIENT_STATE_RECONNECTING) {
 
-        AWS_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Closing connection", (void *)connection);
+        AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Closing connection", (void *)connection);
 
         connection->on_disconnect = on_disconnect;
         connection->on_disconnect_ud = userdata;
@@ -742,7 +984,7 @@ int aws_mqtt_client_connection_disconnect(
         return AWS_OP_SUCCESS;
     }
 
-    AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Connection is not open, and may not be closed", (void *)connection);
+    AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Connection is not open, and may not be closed", (void *)connection);
     return aws_raise_error(AWS_ERROR_MQTT_NOT_CONNECTED);
 }
 
@@ -750,14 +992,49 @@ int aws_mqtt_client_connection_disconnect(
  * Subscribe
  ******************************************************************************/
 
-/* The lifetime of this struct is the same as the lifetime of the subscription */
+/* The lifetime of this struct is the same as the lifetime of the subscription, and of anything dispatched to it */
 struct subscribe_task_topic {
     struct aws_mqtt_client_connection *connection;
 
     struct aws_mqtt_topic_subscription request;
     struct aws_string *filter;
+
+    /* One for the tree, and one while dispatched publishes are being handled */
+    struct aws_atomic_var ref_count;
+    /* dispatch_delivery waiting for this subscription, guarded by the connection's dispatch lock */
+    struct aws_linked_list deliveries;
+    /* Set while deliveries are being handled, guarded by the connection's dispatch lock */
+    bool dispatch_scheduled;
+    /* Handles deliveries when the connection's thread pool is the executor */
+    struct aws_mqtt_thread_pool_job dispatch_job;
 };
 
+static void s_dispatch_run_job(struct aws_mqtt_thread_pool_job *job);
+
+static void s_task_topic_init(struct subscribe_task_topic *task_topic, struct aws_mqtt_client_connection *connection) {
+
+    task_topic->connection = connection;
+    aws_atomic_init_int(&task_topic->ref_count, 1);
+    aws_linked_list_init(&task_topic->deliveries);
+    task_topic->dispatch_scheduled = false;
+    task_topic->dispatch_job.fn = s_dispatch_run_job;
+}
+
+static void s_task_topic_release(struct subscribe_task_topic *task_topic) {
+
+    if (aws_atomic_fetch_sub(&task_topic->ref_count, 1) != 1) {
+        return;
+    }
+
+    if (task_topic->request.on_cleanup) {
+        task_topic->request.on_cleanup(task_topic->request.on_publish_ud);
+    }
+
+    /* The tree has its own copy of the filter, this one is only used by the requests */
+    aws_string_destroy(task_topic->filter);
+    aws_mem_release(task_topic->connection->allocator, task_topic);
+}
+
 /* The lifetime of this struct is from subscribe -> suback */
 struct subscribe_task_arg {
 
@@ -789,13 +1066,8 @@ static void s_on_publish_client_wrapper(
 
 static void s_on_topic_clean_up(void *userdata) {
 
-    struct subscribe_task_topic *task_topic = userdata;
-
-    if (task_topic->request.on_cleanup) {
-        task_topic->request.on_cleanup(task_topic->request.on_publish_ud);
-    }
-
-    aws_mem_release(task_topic->connection->allocator, task_topic);
+    /* Anything still dispatched to it keeps it around */
+    s_task_topic_release(userdata);
 }
 
 static enum aws_mqtt_client_request_state s_subscribe_send(uint16_t message_id, bool is_first_attempt, void *userdata) {
@@ -804,9 +1076,9 @@ static enum aws_mqtt_client_request_state s_subscribe_send(uint16_t message_id,
 
     struct subscribe_task_arg *task_arg = userdata;
     bool initing_packet = task_arg->subscribe.fixed_header.packet_type == 0;
-    struct aws_io_message *message = NULL;
+    struct aws_byte_buf *buf = NULL;
 
-    AWS_LOGF_TRACE(
+    AWS_MQTT_LOGF_TRACE(
         AWS_LS_MQTT_CLIENT,
         "id=%p: Attempting send of subscribe %" PRIu16 " (%s)",
         (void *)task_arg->connection,
@@ -835,7 +1107,19 @@ static enum aws_mqtt_client_request_state s_subscribe_send(uint16_t message_id,
         (void)result;
 
         if (initing_packet) {
-            if (aws_mqtt_packet_subscribe_add_topic(&task_arg->subscribe, topic->request.topic, topic->request.qos)) {
+            /* A filter someone else is subscribed to already is shared, but only once the server has granted it at
+             * the QoS this asks for. Otherwise this waits on a SUBACK of its own, and fails if the last one did. */
+            const struct aws_mqtt_topic_node *existing =
+                aws_mqtt_topic_tree_find(&task_arg->connection->subscriptions, &topic->request.topic);
+            if (existing && existing->granted && existing->granted_qos >= topic->request.qos) {
+                AWS_MQTT_LOGF_DEBUG(
+                    AWS_LS_MQTT_CLIENT,
+                    "id=%p: Topic filter \"" PRInSTR "\" is already subscribed to, sharing it",
+                    (void *)task_arg->connection,
+                    AWS_BYTE_CURSOR_PRI(topic->request.topic));
+
+            } else if (aws_mqtt_packet_subscribe_add_topic(
+                           &task_arg->subscribe, topic->request.topic, topic->request.qos)) {
                 goto handle_error;
             }
         }
@@ -855,19 +1139,35 @@ static enum aws_mqtt_client_request_state s_subscribe_send(uint16_t message_id,
         }
     }
 
-    message = mqtt_get_message_for_packet(task_arg->connection, &task_arg->subscribe.fixed_header);
-    if (!message) {
+    if (!aws_array_list_length(&task_arg->subscribe.topic_filters)) {
+        /* Every filter was shared, so there's nothing for the server to do */
+        aws_mqtt_topic_tree_transaction_commit(&task_arg->connection->subscriptions, &transaction);
+        task_arg->tree_updated = true;
+
+        aws_array_list_clean_up(&transaction);
+        return AWS_MQTT_CLIENT_REQUEST_COMPLETE;
+    }
+
+    buf = mqtt_packet_write_begin(task_arg->connection, &task_arg->subscribe.fixed_header);
+    if (!buf) {
 
         goto handle_error;
     }
 
-    if (aws_mqtt_packet_subscribe_encode(&message->message_data, &task_arg->subscribe)) {
+    if (aws_mqtt_packet_subscribe_encode(buf, &task_arg->subscribe)) {
 
         goto handle_error;
     }
 
-    /* No need to handle this error, if the send fails, it'll just retry */
-    aws_channel_slot_send_message(task_arg->connection->slot, message, AWS_CHANNEL_DIR_WRITE);
+    /* Nothing has gone to the server, so the tree mustn't say it has */
+    if (mqtt_packet_write_end(task_arg->connection)) {
+
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Failed to send encoded SUBSCRIBE packet upstream",
+            (void *)task_arg->connection);
+        goto handle_error;
+    }
 
     if (!task_arg->tree_updated) {
         aws_mqtt_topic_tree_transaction_commit(&task_arg->connection->subscriptions, &transaction);
@@ -879,9 +1179,7 @@ static enum aws_mqtt_client_request_state s_subscribe_send(uint16_t message_id,
 
 handle_error:
 
-    if (message) {
-        aws_mem_release(message->allocator, message);
-    }
+    mqtt_packet_write_abort(task_arg->connection);
     if (!task_arg->tree_updated) {
         aws_mqtt_topic_tree_transaction_roll_back(&task_arg->connection->subscriptions, &transaction);
     }
@@ -898,7 +1196,7 @@ static void s_subscribe_complete(
 
     struct subscribe_task_arg *task_arg = userdata;
 
-    AWS_LOGF_DEBUG(
+    AWS_MQTT_LOGF_DEBUG(
         AWS_LS_MQTT_CLIENT,
         "id=%p: Subscribe %" PRIu16 " completed with error_code %d",
         (void *)connection,
@@ -938,7 +1236,7 @@ uint16_t aws_mqtt_client_connection_subscribe_multiple(
         goto handle_error;
     }
 
-    AWS_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Starting multi-topic subscribe", (void *)connection);
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Starting multi-topic subscribe", (void *)connection);
 
     for (size_t i = 0; i < num_topics; ++i) {
 
@@ -956,7 +1254,7 @@ uint16_t aws_mqtt_client_connection_subscribe_multiple(
             goto handle_error;
         }
 
-        task_topic->connection = connection;
+        s_task_topic_init(task_topic, connection);
         task_topic->request = *request;
 
         task_topic->filter = aws_string_new_from_array(
@@ -969,20 +1267,21 @@ uint16_t aws_mqtt_client_connection_subscribe_multiple(
         /* Update request topic cursor to refer to owned string */
         task_topic->request.topic = aws_byte_cursor_from_string(task_topic->filter);
 
-        AWS_LOGF_DEBUG(
+        AWS_MQTT_LOGF_DEBUG(
             AWS_LS_MQTT_CLIENT,
             "id=%p:     Adding topic \"" PRInSTR "\"",
             (void *)connection,
             AWS_BYTE_CURSOR_PRI(task_topic->request.topic));
 
         /* Push into the list */
-        aws_array_list_push_back(&task_arg->topics, &request);
+        aws_array_list_push_back(&task_arg->topics, &task_topic);
     }
 
-    uint16_t packet_id =
-        mqtt_create_request(task_arg->connection, &s_subscribe_send, task_arg, &s_subscribe_complete, task_arg);
+    uint16_t packet_id = mqtt_create_request(
+        task_arg->connection, &s_subscribe_send, task_arg, &s_subscribe_complete, task_arg, false, 0);
 
-    AWS_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Sending multi-topic subscribe %" PRIu16, (void *)connection, packet_id);
+    AWS_MQTT_LOGF_DEBUG(
+        AWS_LS_MQTT_CLIENT, "id=%p: Sending multi-topic subscribe %" PRIu16, (void *)connection, packet_id);
 
     if (packet_id) {
         return packet_id;
@@ -1024,7 +1323,7 @@ static void s_subscribe_single_complete(
 
     struct subscribe_task_arg *task_arg = userdata;
 
-    AWS_LOGF_DEBUG(
+    AWS_MQTT_LOGF_DEBUG(
         AWS_LS_MQTT_CLIENT,
         "id=%p: Subscribe %" PRIu16 " completed with error code %d",
         (void *)connection,
@@ -1045,7 +1344,7 @@ static void s_subscribe_single_complete(
 
     aws_array_list_clean_up(&task_arg->topics);
     aws_mqtt_packet_subscribe_clean_up(&task_arg->subscribe);
-    aws_mem_release(task_arg->connection->allocator, task_arg);
+    aws_mqtt_recycle_pool_release(&connection->args_pools.subscribe, task_arg);
 }
 
 uint16_t aws_mqtt_client_connection_subscribe(
@@ -1067,20 +1366,14 @@ uint16_t aws_mqtt_client_connection_subscribe(
 
     /* Because we know we're only going to have 1 topic, we can cheat and allocate the array_list in the same block as
      * the task argument. */
-    void *task_topic_storage = NULL;
     struct subscribe_task_topic *task_topic = NULL;
-    struct subscribe_task_arg *task_arg = aws_mem_acquire_many(
-        connection->allocator,
-        2,
-        &task_arg,
-        sizeof(struct subscribe_task_arg),
-        &task_topic_storage,
-        sizeof(struct subscribe_task_topic));
+    struct subscribe_task_arg *task_arg = aws_mqtt_recycle_pool_acquire(&connection->args_pools.subscribe);
 
     if (!task_arg) {
         goto handle_error;
     }
     AWS_ZERO_STRUCT(*task_arg);
+    void *task_topic_storage = task_arg + 1;
 
     task_arg->connection = connection;
     task_arg->on_suback = (aws_mqtt_suback_multi_fn *)on_suback;
@@ -1088,7 +1381,8 @@ uint16_t aws_mqtt_client_connection_subscribe(
 
     aws_array_list_init_static(&task_arg->topics, task_topic_storage, 1, sizeof(void *));
 
-    /* Allocate the topic and push into the list */
+    /* Allocate the topic and push into the list. Unlike the arg, the topic and its filter copy aren't pooled: they're
+     * owned by the topic tree and outlive the request, until the subscription is removed. */
     task_topic = aws_mem_acquire(connection->allocator, sizeof(struct subscribe_task_topic));
     if (!task_topic) {
         goto handle_error;
@@ -1100,20 +1394,17 @@ uint16_t aws_mqtt_client_connection_subscribe(
         goto handle_error;
     }
 
-    task_topic->connection = connection;
+    s_task_topic_init(task_topic, connection);
     task_topic->request.topic = aws_byte_cursor_from_string(task_topic->filter);
     task_topic->request.qos = qos;
     task_topic->request.on_publish = on_publish;
     task_topic->request.on_cleanup = on_ud_cleanup;
     task_topic->request.on_publish_ud = on_publish_ud;
 
-    /* Update request topic cursor to refer to owned string */
-    task_topic->request.topic = aws_byte_cursor_from_string(task_topic->filter);
-
-    uint16_t packet_id =
-        mqtt_create_request(task_arg->connection, &s_subscribe_send, task_arg, &s_subscribe_single_complete, task_arg);
+    uint16_t packet_id = mqtt_create_request(
+        task_arg->connection, &s_subscribe_send, task_arg, &s_subscribe_single_complete, task_arg, false, 0);
 
-    AWS_LOGF_DEBUG(
+    AWS_MQTT_LOGF_DEBUG(
         AWS_LS_MQTT_CLIENT,
         "id=%p: Starting subscribe %" PRIu16 " on topic " PRInSTR,
         (void *)connection,
@@ -1135,261 +1426,1680 @@ handle_error:
 
     if (task_arg) {
 
-        aws_mem_release(connection->allocator, task_arg);
+        aws_mqtt_recycle_pool_release(&connection->args_pools.subscribe, task_arg);
     }
     return 0;
 }
 
 /*******************************************************************************
- * Unsubscribe
+ * Dispatch
  ******************************************************************************/
 
-struct unsubscribe_task_arg {
-    struct aws_mqtt_client_connection *connection;
-    struct aws_byte_cursor filter;
-    /* Packet to populate */
-    struct aws_mqtt_packet_unsubscribe unsubscribe;
+/* Subscriptions commonly matched by one publish, any more are collected on the heap */
+enum { S_DISPATCH_INLINE_MATCHES = 16 };
 
-    /* true if transaction was committed to the topic tree, false requires a retry */
-    bool tree_updated;
+/* Publishes a subscription handles in one go before letting others have the thread */
+static const size_t s_dispatch_max_batch = 32;
 
-    aws_mqtt_op_complete_fn *on_unsuback;
-    void *on_unsuback_ud;
+/* A received publish, copied once for every subscription it matched. Allocated along with its deliveries. */
+struct dispatch_publish {
+    struct aws_mqtt_client_connection *connection;
+    /* Deliveries not yet handled */
+    struct aws_atomic_var ref_count;
+    struct aws_byte_cursor topic;
+    struct aws_byte_cursor payload;
+    /* Sent once every delivery is handled, if the ack policy waits for them. Otherwise packet_identifier is 0. */
+    struct aws_mqtt_packet_ack ack;
+    /* The connection_count it arrived in, the ack means nothing to any later connection */
+    size_t connection_count;
+    /* In the connection's dispatch acks queue, once every delivery is handled */
+    struct aws_mqtt_mpsc_queue_node ack_node;
 };
 
-static enum aws_mqtt_client_request_state s_unsubscribe_send(
-    uint16_t message_id,
-    bool is_first_attempt,
-    void *userdata) {
-
-    (void)is_first_attempt;
-
-    struct unsubscribe_task_arg *task_arg = userdata;
-    struct aws_io_message *message = NULL;
+/* A publish waiting in one subscription's deliveries */
+struct dispatch_delivery {
+    struct aws_linked_list_node node;
+    struct dispatch_publish *publish;
+};
 
-    AWS_LOGF_TRACE(
-        AWS_LS_MQTT_CLIENT,
-        "id=%p: Attempting send of unsubscribe %" PRIu16 " %s",
-        (void *)task_arg->connection,
-        message_id,
-        is_first_attempt ? "first attempt" : "resend");
+static void s_dispatch_acks_drain_task(struct aws_channel_task *task, void *arg, enum aws_task_status status) {
 
-    static const size_t num_topics = 1;
+    (void)task;
 
-    AWS_VARIABLE_LENGTH_ARRAY(uint8_t, transaction_buf, num_topics * aws_mqtt_topic_tree_action_size);
-    struct aws_array_list transaction;
-    aws_array_list_init_static(&transaction, transaction_buf, num_topics, aws_mqtt_topic_tree_action_size);
+    struct aws_mqtt_client_connection *connection = arg;
 
-    if (!task_arg->tree_updated) {
+    /* Clear the flag before draining, so anything pushed from here on schedules the next run */
+    aws_atomic_store_int(&connection->dispatch.acks_drain_scheduled, false);
 
-        if (aws_mqtt_topic_tree_transaction_remove(
-                &task_arg->connection->subscriptions, &transaction, &task_arg->filter)) {
-            goto handle_error;
-        }
+    /* If cancelled, the channel is going away. Leave the queue for the next CONNACK to drop. */
+    if (status == AWS_TASK_STATUS_RUN_READY) {
+        mqtt_dispatch_send_acks(connection);
     }
+}
 
-    if (task_arg->unsubscribe.fixed_header.packet_type == 0) {
-        /* If unsubscribe packet is uninitialized, init it */
-        if (aws_mqtt_packet_unsubscribe_init(&task_arg->unsubscribe, task_arg->connection->allocator, message_id)) {
-            goto handle_error;
-        }
-        if (aws_mqtt_packet_unsubscribe_add_topic(&task_arg->unsubscribe, task_arg->filter)) {
-            goto handle_error;
-        }
-    }
+static void s_dispatch_publish_release(struct dispatch_publish *dispatched) {
 
-    message = mqtt_get_message_for_packet(task_arg->connection, &task_arg->unsubscribe.fixed_header);
-    if (!message) {
-        goto handle_error;
+    if (aws_atomic_fetch_sub(&dispatched->ref_count, 1) != 1) {
+        return;
     }
 
-    if (aws_mqtt_packet_unsubscribe_encode(&message->message_data, &task_arg->unsubscribe)) {
-        aws_mem_release(message->allocator, message);
-        goto handle_error;
+    struct aws_mqtt_client_connection *connection = dispatched->connection;
+    mqtt_read_window_release(connection, dispatched->payload.len);
+    if (!dispatched->ack.packet_identifier) {
+        aws_mem_release(connection->allocator, dispatched);
+        return;
     }
 
-    aws_channel_slot_send_message(task_arg->connection->slot, message, AWS_CHANNEL_DIR_WRITE);
+    /* Every callback has returned, so the channel's thread can ack it now. If the connection was lost meanwhile, the
+     * ack is dropped and the server resends the publish. */
+    aws_mqtt_mpsc_queue_push(&connection->dispatch.acks, &dispatched->ack_node);
+    mqtt_schedule_task_once(
+        connection,
+        &connection->dispatch.acks_drain_scheduled,
+        &connection->dispatch.acks_drain_task,
+        s_dispatch_acks_drain_task,
+        0);
+}
 
-    if (!task_arg->tree_updated) {
-        aws_mqtt_topic_tree_transaction_commit(&task_arg->connection->subscriptions, &transaction);
-        task_arg->tree_updated = true;
-    }
+static void s_dispatch_run(void *arg);
 
-    aws_array_list_clean_up(&transaction);
-    return AWS_MQTT_CLIENT_REQUEST_ONGOING;
+/* Hand a subscription's deliveries to the executor */
+static int s_dispatch_submit(struct subscribe_task_topic *task_topic) {
 
-handle_error:
+    struct aws_mqtt_client_connection *connection = task_topic->connection;
 
-    if (message) {
-        aws_mem_release(message->allocator, message);
+    if (!connection->dispatch.executor) {
+        aws_mqtt_thread_pool_submit(&connection->dispatch.pool, &task_topic->dispatch_job);
+        return AWS_OP_SUCCESS;
     }
-    if (!task_arg->tree_updated) {
-        aws_mqtt_topic_tree_transaction_roll_back(&task_arg->connection->subscriptions, &transaction);
+
+    if (connection->dispatch.executor(s_dispatch_run, task_topic, connection->dispatch.executor_ud)) {
+        AWS_MQTT_LOGF_WARN(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Dispatch executor failed with error %d, delivering publishes on the calling thread",
+            (void *)connection,
+            aws_last_error());
+        return AWS_OP_ERR;
     }
 
-    aws_array_list_clean_up(&transaction);
-    return AWS_MQTT_CLIENT_REQUEST_ERROR;
+    return AWS_OP_SUCCESS;
 }
 
-static void s_unsubscribe_complete(
-    struct aws_mqtt_client_connection *connection,
-    uint16_t packet_id,
-    int error_code,
-    void *userdata) {
+/* Handle a subscription's deliveries in order, on the executor's thread */
+static void s_dispatch_run(void *arg) {
 
-    struct unsubscribe_task_arg *task_arg = userdata;
+    struct subscribe_task_topic *task_topic = arg;
+    struct aws_mqtt_client_connection *connection = task_topic->connection;
 
-    AWS_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Unsubscribe %" PRIu16 " complete", (void *)connection, packet_id);
+    size_t handled = 0;
+    for (;;) {
+        aws_mutex_lock(&connection->dispatch.lock);
+        if (aws_linked_list_empty(&task_topic->deliveries)) {
+            task_topic->dispatch_scheduled = false;
+            aws_mutex_unlock(&connection->dispatch.lock);
+            break;
+        }
 
-    if (task_arg->on_unsuback) {
-        task_arg->on_unsuback(connection, packet_id, error_code, task_arg->on_unsuback_ud);
+        if (handled == s_dispatch_max_batch) {
+            aws_mutex_unlock(&connection->dispatch.lock);
+
+            /* Still scheduled, so the channel's thread won't start another run meanwhile */
+            if (s_dispatch_submit(task_topic) == AWS_OP_SUCCESS) {
+                return;
+            }
+            handled = 0;
+            continue;
+        }
+
+        struct dispatch_delivery *delivery = AWS_CONTAINER_OF(
+            aws_linked_list_pop_front(&task_topic->deliveries), struct dispatch_delivery, node);
+        aws_mutex_unlock(&connection->dispatch.lock);
+
+        struct dispatch_publish *dispatched = delivery->publish;
+        task_topic->request.on_publish(
+            connection, &dispatched->topic, &dispatched->payload, task_topic->request.on_publish_ud);
+        s_dispatch_publish_release(dispatched);
+        ++handled;
     }
 
-    aws_mqtt_packet_unsubscribe_clean_up(&task_arg->unsubscribe);
-    aws_mem_release(task_arg->connection->allocator, task_arg);
+    /* Last, destroy may go ahead as soon as in_flight is 0 */
+    s_task_topic_release(task_topic);
+    aws_atomic_fetch_sub(&connection->dispatch.in_flight, 1);
 }
 
-uint16_t aws_mqtt_client_connection_unsubscribe(
+static void s_dispatch_run_job(struct aws_mqtt_thread_pool_job *job) {
+    s_dispatch_run(AWS_CONTAINER_OF(job, struct subscribe_task_topic, dispatch_job));
+}
+
+int mqtt_dispatch_publish(
     struct aws_mqtt_client_connection *connection,
-    const struct aws_byte_cursor *topic_filter,
-    aws_mqtt_op_complete_fn *on_unsuback,
-    void *on_unsuback_ud) {
+    const struct aws_mqtt_packet_publish *publish,
+    const struct aws_mqtt_packet_ack *ack,
+    bool *ack_deferred) {
+
+    AWS_ASSERT(connection->dispatch.enabled);
+
+    *ack_deferred = false;
+
+    const struct aws_mqtt_topic_node *inline_matches[S_DISPATCH_INLINE_MATCHES];
+    const struct aws_mqtt_topic_node **matches = inline_matches;
+    size_t match_count = 0;
+    /* The subscribers that have to start running */
+    struct subscribe_task_topic *inline_starts[S_DISPATCH_INLINE_MATCHES];
+    struct subscribe_task_topic **starts = inline_starts;
+    if (aws_mqtt_topic_tree_collect_matches(
+            &connection->subscriptions, &publish->topic_name, matches, S_DISPATCH_INLINE_MATCHES, &match_count)) {
+        return AWS_OP_ERR;
+    }
+    if (!match_count) {
+        return AWS_OP_SUCCESS;
+    }
 
-    AWS_ASSERT(connection);
+    if (match_count > S_DISPATCH_INLINE_MATCHES) {
+        matches = aws_mem_acquire(connection->allocator, sizeof(*matches) * match_count);
+        if (!matches) {
+            return AWS_OP_ERR;
+        }
+        if (aws_mqtt_topic_tree_collect_matches(
+                &connection->subscriptions, &publish->topic_name, matches, match_count, &match_count)) {
+            goto error;
+        }
+    }
 
-    if (!aws_mqtt_is_valid_topic_filter(topic_filter)) {
-        aws_raise_error(AWS_ERROR_MQTT_INVALID_TOPIC);
-        return 0;
+    /* Every subscriber sharing a matched filter gets its own delivery */
+    size_t subscriber_count = 0;
+    for (size_t i = 0; i < match_count; ++i) {
+        subscriber_count += matches[i]->subscriber_count;
     }
 
-    struct unsubscribe_task_arg *task_arg = aws_mem_acquire(connection->allocator, sizeof(struct unsubscribe_task_arg));
-    if (!task_arg) {
-        return 0;
+    if (subscriber_count > S_DISPATCH_INLINE_MATCHES) {
+        starts = aws_mem_acquire(connection->allocator, sizeof(*starts) * subscriber_count);
+        if (!starts) {
+            goto error;
+        }
     }
-    AWS_ZERO_STRUCT(*task_arg);
-    task_arg->connection = connection;
-    task_arg->filter = *topic_filter;
-    task_arg->on_unsuback = on_unsuback;
-    task_arg->on_unsuback_ud = on_unsuback_ud;
 
-    uint16_t packet_id =
-        mqtt_create_request(connection, &s_unsubscribe_send, task_arg, s_unsubscribe_complete, task_arg);
+    struct dispatch_publish *dispatched = NULL;
+    struct dispatch_delivery *deliveries = NULL;
+    uint8_t *data = NULL;
+    if (!aws_mem_acquire_many(
+            connection->allocator,
+            3,
+            &dispatched,
+            sizeof(struct dispatch_publish),
+            &deliveries,
+            sizeof(struct dispatch_delivery) * subscriber_count,
+            &data,
+            publish->topic_name.len + publish->payload.len)) {
+        goto error;
+    }
 
-    AWS_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Starting unsubscribe %" PRIu16, (void *)connection, packet_id);
+    dispatched->connection = connection;
+    aws_atomic_init_int(&dispatched->ref_count, subscriber_count);
+    memcpy(data, publish->topic_name.ptr, publish->topic_name.len);
+    dispatched->topic = aws_byte_cursor_from_array(data, publish->topic_name.len);
+    if (publish->payload.len) {
+        memcpy(data + publish->topic_name.len, publish->payload.ptr, publish->payload.len);
+    }
+    dispatched->payload = aws_byte_cursor_from_array(data + publish->topic_name.len, publish->payload.len);
+    dispatched->connection_count = connection->connection_count;
+    AWS_ZERO_STRUCT(dispatched->ack);
+    if (connection->dispatch.ack_policy == AWS_MQTT_DISPATCH_ACK_ON_COMPLETE && ack->packet_identifier) {
+        /* A resend turning up meanwhile waits on this PUBREC, see mqtt_dispatch_defer_duplicate_ack */
+        if (ack->fixed_header.packet_type == AWS_MQTT_PACKET_PUBREC &&
+            aws_mqtt_packet_id_table_put(&connection->dispatch.unacked_qos2, ack->packet_identifier, dispatched)) {
+            aws_mem_release(connection->allocator, dispatched);
+            goto error;
+        }
+        dispatched->ack = *ack;
+        *ack_deferred = true;
+    }
+
+    /* Until every subscription has handled it, so the server can't get too far ahead of them */
+    mqtt_read_window_hold(connection, dispatched->payload.len);
+
+    /* Queue it on every subscriber */
+    size_t delivery_count = 0;
+    size_t start_count = 0;
+    aws_mutex_lock(&connection->dispatch.lock);
+    for (size_t i = 0; i < match_count; ++i) {
+        for (const struct aws_mqtt_topic_subscriber *subscriber = matches[i]->subscribers; subscriber;
+             subscriber = subscriber->next) {
+            struct subscribe_task_topic *task_topic = subscriber->userdata;
+
+            struct dispatch_delivery *delivery = &deliveries[delivery_count++];
+            delivery->publish = dispatched;
+            aws_linked_list_push_back(&task_topic->deliveries, &delivery->node);
+            if (!task_topic->dispatch_scheduled) {
+                task_topic->dispatch_scheduled = true;
+                starts[start_count++] = task_topic;
+            }
+        }
+    }
+    aws_mutex_unlock(&connection->dispatch.lock);
 
-    return packet_id;
-}
+    for (size_t i = 0; i < start_count; ++i) {
+        struct subscribe_task_topic *task_topic = starts[i];
 
-/*******************************************************************************
- * Publish
- ******************************************************************************/
+        /* Held until the run finishes, even if unsubscribed meanwhile */
+        aws_atomic_fetch_add(&task_topic->ref_count, 1);
+        aws_atomic_fetch_add(&connection->dispatch.in_flight, 1);
+        if (s_dispatch_submit(task_topic)) {
+            s_dispatch_run(task_topic);
+        }
+    }
 
-struct publish_task_arg {
-    struct aws_mqtt_client_connection *connection;
-    struct aws_byte_cursor topic;
-    enum aws_mqtt_qos qos;
+    if (starts != inline_starts) {
+        aws_mem_release(connection->allocator, starts);
+    }
+    if (matches != inline_matches) {
+        aws_mem_release(connection->allocator, (void *)matches);
+    }
+    return AWS_OP_SUCCESS;
+
+error:
+    if (starts != inline_starts) {
+        aws_mem_release(connection->allocator, starts);
+    }
+    if (matches != inline_matches) {
+        aws_mem_release(connection->allocator, (void *)matches);
+    }
+    return AWS_OP_ERR;
+}
+
+void mqtt_dispatch_send_acks(struct aws_mqtt_client_connection *connection) {
+
+    if (!connection->dispatch.enabled) {
+        return;
+    }
+
+    struct aws_mqtt_mpsc_queue_node *node = NULL;
+    while ((node = aws_mqtt_mpsc_queue_pop(&connection->dispatch.acks))) {
+
+        struct dispatch_publish *dispatched = AWS_CONTAINER_OF(node, struct dispatch_publish, ack_node);
+
+        /* Unless a later publish has taken its id since, after a clean session */
+        const uint16_t packet_id = dispatched->ack.packet_identifier;
+        if (packet_id && aws_mqtt_packet_id_table_find(&connection->dispatch.unacked_qos2, packet_id) == dispatched) {
+            aws_mqtt_packet_id_table_remove(&connection->dispatch.unacked_qos2, packet_id);
+        }
+
+        if (connection->state == AWS_MQTT_CLIENT_STATE_CONNECTED &&
+            dispatched->connection_count == connection->connection_count) {
+
+            /* If this fails, the server resends the publish */
+            struct aws_byte_buf *buf = mqtt_packet_write_begin(connection, &dispatched->ack.fixed_header);
+            if (buf) {
+                if (aws_mqtt_packet_ack_encode(buf, &dispatched->ack)) {
+                    mqtt_packet_write_abort(connection);
+                } else if (mqtt_packet_write_end(connection)) {
+                    AWS_MQTT_LOGF_WARN(
+                        AWS_LS_MQTT_CLIENT,
+                        "id=%p: Failed to send ack for publish %" PRIu16 ", error %d, the server will resend it",
+                        (void *)connection,
+                        dispatched->ack.packet_identifier,
+                        aws_last_error());
+                }
+            }
+        } else {
+            AWS_MQTT_LOGF_DEBUG(
+                AWS_LS_MQTT_CLIENT,
+                "id=%p: Dropping ack for publish %" PRIu16 " handled after its connection was lost",
+                (void *)connection,
+                dispatched->ack.packet_identifier);
+        }
+
+        aws_mem_release(connection->allocator, dispatched);
+    }
+}
+
+bool mqtt_dispatch_defer_duplicate_ack(struct aws_mqtt_client_connection *connection, uint16_t packet_id) {
+
+    if (!connection->dispatch.enabled) {
+        return false;
+    }
+
+    struct dispatch_publish *dispatched = aws_mqtt_packet_id_table_find(&connection->dispatch.unacked_qos2, packet_id);
+    if (!dispatched) {
+        return false;
+    }
+
+    /* Even if the first copy came in on an earlier connection, this one is waiting for the ack now */
+    dispatched->connection_count = connection->connection_count;
+    return true;
+}
+
+/* Stop dispatching for destroy. Waits for the connection's own threads, anything given to a user executor must
+ * already be done. */
+static void s_dispatch_clean_up(struct aws_mqtt_client_connection *connection) {
+
+    if (!connection->dispatch.enabled) {
+        return;
+    }
+
+    if (!connection->dispatch.executor) {
+        aws_mqtt_thread_pool_clean_up(&connection->dispatch.pool);
+    }
+    AWS_ASSERT(aws_atomic_load_int(&connection->dispatch.in_flight) == 0);
+
+    /* Acks that never got to be sent */
+    struct aws_mqtt_mpsc_queue_node *node = NULL;
+    while ((node = aws_mqtt_mpsc_queue_pop(&connection->dispatch.acks))) {
+        aws_mem_release(connection->allocator, AWS_CONTAINER_OF(node, struct dispatch_publish, ack_node));
+    }
+
+    aws_mqtt_packet_id_table_clean_up(&connection->dispatch.unacked_qos2);
+    aws_mutex_clean_up(&connection->dispatch.lock);
+    connection->dispatch.enabled = false;
+}
+
+int aws_mqtt_client_connection_set_dispatch(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_mqtt_dispatch_options *options) {
+
+    AWS_ASSERT(connection);
+    AWS_ASSERT(options);
+
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: Setting publish dispatch", (void *)connection);
+
+    if (connection->state != AWS_MQTT_CLIENT_STATE_DISCONNECTED) {
+        return aws_raise_error(AWS_ERROR_MQTT_ALREADY_CONNECTED);
+    }
+    if (connection->dispatch.enabled) {
+        return aws_raise_error(AWS_ERROR_INVALID_STATE);
+    }
+    if (options->ack_policy != AWS_MQTT_DISPATCH_ACK_ON_RECEIPT &&
+        options->ack_policy != AWS_MQTT_DISPATCH_ACK_ON_COMPLETE) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    if (aws_mutex_init(&connection->dispatch.lock)) {
+        return AWS_OP_ERR;
+    }
+
+    if (!options->executor) {
+        const size_t thread_count = options->thread_count ? options->thread_count : 1;
+        if (aws_mqtt_thread_pool_init(&connection->dispatch.pool, connection->allocator, thread_count)) {
+            AWS_MQTT_LOGF_ERROR(
+                AWS_LS_MQTT_CLIENT,
+                "id=%p: Failed to start dispatch threads, error %d",
+                (void *)connection,
+                aws_last_error());
+            aws_mutex_clean_up(&connection->dispatch.lock);
+            return AWS_OP_ERR;
+        }
+    }
+
+    connection->dispatch.executor = options->executor;
+    connection->dispatch.executor_ud = options->executor_ud;
+    connection->dispatch.ack_policy = options->ack_policy;
+    aws_atomic_init_int(&connection->dispatch.in_flight, 0);
+    aws_mqtt_mpsc_queue_init(&connection->dispatch.acks);
+    aws_atomic_init_int(&connection->dispatch.acks_drain_scheduled, false);
+    aws_mqtt_packet_id_table_init(&connection->dispatch.unacked_qos2, connection->allocator, NULL);
+    connection->dispatch.enabled = true;
+
+    return AWS_OP_SUCCESS;
+}
+
+/*******************************************************************************
+ * Resubscribe
+ ******************************************************************************/
+
+/* One SUBSCRIBE restoring part of the topic tree. The filters are copies, so the tree may change while it's sent. */
+struct resubscribe_task_arg {
+    struct aws_mqtt_client_connection *connection;
+    /* The packet's topic filters point into here */
+    struct aws_byte_buf filters;
+    struct aws_mqtt_packet_subscribe subscribe;
+};
+
+/* A filter copied into a resubscribe_task_arg's filters, right after the one before it */
+struct resubscribe_filter {
+    size_t len;
+    enum aws_mqtt_qos qos;
+};
+
+struct resubscribe_state {
+    struct aws_mqtt_client_connection *connection;
+    /* The SUBSCRIBE being filled, or NULL until the next subscription needs one */
+    struct resubscribe_task_arg *task_arg;
+    /* resubscribe_filter for each filter copied into task_arg so far. Turned into the packet's topics once it's full,
+     * since filters may move as it grows until then. */
+    struct aws_array_list pending_filters;
+    /* What task_arg's remaining length will be */
+    size_t remaining_length;
+    size_t packet_count;
+    size_t filter_count;
+    bool failed;
+};
+
+static void s_resubscribe_task_arg_destroy(struct resubscribe_task_arg *task_arg) {
+
+    aws_mqtt_packet_subscribe_clean_up(&task_arg->subscribe);
+    aws_byte_buf_clean_up(&task_arg->filters);
+    aws_mem_release(task_arg->connection->allocator, task_arg);
+}
+
+static enum aws_mqtt_client_request_state s_resubscribe_send(
+    uint16_t message_id,
+    bool is_first_attempt,
+    void *userdata) {
+
+    (void)is_first_attempt;
+
+    struct resubscribe_task_arg *task_arg = userdata;
+
+    AWS_MQTT_LOGF_TRACE(
+        AWS_LS_MQTT_CLIENT,
+        "id=%p: Attempting send of resubscribe %" PRIu16 " (%s)",
+        (void *)task_arg->connection,
+        message_id,
+        is_first_attempt ? "first attempt" : "resend");
+
+    task_arg->subscribe.packet_identifier = message_id;
+
+    struct aws_byte_buf *buf = mqtt_packet_write_begin(task_arg->connection, &task_arg->subscribe.fixed_header);
+    if (!buf) {
+        return AWS_MQTT_CLIENT_REQUEST_ERROR;
+    }
+
+    if (aws_mqtt_packet_subscribe_encode(buf, &task_arg->subscribe)) {
+        mqtt_packet_write_abort(task_arg->connection);
+        return AWS_MQTT_CLIENT_REQUEST_ERROR;
+    }
+
+    if (mqtt_packet_write_end(task_arg->connection)) {
+
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Failed to send encoded resubscribe %" PRIu16 " upstream",
+            (void *)task_arg->connection,
+            message_id);
+        return AWS_MQTT_CLIENT_REQUEST_ERROR;
+    }
+
+    return AWS_MQTT_CLIENT_REQUEST_ONGOING;
+}
+
+static void s_resubscribe_complete(
+    struct aws_mqtt_client_connection *connection,
+    uint16_t packet_id,
+    int error_code,
+    void *userdata) {
+
+    struct resubscribe_task_arg *task_arg = userdata;
+
+    if (error_code) {
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Resubscribe %" PRIu16 " failed with error_code %d",
+            (void *)connection,
+            packet_id,
+            error_code);
+    } else {
+        AWS_MQTT_LOGF_DEBUG(
+            AWS_LS_MQTT_CLIENT, "id=%p: Resubscribe %" PRIu16 " completed", (void *)connection, packet_id);
+    }
+
+    s_resubscribe_task_arg_destroy(task_arg);
+}
+
+void mqtt_subscribe_acked(
+    struct aws_mqtt_client_connection *connection,
+    uint16_t packet_id,
+    struct aws_byte_cursor return_codes) {
+
+    const struct aws_mqtt_outstanding_request *request =
+        aws_mqtt_packet_id_table_find(&connection->outstanding_requests, packet_id);
+    if (!request || request->completed) {
+        return;
+    }
+
+    const struct aws_mqtt_packet_subscribe *subscribe = NULL;
+    if (request->send_request == s_subscribe_send) {
+        subscribe = &((const struct subscribe_task_arg *)request->send_request_ud)->subscribe;
+    } else if (request->send_request == s_resubscribe_send) {
+        subscribe = &((const struct resubscribe_task_arg *)request->send_request_ud)->subscribe;
+    } else {
+        return;
+    }
+
+    /* One return code per filter in the packet, in the same order */
+    const size_t count = aws_array_list_length(&subscribe->topic_filters);
+    for (size_t i = 0; i < count; ++i) {
+        uint8_t return_code = 0;
+        if (!aws_byte_cursor_read_u8(&return_codes, &return_code)) {
+            break;
+        }
+
+        struct aws_mqtt_subscription *filter = NULL;
+        aws_array_list_get_at_ptr(&subscribe->topic_filters, (void **)&filter, i);
+
+        const bool granted = return_code <= AWS_MQTT_QOS_EXACTLY_ONCE;
+        if (!granted) {
+            AWS_MQTT_LOGF_WARN(
+                AWS_LS_MQTT_CLIENT,
+                "id=%p: Server refused subscription to topic filter \"" PRInSTR "\" in subscribe %" PRIu16,
+                (void *)connection,
+                AWS_BYTE_CURSOR_PRI(filter->topic_filter),
+                packet_id);
+        }
+        aws_mqtt_topic_tree_set_granted(
+            &connection->subscriptions, &filter->topic_filter, granted, (enum aws_mqtt_qos)return_code);
+    }
+}
+
+/* Build the packet being filled from its filters, and start sending it */
+static int s_resubscribe_start_packet(struct resubscribe_state *state) {
+
+    struct aws_mqtt_client_connection *connection = state->connection;
+    struct resubscribe_task_arg *task_arg = state->task_arg;
+    state->task_arg = NULL;
+
+    /* The id is filled in when sent */
+    if (aws_mqtt_packet_subscribe_init(&task_arg->subscribe, connection->allocator, 0)) {
+        goto error;
+    }
+
+    struct aws_byte_cursor filters = aws_byte_cursor_from_buf(&task_arg->filters);
+    const size_t count = aws_array_list_length(&state->pending_filters);
+    for (size_t i = 0; i < count; ++i) {
+        struct resubscribe_filter *filter = NULL;
+        aws_array_list_get_at_ptr(&state->pending_filters, (void **)&filter, i);
+
+        struct aws_byte_cursor topic = aws_byte_cursor_advance(&filters, filter->len);
+        if (aws_mqtt_packet_subscribe_add_topic(&task_arg->subscribe, topic, filter->qos)) {
+            goto error;
+        }
+        /* The server that granted it is gone, so nothing shares it until the new one does too */
+        aws_mqtt_topic_tree_set_granted(&connection->subscriptions, &topic, false, AWS_MQTT_QOS_AT_MOST_ONCE);
+    }
+    aws_array_list_clear(&state->pending_filters);
+    AWS_ASSERT(task_arg->subscribe.fixed_header.remaining_length == state->remaining_length);
+
+    if (!mqtt_create_request(connection, &s_resubscribe_send, task_arg, &s_resubscribe_complete, task_arg, false, 0)) {
+        goto error;
+    }
+
+    ++state->packet_count;
+    state->filter_count += count;
+    return AWS_OP_SUCCESS;
+
+error:
+    aws_array_list_clear(&state->pending_filters);
+    s_resubscribe_task_arg_destroy(task_arg);
+    return AWS_OP_ERR;
+}
+
+static bool s_resubscribe_visitor(const struct aws_mqtt_topic_node *subscription, void *user_data) {
+
+    struct resubscribe_state *state = user_data;
+    struct aws_mqtt_client_connection *connection = state->connection;
+
+    /* Length prefixed filter, then the requested QoS */
+    const size_t size = 2 + subscription->topic_filter->len + 1;
+
+    if (state->task_arg && state->remaining_length + size > connection->resubscribe_max_remaining_length) {
+        if (s_resubscribe_start_packet(state)) {
+            state->failed = true;
+            return false;
+        }
+    }
+
+    if (!state->task_arg) {
+        struct resubscribe_task_arg *task_arg =
+            aws_mem_acquire(connection->allocator, sizeof(struct resubscribe_task_arg));
+        if (!task_arg) {
+            state->failed = true;
+            return false;
+        }
+        AWS_ZERO_STRUCT(*task_arg);
+        task_arg->connection = connection;
+
+        if (aws_byte_buf_init(&task_arg->filters, connection->allocator, 1024)) {
+            aws_mem_release(connection->allocator, task_arg);
+            state->failed = true;
+            return false;
+        }
+
+        state->task_arg = task_arg;
+        /* The packet id */
+        state->remaining_length = 2;
+    }
+
+    struct aws_byte_cursor topic_filter = aws_byte_cursor_from_string(subscription->topic_filter);
+    struct resubscribe_filter filter = {.len = topic_filter.len, .qos = subscription->qos};
+    if (aws_byte_buf_append_dynamic(&state->task_arg->filters, &topic_filter) ||
+        aws_array_list_push_back(&state->pending_filters, &filter)) {
+        state->failed = true;
+        return false;
+    }
+    state->remaining_length += size;
+
+    return true;
+}
+
+void mqtt_resubscribe_all(struct aws_mqtt_client_connection *connection) {
+
+    struct resubscribe_state state;
+    AWS_ZERO_STRUCT(state);
+    state.connection = connection;
+
+    if (aws_array_list_init_dynamic(
+            &state.pending_filters, connection->allocator, 64, sizeof(struct resubscribe_filter))) {
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT, "id=%p: Failed to start resubscribe, error %d", (void *)connection, aws_last_error());
+        return;
+    }
+
+    aws_mqtt_topic_tree_iterate(&connection->subscriptions, s_resubscribe_visitor, &state);
+
+    if (!state.failed && state.task_arg) {
+        state.failed = s_resubscribe_start_packet(&state) != AWS_OP_SUCCESS;
+    }
+    if (state.task_arg) {
+        /* Left half filled by a failure */
+        s_resubscribe_task_arg_destroy(state.task_arg);
+    }
+    aws_array_list_clean_up(&state.pending_filters);
+
+    if (state.failed) {
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Failed to resubscribe to every topic filter, error %d. Resubscribed to %d in %d packets.",
+            (void *)connection,
+            aws_last_error(),
+            (int)state.filter_count,
+            (int)state.packet_count);
+        return;
+    }
+
+    AWS_MQTT_LOGF_DEBUG(
+        AWS_LS_MQTT_CLIENT,
+        "id=%p: Resubscribing to %d topic filters in %d packets",
+        (void *)connection,
+        (int)state.filter_count,
+        (int)state.packet_count);
+}
+
+/*******************************************************************************
+ * Unsubscribe
+ ******************************************************************************/
+
+struct unsubscribe_task_arg {
+    struct aws_mqtt_client_connection *connection;
+    struct aws_byte_cursor filter;
+    /* Packet to populate */
+    struct aws_mqtt_packet_unsubscribe unsubscribe;
+
+    /* true if transaction was committed to the topic tree, false requires a retry */
+    bool tree_updated;
+
+    /* If set, only the subscription made with on_publish_ud leaves, see unsubscribe_one */
+    bool one_subscriber;
+    void *on_publish_ud;
+
+    aws_mqtt_op_complete_fn *on_unsuback;
+    void *on_unsuback_ud;
+};
+
+/* Find the subscription to node made with on_publish_ud */
+static struct subscribe_task_topic *s_task_topic_find(const struct aws_mqtt_topic_node *node, void *on_publish_ud) {
+
+    for (const struct aws_mqtt_topic_subscriber *subscriber = node->subscribers; subscriber;
+         subscriber = subscriber->next) {
+        struct subscribe_task_topic *task_topic = subscriber->userdata;
+        if (task_topic->request.on_publish_ud == on_publish_ud) {
+            return task_topic;
+        }
+    }
+    return NULL;
+}
+
+static enum aws_mqtt_client_request_state s_unsubscribe_send(
+    uint16_t message_id,
+    bool is_first_attempt,
+    void *userdata) {
+
+    (void)is_first_attempt;
+
+    struct unsubscribe_task_arg *task_arg = userdata;
+    struct aws_byte_buf *buf = NULL;
+
+    AWS_MQTT_LOGF_TRACE(
+        AWS_LS_MQTT_CLIENT,
+        "id=%p: Attempting send of unsubscribe %" PRIu16 " %s",
+        (void *)task_arg->connection,
+        message_id,
+        is_first_attempt ? "first attempt" : "resend");
+
+    static const size_t num_topics = 1;
+
+    AWS_VARIABLE_LENGTH_ARRAY(uint8_t, transaction_buf, num_topics * aws_mqtt_topic_tree_action_size);
+    struct aws_array_list transaction;
+    aws_array_list_init_static(&transaction, transaction_buf, num_topics, aws_mqtt_topic_tree_action_size);
+
+    if (!task_arg->tree_updated && task_arg->one_subscriber) {
+
+        const struct aws_mqtt_topic_node *node =
+            aws_mqtt_topic_tree_find(&task_arg->connection->subscriptions, &task_arg->filter);
+        struct subscribe_task_topic *task_topic = node ? s_task_topic_find(node, task_arg->on_publish_ud) : NULL;
+
+        if (!task_topic) {
+            /* Nothing to remove, and the server mustn't drop a filter someone else may still be using */
+            AWS_MQTT_LOGF_DEBUG(
+                AWS_LS_MQTT_CLIENT,
+                "id=%p: No subscription to topic filter \"" PRInSTR "\" with that userdata, nothing to unsubscribe",
+                (void *)task_arg->connection,
+                AWS_BYTE_CURSOR_PRI(task_arg->filter));
+
+            task_arg->tree_updated = true;
+            aws_array_list_clean_up(&transaction);
+            return AWS_MQTT_CLIENT_REQUEST_COMPLETE;
+        }
+
+        if (aws_mqtt_topic_tree_transaction_remove_subscriber(
+                &task_arg->connection->subscriptions, &transaction, &task_arg->filter, task_topic)) {
+            goto handle_error;
+        }
+
+        /* Read before committing, which may free the node */
+        if (node->subscriber_count > 1) {
+            AWS_MQTT_LOGF_DEBUG(
+                AWS_LS_MQTT_CLIENT,
+                "id=%p: Topic filter \"" PRInSTR "\" still has subscribers, not unsubscribing from the server",
+                (void *)task_arg->connection,
+                AWS_BYTE_CURSOR_PRI(task_arg->filter));
+
+            aws_mqtt_topic_tree_transaction_commit(&task_arg->connection->subscriptions, &transaction);
+            task_arg->tree_updated = true;
+
+            aws_array_list_clean_up(&transaction);
+            return AWS_MQTT_CLIENT_REQUEST_COMPLETE;
+        }
+
+    } else if (!task_arg->tree_updated) {
+
+        if (aws_mqtt_topic_tree_transaction_remove(
+                &task_arg->connection->subscriptions, &transaction, &task_arg->filter)) {
+            goto handle_error;
+        }
+    }
+
+    if (task_arg->unsubscribe.fixed_header.packet_type == 0) {
+        /* If unsubscribe packet is uninitialized, init it */
+        if (aws_mqtt_packet_unsubscribe_init(&task_arg->unsubscribe, task_arg->connection->allocator, message_id)) {
+            goto handle_error;
+        }
+        if (aws_mqtt_packet_unsubscribe_add_topic(&task_arg->unsubscribe, task_arg->filter)) {
+            goto handle_error;
+        }
+    }
+
+    buf = mqtt_packet_write_begin(task_arg->connection, &task_arg->unsubscribe.fixed_header);
+    if (!buf) {
+        goto handle_error;
+    }
+
+    if (aws_mqtt_packet_unsubscribe_encode(buf, &task_arg->unsubscribe)) {
+        goto handle_error;
+    }
+
+    /* Nothing has gone to the server, so the tree mustn't say it has */
+    if (mqtt_packet_write_end(task_arg->connection)) {
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Failed to send encoded UNSUBSCRIBE packet upstream",
+            (void *)task_arg->connection);
+        goto handle_error;
+    }
+
+    if (!task_arg->tree_updated) {
+        aws_mqtt_topic_tree_transaction_commit(&task_arg->connection->subscriptions, &transaction);
+        task_arg->tree_updated = true;
+    }
+
+    aws_array_list_clean_up(&transaction);
+    return AWS_MQTT_CLIENT_REQUEST_ONGOING;
+
+handle_error:
+
+    mqtt_packet_write_abort(task_arg->connection);
+    if (!task_arg->tree_updated) {
+        aws_mqtt_topic_tree_transaction_roll_back(&task_arg->connection->subscriptions, &transaction);
+    }
+
+    aws_array_list_clean_up(&transaction);
+    return AWS_MQTT_CLIENT_REQUEST_ERROR;
+}
+
+static void s_unsubscribe_complete(
+    struct aws_mqtt_client_connection *connection,
+    uint16_t packet_id,
+    int error_code,
+    void *userdata) {
+
+    struct unsubscribe_task_arg *task_arg = userdata;
+
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Unsubscribe %" PRIu16 " complete", (void *)connection, packet_id);
+
+    if (task_arg->on_unsuback) {
+        task_arg->on_unsuback(connection, packet_id, error_code, task_arg->on_unsuback_ud);
+    }
+
+    aws_mqtt_packet_unsubscribe_clean_up(&task_arg->unsubscribe);
+    aws_mqtt_recycle_pool_release(&connection->args_pools.unsubscribe, task_arg);
+}
+
+static uint16_t s_unsubscribe(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_byte_cursor *topic_filter,
+    bool one_subscriber,
+    void *on_publish_ud,
+    aws_mqtt_op_complete_fn *on_unsuback,
+    void *on_unsuback_ud) {
+
+    AWS_ASSERT(connection);
+
+    if (!aws_mqtt_is_valid_topic_filter(topic_filter)) {
+        aws_raise_error(AWS_ERROR_MQTT_INVALID_TOPIC);
+        return 0;
+    }
+
+    struct unsubscribe_task_arg *task_arg = aws_mqtt_recycle_pool_acquire(&connection->args_pools.unsubscribe);
+    if (!task_arg) {
+        return 0;
+    }
+    AWS_ZERO_STRUCT(*task_arg);
+    task_arg->connection = connection;
+    task_arg->filter = *topic_filter;
+    task_arg->one_subscriber = one_subscriber;
+    task_arg->on_publish_ud = on_publish_ud;
+    task_arg->on_unsuback = on_unsuback;
+    task_arg->on_unsuback_ud = on_unsuback_ud;
+
+    uint16_t packet_id =
+        mqtt_create_request(connection, &s_unsubscribe_send, task_arg, s_unsubscribe_complete, task_arg, false, 0);
+
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Starting unsubscribe %" PRIu16, (void *)connection, packet_id);
+
+    /* The request was never created, so on_complete won't free the arg */
+    if (!packet_id) {
+        aws_mqtt_recycle_pool_release(&connection->args_pools.unsubscribe, task_arg);
+    }
+
+    return packet_id;
+}
+
+uint16_t aws_mqtt_client_connection_unsubscribe(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_byte_cursor *topic_filter,
+    aws_mqtt_op_complete_fn *on_unsuback,
+    void *on_unsuback_ud) {
+
+    return s_unsubscribe(connection, topic_filter, false, NULL, on_unsuback, on_unsuback_ud);
+}
+
+uint16_t aws_mqtt_client_connection_unsubscribe_one(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_byte_cursor *topic_filter,
+    void *on_publish_ud,
+    aws_mqtt_op_complete_fn *on_unsuback,
+    void *on_unsuback_ud) {
+
+    return s_unsubscribe(connection, topic_filter, true, on_publish_ud, on_unsuback, on_unsuback_ud);
+}
+
+/*******************************************************************************
+ * Publish
+ ******************************************************************************/
+
+struct publish_batch;
+
+struct publish_task_arg {
+    struct aws_mqtt_client_connection *connection;
+    /* If set, this arg is part of a batch from publish_multiple and is freed with it */
+    struct publish_batch *batch;
+    /* The pool the arg goes back to otherwise. If NULL, it was allocated on its own by publish_copy. */
+    struct aws_mqtt_recycle_pool *pool;
+    /* If set, the headers are encoded from here instead of from publish */
+    const struct aws_mqtt_publish_template *tmpl;
+    struct aws_byte_cursor topic;
+    enum aws_mqtt_qos qos;
     bool retain;
+
+    /* Where the payload comes from. For non-streamed publishes this reads from payload. */
+    size_t payload_size;
+    aws_mqtt_publish_payload_fn *payload_fn;
+    void *payload_ud;
     struct aws_byte_cursor payload;
 
-    /* Packet to populate */
-    struct aws_mqtt_packet_publish publish;
+    /* Packet to populate */
+    struct aws_mqtt_packet_publish publish;
+
+    /* If true, on_complete hears about the publish being dropped by a disconnect, see the request's field */
+    bool complete_on_drop;
+    aws_mqtt_op_complete_fn *on_complete;
+    void *userdata;
+};
+
+/* Everything publish_multiple needs, in one allocation */
+struct publish_batch {
+    struct aws_allocator *allocator;
+    /* Publishes that haven't completed yet. Only touched on the channel's thread once the requests are created. */
+    size_t remaining;
+};
+
+static int s_publish_payload_from_cursor(struct aws_byte_buf *dest, size_t offset, size_t length, void *userdata) {
+
+    struct publish_task_arg *task_arg = userdata;
+    AWS_ASSERT(offset + length <= task_arg->payload.len);
+
+    if (!aws_byte_buf_write(dest, task_arg->payload.ptr + offset, length)) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static enum aws_mqtt_client_request_state s_publish_send(uint16_t message_id, bool is_first_attempt, void *userdata) {
+    struct publish_task_arg *task_arg = userdata;
+    struct aws_mqtt_client_connection *connection = task_arg->connection;
+
+    AWS_MQTT_LOGF_TRACE(
+        AWS_LS_MQTT_CLIENT,
+        "id=%p: Attempting send of publish %" PRIu16 " %s",
+        (void *)task_arg->connection,
+        message_id,
+        is_first_attempt ? "first attempt" : "resend");
+
+    bool is_qos_0 = task_arg->qos == AWS_MQTT_QOS_AT_MOST_ONCE;
+    if (is_qos_0) {
+        message_id = 0;
+    }
+
+    if (is_first_attempt && task_arg->tmpl) {
+        /* Only the fixed header is needed, the rest comes straight from the template */
+        aws_mqtt_publish_template_init_header(
+            task_arg->tmpl, false, task_arg->payload_size, &task_arg->publish.fixed_header);
+
+    } else if (is_first_attempt) {
+        if (aws_mqtt_packet_publish_init(
+                &task_arg->publish,
+                task_arg->retain,
+                task_arg->qos,
+                !is_first_attempt,
+                task_arg->topic,
+                message_id,
+                aws_byte_cursor_from_array(NULL, 0))) {
+
+            return AWS_MQTT_CLIENT_REQUEST_ERROR;
+        }
+
+        /* The payload is written separately, only its size goes in the packet */
+        task_arg->publish.fixed_header.remaining_length += task_arg->payload_size;
+    } else {
+        /* [MQTT-3.3.1-1] Set the DUP flag on every resend */
+        task_arg->publish.fixed_header.flags |= 1 << 3;
+    }
+
+    struct aws_byte_buf *buf = mqtt_packet_write_begin(connection, &task_arg->publish.fixed_header);
+    if (!buf) {
+        return AWS_MQTT_CLIENT_REQUEST_ERROR;
+    }
+
+    /* Encode the headers, and everything but the payload */
+    int encode_result = task_arg->tmpl ? aws_mqtt_publish_template_encode_headers(
+                                             buf, task_arg->tmpl, &task_arg->publish.fixed_header, message_id)
+                                       : aws_mqtt_packet_publish_encode_headers(buf, &task_arg->publish);
+    if (encode_result) {
+        mqtt_packet_write_abort(connection);
+        return AWS_MQTT_CLIENT_REQUEST_ERROR;
+    }
+
+    /* Pull the payload a message at a time, so only one message's worth is ever copied out of the provider */
+    size_t offset = 0;
+    bool packet_started = false;
+    while (true) {
+        const size_t left_in_message = buf->capacity - buf->len;
+        const size_t left_in_payload = task_arg->payload_size - offset;
+        const size_t to_write = left_in_payload < left_in_message ? left_in_payload : left_in_message;
+
+        if (to_write) {
+            /* Write this chunk */
+            const size_t len_before = buf->len;
+            if (task_arg->payload_fn(buf, offset, to_write, task_arg->payload_ud) ||
+                buf->len != len_before + to_write) {
+
+                AWS_MQTT_LOGF_ERROR(
+                    AWS_LS_MQTT_CLIENT,
+                    "id=%p: Payload provider failed to write payload of publish %" PRIu16,
+                    (void *)connection,
+                    message_id);
+                mqtt_packet_write_abort(connection);
+                goto handle_partial_packet;
+            }
+            offset += to_write;
+        }
+
+        if (mqtt_packet_write_end(connection)) {
+            goto handle_partial_packet;
+        }
+        packet_started = true;
+
+        /* If there's still payload left, the packet was too big to batch. Get a new message and keep going. */
+        if (offset == task_arg->payload_size) {
+            break;
+        }
+
+        buf = mqtt_packet_write_begin(connection, &task_arg->publish.fixed_header);
+        if (!buf) {
+            goto handle_partial_packet;
+        }
+    }
+
+    /* If QoS == 0, there will be no ack, so consider the request done now. */
+    return is_qos_0 ? AWS_MQTT_CLIENT_REQUEST_COMPLETE : AWS_MQTT_CLIENT_REQUEST_ONGOING;
+
+handle_partial_packet:
+    if (packet_started) {
+        /* Part of the packet may already be on the wire, the stream can't be recovered */
+        mqtt_disconnect_impl(connection, aws_last_error());
+    }
+
+    return AWS_MQTT_CLIENT_REQUEST_ERROR;
+}
+
+static void s_publish_arg_release(struct aws_mqtt_client_connection *connection, struct publish_task_arg *arg) {
+
+    if (arg->pool) {
+        aws_mqtt_recycle_pool_release(arg->pool, arg);
+    } else {
+        aws_mem_release(connection->allocator, arg);
+    }
+}
+
+static void s_publish_complete(
+    struct aws_mqtt_client_connection *connection,
+    uint16_t packet_id,
+    int error_code,
+    void *userdata) {
+    struct publish_task_arg *task_arg = userdata;
+
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Publish %" PRIu16 " complete", (void *)connection, packet_id);
+
+    if (task_arg->on_complete) {
+        task_arg->on_complete(connection, packet_id, error_code, task_arg->userdata);
+    }
+
+    struct publish_batch *batch = task_arg->batch;
+    if (!batch) {
+        s_publish_arg_release(connection, task_arg);
+    } else if (--batch->remaining == 0) {
+        aws_mem_release(batch->allocator, batch);
+    }
+}
+
+static void s_publish_arg_init(
+    struct publish_task_arg *arg,
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_mqtt_publish_template *tmpl,
+    const struct aws_byte_cursor *topic,
+    enum aws_mqtt_qos qos,
+    bool retain,
+    const struct aws_byte_cursor *payload,
+    size_t payload_size,
+    aws_mqtt_publish_payload_fn *payload_fn,
+    void *payload_ud,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata) {
+
+    AWS_ZERO_STRUCT(*arg);
+    arg->connection = connection;
+    arg->tmpl = tmpl;
+    arg->topic = *topic;
+    arg->qos = qos;
+    arg->retain = retain;
+
+    if (payload) {
+        arg->payload = *payload;
+        arg->payload_size = payload->len;
+        arg->payload_fn = s_publish_payload_from_cursor;
+        arg->payload_ud = arg;
+    } else {
+        arg->payload_size = payload_size;
+        arg->payload_fn = payload_fn;
+        arg->payload_ud = payload_ud;
+    }
+
+    arg->on_complete = on_complete;
+    arg->userdata = userdata;
+}
+
+static void s_publish_request_options_init(struct aws_mqtt_request_options *options, struct publish_task_arg *arg) {
+
+    AWS_ZERO_STRUCT(*options);
+    options->send_request = &s_publish_send;
+    options->send_request_ud = arg;
+    options->on_complete = &s_publish_complete;
+    options->on_complete_ud = arg;
+    /* QoS 0 publishes are done as soon as they're written, so only the rest wait on the in-flight window */
+    options->windowed = arg->qos != AWS_MQTT_QOS_AT_MOST_ONCE;
+    options->queued_bytes = arg->topic.len + arg->payload_size;
+    options->complete_on_drop = arg->complete_on_drop;
+}
+
+/* Create the request for an initialized arg, freeing the arg if that fails */
+static uint16_t s_publish_start(struct aws_mqtt_client_connection *connection, struct publish_task_arg *arg) {
+
+    struct aws_mqtt_request_options options;
+    s_publish_request_options_init(&options, arg);
+    uint16_t packet_id = mqtt_create_request_with_options(connection, &options);
+
+    AWS_MQTT_LOGF_DEBUG(
+        AWS_LS_MQTT_CLIENT,
+        "id=%p: Starting publish %" PRIu16 " to topic " PRInSTR,
+        (void *)connection,
+        packet_id,
+        AWS_BYTE_CURSOR_PRI(arg->topic));
+
+    /* The request was never created, so on_complete won't free the arg */
+    if (!packet_id) {
+        s_publish_arg_release(connection, arg);
+    }
+
+    return packet_id;
+}
+
+/* If tmpl is set, topic, qos and retain come from it and have already been validated */
+static uint16_t s_publish(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_mqtt_publish_template *tmpl,
+    const struct aws_byte_cursor *topic,
+    enum aws_mqtt_qos qos,
+    bool retain,
+    const struct aws_byte_cursor *payload,
+    size_t payload_size,
+    aws_mqtt_publish_payload_fn *payload_fn,
+    void *payload_ud,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata) {
+
+    AWS_ASSERT(connection);
+
+    if (tmpl) {
+        topic = &tmpl->topic;
+        qos = tmpl->qos;
+        retain = tmpl->retain;
+    } else if (!aws_mqtt_is_valid_topic(topic)) {
+        aws_raise_error(AWS_ERROR_MQTT_INVALID_TOPIC);
+        return 0;
+    }
+
+    struct publish_task_arg *arg = aws_mqtt_recycle_pool_acquire(&connection->args_pools.publish);
+    if (!arg) {
+        return 0;
+    }
+
+    s_publish_arg_init(
+        arg,
+        connection,
+        tmpl,
+        topic,
+        qos,
+        retain,
+        payload,
+        payload_size,
+        payload_fn,
+        payload_ud,
+        on_complete,
+        userdata);
+    arg->pool = &connection->args_pools.publish;
+
+    return s_publish_start(connection, arg);
+}
+
+uint16_t aws_mqtt_client_connection_publish(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_byte_cursor *topic,
+    enum aws_mqtt_qos qos,
+    bool retain,
+    const struct aws_byte_cursor *payload,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata) {
+
+    AWS_ASSERT(payload);
+
+    return s_publish(connection, NULL, topic, qos, retain, payload, 0, NULL, NULL, on_complete, userdata);
+}
+
+uint16_t aws_mqtt_client_connection_publish_copy(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_byte_cursor *topic,
+    enum aws_mqtt_qos qos,
+    bool retain,
+    const struct aws_byte_cursor *payload,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata) {
+
+    AWS_ASSERT(connection);
+    AWS_ASSERT(topic);
+    AWS_ASSERT(payload);
+
+    if (!aws_mqtt_is_valid_topic(topic)) {
+        aws_raise_error(AWS_ERROR_MQTT_INVALID_TOPIC);
+        return 0;
+    }
+
+    /* The copy goes right after the arg, in the same block */
+    size_t copy_size = 0;
+    size_t block_size = 0;
+    if (aws_add_size_checked(topic->len, payload->len, &copy_size) ||
+        aws_add_size_checked(sizeof(struct publish_task_arg), copy_size, &block_size)) {
+        return 0;
+    }
+
+    struct aws_mqtt_recycle_pool *pool = NULL;
+    struct publish_task_arg *arg = NULL;
+    if (copy_size <= s_publish_copy_inline_max) {
+        pool = &connection->args_pools.publish_copy;
+        arg = aws_mqtt_recycle_pool_acquire(pool);
+    } else {
+        arg = aws_mem_acquire(connection->allocator, block_size);
+    }
+    if (!arg) {
+        return 0;
+    }
+
+    uint8_t *storage = (uint8_t *)(arg + 1);
+    if (topic->len) {
+        memcpy(storage, topic->ptr, topic->len);
+    }
+    if (payload->len) {
+        memcpy(storage + topic->len, payload->ptr, payload->len);
+    }
+    const struct aws_byte_cursor topic_copy = aws_byte_cursor_from_array(storage, topic->len);
+    const struct aws_byte_cursor payload_copy = aws_byte_cursor_from_array(storage + topic->len, payload->len);
+
+    s_publish_arg_init(
+        arg,
+        connection,
+        NULL,
+        &topic_copy,
+        qos,
+        retain,
+        &payload_copy,
+        0,
+        NULL,
+        NULL,
+        on_complete,
+        userdata);
+    arg->pool = pool;
+
+    return s_publish_start(connection, arg);
+}
+
+uint16_t aws_mqtt_client_connection_publish_template(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_mqtt_publish_template *tmpl,
+    const struct aws_byte_cursor *payload,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata) {
+
+    AWS_ASSERT(tmpl);
+    AWS_ASSERT(payload);
+
+    return s_publish(
+        connection, tmpl, NULL, AWS_MQTT_QOS_AT_MOST_ONCE, false, payload, 0, NULL, NULL, on_complete, userdata);
+}
+
+uint16_t aws_mqtt_client_connection_publish_streaming(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_byte_cursor *topic,
+    enum aws_mqtt_qos qos,
+    bool retain,
+    size_t payload_size,
+    aws_mqtt_publish_payload_fn *payload_fn,
+    void *payload_ud,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata) {
+
+    AWS_ASSERT(payload_fn || !payload_size);
+
+    return s_publish(
+        connection, NULL, topic, qos, retain, NULL, payload_size, payload_fn, payload_ud, on_complete, userdata);
+}
 
+int aws_mqtt_client_connection_publish_multiple(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_array_list *messages,
+    uint16_t *packet_ids,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata) {
+
+    AWS_ASSERT(connection);
+    AWS_ASSERT(messages);
+
+    const size_t count = aws_array_list_length(messages);
+    if (!count) {
+        return AWS_OP_SUCCESS;
+    }
+
+    /* Validate everything first, so nothing is sent if any of it is bad */
+    for (size_t i = 0; i < count; ++i) {
+        struct aws_mqtt_publish_message *message = NULL;
+        aws_array_list_get_at_ptr(messages, (void **)&message, i);
+        if (!aws_mqtt_is_valid_topic(&message->topic)) {
+            return aws_raise_error(AWS_ERROR_MQTT_INVALID_TOPIC);
+        }
+    }
+
+    /* The request options and ids are only needed until the requests are created, but riding along in the same
+     * allocation keeps the whole batch to one trip to the allocator */
+    struct publish_batch *batch = NULL;
+    struct publish_task_arg *args = NULL;
+    struct aws_mqtt_request_options *options = NULL;
+    uint16_t *batch_packet_ids = NULL;
+    if (!aws_mem_acquire_many(
+            connection->allocator,
+            4,
+            &batch,
+            sizeof(struct publish_batch),
+            &args,
+            sizeof(struct publish_task_arg) * count,
+            &options,
+            sizeof(struct aws_mqtt_request_options) * count,
+            &batch_packet_ids,
+            sizeof(uint16_t) * count)) {
+        return AWS_OP_ERR;
+    }
+
+    batch->allocator = connection->allocator;
+    batch->remaining = count;
+
+    for (size_t i = 0; i < count; ++i) {
+        struct aws_mqtt_publish_message *message = NULL;
+        aws_array_list_get_at_ptr(messages, (void **)&message, i);
+
+        s_publish_arg_init(
+            &args[i],
+            connection,
+            NULL,
+            &message->topic,
+            message->qos,
+            message->retain,
+            &message->payload,
+            0,
+            NULL,
+            NULL,
+            on_complete,
+            userdata);
+        args[i].batch = batch;
+        s_publish_request_options_init(&options[i], &args[i]);
+    }
+
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Starting batch of %d publishes", (void *)connection, (int)count);
+
+    /* Once this succeeds, the batch may already have been completed and freed */
+    if (mqtt_create_requests(connection, options, count, packet_ids ? packet_ids : batch_packet_ids)) {
+        aws_mem_release(connection->allocator, batch);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/*******************************************************************************
+ * Spool
+ ******************************************************************************/
+
+/* Spooled publishes handed to the connection at once when max_in_flight is 0 */
+static const size_t s_spool_default_max_in_flight = 16;
+/* Failed sends a spooled publish gets when max_attempts is 0 */
+static const size_t s_spool_default_max_attempts = 5;
+/* How long to wait before pumping again after a spooled publish couldn't be started or failed */
+static const uint64_t s_spool_retry_delay_secs = 1;
+
+/* A publish taken from the spool, until it's acked */
+struct aws_mqtt_spool_slot {
+    struct aws_linked_list_node node;
+    struct aws_mqtt_client_connection *connection;
+    uint64_t position;
     aws_mqtt_op_complete_fn *on_complete;
     void *userdata;
 };
 
-static enum aws_mqtt_client_request_state s_publish_send(uint16_t message_id, bool is_first_attempt, void *userdata) {
-    struct publish_task_arg *task_arg = userdata;
+static void s_spool_pump_task(struct aws_channel_task *task, void *arg, enum aws_task_status status) {
 
-    AWS_LOGF_TRACE(
-        AWS_LS_MQTT_CLIENT,
-        "id=%p: Attempting send of publish %" PRIu16 " %s",
-        (void *)task_arg->connection,
-        message_id,
-        is_first_attempt ? "first attempt" : "resend");
+    (void)task;
 
-    bool is_qos_0 = task_arg->qos == AWS_MQTT_QOS_AT_MOST_ONCE;
-    if (is_qos_0) {
-        message_id = 0;
+    struct aws_mqtt_client_connection *connection = arg;
+
+    /* Clear the flag before pumping, so anything appended from here on schedules the next run */
+    aws_atomic_store_int(&connection->spool.pump_scheduled, false);
+
+    /* If cancelled, the channel is going away. The next CONNACK pumps instead. */
+    if (status == AWS_TASK_STATUS_RUN_READY) {
+        mqtt_spool_pump(connection);
     }
+}
 
-    if (is_first_attempt) {
-        if (aws_mqtt_packet_publish_init(
-                &task_arg->publish,
-                task_arg->retain,
-                task_arg->qos,
-                !is_first_attempt,
-                task_arg->topic,
-                message_id,
-                task_arg->payload)) {
+/* Pump from the channel's thread after delay_ns, unless a pump is already on its way. If not connected, the next
+ * CONNACK pumps instead. Safe from any thread. */
+static void s_spool_schedule_pump(struct aws_mqtt_client_connection *connection, uint64_t delay_ns) {
+    mqtt_schedule_task_once(
+        connection, &connection->spool.pump_scheduled, &connection->spool.pump_task, s_spool_pump_task, delay_ns);
+}
 
-            return AWS_MQTT_CLIENT_REQUEST_ERROR;
-        }
+static void s_spool_publish_complete(
+    struct aws_mqtt_client_connection *connection,
+    uint16_t packet_id,
+    int error_code,
+    void *userdata) {
+
+    struct aws_mqtt_spool_slot *slot = userdata;
+
+    bool dropped = false;
+    aws_mutex_lock(&connection->spool.lock);
+    if (error_code == AWS_ERROR_MQTT_CONNECTION_DESTROYED) {
+        /* Dropped by a disconnect, so it's sent again once connected and that isn't held against it */
+        aws_mqtt_spool_requeue(&connection->spool.spool, slot->position);
+    } else if (error_code) {
+        /* Sent again before anything after it, unless it's failed too many times already */
+        dropped = aws_mqtt_spool_fail(&connection->spool.spool, slot->position);
+    } else {
+        aws_mqtt_spool_ack(&connection->spool.spool, slot->position);
     }
+    aws_mutex_unlock(&connection->spool.lock);
 
-    struct aws_io_message *message = mqtt_get_message_for_packet(task_arg->connection, &task_arg->publish.fixed_header);
-    if (!message) {
-        return AWS_MQTT_CLIENT_REQUEST_ERROR;
+    aws_linked_list_push_back(&connection->spool.free_slots, &slot->node);
+
+    if (error_code && !dropped) {
+        AWS_MQTT_LOGF_WARN(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Spooled publish %" PRIu16 " failed with error %d, keeping it spooled",
+            (void *)connection,
+            packet_id,
+            error_code);
+
+        /* Give whatever failed it a moment before trying again */
+        s_spool_schedule_pump(
+            connection, aws_timestamp_convert(s_spool_retry_delay_secs, AWS_TIMESTAMP_SECS, AWS_TIMESTAMP_NANOS, NULL));
+        return;
     }
 
-    /* Encode the headers, and everything but the payload */
-    if (aws_mqtt_packet_publish_encode_headers(&message->message_data, &task_arg->publish)) {
-        return AWS_MQTT_CLIENT_REQUEST_ERROR;
+    if (dropped) {
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Spooled publish %" PRIu16 " failed with error %d too many times, dropping it",
+            (void *)connection,
+            packet_id,
+            error_code);
     }
 
-    struct aws_byte_cursor payload_cur = task_arg->payload;
-    {
-    write_payload_chunk:
-        (void)NULL;
+    if (slot->on_complete) {
+        slot->on_complete(connection, packet_id, error_code, slot->userdata);
+    }
 
-        const size_t left_in_message = message->message_data.capacity - message->message_data.len;
-        const size_t to_write = payload_cur.len < left_in_message ? payload_cur.len : left_in_message;
+    mqtt_spool_pump(connection);
+}
 
-        if (to_write) {
-            /* Write this chunk */
-            struct aws_byte_cursor to_write_cur = aws_byte_cursor_advance(&payload_cur, to_write);
-            AWS_ASSERT(to_write_cur.ptr); /* to_write is guaranteed to be inside the bounds of payload_cur */
-            if (!aws_byte_buf_write_from_whole_cursor(&message->message_data, to_write_cur)) {
+void mqtt_spool_pump(struct aws_mqtt_client_connection *connection) {
 
-                aws_mem_release(message->allocator, message);
-                return AWS_MQTT_CLIENT_REQUEST_ERROR;
-            }
-        }
+    if (!connection->spool.enabled) {
+        return;
+    }
 
-        if (aws_channel_slot_send_message(task_arg->connection->slot, message, AWS_CHANNEL_DIR_WRITE)) {
+    while (connection->state == AWS_MQTT_CLIENT_STATE_CONNECTED &&
+           !aws_linked_list_empty(&connection->spool.free_slots)) {
 
-            aws_mem_release(message->allocator, message);
-            return AWS_MQTT_CLIENT_REQUEST_ERROR;
+        struct aws_mqtt_spool_publish publish;
+        aws_mutex_lock(&connection->spool.lock);
+        const bool taken = aws_mqtt_spool_take(&connection->spool.spool, &publish);
+        aws_mutex_unlock(&connection->spool.lock);
+        if (!taken) {
+            return;
+        }
+
+        struct aws_mqtt_spool_slot *slot = AWS_CONTAINER_OF(
+            aws_linked_list_pop_front(&connection->spool.free_slots), struct aws_mqtt_spool_slot, node);
+        slot->position = publish.position;
+        slot->on_complete = publish.on_complete;
+        slot->userdata = publish.userdata;
+
+        /* The topic and payload are read straight out of the spool, where they stay put until acked */
+        uint16_t packet_id = 0;
+        struct publish_task_arg *arg = aws_mqtt_recycle_pool_acquire(&connection->args_pools.publish);
+        if (arg) {
+            s_publish_arg_init(
+                arg,
+                connection,
+                NULL,
+                &publish.topic,
+                publish.qos,
+                publish.retain,
+                &publish.payload,
+                0,
+                NULL,
+                NULL,
+                s_spool_publish_complete,
+                slot);
+            arg->pool = &connection->args_pools.publish;
+            /* Otherwise a disconnect would leave the record taken, and its slot used, for good */
+            arg->complete_on_drop = true;
+            packet_id = s_publish_start(connection, arg);
         }
 
-        /* If there's still payload left, get a new message and start again. */
-        if (payload_cur.len) {
-            message = mqtt_get_message_for_packet(task_arg->connection, &task_arg->publish.fixed_header);
-            goto write_payload_chunk;
+        if (!packet_id) {
+            /* Out of memory or packet ids, which isn't the record's fault, so it doesn't count as an attempt */
+            AWS_MQTT_LOGF_WARN(
+                AWS_LS_MQTT_CLIENT,
+                "id=%p: Failed to start spooled publish, error %d",
+                (void *)connection,
+                aws_last_error());
+
+            aws_mutex_lock(&connection->spool.lock);
+            aws_mqtt_spool_requeue(&connection->spool.spool, slot->position);
+            aws_mutex_unlock(&connection->spool.lock);
+            aws_linked_list_push_front(&connection->spool.free_slots, &slot->node);
+
+            /* Not every request that frees things up is a spooled one, so don't count on a completion to pump */
+            s_spool_schedule_pump(
+                connection,
+                aws_timestamp_convert(s_spool_retry_delay_secs, AWS_TIMESTAMP_SECS, AWS_TIMESTAMP_NANOS, NULL));
+            return;
         }
     }
+}
 
-    /* If QoS == 0, there will be no ack, so consider the request done now. */
-    return is_qos_0 ? AWS_MQTT_CLIENT_REQUEST_COMPLETE : AWS_MQTT_CLIENT_REQUEST_ONGOING;
+/* Close the spool for destroy, once every request is gone. Whatever wasn't acked stays in the file. */
+static void s_spool_clean_up(struct aws_mqtt_client_connection *connection) {
+
+    if (!connection->spool.enabled) {
+        return;
+    }
+
+    aws_mqtt_spool_close(&connection->spool.spool);
+    aws_mem_release(connection->allocator, connection->spool.slots);
+    aws_mutex_clean_up(&connection->spool.lock);
+    connection->spool.enabled = false;
 }
 
-static void s_publish_complete(
+int aws_mqtt_client_connection_set_spool(
     struct aws_mqtt_client_connection *connection,
-    uint16_t packet_id,
-    int error_code,
-    void *userdata) {
-    struct publish_task_arg *task_arg = userdata;
+    const struct aws_mqtt_spool_options *options) {
 
-    AWS_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Publish %" PRIu16 " complete", (void *)connection, packet_id);
+    AWS_ASSERT(connection);
+    AWS_ASSERT(options);
 
-    if (task_arg->on_complete) {
-        task_arg->on_complete(connection, packet_id, error_code, task_arg->userdata);
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: Setting publish spool", (void *)connection);
+
+    if (connection->state != AWS_MQTT_CLIENT_STATE_DISCONNECTED) {
+        return aws_raise_error(AWS_ERROR_MQTT_ALREADY_CONNECTED);
+    }
+    if (connection->spool.enabled) {
+        return aws_raise_error(AWS_ERROR_INVALID_STATE);
+    }
+    if (!options->path || options->max_attempts > UINT8_MAX) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    const size_t max_in_flight = options->max_in_flight ? options->max_in_flight : s_spool_default_max_in_flight;
+    size_t slots_size = 0;
+    if (aws_mul_size_checked(max_in_flight, sizeof(struct aws_mqtt_spool_slot), &slots_size)) {
+        return AWS_OP_ERR;
+    }
+    struct aws_mqtt_spool_slot *slots = aws_mem_acquire(connection->allocator, slots_size);
+    if (!slots) {
+        return AWS_OP_ERR;
+    }
+
+    if (aws_mutex_init(&connection->spool.lock)) {
+        goto failed_init_lock;
+    }
+
+    if (aws_mqtt_spool_open(
+            &connection->spool.spool, connection->allocator, options->path, options->max_bytes, options->sync)) {
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Failed to open spool %s, error %d",
+            (void *)connection,
+            options->path,
+            aws_last_error());
+        goto failed_open;
+    }
+
+    AWS_MQTT_LOGF_DEBUG(
+        AWS_LS_MQTT_CLIENT,
+        "id=%p: Opened spool %s holding %d unacknowledged publishes",
+        (void *)connection,
+        options->path,
+        (int)connection->spool.spool.count);
+
+    connection->spool.spool.max_attempts =
+        (uint8_t)(options->max_attempts ? options->max_attempts : s_spool_default_max_attempts);
+    connection->spool.slots = slots;
+    aws_linked_list_init(&connection->spool.free_slots);
+    for (size_t i = 0; i < max_in_flight; ++i) {
+        slots[i].connection = connection;
+        aws_linked_list_push_back(&connection->spool.free_slots, &slots[i].node);
     }
+    aws_atomic_init_int(&connection->spool.pump_scheduled, false);
+    connection->spool.enabled = true;
+
+    return AWS_OP_SUCCESS;
+
+failed_open:
+    aws_mutex_clean_up(&connection->spool.lock);
+
+failed_init_lock:
+    aws_mem_release(connection->allocator, slots);
 
-    aws_mem_release(connection->allocator, task_arg);
+    return AWS_OP_ERR;
 }
 
-uint16_t aws_mqtt_client_connection_publish(
+int aws_mqtt_client_connection_publish_spooled(
     struct aws_mqtt_client_connection *connection,
     const struct aws_byte_cursor *topic,
     enum aws_mqtt_qos qos,
@@ -1399,91 +3109,158 @@ uint16_t aws_mqtt_client_connection_publish(
     void *userdata) {
 
     AWS_ASSERT(connection);
+    AWS_ASSERT(topic);
+    AWS_ASSERT(payload);
 
-    if (!aws_mqtt_is_valid_topic(topic)) {
-        aws_raise_error(AWS_ERROR_MQTT_INVALID_TOPIC);
-        return 0;
+    if (!connection->spool.enabled) {
+        return aws_raise_error(AWS_ERROR_INVALID_STATE);
     }
-
-    struct publish_task_arg *arg = aws_mem_acquire(connection->allocator, sizeof(struct publish_task_arg));
-    if (!arg) {
-        return 0;
+    if (qos != AWS_MQTT_QOS_AT_LEAST_ONCE && qos != AWS_MQTT_QOS_EXACTLY_ONCE) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+    if (!aws_mqtt_is_valid_topic(topic)) {
+        return aws_raise_error(AWS_ERROR_MQTT_INVALID_TOPIC);
     }
 
-    arg->connection = connection;
-    arg->topic = *topic;
-    arg->qos = qos;
-    arg->retain = retain;
-    arg->payload = *payload;
-
-    arg->on_complete = on_complete;
-    arg->userdata = userdata;
+    const struct aws_mqtt_spool_publish publish = {
+        .topic = *topic,
+        .payload = *payload,
+        .qos = qos,
+        .retain = retain,
+        .on_complete = on_complete,
+        .userdata = userdata,
+    };
 
-    uint16_t packet_id = mqtt_create_request(connection, &s_publish_send, arg, &s_publish_complete, arg);
+    aws_mutex_lock(&connection->spool.lock);
+    const int result = aws_mqtt_spool_append(&connection->spool.spool, &publish);
+    aws_mutex_unlock(&connection->spool.lock);
+    if (result) {
+        return AWS_OP_ERR;
+    }
 
-    AWS_LOGF_DEBUG(
+    AWS_MQTT_LOGF_TRACE(
         AWS_LS_MQTT_CLIENT,
-        "id=%p: Starting publish %" PRIu16 " to topic " PRInSTR,
+        "id=%p: Spooled publish to topic " PRInSTR,
         (void *)connection,
-        packet_id,
         AWS_BYTE_CURSOR_PRI(*topic));
 
-    return packet_id;
+    s_spool_schedule_pump(connection, 0);
+
+    return AWS_OP_SUCCESS;
 }
 
 /*******************************************************************************
- * Ping
+ * Task Arg Pools
  ******************************************************************************/
 
-static enum aws_mqtt_client_request_state s_pingreq_send(uint16_t message_id, bool is_first_attempt, void *userdata) {
-    (void)message_id;
-    (void)is_first_attempt;
-
-    struct aws_mqtt_client_connection *connection = userdata;
+static void s_args_pools_init(struct aws_mqtt_client_connection *connection) {
 
-    if (is_first_attempt) {
-        /* First attempt, actually send the packet */
+    aws_mqtt_recycle_pool_init(
+        &connection->args_pools.publish,
+        connection->allocator,
+        sizeof(struct publish_task_arg),
+        s_recycle_pool_max_cached);
+    aws_mqtt_recycle_pool_init(
+        &connection->args_pools.publish_copy,
+        connection->allocator,
+        sizeof(struct publish_task_arg) + s_publish_copy_inline_max,
+        s_recycle_pool_max_cached);
+    /* Single topic subscribes keep their one element topics list in the same block */
+    aws_mqtt_recycle_pool_init(
+        &connection->args_pools.subscribe,
+        connection->allocator,
+        sizeof(struct subscribe_task_arg) + sizeof(void *),
+        s_recycle_pool_max_cached);
+    aws_mqtt_recycle_pool_init(
+        &connection->args_pools.unsubscribe,
+        connection->allocator,
+        sizeof(struct unsubscribe_task_arg),
+        s_recycle_pool_max_cached);
+}
 
-        struct aws_mqtt_packet_connection pingreq;
-        aws_mqtt_packet_pingreq_init(&pingreq);
+static void s_args_pools_clean_up(struct aws_mqtt_client_connection *connection) {
 
-        struct aws_io_message *message = mqtt_get_message_for_packet(connection, &pingreq.fixed_header);
-        if (!message) {
-            return AWS_MQTT_CLIENT_REQUEST_ERROR;
-        }
+    aws_mqtt_recycle_pool_clean_up(&connection->args_pools.publish);
+    aws_mqtt_recycle_pool_clean_up(&connection->args_pools.publish_copy);
+    aws_mqtt_recycle_pool_clean_up(&connection->args_pools.subscribe);
+    aws_mqtt_recycle_pool_clean_up(&connection->args_pools.unsubscribe);
+}
 
-        if (aws_mqtt_packet_connection_encode(&message->message_data, &pingreq)) {
-            return AWS_MQTT_CLIENT_REQUEST_ERROR;
-        }
+/*******************************************************************************
+ * Ping
+ ******************************************************************************/
 
-        if (aws_channel_slot_send_message(connection->slot, message, AWS_CHANNEL_DIR_WRITE)) {
+int aws_mqtt_client_connection_ping(struct aws_mqtt_client_connection *connection) {
 
-            aws_mem_release(message->allocator, message);
-            return AWS_MQTT_CLIENT_REQUEST_ERROR;
-        }
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Starting ping", (void *)connection);
 
-        return AWS_MQTT_CLIENT_REQUEST_ONGOING;
+    if (connection->state != AWS_MQTT_CLIENT_STATE_CONNECTED) {
+        return aws_raise_error(AWS_ERROR_MQTT_NOT_CONNECTED);
     }
 
-    /* Check that a pingresp has been received since pingreq was sent */
+    mqtt_keep_alive_ping_now(connection);
+
+    return AWS_OP_SUCCESS;
+}
+
+size_t aws_mqtt_client_connection_get_queued_bytes(const struct aws_mqtt_client_connection *connection) {
+
+    AWS_ASSERT(connection);
+
+    return aws_atomic_load_int(&connection->queued_bytes);
+}
 
-    uint64_t current_time = 0;
-    aws_channel_current_clock_time(connection->slot->channel, &current_time);
+/*******************************************************************************
+ * Stats
+ ******************************************************************************/
 
-    if (current_time - connection->last_pingresp_timestamp > connection->request_timeout_ns) {
-        /* It's been too long since the last ping, close the connection */
+static void s_stats_init(struct aws_mqtt_client_connection *connection) {
 
-        mqtt_disconnect_impl(connection, AWS_ERROR_MQTT_TIMEOUT);
+    for (size_t i = 0; i < AWS_MQTT_STATS_PACKET_TYPE_COUNT; ++i) {
+        aws_atomic_init_int(&connection->stats.packets_sent[i], 0);
+        aws_atomic_init_int(&connection->stats.packets_received[i], 0);
+    }
+    aws_atomic_init_int(&connection->stats.bytes_sent, 0);
+    aws_atomic_init_int(&connection->stats.bytes_received, 0);
+    aws_atomic_init_int(&connection->stats.retries, 0);
+    aws_atomic_init_int(&connection->stats.pending_requests, 0);
+    for (size_t i = 0; i < AWS_MQTT_STATS_ACK_LATENCY_BUCKET_COUNT; ++i) {
+        aws_atomic_init_int(&connection->stats.ack_latency[i], 0);
     }
+}
 
-    return AWS_MQTT_CLIENT_REQUEST_COMPLETE;
+static uint64_t s_stats_load(const struct aws_atomic_var *var) {
+    return aws_atomic_load_int_explicit(var, aws_memory_order_relaxed);
 }
 
-int aws_mqtt_client_connection_ping(struct aws_mqtt_client_connection *connection) {
+void aws_mqtt_client_connection_get_stats(
+    const struct aws_mqtt_client_connection *connection,
+    struct aws_mqtt_connection_stats *stats) {
+
+    AWS_ASSERT(connection);
+    AWS_ASSERT(stats);
 
-    AWS_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "id=%p: Starting ping", (void *)connection);
+    for (size_t i = 0; i < AWS_MQTT_STATS_PACKET_TYPE_COUNT; ++i) {
+        stats->packets_sent[i] = s_stats_load(&connection->stats.packets_sent[i]);
+        stats->packets_received[i] = s_stats_load(&connection->stats.packets_received[i]);
+    }
+    stats->bytes_sent = s_stats_load(&connection->stats.bytes_sent);
+    stats->bytes_received = s_stats_load(&connection->stats.bytes_received);
+    stats->retries = s_stats_load(&connection->stats.retries);
 
-    mqtt_create_request(connection, &s_pingreq_send, connection, NULL, NULL);
+    stats->requests_in_flight = aws_mqtt_packet_id_allocator_get_in_use_count(&connection->packet_ids);
+    stats->pending_requests = s_stats_load(&connection->stats.pending_requests);
+    stats->queued_bytes = s_stats_load(&connection->queued_bytes);
 
-    return AWS_OP_SUCCESS;
+    /* Only the lock changes, the connection's stats don't */
+    struct aws_mutex *ping_lock = (struct aws_mutex *)&connection->stats.ping.lock;
+    aws_mutex_lock(ping_lock);
+    stats->last_ping_rtt_ns = connection->stats.ping.last_rtt_ns;
+    stats->smoothed_ping_rtt_ns = connection->stats.ping.smoothed_rtt_ns;
+    stats->last_pingresp_timestamp = connection->stats.ping.last_pingresp_timestamp;
+    aws_mutex_unlock(ping_lock);
+
+    for (size_t i = 0; i < AWS_MQTT_STATS_ACK_LATENCY_BUCKET_COUNT; ++i) {
+        stats->ack_latency[i] = s_stats_load(&connection->stats.ack_latency[i]);
+    }
 }
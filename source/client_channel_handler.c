@@ -15,19 +15,55 @@
 
 #include <aws/mqtt/private/client_impl.h>
 
+#include <aws/mqtt/private/logging.h>
 #include <aws/mqtt/private/packets.h>
 #include <aws/mqtt/private/topic_tree.h>
 
-#include <aws/io/logging.h>
-
 #include <aws/common/clock.h>
 #include <aws/common/math.h>
 #include <aws/common/task_scheduler.h>
 
+#include <inttypes.h>
+
 #ifdef _MSC_VER
 #    pragma warning(disable : 4204)
 #endif
 
+/*******************************************************************************
+ * Stats
+ ******************************************************************************/
+
+/* Only the channel's thread writes the stats, so a relaxed load and store is enough and avoids a locked add */
+static void s_stats_add(struct aws_atomic_var *counter, size_t n) {
+    aws_atomic_store_int_explicit(
+        counter, aws_atomic_load_int_explicit(counter, aws_memory_order_relaxed) + n, aws_memory_order_relaxed);
+}
+
+static void s_stats_record_ack_latency(struct aws_mqtt_client_connection *connection, uint64_t latency_ns) {
+
+    /* Bucket by the number of significant bits in microseconds */
+    uint64_t latency_us = latency_ns / 1000;
+    size_t bucket = 0;
+    while (latency_us && bucket < AWS_MQTT_STATS_ACK_LATENCY_BUCKET_COUNT - 1) {
+        latency_us >>= 1;
+        ++bucket;
+    }
+    s_stats_add(&connection->stats.ack_latency[bucket], 1);
+}
+
+/* Count the bytes of the packet being written that have just been sent, and the packet once all of it has */
+static void s_stats_count_sent(struct aws_mqtt_client_connection *connection, size_t bytes) {
+
+    s_stats_add(&connection->stats.bytes_sent, bytes);
+
+    if (bytes >= connection->write_batch.packet_bytes_left) {
+        connection->write_batch.packet_bytes_left = 0;
+        s_stats_add(&connection->stats.packets_sent[connection->write_batch.packet_type], 1);
+    } else {
+        connection->write_batch.packet_bytes_left -= bytes;
+    }
+}
+
 /*******************************************************************************
  * Packet State Machine
  ******************************************************************************/
@@ -37,47 +73,44 @@ static const uint16_t s_default_keep_alive_ping_freq_secs = 3600;
 
 typedef int(packet_handler_fn)(struct aws_mqtt_client_connection *connection, struct aws_byte_cursor message_cursor);
 
+static void s_request_send(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_mqtt_outstanding_request *request,
+    bool is_retry);
+static void s_window_drain(struct aws_mqtt_client_connection *connection);
+static void s_replay_start(struct aws_mqtt_client_connection *connection, struct aws_linked_list *requests);
+static void s_read_window_update(struct aws_mqtt_client_connection *connection, size_t credit);
+static bool s_read_window_closed(const struct aws_mqtt_client_connection *connection);
+
+/* Park a request until the next CONNACK. Channel's thread only. */
+static void s_pending_requests_push(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_mqtt_outstanding_request *request) {
+
+    aws_mutex_lock(&connection->pending_requests.mutex);
+    aws_linked_list_push_back(&connection->pending_requests.list, &request->list_node);
+    aws_mutex_unlock(&connection->pending_requests.mutex);
+
+    s_stats_add(&connection->stats.pending_requests, 1);
+}
+
 static int s_packet_handler_default(
     struct aws_mqtt_client_connection *connection,
     struct aws_byte_cursor message_cursor) {
     (void)connection;
     (void)message_cursor;
 
-    AWS_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Unhandled packet type received", (void *)connection);
+    AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_CLIENT, "id=%p: Unhandled packet type received", (void *)connection);
     return aws_raise_error(AWS_ERROR_MQTT_INVALID_PACKET_TYPE);
 }
 
-static void s_on_time_to_ping(struct aws_channel_task *channel_task, void *arg, enum aws_task_status status);
-static void s_schedule_ping(struct aws_mqtt_client_connection *connection) {
-    aws_channel_task_init(&connection->ping_task, s_on_time_to_ping, connection);
-
-    uint64_t schedule_time = 0;
-    aws_channel_current_clock_time(connection->slot->channel, &schedule_time);
-    if (connection->keep_alive_time_secs) {
-        schedule_time +=
-            aws_timestamp_convert(connection->keep_alive_time_secs, AWS_TIMESTAMP_SECS, AWS_TIMESTAMP_NANOS, NULL);
-    } else {
-        schedule_time +=
-            aws_timestamp_convert(s_default_keep_alive_ping_freq_secs, AWS_TIMESTAMP_SECS, AWS_TIMESTAMP_NANOS, NULL);
-    }
-
-    aws_channel_schedule_task_future(connection->slot->channel, &connection->ping_task, schedule_time);
-}
-
-static void s_on_time_to_ping(struct aws_channel_task *channel_task, void *arg, enum aws_task_status status) {
-    (void)channel_task;
+static void s_keep_alive_start(struct aws_mqtt_client_connection *connection);
 
-    if (status == AWS_TASK_STATUS_RUN_READY) {
-        struct aws_mqtt_client_connection *connection = arg;
-        aws_mqtt_client_connection_ping(connection);
-        s_schedule_ping(connection);
-    }
-}
 static int s_packet_handler_connack(
     struct aws_mqtt_client_connection *connection,
     struct aws_byte_cursor message_cursor) {
 
-    AWS_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: CONNACK received", (void *)connection);
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: CONNACK received", (void *)connection);
 
     struct aws_mqtt_packet_connack connack;
     if (aws_mqtt_packet_connack_decode(&message_cursor, &connack)) {
@@ -105,7 +138,17 @@ static int s_packet_handler_connack(
     }
 
     if (connack.connect_return_code == AWS_MQTT_CONNECT_ACCEPTED) {
-        /* If successfully connected, schedule all pending tasks */
+        /* A new session won't resend any QoS 2 publishes we're waiting on a PUBREL for */
+        if (!connack.session_present) {
+            aws_mqtt_packet_id_set_clear(&connection->inbound_qos2_ids);
+
+            /* Before anything else is resent, so what the subscriptions are for doesn't race them */
+            if (connection->auto_resubscribe) {
+                mqtt_resubscribe_all(connection);
+            }
+        }
+
+        /* If successfully connected, resend all pending requests */
 
         struct aws_linked_list requests;
         aws_linked_list_init(&requests);
@@ -113,29 +156,46 @@ static int s_packet_handler_connack(
         aws_mutex_lock(&connection->pending_requests.mutex);
         aws_linked_list_swap_contents(&connection->pending_requests.list, &requests);
         aws_mutex_unlock(&connection->pending_requests.mutex);
+        aws_atomic_store_int_explicit(&connection->stats.pending_requests, 0, aws_memory_order_relaxed);
 
-        if (!aws_linked_list_empty(&requests)) {
-            struct aws_linked_list_node *current = aws_linked_list_front(&requests);
-            const struct aws_linked_list_node *end = aws_linked_list_end(&requests);
+        s_replay_start(connection, &requests);
 
-            do {
+        /* Start whatever the window held back, the outstanding table may have been emptied while offline */
+        s_window_drain(connection);
 
-                struct aws_mqtt_outstanding_request *request =
-                    AWS_CONTAINER_OF(current, struct aws_mqtt_outstanding_request, list_node);
-                aws_channel_schedule_task_now(connection->slot->channel, &request->timeout_task);
+        /* Start anything submitted from other threads while offline */
+        mqtt_submit_queued_requests(connection);
 
-                current = current->next;
-            } while (current != end);
-        }
+        /* Behind everything else, spooled publishes were waiting on disk */
+        mqtt_spool_pump(connection);
+
+        /* Acks of publishes handled while offline belong to the old connection */
+        mqtt_dispatch_send_acks(connection);
     } else {
         /* If error code returned, disconnect */
         mqtt_disconnect_impl(connection, AWS_ERROR_MQTT_PROTOCOL_ERROR);
     }
 
-    s_schedule_ping(connection);
+    s_keep_alive_start(connection);
     return AWS_OP_SUCCESS;
 }
 
+/* Encode and send (or batch) an ack packet */
+static int s_send_ack(struct aws_mqtt_client_connection *connection, struct aws_mqtt_packet_ack *ack) {
+
+    struct aws_byte_buf *buf = mqtt_packet_write_begin(connection, &ack->fixed_header);
+    if (!buf) {
+        return AWS_OP_ERR;
+    }
+
+    if (aws_mqtt_packet_ack_encode(buf, ack)) {
+        mqtt_packet_write_abort(connection);
+        return AWS_OP_ERR;
+    }
+
+    return mqtt_packet_write_end(connection);
+}
+
 static int s_packet_handler_publish(
     struct aws_mqtt_client_connection *connection,
     struct aws_byte_cursor message_cursor) {
@@ -145,12 +205,10 @@ static int s_packet_handler_publish(
         return AWS_OP_ERR;
     }
 
-    if (aws_mqtt_topic_tree_publish(&connection->subscriptions, &publish)) {
-        return AWS_OP_ERR;
-    }
-
     struct aws_mqtt_packet_ack puback;
     AWS_ZERO_STRUCT(puback);
+    bool deliver = true;
+    bool qos2 = false;
 
     /* Switch on QoS flags (bits 1 & 2) */
     switch ((publish.fixed_header.flags >> 1) & 0x3) {
@@ -161,24 +219,42 @@ static int s_packet_handler_publish(
             aws_mqtt_packet_puback_init(&puback, publish.packet_identifier);
             break;
         case AWS_MQTT_QOS_EXACTLY_ONCE:
+            /* Deliver on first receipt and remember the id until PUBREL, so a resend of the same PUBLISH only gets
+             * another PUBREC [MQTT-4.3.3-2] */
+            qos2 = true;
+            deliver = !aws_mqtt_packet_id_set_contains(&connection->inbound_qos2_ids, publish.packet_identifier);
+            if (!deliver) {
+                AWS_MQTT_LOGF_DEBUG(
+                    AWS_LS_MQTT_CLIENT,
+                    "id=%p: Ignoring duplicate of QoS 2 publish %" PRIu16,
+                    (void *)connection,
+                    publish.packet_identifier);
+            }
             aws_mqtt_packet_pubrec_init(&puback, publish.packet_identifier);
             break;
     }
 
-    if (puback.packet_identifier) {
-
-        struct aws_io_message *message = mqtt_get_message_for_packet(connection, &puback.fixed_header);
-        if (!message) {
+    bool ack_deferred = false;
+    if (deliver) {
+        if (connection->dispatch.enabled) {
+            if (mqtt_dispatch_publish(connection, &publish, &puback, &ack_deferred)) {
+                return AWS_OP_ERR;
+            }
+        } else if (aws_mqtt_topic_tree_publish(&connection->subscriptions, &publish)) {
             return AWS_OP_ERR;
         }
 
-        if (aws_mqtt_packet_ack_encode(&message->message_data, &puback)) {
-            return AWS_OP_ERR;
+        /* Only once it's been delivered, so a resend after a failure is delivered again */
+        if (qos2) {
+            aws_mqtt_packet_id_set_add(&connection->inbound_qos2_ids, publish.packet_identifier);
         }
+    } else if (qos2) {
+        /* The first copy still being handled acks for both */
+        ack_deferred = mqtt_dispatch_defer_duplicate_ack(connection, publish.packet_identifier);
+    }
 
-        if (aws_channel_slot_send_message(connection->slot, message, AWS_CHANNEL_DIR_WRITE)) {
-            return AWS_OP_ERR;
-        }
+    if (puback.packet_identifier && !ack_deferred) {
+        return s_send_ack(connection, &puback);
     }
 
     return AWS_OP_SUCCESS;
@@ -196,7 +272,7 @@ static int s_packet_handler_ack(struct aws_mqtt_client_connection *connection, s
     return AWS_OP_SUCCESS;
 }
 
-static int s_packet_handler_pubrec(
+static int s_packet_handler_suback(
     struct aws_mqtt_client_connection *connection,
     struct aws_byte_cursor message_cursor) {
 
@@ -205,25 +281,41 @@ static int s_packet_handler_pubrec(
         return AWS_OP_ERR;
     }
 
-    /* TODO: When sending PUBLISH with QoS 3, we should be storing the data until this packet is recieved, at which
-     * point we may discard it. */
+    /* What's left is a return code per filter, before the request (and the packet they match up with) goes away */
+    mqtt_subscribe_acked(connection, ack.packet_identifier, message_cursor);
+    mqtt_request_complete(connection, AWS_OP_SUCCESS, ack.packet_identifier);
 
-    /* Send PUBREL */
-    aws_mqtt_packet_pubrel_init(&ack, ack.packet_identifier);
-    struct aws_io_message *message = mqtt_get_message_for_packet(connection, &ack.fixed_header);
-    if (!message) {
-        return AWS_OP_ERR;
-    }
+    return AWS_OP_SUCCESS;
+}
+
+static int s_packet_handler_pubrec(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_byte_cursor message_cursor) {
 
-    if (aws_mqtt_packet_ack_encode(&message->message_data, &ack)) {
+    struct aws_mqtt_packet_ack ack;
+    if (aws_mqtt_packet_ack_decode(&message_cursor, &ack)) {
         return AWS_OP_ERR;
     }
 
-    if (aws_channel_slot_send_message(connection->slot, message, AWS_CHANNEL_DIR_WRITE)) {
-        return AWS_OP_ERR;
+    /* The server has the PUBLISH now, so from here on the request is resent as PUBREL and never touches the payload
+     * again. It stays outstanding, keeping its packet id, until PUBCOMP. */
+    struct aws_mqtt_outstanding_request *request =
+        aws_mqtt_packet_id_table_find(&connection->outstanding_requests, ack.packet_identifier);
+    if (request && !request->completed) {
+        request->released = true;
+
+        if (request->retrying) {
+            /* Send the PUBREL through the request, so it's retried (from now) like the PUBLISH was */
+            aws_linked_list_remove(&request->list_node);
+            request->retrying = false;
+            s_request_send(connection, request, false);
+            return AWS_OP_SUCCESS;
+        }
     }
 
-    return AWS_OP_SUCCESS;
+    /* Otherwise (like an unknown id) just answer it [MQTT-4.3.3-1] */
+    aws_mqtt_packet_pubrel_init(&ack, ack.packet_identifier);
+    return s_send_ack(connection, &ack);
 }
 
 static int s_packet_handler_pubrel(
@@ -235,22 +327,12 @@ static int s_packet_handler_pubrel(
         return AWS_OP_ERR;
     }
 
+    /* The server won't send this PUBLISH again, so the id may be used for a new one */
+    aws_mqtt_packet_id_set_remove(&connection->inbound_qos2_ids, ack.packet_identifier);
+
     /* Send PUBCOMP */
     aws_mqtt_packet_pubcomp_init(&ack, ack.packet_identifier);
-    struct aws_io_message *message = mqtt_get_message_for_packet(connection, &ack.fixed_header);
-    if (!message) {
-        return AWS_OP_ERR;
-    }
-
-    if (aws_mqtt_packet_ack_encode(&message->message_data, &ack)) {
-        return AWS_OP_ERR;
-    }
-
-    if (aws_channel_slot_send_message(connection->slot, message, AWS_CHANNEL_DIR_WRITE)) {
-        return AWS_OP_ERR;
-    }
-
-    return AWS_OP_SUCCESS;
+    return s_send_ack(connection, &ack);
 }
 
 static int s_packet_handler_pingresp(
@@ -259,10 +341,29 @@ static int s_packet_handler_pingresp(
 
     (void)message_cursor;
 
-    AWS_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: PINGRESP received", (void *)connection);
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: PINGRESP received", (void *)connection);
 
     /* Store the timestamp this was received */
-    aws_channel_current_clock_time(connection->slot->channel, &connection->last_pingresp_timestamp);
+    uint64_t now = 0;
+    aws_channel_current_clock_time(connection->slot->channel, &now);
+
+    /* An unsolicited one says nothing about the round trip */
+    uint64_t rtt = 0;
+    const bool answered = connection->keep_alive.pingreq_timestamp != 0;
+    if (answered) {
+        rtt = now - connection->keep_alive.pingreq_timestamp;
+        const uint64_t smoothed = connection->keep_alive.smoothed_rtt_ns;
+        connection->keep_alive.smoothed_rtt_ns = smoothed ? smoothed - smoothed / 8 + rtt / 8 : rtt;
+        connection->keep_alive.pingreq_timestamp = 0;
+    }
+
+    aws_mutex_lock(&connection->stats.ping.lock);
+    connection->stats.ping.last_pingresp_timestamp = now;
+    if (answered) {
+        connection->stats.ping.last_rtt_ns = rtt;
+        connection->stats.ping.smoothed_rtt_ns = connection->keep_alive.smoothed_rtt_ns;
+    }
+    aws_mutex_unlock(&connection->stats.ping.lock);
 
     return AWS_OP_SUCCESS;
 }
@@ -277,7 +378,7 @@ static packet_handler_fn *s_packet_handlers[] = {
     [AWS_MQTT_PACKET_PUBREL] = &s_packet_handler_pubrel,
     [AWS_MQTT_PACKET_PUBCOMP] = &s_packet_handler_ack,
     [AWS_MQTT_PACKET_SUBSCRIBE] = &s_packet_handler_default,
-    [AWS_MQTT_PACKET_SUBACK] = &s_packet_handler_ack,
+    [AWS_MQTT_PACKET_SUBACK] = &s_packet_handler_suback,
     [AWS_MQTT_PACKET_UNSUBSCRIBE] = &s_packet_handler_default,
     [AWS_MQTT_PACKET_UNSUBACK] = &s_packet_handler_ack,
     [AWS_MQTT_PACKET_PINGREQ] = &s_packet_handler_default,
@@ -305,10 +406,18 @@ static int s_process_mqtt_packet(
         return aws_raise_error(AWS_ERROR_MQTT_INVALID_PACKET_TYPE);
     }
 
+    s_stats_add(&connection->stats.packets_received[packet_type], 1);
+
     /* Handle the packet */
     return s_packet_handlers[packet_type](connection, packet);
 }
 
+static int s_on_packet(struct aws_byte_cursor packet, void *userdata) {
+
+    struct aws_mqtt_client_connection *connection = userdata;
+    return s_process_mqtt_packet(connection, aws_mqtt_get_packet_type(packet.ptr), packet);
+}
+
 /**
  * Handles incoming messages from the server.
  */
@@ -323,100 +432,29 @@ static int s_process_read_message(
         return AWS_OP_ERR;
     }
 
-    /* This cursor will be updated as we read through the message. */
-    struct aws_byte_cursor message_cursor = aws_byte_cursor_from_buf(&message->message_data);
-
-    /* If there's pending packet left over from last time, attempt to complete it. */
-    if (connection->pending_packet.len) {
-
-        int result = AWS_OP_SUCCESS;
-
-        /* This determines how much to read from the message (min(expected_remaining, message.len)) */
-        size_t to_read = connection->pending_packet.capacity - connection->pending_packet.len;
-        /* This will be set to false if this message still won't complete the packet object. */
-        bool packet_complete = true;
-        if (to_read > message_cursor.len) {
-            to_read = message_cursor.len;
-            packet_complete = false;
-        }
-
-        /* Write the chunk to the buffer.
-         * This will either complete the packet, or be the entirety of message if more data is required. */
-        struct aws_byte_cursor chunk = aws_byte_cursor_advance(&message_cursor, to_read);
-        AWS_ASSERT(chunk.ptr); /* Guaranteed to be in bounds */
-        result = (int)aws_byte_buf_write_from_whole_cursor(&connection->pending_packet, chunk) - 1;
-        if (result) {
-            goto handle_error;
-        }
-
-        /* If the packet is still incomplete, don't do anything with the data. */
-        if (!packet_complete) {
-            return AWS_OP_SUCCESS;
-        }
-
-        /* Handle the completed pending packet */
-        struct aws_byte_cursor packet_data = aws_byte_cursor_from_buf(&connection->pending_packet);
-        result = s_process_mqtt_packet(connection, aws_mqtt_get_packet_type(packet_data.ptr), packet_data);
-
-    handle_error:
-        /* Clean up the pending packet */
-        aws_byte_buf_clean_up(&connection->pending_packet);
-        AWS_ZERO_STRUCT(connection->pending_packet);
-
-        if (result) {
-            return AWS_OP_ERR;
-        }
-    }
-
-    while (message_cursor.len) {
-
-        /* Temp byte cursor so we can decode the header without advancing message_cursor. */
-        struct aws_byte_cursor header_decode = message_cursor;
-
-        struct aws_mqtt_fixed_header packet_header;
-        AWS_ZERO_STRUCT(packet_header);
-        int result = aws_mqtt_fixed_header_decode(&header_decode, &packet_header);
-
-        /* Calculate how much data was read. */
-        const size_t fixed_header_size = message_cursor.len - header_decode.len;
-
-        if (result) {
-            if (aws_last_error() == AWS_ERROR_SHORT_BUFFER) {
-                /* Message data too short, store data and come back later. */
-                if (aws_byte_buf_init(
-                        &connection->pending_packet,
-                        connection->allocator,
-                        fixed_header_size + packet_header.remaining_length)) {
-
-                    return AWS_OP_ERR;
-                }
-
-                /* Write the partial packet. */
-                if (!aws_byte_buf_write_from_whole_cursor(&connection->pending_packet, message_cursor)) {
-                    aws_byte_buf_clean_up(&connection->pending_packet);
-                    return AWS_OP_ERR;
-                }
-
-                aws_reset_error();
-                goto cleanup;
-            } else {
-                return AWS_OP_ERR;
-            }
-        }
+    s_stats_add(&connection->stats.bytes_received, message->message_data.len);
+    aws_channel_current_clock_time(slot->channel, &connection->keep_alive.last_read_timestamp);
 
-        struct aws_byte_cursor packet_data =
-            aws_byte_cursor_advance(&message_cursor, fixed_header_size + packet_header.remaining_length);
-        s_process_mqtt_packet(connection, packet_header.packet_type, packet_data);
+    /* Whole packets are handled straight out of the message, split ones once the rest of them arrives */
+    if (aws_mqtt_packet_framer_process(
+            &connection->framer, aws_byte_cursor_from_buf(&message->message_data), s_on_packet, connection)) {
+        return AWS_OP_ERR;
     }
 
-cleanup:
     /* Do cleanup */
-    aws_channel_slot_increment_read_window(slot, message->message_data.len);
+    if (connection->read_window.initial) {
+        connection->read_window.read_since_growth += message->message_data.len;
+        s_read_window_update(connection, message->message_data.len);
+    } else {
+        aws_channel_slot_increment_read_window(slot, message->message_data.len);
+    }
     aws_mem_release(message->allocator, message);
 
     return AWS_OP_SUCCESS;
 }
 
+static void s_write_batch_discard(struct aws_mqtt_client_connection *connection);
+
 static int s_shutdown(
     struct aws_channel_handler *handler,
     struct aws_channel_slot *slot,
@@ -437,27 +475,31 @@ static int s_shutdown(
                 aws_mqtt_packet_disconnect_init(&disconnect);
 
                 /* if any of these fail, we don't care, because we're disconnecting anyway */
-                struct aws_io_message *message = mqtt_get_message_for_packet(connection, &disconnect.fixed_header);
-                if (!message) {
-                    goto done;
-                }
-                if (aws_mqtt_packet_connection_encode(&message->message_data, &disconnect)) {
-                    goto done;
+                struct aws_byte_buf *buf = mqtt_packet_write_begin(connection, &disconnect.fixed_header);
+                if (buf) {
+                    if (aws_mqtt_packet_connection_encode(buf, &disconnect)) {
+                        mqtt_packet_write_abort(connection);
+                    } else {
+                        mqtt_packet_write_end(connection);
+                    }
                 }
-                aws_channel_slot_send_message(slot, message, AWS_CHANNEL_DIR_WRITE);
             }
+
+            /* Get everything still batched out before the connection closes */
+            mqtt_packet_write_flush(connection);
         }
+
+        s_write_batch_discard(connection);
     }
 
-done:
     return aws_channel_slot_on_handler_shutdown_complete(slot, dir, error_code, free_scarce_resources_immediately);
 }
 
 static size_t s_initial_window_size(struct aws_channel_handler *handler) {
 
-    (void)handler;
+    struct aws_mqtt_client_connection *connection = handler->impl;
 
-    return SIZE_MAX;
+    return connection->read_window.initial ? connection->read_window.size : SIZE_MAX;
 }
 
 static void s_destroy(struct aws_channel_handler *handler) {
@@ -498,171 +540,1170 @@ struct aws_io_message *mqtt_get_message_for_packet(
         connection->slot->channel, AWS_IO_MESSAGE_APPLICATION_DATA, 3 + header->remaining_length);
 }
 
+void mqtt_shared_channel_set(struct aws_mqtt_client_connection *connection, struct aws_channel *channel) {
+
+    AWS_ASSERT(!channel || aws_channel_thread_is_callers_thread(channel));
+
+    /* Held while it's set, so it can't be freed under a thread scheduling on it, whenever the bootstrap destroys it */
+    if (channel) {
+        aws_channel_acquire_hold(channel);
+    }
+
+    aws_mutex_lock(&connection->shared_channel.lock);
+    struct aws_channel *old_channel = connection->shared_channel.channel;
+    connection->shared_channel.channel = channel;
+    aws_mutex_unlock(&connection->shared_channel.lock);
+
+    if (old_channel) {
+        aws_channel_release_hold(old_channel);
+    }
+}
+
+void mqtt_schedule_task_once(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_atomic_var *scheduled,
+    struct aws_channel_task *task,
+    aws_channel_task_fn *task_fn,
+    uint64_t delay_ns) {
+
+    aws_mutex_lock(&connection->shared_channel.lock);
+
+    struct aws_channel *channel = connection->shared_channel.channel;
+    if (channel && !aws_atomic_exchange_int(scheduled, true)) {
+        aws_channel_task_init(task, task_fn, connection);
+
+        if (delay_ns) {
+            uint64_t now = 0;
+            aws_channel_current_clock_time(channel, &now);
+            aws_channel_schedule_task_future(channel, task, now + delay_ns);
+        } else {
+            aws_channel_schedule_task_now(channel, task);
+        }
+    }
+
+    aws_mutex_unlock(&connection->shared_channel.lock);
+}
+
 /*******************************************************************************
- * Requests
+ * Keep Alive
  ******************************************************************************/
 
-static void s_request_timeout_task(struct aws_channel_task *task, void *arg, enum aws_task_status status) {
+/* Least time a PINGRESP is given when the timeout goes by round trip time */
+static const uint64_t s_min_ping_timeout_ns = 3000000000;
 
-    struct aws_mqtt_outstanding_request *request = arg;
+static uint64_t s_keep_alive_interval_ns(const struct aws_mqtt_client_connection *connection) {
 
-    if (status == AWS_TASK_STATUS_CANCELED) {
-        /* If task cancelled, assume safe shutdown is in progress and signal hash_table destroy to clean up */
-        request->cancelled = true;
-        return;
+    const uint16_t secs =
+        connection->keep_alive_time_secs ? connection->keep_alive_time_secs : s_default_keep_alive_ping_freq_secs;
+    return aws_timestamp_convert(secs, AWS_TIMESTAMP_SECS, AWS_TIMESTAMP_NANOS, NULL);
+}
+
+static uint64_t s_ping_timeout_ns(const struct aws_mqtt_client_connection *connection) {
+
+    if (connection->keep_alive.timeout_ns) {
+        return connection->keep_alive.timeout_ns;
+    }
+
+    /* Nothing to go by yet, so give it as long as the server gives us */
+    if (!connection->keep_alive.smoothed_rtt_ns) {
+        return s_keep_alive_interval_ns(connection);
+    }
+
+    const uint64_t by_rtt = connection->keep_alive.smoothed_rtt_ns * 4;
+    return by_rtt > s_min_ping_timeout_ns ? by_rtt : s_min_ping_timeout_ns;
+}
+
+static int s_ping_send(struct aws_mqtt_client_connection *connection, uint64_t now) {
+
+    struct aws_mqtt_packet_connection pingreq;
+    aws_mqtt_packet_pingreq_init(&pingreq);
+
+    struct aws_byte_buf *buf = mqtt_packet_write_begin(connection, &pingreq.fixed_header);
+    if (!buf) {
+        return AWS_OP_ERR;
+    }
+
+    if (aws_mqtt_packet_connection_encode(buf, &pingreq)) {
+        mqtt_packet_write_abort(connection);
+        return AWS_OP_ERR;
+    }
+
+    /* The round trip is timed from here, so don't let it sit in the batch */
+    if (mqtt_packet_write_end(connection) || mqtt_packet_write_flush(connection)) {
+        return AWS_OP_ERR;
     }
 
-    if (request->cancelled) {
-        /* If the request was cancelled, assume all containers are gone and just free */
-        aws_memory_pool_release(&request->connection->requests_pool, request);
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: PINGREQ sent", (void *)connection);
+    connection->keep_alive.pingreq_timestamp = now;
+
+    return AWS_OP_SUCCESS;
+}
+
+static void s_keep_alive_task(struct aws_channel_task *task, void *arg, enum aws_task_status status);
+
+static void s_keep_alive_schedule(struct aws_mqtt_client_connection *connection, uint64_t run_at) {
+
+    aws_channel_task_init(&connection->keep_alive.task, s_keep_alive_task, connection);
+    aws_channel_schedule_task_future(connection->slot->channel, &connection->keep_alive.task, run_at);
+}
+
+static void s_keep_alive_task(struct aws_channel_task *task, void *arg, enum aws_task_status status) {
+
+    (void)task;
+
+    struct aws_mqtt_client_connection *connection = arg;
+    if (status != AWS_TASK_STATUS_RUN_READY || connection->state != AWS_MQTT_CLIENT_STATE_CONNECTED) {
         return;
     }
 
-    if (status == AWS_TASK_STATUS_RUN_READY) {
-        if (!request->completed) {
-            /* If not complete, attempt retry */
-            enum aws_mqtt_client_request_state state =
-                request->send_request(request->message_id, !request->initiated, request->send_request_ud);
-
-            int error_code = AWS_OP_SUCCESS;
-            switch (state) {
-                case AWS_MQTT_CLIENT_REQUEST_ERROR:
-                    error_code = aws_last_error();
-                    /* fall-thru */
-
-                case AWS_MQTT_CLIENT_REQUEST_COMPLETE:
-                    /* If the send_request function reports the request is complete,
-                    remove from the hash table and call the callback. */
-                    request->completed = true;
-                    if (request->on_complete) {
-                        request->on_complete(
-                            request->connection, request->message_id, error_code, request->on_complete_ud);
-                    }
-                    break;
+    uint64_t now = 0;
+    aws_channel_current_clock_time(connection->slot->channel, &now);
 
-                case AWS_MQTT_CLIENT_REQUEST_ONGOING:
-                    /* Nothing to do here, just continue */
-                    break;
-            }
+    /* A ping is out, there's nothing to do but wait for it */
+    if (connection->keep_alive.pingreq_timestamp) {
+        const uint64_t timeout = s_ping_timeout_ns(connection);
+
+        /* Consumers are holding on to everything the window allows, so the PINGRESP can't get through */
+        if (s_read_window_closed(connection)) {
+            s_keep_alive_schedule(connection, now + timeout);
+            return;
+        }
+
+        /* Anything read since says the server is alive, and the PINGRESP may just be queued behind more of it. So
+         * the wait starts over from the last read, or from when the window last opened. */
+        uint64_t since = connection->keep_alive.pingreq_timestamp;
+        if (since < connection->keep_alive.last_read_timestamp) {
+            since = connection->keep_alive.last_read_timestamp;
+        }
+        if (since < connection->keep_alive.window_opened_timestamp) {
+            since = connection->keep_alive.window_opened_timestamp;
+        }
+
+        if (now - since >= timeout) {
+            AWS_MQTT_LOGF_WARN(
+                AWS_LS_MQTT_CLIENT,
+                "id=%p: No PINGRESP within %d ms, closing the connection",
+                (void *)connection,
+                (int)aws_timestamp_convert(timeout, AWS_TIMESTAMP_NANOS, AWS_TIMESTAMP_MILLIS, NULL));
+            mqtt_disconnect_impl(connection, AWS_ERROR_MQTT_TIMEOUT);
+            return;
         }
-        request->initiated = true;
+        s_keep_alive_schedule(connection, since + timeout);
+        return;
+    }
+
+    /* Traffic both ways says the connection is alive. Writing alone says nothing, a hung server just never answers. */
+    const uint64_t last_write = connection->keep_alive.last_write_timestamp;
+    const uint64_t last_read = connection->keep_alive.last_read_timestamp;
+    const uint64_t due = (last_write < last_read ? last_write : last_read) + s_keep_alive_interval_ns(connection);
+    if (now < due) {
+        s_keep_alive_schedule(connection, due);
+        return;
+    }
+
+    if (s_ping_send(connection, now)) {
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT, "id=%p: Failed to send PINGREQ, error %d", (void *)connection, aws_last_error());
+        s_keep_alive_schedule(connection, now + s_keep_alive_interval_ns(connection));
+        return;
+    }
 
-        if (request->completed) {
-            /* If complete, remove request from outstanding list and return to pool */
+    s_keep_alive_schedule(connection, now + s_ping_timeout_ns(connection));
+}
 
-            struct aws_hash_element elem;
-            int was_present = 0;
+static void s_keep_alive_start(struct aws_mqtt_client_connection *connection) {
 
-            aws_mutex_lock(&request->connection->outstanding_requests.mutex);
+    uint64_t now = 0;
+    aws_channel_current_clock_time(connection->slot->channel, &now);
 
-            aws_hash_table_remove(
-                &request->connection->outstanding_requests.table, &request->message_id, &elem, &was_present);
+    connection->keep_alive.last_write_timestamp = now;
+    connection->keep_alive.last_read_timestamp = now;
+    connection->keep_alive.pingreq_timestamp = 0;
+    connection->keep_alive.window_opened_timestamp = 0;
+    s_keep_alive_schedule(connection, now + s_keep_alive_interval_ns(connection));
+}
 
-            aws_mutex_unlock(&request->connection->outstanding_requests.mutex);
+static void s_keep_alive_ping_now_task(struct aws_channel_task *task, void *arg, enum aws_task_status status) {
 
-            AWS_ASSERT(was_present);
+    (void)task;
 
-            aws_memory_pool_release(&request->connection->requests_pool, elem.value);
-        } else if (request->connection->state == AWS_MQTT_CLIENT_STATE_CONNECTED) {
-            /* If not complete and online, schedule retry task */
+    struct aws_mqtt_client_connection *connection = arg;
 
-            uint64_t ttr = 0;
-            aws_channel_current_clock_time(request->connection->slot->channel, &ttr);
-            ttr += request->connection->request_timeout_ns;
+    aws_atomic_store_int(&connection->keep_alive.ping_now_scheduled, false);
 
-            aws_channel_schedule_task_future(request->connection->slot->channel, task, ttr);
-        } else {
-            /* Else, put the task in the pending list */
+    /* Its timeout is checked the next time the keep-alive task runs, which is at most an interval away */
+    if (status == AWS_TASK_STATUS_RUN_READY && connection->state == AWS_MQTT_CLIENT_STATE_CONNECTED &&
+        !connection->keep_alive.pingreq_timestamp) {
 
-            aws_mutex_lock(&request->connection->pending_requests.mutex);
-            aws_linked_list_push_back(&request->connection->pending_requests.list, &request->list_node);
-            aws_mutex_unlock(&request->connection->pending_requests.mutex);
+        uint64_t now = 0;
+        aws_channel_current_clock_time(connection->slot->channel, &now);
+        if (s_ping_send(connection, now)) {
+            AWS_MQTT_LOGF_ERROR(
+                AWS_LS_MQTT_CLIENT, "id=%p: Failed to send PINGREQ, error %d", (void *)connection, aws_last_error());
         }
     }
 }
 
-uint16_t mqtt_create_request(
-    struct aws_mqtt_client_connection *connection,
-    aws_mqtt_send_request_fn *send_request,
-    void *send_request_ud,
-    aws_mqtt_op_complete_fn *on_complete,
-    void *on_complete_ud) {
+void mqtt_keep_alive_ping_now(struct aws_mqtt_client_connection *connection) {
 
-    AWS_ASSERT(connection);
-    AWS_ASSERT(send_request);
+    mqtt_schedule_task_once(
+        connection,
+        &connection->keep_alive.ping_now_scheduled,
+        &connection->keep_alive.ping_now_task,
+        s_keep_alive_ping_now_task,
+        0);
+}
 
-    struct aws_mqtt_outstanding_request *next_request = aws_memory_pool_acquire(&connection->requests_pool);
-    if (!next_request) {
-        return 0;
-    }
-    memset(next_request, 0, sizeof(struct aws_mqtt_outstanding_request));
+/*******************************************************************************
+ * Read Window
+ ******************************************************************************/
+
+/* Account for holds and releases made since the last time, returning the credit the releases give back */
+static size_t s_read_window_collect(struct aws_mqtt_client_connection *connection) {
 
-    struct aws_hash_element *elem = NULL;
-    uint16_t next_id = 0;
+    const size_t holds = aws_atomic_exchange_int(&connection->read_window.pending_holds, 0);
+    const size_t releases = aws_atomic_exchange_int(&connection->read_window.pending_releases, 0);
 
-    aws_mutex_lock(&connection->outstanding_requests.mutex);
-    do {
+    connection->read_window.held += holds;
+    connection->read_window.debt += holds;
 
-        ++next_id;
-        aws_hash_table_find(&connection->outstanding_requests.table, &next_id, &elem);
+    /* Releasing more than is held can only be a consumer's mistake, don't let it open the window further */
+    const size_t released = releases < connection->read_window.held ? releases : connection->read_window.held;
+    connection->read_window.held -= released;
 
-    } while (elem);
+    /* Bytes read from an earlier channel were never part of this one's window */
+    const size_t stale = released < connection->read_window.stale ? released : connection->read_window.stale;
+    connection->read_window.stale -= stale;
 
-    AWS_ASSERT(next_id); /* Somehow have UINT16_MAX outstanding requests, definitely a bug */
-    next_request->message_id = next_id;
+    return released - stale;
+}
 
-    /* Store the request by message_id */
-    if (aws_hash_table_put(&connection->outstanding_requests.table, &next_request->message_id, next_request, NULL)) {
+/* Whether everything the window allows is being held by consumers, as of the last update */
+static bool s_read_window_closed(const struct aws_mqtt_client_connection *connection) {
 
-        aws_memory_pool_release(&connection->requests_pool, next_request);
-        return 0;
+    if (!connection->read_window.initial) {
+        return false;
     }
 
-    aws_mutex_unlock(&connection->outstanding_requests.mutex);
+    /* Held bytes already kept out of this channel's window, against its size */
+    const size_t held = connection->read_window.held;
+    const size_t not_kept_out = connection->read_window.stale + connection->read_window.debt;
+    return held >= not_kept_out && held - not_kept_out >= connection->read_window.size;
+}
 
-    next_request->allocator = connection->allocator;
-    next_request->connection = connection;
-    next_request->initiated = false;
-    next_request->completed = false;
-    next_request->send_request = send_request;
-    next_request->send_request_ud = send_request_ud;
-    next_request->on_complete = on_complete;
-    next_request->on_complete_ud = on_complete_ud;
+/* Give credit back to the channel, less whatever consumers are holding on to, and widen the window if they're keeping
+ * up. Channel's thread only. */
+static void s_read_window_update(struct aws_mqtt_client_connection *connection, size_t credit) {
 
-    aws_channel_task_init(&next_request->timeout_task, s_request_timeout_task, next_request);
+    const bool was_closed = s_read_window_closed(connection);
+    credit += s_read_window_collect(connection);
 
-    /* Send the request now if on channel's thread, otherwise schedule a task */
-    if (connection->state != AWS_MQTT_CLIENT_STATE_CONNECTED) {
-        aws_mutex_lock(&connection->pending_requests.mutex);
-        aws_linked_list_push_back(&connection->pending_requests.list, &next_request->list_node);
-        aws_mutex_unlock(&connection->pending_requests.mutex);
-    } else if (aws_channel_thread_is_callers_thread(connection->slot->channel)) {
-        s_request_timeout_task(&next_request->timeout_task, next_request, AWS_TASK_STATUS_RUN_READY);
-    } else {
-        aws_channel_schedule_task_now(connection->slot->channel, &next_request->timeout_task);
+    const size_t paid = credit < connection->read_window.debt ? credit : connection->read_window.debt;
+    credit -= paid;
+    connection->read_window.debt -= paid;
+
+    const size_t size = connection->read_window.size;
+    if (size < connection->read_window.max && connection->read_window.read_since_growth >= size &&
+        connection->read_window.held <= size / 2) {
+
+        const size_t growth = connection->read_window.max - size < size ? connection->read_window.max - size : size;
+        connection->read_window.size += growth;
+        connection->read_window.read_since_growth = 0;
+        credit += growth;
+
+        AWS_MQTT_LOGF_TRACE(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Read window grew to %d bytes",
+            (void *)connection,
+            (int)connection->read_window.size);
     }
 
-    return next_request->message_id;
+    if (credit && connection->slot) {
+        aws_channel_slot_increment_read_window(connection->slot, credit);
+
+        /* Nothing could be read while it was closed, which the keep-alive mustn't hold against the server */
+        if (was_closed) {
+            aws_channel_current_clock_time(connection->slot->channel, &connection->keep_alive.window_opened_timestamp);
+        }
+    }
 }
 
-void mqtt_request_complete(struct aws_mqtt_client_connection *connection, int error_code, uint16_t message_id) {
+static void s_read_window_update_task(struct aws_channel_task *task, void *arg, enum aws_task_status status) {
 
-    struct aws_hash_element *elem = NULL;
-    aws_mutex_lock(&connection->outstanding_requests.mutex);
+    (void)task;
 
-    aws_hash_table_find(&connection->outstanding_requests.table, &message_id, &elem);
-    AWS_ASSERT(elem);
+    struct aws_mqtt_client_connection *connection = arg;
+
+    /* Clear the flag before updating, so anything released from here on schedules the next run */
+    aws_atomic_store_int(&connection->read_window.update_scheduled, false);
 
-    aws_mutex_unlock(&connection->outstanding_requests.mutex);
+    /* If cancelled, the channel is going away. The next one's reset accounts for what's pending. */
+    if (status == AWS_TASK_STATUS_RUN_READY) {
+        s_read_window_update(connection, 0);
+    }
+}
 
-    struct aws_mqtt_outstanding_request *request = elem->value;
+void mqtt_read_window_reset(struct aws_mqtt_client_connection *connection) {
 
-    /* Alert the user */
-    if (request->on_complete) {
-        request->on_complete(request->connection, request->message_id, error_code, request->on_complete_ud);
+    if (!connection->read_window.initial) {
+        return;
+    }
+
+    s_read_window_collect(connection);
+
+    /* What's still held was read from an earlier channel, releasing it mustn't open this one's window */
+    connection->read_window.stale = connection->read_window.held;
+    connection->read_window.debt = 0;
+    connection->read_window.size = connection->read_window.initial;
+    connection->read_window.read_since_growth = 0;
+}
+
+void mqtt_read_window_hold(struct aws_mqtt_client_connection *connection, size_t size) {
+
+    if (connection->read_window.initial && size) {
+        /* Comes out of the next credit given back, on the channel's thread */
+        aws_atomic_fetch_add(&connection->read_window.pending_holds, size);
+    }
+}
+
+void mqtt_read_window_release(struct aws_mqtt_client_connection *connection, size_t size) {
+
+    if (!connection->read_window.initial || !size) {
+        return;
+    }
+
+    aws_atomic_fetch_add(&connection->read_window.pending_releases, size);
+
+    /* If there's no channel, the next one's reset picks it up */
+    mqtt_schedule_task_once(
+        connection,
+        &connection->read_window.update_scheduled,
+        &connection->read_window.update_task,
+        s_read_window_update_task,
+        0);
+}
+
+/*******************************************************************************
+ * Write Batching
+ ******************************************************************************/
+
+/* Upper bound on a packet's encoded size: the type byte, up to 4 bytes of remaining length, then the rest */
+static size_t s_max_packet_size(const struct aws_mqtt_fixed_header *header) {
+    return 5 + header->remaining_length;
+}
+
+/* Exact encoded size of a packet */
+static size_t s_packet_size(const struct aws_mqtt_fixed_header *header) {
+
+    const size_t length = header->remaining_length;
+    const size_t length_size = length < 128 ? 1 : length < 16384 ? 2 : length < 2097152 ? 3 : 4;
+    return 1 + length_size + length;
+}
+
+/* Batch size used for replay bursts when the connection has batching off (or smaller), since each burst is written
+ * all at once anyway */
+static const size_t s_replay_batch_bytes = 16 * 1024;
+
+static void s_write_batch_discard(struct aws_mqtt_client_connection *connection) {
+
+    struct aws_io_message *message = connection->write_batch.message;
+    if (message) {
+        aws_mem_release(message->allocator, message);
+        connection->write_batch.message = NULL;
+    }
+}
+
+static void s_write_batch_flush_task(struct aws_channel_task *task, void *arg, enum aws_task_status status) {
+
+    (void)task;
+
+    struct aws_mqtt_client_connection *connection = arg;
+    connection->write_batch.flush_scheduled = false;
+
+    if (status == AWS_TASK_STATUS_RUN_READY) {
+        mqtt_packet_write_flush(connection);
+    } else {
+        /* The channel is going away, nothing in the batch can be sent anymore */
+        s_write_batch_discard(connection);
+    }
+}
+
+static void s_write_batch_schedule_flush(struct aws_mqtt_client_connection *connection) {
+
+    if (connection->write_batch.flush_scheduled) {
+        return;
+    }
+
+    struct aws_channel *channel = connection->slot->channel;
+    aws_channel_task_init(&connection->write_batch.flush_task, s_write_batch_flush_task, connection);
+
+    if (connection->write_batch.max_delay_ns) {
+        uint64_t flush_time = 0;
+        aws_channel_current_clock_time(channel, &flush_time);
+        flush_time += connection->write_batch.max_delay_ns;
+        aws_channel_schedule_task_future(channel, &connection->write_batch.flush_task, flush_time);
+    } else {
+        aws_channel_schedule_task_now(channel, &connection->write_batch.flush_task);
+    }
+    connection->write_batch.flush_scheduled = true;
+}
+
+int mqtt_packet_write_flush(struct aws_mqtt_client_connection *connection) {
+
+    AWS_ASSERT(!connection->write_batch.open_message);
+
+    struct aws_io_message *message = connection->write_batch.message;
+    if (!message || !message->message_data.len) {
+        return AWS_OP_SUCCESS;
+    }
+    connection->write_batch.message = NULL;
+
+    if (aws_channel_slot_send_message(connection->slot, message, AWS_CHANNEL_DIR_WRITE)) {
+
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Failed to send batched packets upstream, error %d",
+            (void *)connection,
+            aws_last_error());
+        aws_mem_release(message->allocator, message);
+        return AWS_OP_ERR;
+    }
+    aws_channel_current_clock_time(connection->slot->channel, &connection->keep_alive.last_write_timestamp);
+
+    return AWS_OP_SUCCESS;
+}
+
+struct aws_byte_buf *mqtt_packet_write_begin(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_mqtt_fixed_header *header) {
+
+    AWS_ASSERT(!connection->write_batch.open_message);
+
+    if (!connection->write_batch.packet_bytes_left) {
+        /* Not the continuation of a packet that's already been partly sent */
+        connection->write_batch.packet_bytes_left = s_packet_size(header);
+        connection->write_batch.packet_type = header->packet_type;
+    }
+
+    const size_t packet_size = s_max_packet_size(header);
+
+    size_t batch_bytes = connection->write_batch.max_bytes;
+    if (connection->replay.in_burst && batch_bytes < s_replay_batch_bytes) {
+        batch_bytes = s_replay_batch_bytes;
+    }
+
+    if (packet_size <= batch_bytes) {
+
+        struct aws_io_message *batch = connection->write_batch.message;
+        if (batch && batch->message_data.capacity - batch->message_data.len < packet_size) {
+            /* Doesn't fit, send what's there and start a new batch. A failure is logged, and retries will resend. */
+            mqtt_packet_write_flush(connection);
+            batch = connection->write_batch.message;
+        }
+
+        if (!batch) {
+            batch = aws_channel_acquire_message_from_pool(
+                connection->slot->channel, AWS_IO_MESSAGE_APPLICATION_DATA, batch_bytes);
+            connection->write_batch.message = batch;
+        }
+
+        if (batch && batch->message_data.capacity - batch->message_data.len >= packet_size) {
+            connection->write_batch.open_message = batch;
+            connection->write_batch.open_start = batch->message_data.len;
+            return &batch->message_data;
+        }
+
+        /* The pool couldn't provide a big enough message, send this packet by itself */
+    }
+
+    /* Send anything already batched first, so packets go out in the order they were written */
+    mqtt_packet_write_flush(connection);
+
+    struct aws_io_message *message = mqtt_get_message_for_packet(connection, header);
+    if (!message) {
+        connection->write_batch.packet_bytes_left = 0;
+        return NULL;
+    }
+
+    connection->write_batch.open_message = message;
+    connection->write_batch.open_start = 0;
+    return &message->message_data;
+}
+
+int mqtt_packet_write_end(struct aws_mqtt_client_connection *connection) {
+
+    struct aws_io_message *message = connection->write_batch.open_message;
+    AWS_ASSERT(message);
+    connection->write_batch.open_message = NULL;
+
+    const size_t written = message->message_data.len - connection->write_batch.open_start;
+
+    if (message == connection->write_batch.message) {
+        /* Wait a little for more packets to fill up the message */
+        s_stats_count_sent(connection, written);
+        s_write_batch_schedule_flush(connection);
+        return AWS_OP_SUCCESS;
+    }
+
+    if (aws_channel_slot_send_message(connection->slot, message, AWS_CHANNEL_DIR_WRITE)) {
+        aws_mem_release(message->allocator, message);
+        connection->write_batch.packet_bytes_left = 0;
+        return AWS_OP_ERR;
+    }
+    s_stats_count_sent(connection, written);
+    aws_channel_current_clock_time(connection->slot->channel, &connection->keep_alive.last_write_timestamp);
+
+    return AWS_OP_SUCCESS;
+}
+
+void mqtt_packet_write_abort(struct aws_mqtt_client_connection *connection) {
+
+    struct aws_io_message *message = connection->write_batch.open_message;
+    if (!message) {
+        return;
+    }
+    connection->write_batch.open_message = NULL;
+    connection->write_batch.packet_bytes_left = 0;
+
+    if (message == connection->write_batch.message) {
+        /* Drop only this packet, the ones before it are still good */
+        message->message_data.len = connection->write_batch.open_start;
+    } else {
+        aws_mem_release(message->allocator, message);
+    }
+}
+
+/*******************************************************************************
+ * Requests
+ ******************************************************************************/
+
+/* Stop counting a request's bytes as queued, once they've been written or given up on */
+static void s_request_dequeue_bytes(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_mqtt_outstanding_request *request) {
+
+    if (request->queued_bytes) {
+        aws_atomic_fetch_sub(&connection->queued_bytes, request->queued_bytes);
+        request->queued_bytes = 0;
+    }
+}
+
+void mqtt_request_release(struct aws_mqtt_client_connection *connection, struct aws_mqtt_outstanding_request *request) {
+
+    s_request_dequeue_bytes(connection, request);
+
+    if (request->from_pool) {
+        aws_memory_pool_release(&connection->requests_pool, request);
+    } else {
+        aws_mqtt_recycle_pool_release(&connection->shared_requests_pool, request);
+    }
+}
+
+/* Take a request out of the outstanding table and free it, once it's done */
+static void s_request_finish(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_mqtt_outstanding_request *request) {
+
+    struct aws_mqtt_outstanding_request *removed =
+        aws_mqtt_packet_id_table_remove(&connection->outstanding_requests, request->message_id);
+    if (removed) {
+        aws_mqtt_packet_id_allocator_release(&connection->packet_ids, request->message_id);
+    }
+
+    AWS_ASSERT(removed == request);
+
+    const bool windowed = request->windowed;
+    mqtt_request_release(connection, request);
+
+    if (windowed) {
+        AWS_ASSERT(connection->window.in_flight > 0);
+        --connection->window.in_flight;
+        s_window_drain(connection);
+    }
+}
+
+static void s_retry_task(struct aws_channel_task *task, void *arg, enum aws_task_status status);
+
+static void s_schedule_retry_task(struct aws_mqtt_client_connection *connection) {
+
+    if (connection->retries.task_timestamp || aws_linked_list_empty(&connection->retries.list)) {
+        /* Already scheduled, no later than the front request is due since nothing is ever due earlier than that */
+        return;
+    }
+
+    struct aws_mqtt_outstanding_request *front = AWS_CONTAINER_OF(
+        aws_linked_list_front(&connection->retries.list), struct aws_mqtt_outstanding_request, list_node);
+
+    connection->retries.task_timestamp = front->retry_timestamp;
+    aws_channel_task_init(&connection->retries.task, s_retry_task, connection);
+    aws_channel_schedule_task_future(connection->slot->channel, &connection->retries.task, front->retry_timestamp);
+}
+
+/* Second half of a QoS 2 publish, once PUBREC has arrived */
+static enum aws_mqtt_client_request_state s_pubrel_send(
+    struct aws_mqtt_client_connection *connection,
+    uint16_t message_id) {
+
+    AWS_MQTT_LOGF_TRACE(
+        AWS_LS_MQTT_CLIENT, "id=%p: Sending PUBREL for publish %" PRIu16, (void *)connection, message_id);
+
+    struct aws_mqtt_packet_ack pubrel;
+    aws_mqtt_packet_pubrel_init(&pubrel, message_id);
+    if (s_send_ack(connection, &pubrel)) {
+        return AWS_MQTT_CLIENT_REQUEST_ERROR;
+    }
+
+    return AWS_MQTT_CLIENT_REQUEST_ONGOING;
+}
+
+/* Send a request (again) unless it's complete, then wait for it to complete, retry or finish it.
+ * is_retry is set when it was sent before and its ack never came, either in time or before the connection was lost. */
+static void s_request_send(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_mqtt_outstanding_request *request,
+    bool is_retry) {
+
+    const bool is_first_attempt = !request->initiated;
+
+    if (!request->completed) {
+        /* If not complete, attempt retry */
+        enum aws_mqtt_client_request_state state =
+            request->released
+                ? s_pubrel_send(connection, request->message_id)
+                : request->send_request(request->message_id, !request->initiated, request->send_request_ud);
+        if (is_first_attempt) {
+            s_request_dequeue_bytes(connection, request);
+        }
+
+        int error_code = AWS_OP_SUCCESS;
+        switch (state) {
+            case AWS_MQTT_CLIENT_REQUEST_ERROR:
+                error_code = aws_last_error();
+                /* fall-thru */
+
+            case AWS_MQTT_CLIENT_REQUEST_COMPLETE:
+                /* If the send_request function reports the request is complete,
+                remove from the hash table and call the callback. */
+                request->completed = true;
+                if (request->on_complete) {
+                    request->on_complete(connection, request->message_id, error_code, request->on_complete_ud);
+                }
+                break;
+
+            case AWS_MQTT_CLIENT_REQUEST_ONGOING:
+                /* Only count what actually went out again */
+                if (is_retry) {
+                    s_stats_add(&connection->stats.retries, 1);
+                }
+                break;
+        }
+    }
+    request->initiated = true;
+
+    if (request->completed) {
+        /* If complete, remove request from outstanding list and return to pool */
+        s_request_finish(connection, request);
+
+    } else if (connection->state == AWS_MQTT_CLIENT_STATE_CONNECTED) {
+        /* If not complete and online, wait for the retry */
+
+        uint64_t now = 0;
+        aws_channel_current_clock_time(connection->slot->channel, &now);
+        request->retry_timestamp = now + connection->request_timeout_ns;
+        if (is_first_attempt) {
+            request->sent_timestamp = now;
+        }
+
+        /* Everything already queued was queued earlier with the same timeout, so the list stays in order */
+        AWS_ASSERT(
+            aws_linked_list_empty(&connection->retries.list) ||
+            AWS_CONTAINER_OF(
+                aws_linked_list_back(&connection->retries.list), struct aws_mqtt_outstanding_request, list_node)
+                    ->retry_timestamp <= request->retry_timestamp);
+
+        aws_linked_list_push_back(&connection->retries.list, &request->list_node);
+        request->retrying = true;
+        s_schedule_retry_task(connection);
+
+    } else {
+        /* Else, put the task in the pending list */
+
+        s_pending_requests_push(connection, request);
+    }
+}
+
+static void s_retry_task(struct aws_channel_task *task, void *arg, enum aws_task_status status) {
+
+    (void)task;
+
+    struct aws_mqtt_client_connection *connection = arg;
+    connection->retries.task_timestamp = 0;
+
+    if (status == AWS_TASK_STATUS_CANCELED) {
+        /* If task cancelled, the channel is going away. Park whatever is still waiting to be resent on the next
+         * CONNACK, if the table lets go of it first (on disconnect) it's freed from there instead. */
+        while (!aws_linked_list_empty(&connection->retries.list)) {
+            struct aws_mqtt_outstanding_request *request = AWS_CONTAINER_OF(
+                aws_linked_list_pop_front(&connection->retries.list), struct aws_mqtt_outstanding_request, list_node);
+            request->retrying = false;
+
+            if (request->cancelled) {
+                /* If the table already let go of the request, assume all containers are gone and just free */
+                mqtt_request_release(connection, request);
+            } else {
+                s_pending_requests_push(connection, request);
+            }
+        }
+        return;
+    }
+
+    uint64_t now = 0;
+    aws_channel_current_clock_time(connection->slot->channel, &now);
+
+    /* Take everything that's due first, so nothing resent here can come around again in the same run */
+    struct aws_linked_list due;
+    aws_linked_list_init(&due);
+    while (!aws_linked_list_empty(&connection->retries.list)) {
+        struct aws_linked_list_node *node = aws_linked_list_front(&connection->retries.list);
+        struct aws_mqtt_outstanding_request *request =
+            AWS_CONTAINER_OF(node, struct aws_mqtt_outstanding_request, list_node);
+        if (request->retry_timestamp > now) {
+            break;
+        }
+
+        aws_linked_list_pop_front(&connection->retries.list);
+        request->retrying = false;
+        aws_linked_list_push_back(&due, node);
+    }
+
+    while (!aws_linked_list_empty(&due)) {
+        struct aws_mqtt_outstanding_request *request =
+            AWS_CONTAINER_OF(aws_linked_list_pop_front(&due), struct aws_mqtt_outstanding_request, list_node);
+        s_request_send(connection, request, true);
+    }
+
+    s_schedule_retry_task(connection);
+}
+
+static void s_replay_task(struct aws_channel_task *task, void *arg, enum aws_task_status status);
+
+/* Resend up to burst_size requests from the front of the replay list, coalesced into as few writes as possible, and
+ * schedule the next burst if any are left */
+static void s_replay_burst(struct aws_mqtt_client_connection *connection) {
+
+    const size_t burst_size = connection->replay.burst_size;
+
+    connection->replay.in_burst = true;
+    for (size_t sent = 0; !aws_linked_list_empty(&connection->replay.list) && (!burst_size || sent < burst_size);) {
+        struct aws_mqtt_outstanding_request *request = AWS_CONTAINER_OF(
+            aws_linked_list_pop_front(&connection->replay.list), struct aws_mqtt_outstanding_request, list_node);
+
+        if (request->cancelled) {
+            /* The outstanding table already let go of it while offline */
+            mqtt_request_release(connection, request);
+        } else {
+            s_request_send(connection, request, request->initiated);
+            ++sent;
+        }
+    }
+    connection->replay.in_burst = false;
+
+    /* The burst won't get any bigger, so don't wait out the batch delay */
+    mqtt_packet_write_flush(connection);
+
+    if (aws_linked_list_empty(&connection->replay.list)) {
+        return;
+    }
+
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: Replay burst sent, scheduling the next one", (void *)connection);
+
+    struct aws_channel *channel = connection->slot->channel;
+    aws_channel_task_init(&connection->replay.task, s_replay_task, connection);
+    if (connection->replay.burst_interval_ns) {
+        uint64_t now = 0;
+        aws_channel_current_clock_time(channel, &now);
+        aws_channel_schedule_task_future(channel, &connection->replay.task, now + connection->replay.burst_interval_ns);
+    } else {
+        aws_channel_schedule_task_now(channel, &connection->replay.task);
+    }
+    connection->replay.scheduled = true;
+}
+
+static void s_replay_task(struct aws_channel_task *task, void *arg, enum aws_task_status status) {
+
+    (void)task;
+
+    struct aws_mqtt_client_connection *connection = arg;
+    connection->replay.scheduled = false;
+
+    if (status == AWS_TASK_STATUS_CANCELED) {
+        /* The channel is going away, park the rest for the next CONNACK like the retry task does */
+        while (!aws_linked_list_empty(&connection->replay.list)) {
+            struct aws_mqtt_outstanding_request *request = AWS_CONTAINER_OF(
+                aws_linked_list_pop_front(&connection->replay.list), struct aws_mqtt_outstanding_request, list_node);
+
+            if (request->cancelled) {
+                mqtt_request_release(connection, request);
+            } else {
+                s_pending_requests_push(connection, request);
+            }
+        }
+        return;
+    }
+
+    s_replay_burst(connection);
+}
+
+/* Take over requests parked while offline and start resending them, in the order they were parked */
+static void s_replay_start(struct aws_mqtt_client_connection *connection, struct aws_linked_list *requests) {
+
+    /* Whatever the last channel didn't get to was parked again when its task was cancelled */
+    AWS_ASSERT(aws_linked_list_empty(&connection->replay.list));
+    AWS_ASSERT(!connection->replay.scheduled);
+
+    if (aws_linked_list_empty(requests)) {
+        return;
+    }
+
+    aws_linked_list_swap_contents(&connection->replay.list, requests);
+    s_replay_burst(connection);
+}
+
+/* Store a new request by its message_id and start it (or park it until connected). Channel's thread only. */
+static int s_request_admit(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_mqtt_outstanding_request *request) {
+
+    if (aws_mqtt_packet_id_table_put(&connection->outstanding_requests, request->message_id, request)) {
+        return AWS_OP_ERR;
+    }
+
+    if (request->windowed) {
+        ++connection->window.in_flight;
+    }
+
+    if (connection->state != AWS_MQTT_CLIENT_STATE_CONNECTED) {
+        s_pending_requests_push(connection, request);
+    } else if (!aws_linked_list_empty(&connection->replay.list)) {
+        /* Behind the session still being replayed, so nothing overtakes what was sent before the reconnect */
+        aws_linked_list_push_back(&connection->replay.list, &request->list_node);
+    } else {
+        s_request_send(connection, request, false);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static bool s_window_has_room(const struct aws_mqtt_client_connection *connection) {
+    return !connection->window.max || connection->window.in_flight < connection->window.max;
+}
+
+/* Admit a request, unless it has to wait behind the in-flight window. Channel's thread only. */
+static int s_request_start(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_mqtt_outstanding_request *request) {
+
+    /* Anything already waiting goes first, so windowed requests are still sent in the order they were made */
+    if (request->windowed && (!aws_linked_list_empty(&connection->window.queue) || !s_window_has_room(connection))) {
+        aws_linked_list_push_back(&connection->window.queue, &request->list_node);
+        connection->window.blocked = true;
+        return AWS_OP_SUCCESS;
+    }
+
+    return s_request_admit(connection, request);
+}
+
+/* The caller already has the message_id of a request that was accepted, so failing to start it can only be
+ * reported through on_complete */
+static void s_request_fail_start(
+    struct aws_mqtt_client_connection *connection,
+    struct aws_mqtt_outstanding_request *request) {
+
+    const int error_code = aws_last_error();
+
+    AWS_MQTT_LOGF_ERROR(
+        AWS_LS_MQTT_CLIENT,
+        "id=%p: Failed to start request %" PRIu16 ", error %d",
+        (void *)connection,
+        request->message_id,
+        error_code);
+
+    if (request->on_complete) {
+        request->on_complete(connection, request->message_id, error_code, request->on_complete_ud);
+    }
+    aws_mqtt_packet_id_allocator_release(&connection->packet_ids, request->message_id);
+    mqtt_request_release(connection, request);
+}
+
+static void s_window_drain(struct aws_mqtt_client_connection *connection) {
+
+    if (connection->window.draining) {
+        return;
+    }
+    connection->window.draining = true;
+
+    while (!aws_linked_list_empty(&connection->window.queue) && s_window_has_room(connection)) {
+        struct aws_mqtt_outstanding_request *request = AWS_CONTAINER_OF(
+            aws_linked_list_pop_front(&connection->window.queue), struct aws_mqtt_outstanding_request, list_node);
+
+        if (s_request_admit(connection, request)) {
+            s_request_fail_start(connection, request);
+        }
+    }
+
+    connection->window.draining = false;
+
+    if (connection->window.blocked && aws_linked_list_empty(&connection->window.queue)) {
+        connection->window.blocked = false;
+        MQTT_CLIENT_CALL_CALLBACK(connection, on_window_available);
+    }
+}
+
+void mqtt_submit_queued_requests(struct aws_mqtt_client_connection *connection) {
+
+    struct aws_mqtt_mpsc_queue_node *node = NULL;
+    while ((node = aws_mqtt_mpsc_queue_pop(&connection->submissions.queue))) {
+
+        struct aws_mqtt_outstanding_request *request =
+            AWS_CONTAINER_OF(node, struct aws_mqtt_outstanding_request, submission_node);
+
+        if (s_request_start(connection, request)) {
+            s_request_fail_start(connection, request);
+        }
+    }
+
+    /* If a producer was caught mid-push, it hasn't checked drain_scheduled yet and will schedule another drain */
+}
+
+static void s_submission_drain_task(struct aws_channel_task *task, void *arg, enum aws_task_status status) {
+
+    (void)task;
+
+    struct aws_mqtt_client_connection *connection = arg;
+
+    /* Clear the flag before draining, so anything pushed from here on schedules the next run */
+    aws_atomic_store_int(&connection->submissions.drain_scheduled, false);
+
+    /* If cancelled, the channel is going away. Leave the queue for the next CONNACK. */
+    if (status == AWS_TASK_STATUS_RUN_READY) {
+        mqtt_submit_queued_requests(connection);
+    }
+}
+
+/* Whatever the state, as it may change right after the push. Without a channel, the next CONNACK drains instead. */
+static void s_schedule_submission_drain(struct aws_mqtt_client_connection *connection) {
+    mqtt_schedule_task_once(
+        connection,
+        &connection->submissions.drain_scheduled,
+        &connection->submissions.drain_task,
+        s_submission_drain_task,
+        0);
+}
+
+/* Reserve an id and memory for a request, without starting it */
+static struct aws_mqtt_outstanding_request *s_request_new(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_mqtt_request_options *options,
+    bool on_channel_thread) {
+
+    AWS_ASSERT(options->send_request);
+
+    uint16_t message_id = aws_mqtt_packet_id_allocator_acquire(&connection->packet_ids);
+    if (!message_id) {
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_CLIENT, "id=%p: No packet ids available, too many outstanding requests", (void *)connection);
+        return NULL;
+    }
+
+    /* requests_pool isn't thread safe, so it's only used from the channel's thread */
+    struct aws_mqtt_outstanding_request *next_request = NULL;
+    if (on_channel_thread) {
+        next_request = aws_memory_pool_acquire(&connection->requests_pool);
+    } else {
+        next_request = aws_mqtt_recycle_pool_acquire(&connection->shared_requests_pool);
+    }
+    if (!next_request) {
+        aws_mqtt_packet_id_allocator_release(&connection->packet_ids, message_id);
+        return NULL;
+    }
+    memset(next_request, 0, sizeof(struct aws_mqtt_outstanding_request));
+
+    next_request->allocator = connection->allocator;
+    next_request->connection = connection;
+    next_request->message_id = message_id;
+    next_request->from_pool = on_channel_thread;
+    next_request->initiated = false;
+    next_request->completed = false;
+    next_request->send_request = options->send_request;
+    next_request->send_request_ud = options->send_request_ud;
+    next_request->on_complete = options->on_complete;
+    next_request->on_complete_ud = options->on_complete_ud;
+    next_request->windowed = options->windowed;
+    next_request->queued_bytes = options->queued_bytes;
+    next_request->complete_on_drop = options->complete_on_drop;
+    aws_atomic_fetch_add(&connection->queued_bytes, options->queued_bytes);
+
+    return next_request;
+}
+
+static bool s_is_on_channel_thread(struct aws_mqtt_client_connection *connection) {
+
+    aws_mutex_lock(&connection->shared_channel.lock);
+    struct aws_channel *channel = connection->shared_channel.channel;
+    const bool on_channel_thread = channel && aws_channel_thread_is_callers_thread(channel);
+    aws_mutex_unlock(&connection->shared_channel.lock);
+
+    return on_channel_thread;
+}
+
+uint16_t mqtt_create_request(
+    struct aws_mqtt_client_connection *connection,
+    aws_mqtt_send_request_fn *send_request,
+    void *send_request_ud,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *on_complete_ud,
+    bool windowed,
+    size_t queued_bytes) {
+
+    const struct aws_mqtt_request_options options = {
+        .send_request = send_request,
+        .send_request_ud = send_request_ud,
+        .on_complete = on_complete,
+        .on_complete_ud = on_complete_ud,
+        .windowed = windowed,
+        .queued_bytes = queued_bytes,
+    };
+    return mqtt_create_request_with_options(connection, &options);
+}
+
+uint16_t mqtt_create_request_with_options(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_mqtt_request_options *options) {
+
+    AWS_ASSERT(connection);
+    AWS_ASSERT(options);
+    AWS_ASSERT(options->send_request);
+    AWS_ASSERT(options->on_complete || !options->complete_on_drop);
+
+    const bool on_channel_thread = s_is_on_channel_thread(connection);
+
+    struct aws_mqtt_outstanding_request *next_request = s_request_new(connection, options, on_channel_thread);
+    if (!next_request) {
+        return 0;
+    }
+    const uint16_t message_id = next_request->message_id;
+
+    if (on_channel_thread) {
+        /* Send the request now if on channel's thread */
+        if (s_request_start(connection, next_request)) {
+            aws_mqtt_packet_id_allocator_release(&connection->packet_ids, message_id);
+            mqtt_request_release(connection, next_request);
+            return 0;
+        }
+    } else {
+        /* Otherwise hand it to the channel's thread */
+        aws_mqtt_mpsc_queue_push(&connection->submissions.queue, &next_request->submission_node);
+        s_schedule_submission_drain(connection);
+    }
+
+    return message_id;
+}
+
+int mqtt_create_requests(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_mqtt_request_options *options,
+    size_t count,
+    uint16_t *message_ids) {
+
+    AWS_ASSERT(connection);
+    AWS_ASSERT(options || !count);
+    AWS_ASSERT(message_ids || !count);
+
+    const bool on_channel_thread = s_is_on_channel_thread(connection);
+
+    /* Create everything before starting anything, so a failure leaves nothing half sent */
+    struct aws_linked_list requests;
+    aws_linked_list_init(&requests);
+    for (size_t i = 0; i < count; ++i) {
+        struct aws_mqtt_outstanding_request *request = s_request_new(connection, &options[i], on_channel_thread);
+        if (!request) {
+            while (!aws_linked_list_empty(&requests)) {
+                struct aws_mqtt_outstanding_request *created = AWS_CONTAINER_OF(
+                    aws_linked_list_pop_front(&requests), struct aws_mqtt_outstanding_request, list_node);
+                aws_mqtt_packet_id_allocator_release(&connection->packet_ids, created->message_id);
+                mqtt_request_release(connection, created);
+            }
+            return AWS_OP_ERR;
+        }
+
+        message_ids[i] = request->message_id;
+        aws_linked_list_push_back(&requests, &request->list_node);
+    }
+
+    while (!aws_linked_list_empty(&requests)) {
+        struct aws_mqtt_outstanding_request *request =
+            AWS_CONTAINER_OF(aws_linked_list_pop_front(&requests), struct aws_mqtt_outstanding_request, list_node);
+
+        if (on_channel_thread) {
+            /* The caller gets every id back, so a request that can't be started is reported through on_complete */
+            if (s_request_start(connection, request)) {
+                s_request_fail_start(connection, request);
+            }
+        } else {
+            aws_mqtt_mpsc_queue_push(&connection->submissions.queue, &request->submission_node);
+        }
+    }
+
+    /* Only once everything is queued, so the whole batch is started (and written) by the same drain */
+    if (!on_channel_thread && count) {
+        s_schedule_submission_drain(connection);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+void mqtt_request_complete(struct aws_mqtt_client_connection *connection, int error_code, uint16_t message_id) {
+
+    struct aws_mqtt_outstanding_request *request =
+        aws_mqtt_packet_id_table_find(&connection->outstanding_requests, message_id);
+
+    if (!request) {
+        AWS_MQTT_LOGF_WARN(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Received ack for unknown packet id %" PRIu16 ", ignoring",
+            (void *)connection,
+            message_id);
+        return;
+    }
+
+    /* Already completed, a duplicate ack mustn't call back (or free anything) a second time */
+    if (request->completed) {
+        AWS_MQTT_LOGF_DEBUG(
+            AWS_LS_MQTT_CLIENT,
+            "id=%p: Received another ack for packet id %" PRIu16 ", ignoring",
+            (void *)connection,
+            message_id);
+        return;
+    }
+
+    if (request->sent_timestamp && error_code == AWS_OP_SUCCESS) {
+        uint64_t now = 0;
+        aws_channel_current_clock_time(connection->slot->channel, &now);
+        s_stats_record_ack_latency(connection, now - request->sent_timestamp);
+    }
+
+    /* Alert the user */
+    if (request->on_complete) {
+        request->on_complete(request->connection, request->message_id, error_code, request->on_complete_ud);
+    }
+    request->completed = true;
+
+    if (request->retrying) {
+        /* Nothing left to wait for, so don't hold on to the request (and its id) until the retry comes around */
+        aws_linked_list_remove(&request->list_node);
+        request->retrying = false;
+        s_request_finish(connection, request);
     }
-    /* Mark as complete for the cleanup task */
-    request->completed = true;
 }
 
 struct mqtt_shutdown_task {
@@ -677,7 +1718,7 @@ static void s_mqtt_disconnect_task(struct aws_channel_task *channel_task, void *
     struct mqtt_shutdown_task *task = AWS_CONTAINER_OF(channel_task, struct mqtt_shutdown_task, task);
     struct aws_mqtt_client_connection *connection = arg;
 
-    AWS_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: Doing disconnect", (void *)connection);
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_CLIENT, "id=%p: Doing disconnect", (void *)connection);
 
     /* If there is an outstanding reconnect task, cancel it */
     if (connection->state == AWS_MQTT_CLIENT_STATE_DISCONNECTING && connection->reconnect_task) {
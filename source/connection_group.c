@@ -0,0 +1,309 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/connection_group.h>
+
+#include <aws/mqtt/private/client_impl.h>
+#include <aws/mqtt/private/logging.h>
+
+#include <aws/io/channel.h>
+#include <aws/io/channel_bootstrap.h>
+#include <aws/io/event_loop.h>
+
+#include <aws/common/task_scheduler.h>
+
+/*******************************************************************************
+ * Group
+ ******************************************************************************/
+
+struct aws_mqtt_connection_group *aws_mqtt_connection_group_new(struct aws_mqtt_client *client) {
+
+    AWS_ASSERT(client);
+
+    struct aws_event_loop_group *el_group = client->bootstrap->event_loop_group;
+    const size_t shard_count = aws_event_loop_group_get_loop_count(el_group);
+    AWS_ASSERT(shard_count > 0);
+
+    struct aws_mqtt_connection_group *group = NULL;
+    struct aws_mqtt_connection_group_shard *shards = NULL;
+    if (!aws_mem_acquire_many(
+            client->allocator,
+            2,
+            &group,
+            sizeof(struct aws_mqtt_connection_group),
+            &shards,
+            sizeof(struct aws_mqtt_connection_group_shard) * shard_count)) {
+        return NULL;
+    }
+
+    AWS_ZERO_STRUCT(*group);
+    group->allocator = client->allocator;
+    group->client = client;
+    aws_atomic_init_int(&group->ref_count, 1);
+    aws_atomic_init_int(&group->connection_count, 0);
+    group->shards = shards;
+    group->shard_count = shard_count;
+
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards[i].loop = aws_event_loop_group_get_loop_at(el_group, i);
+        aws_linked_list_init(&shards[i].connections);
+    }
+
+    AWS_MQTT_LOGF_DEBUG(
+        AWS_LS_MQTT_CLIENT, "group=%p: Created connection group over %d event loops", (void *)group, (int)shard_count);
+
+    return group;
+}
+
+static void s_group_release(struct aws_mqtt_connection_group *group) {
+
+    if (aws_atomic_fetch_sub(&group->ref_count, 1) == 1) {
+        AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "group=%p: Freeing connection group", (void *)group);
+        aws_mem_release(group->allocator, group);
+    }
+}
+
+void aws_mqtt_connection_group_destroy(struct aws_mqtt_connection_group *group) {
+
+    if (!group) {
+        return;
+    }
+
+    AWS_ASSERT(aws_atomic_load_int(&group->connection_count) == 0);
+
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_CLIENT, "group=%p: Destroying connection group", (void *)group);
+
+    /* Shard tasks still on their way keep it around until they've run */
+    s_group_release(group);
+}
+
+struct aws_mqtt_client_connection *aws_mqtt_connection_group_new_connection(struct aws_mqtt_connection_group *group) {
+
+    AWS_ASSERT(group);
+
+    struct aws_mqtt_client_connection *connection = aws_mqtt_client_connection_new(group->client);
+    if (!connection) {
+        return NULL;
+    }
+
+    connection->group = group;
+    aws_atomic_fetch_add(&group->connection_count, 1);
+
+    return connection;
+}
+
+void aws_mqtt_connection_group_release(struct aws_mqtt_connection_group *group) {
+
+    AWS_ASSERT(aws_atomic_load_int(&group->connection_count) > 0);
+    aws_atomic_fetch_sub(&group->connection_count, 1);
+}
+
+/*******************************************************************************
+ * Shards
+ ******************************************************************************/
+
+void aws_mqtt_connection_group_join(
+    struct aws_mqtt_connection_group *group,
+    struct aws_mqtt_client_connection *connection,
+    struct aws_channel *channel) {
+
+    AWS_ASSERT(!connection->group_shard);
+
+    /* The bootstrap picks the event loop each channel runs on, so the shard follows wherever it landed */
+    struct aws_event_loop *loop = aws_channel_get_event_loop(channel);
+    for (size_t i = 0; i < group->shard_count; ++i) {
+        struct aws_mqtt_connection_group_shard *shard = &group->shards[i];
+        if (shard->loop == loop) {
+            aws_linked_list_push_back(&shard->connections, &connection->group_node);
+            connection->group_shard = shard;
+            return;
+        }
+    }
+
+    /* Not one of the bootstrap's loops, so the connection just won't get group publishes on this channel */
+    AWS_MQTT_LOGF_WARN(
+        AWS_LS_MQTT_CLIENT,
+        "id=%p: Channel is on an event loop outside group %p, leaving it out of group publishes",
+        (void *)connection,
+        (void *)group);
+}
+
+void aws_mqtt_connection_group_leave(struct aws_mqtt_client_connection *connection) {
+
+    if (connection->group_shard) {
+        aws_linked_list_remove(&connection->group_node);
+        connection->group_shard = NULL;
+    }
+}
+
+/*******************************************************************************
+ * Publish
+ ******************************************************************************/
+
+struct group_publish;
+
+/* Publishes to every connection in one shard, on the shard's event loop. Holds a reference to the group, which the
+ * shard belongs to, until it runs. */
+struct group_publish_shard_task {
+    struct aws_task task;
+    struct group_publish *publish;
+    struct aws_mqtt_connection_group *group;
+    struct aws_mqtt_connection_group_shard *shard;
+};
+
+/* Shared by every connection the message is published on, in one allocation along with the shard tasks and the
+ * payload. Freed once every shard task has run and every publish they started has completed. */
+struct group_publish {
+    struct aws_allocator *allocator;
+    struct aws_atomic_var ref_count;
+    struct aws_mqtt_publish_template *tmpl;
+    struct aws_byte_cursor payload;
+    aws_mqtt_op_complete_fn *on_complete;
+    void *userdata;
+};
+
+static void s_group_publish_release(struct group_publish *publish) {
+
+    if (aws_atomic_fetch_sub(&publish->ref_count, 1) == 1) {
+        aws_mqtt_publish_template_destroy(publish->tmpl);
+        aws_mem_release(publish->allocator, publish);
+    }
+}
+
+static void s_group_publish_complete(
+    struct aws_mqtt_client_connection *connection,
+    uint16_t packet_id,
+    int error_code,
+    void *userdata) {
+
+    struct group_publish *publish = userdata;
+
+    if (publish->on_complete) {
+        publish->on_complete(connection, packet_id, error_code, publish->userdata);
+    }
+
+    s_group_publish_release(publish);
+}
+
+static void s_group_publish_shard_task(struct aws_task *task, void *arg, enum aws_task_status status) {
+
+    (void)task;
+
+    struct group_publish_shard_task *shard_task = arg;
+    struct group_publish *publish = shard_task->publish;
+    /* Read now, the shard task goes with publish */
+    struct aws_mqtt_connection_group *group = shard_task->group;
+
+    if (status == AWS_TASK_STATUS_RUN_READY) {
+        struct aws_linked_list *connections = &shard_task->shard->connections;
+
+        /* Every connection in the shard is on this thread, so each publish starts right away without a task of its
+         * own. Completing one can't change the shard, channels only leave from their shutdown callback. */
+        for (struct aws_linked_list_node *node = aws_linked_list_begin(connections);
+             node != aws_linked_list_end(connections);
+             node = aws_linked_list_next(node)) {
+
+            struct aws_mqtt_client_connection *connection =
+                AWS_CONTAINER_OF(node, struct aws_mqtt_client_connection, group_node);
+            if (connection->state != AWS_MQTT_CLIENT_STATE_CONNECTED) {
+                continue;
+            }
+
+            /* Held until this publish completes */
+            aws_atomic_fetch_add(&publish->ref_count, 1);
+            if (!aws_mqtt_client_connection_publish_template(
+                    connection, publish->tmpl, &publish->payload, s_group_publish_complete, publish)) {
+
+                AWS_MQTT_LOGF_ERROR(
+                    AWS_LS_MQTT_CLIENT,
+                    "id=%p: Failed to start group publish, error %d",
+                    (void *)connection,
+                    aws_last_error());
+                s_group_publish_release(publish);
+            }
+        }
+    }
+
+    s_group_publish_release(publish);
+    s_group_release(group);
+}
+
+int aws_mqtt_connection_group_publish(
+    struct aws_mqtt_connection_group *group,
+    const struct aws_byte_cursor *topic,
+    enum aws_mqtt_qos qos,
+    bool retain,
+    const struct aws_byte_cursor *payload,
+    aws_mqtt_op_complete_fn *on_complete,
+    void *userdata) {
+
+    AWS_ASSERT(group);
+    AWS_ASSERT(topic);
+    AWS_ASSERT(payload);
+
+    /* Validates the topic */
+    struct aws_mqtt_publish_template *tmpl = aws_mqtt_publish_template_new(group->allocator, topic, qos, retain);
+    if (!tmpl) {
+        return AWS_OP_ERR;
+    }
+
+    struct group_publish *publish = NULL;
+    struct group_publish_shard_task *shard_tasks = NULL;
+    uint8_t *payload_storage = NULL;
+    if (!aws_mem_acquire_many(
+            group->allocator,
+            3,
+            &publish,
+            sizeof(struct group_publish),
+            &shard_tasks,
+            sizeof(struct group_publish_shard_task) * group->shard_count,
+            &payload_storage,
+            payload->len)) {
+
+        aws_mqtt_publish_template_destroy(tmpl);
+        return AWS_OP_ERR;
+    }
+
+    publish->allocator = group->allocator;
+    /* One for each shard task, the publishes they start take their own */
+    aws_atomic_init_int(&publish->ref_count, group->shard_count);
+    publish->tmpl = tmpl;
+    if (payload->len) {
+        memcpy(payload_storage, payload->ptr, payload->len);
+    }
+    publish->payload = aws_byte_cursor_from_array(payload_storage, payload->len);
+    publish->on_complete = on_complete;
+    publish->userdata = userdata;
+
+    AWS_MQTT_LOGF_DEBUG(
+        AWS_LS_MQTT_CLIENT,
+        "group=%p: Starting group publish to topic " PRInSTR,
+        (void *)group,
+        AWS_BYTE_CURSOR_PRI(*topic));
+
+    /* All taken before any task is scheduled, since the first to run may otherwise free the group */
+    aws_atomic_fetch_add(&group->ref_count, group->shard_count);
+
+    /* After the last of these is scheduled, publish may already be gone */
+    for (size_t i = 0; i < group->shard_count; ++i) {
+        shard_tasks[i].publish = publish;
+        shard_tasks[i].group = group;
+        shard_tasks[i].shard = &group->shards[i];
+        aws_task_init(&shard_tasks[i].task, s_group_publish_shard_task, &shard_tasks[i]);
+        aws_event_loop_schedule_task_now(group->shards[i].loop, &shard_tasks[i].task);
+    }
+
+    return AWS_OP_SUCCESS;
+}
@@ -39,11 +39,40 @@ static int s_encode_remaining_length(struct aws_byte_buf *buf, size_t remaining_
 
     return AWS_OP_SUCCESS;
 }
+
+/* Bytes taken by a remaining_length, indexed by the continuation bits of the first 4 bytes it could take up
+ * (bit n is byte n's). 0 if all 4 have the bit set, which is malformed. */
+static const uint8_t s_remaining_length_size[16] = {1, 2, 1, 3, 1, 2, 1, 4, 1, 2, 1, 3, 1, 2, 1, 0};
+
+/* The bits of the value held by a remaining_length of each size */
+static const uint32_t s_remaining_length_mask[5] = {0, 0x7F, 0x3FFF, 0x1FFFFF, 0xFFFFFFF};
+
 static int s_decode_remaining_length(struct aws_byte_cursor *cur, size_t *remaining_length) {
 
     AWS_ASSERT(cur);
 
-    /* Read remaining_length */
+    if (cur->len >= 4) {
+        /* Decode all 4 bytes it could take up at once, then keep only as many as the continuation bits say are used */
+        const uint8_t *bytes = cur->ptr;
+        const uint32_t word =
+            (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+
+        const size_t continuation = (word >> 7 & 1) | (word >> 14 & 2) | (word >> 21 & 4) | (word >> 28 & 8);
+        const uint8_t size = s_remaining_length_size[continuation];
+        if (!size) {
+            /* If high order bit is set on last byte, value is malformed */
+            return aws_raise_error(AWS_ERROR_MQTT_INVALID_REMAINING_LENGTH);
+        }
+
+        /* Squeeze out the continuation bits */
+        const uint32_t value = (word & 0x7F) | (word >> 1 & 0x3F80) | (word >> 2 & 0x1FC000) | (word >> 3 & 0xFE00000);
+        *remaining_length = value & s_remaining_length_mask[size];
+        aws_byte_cursor_advance(cur, size);
+
+        return AWS_OP_SUCCESS;
+    }
+
+    /* Too close to the end of the buffer to read ahead, read remaining_length a byte at a time */
     size_t multiplier = 1;
     *remaining_length = 0;
     while (true) {
@@ -137,6 +166,11 @@ int aws_mqtt_fixed_header_decode(struct aws_byte_cursor *cur, struct aws_mqtt_fi
     header->packet_type = aws_mqtt_get_packet_type(&byte_1);
     header->flags = byte_1 & 0xF;
 
+    /* Types 0 and 15 are reserved, and straight off the wire they're as likely as any other */
+    if (header->packet_type < AWS_MQTT_PACKET_CONNECT || header->packet_type > AWS_MQTT_PACKET_DISCONNECT) {
+        return aws_raise_error(AWS_ERROR_MQTT_INVALID_PACKET_TYPE);
+    }
+
     /* Read remaining length */
     if (s_decode_remaining_length(cur, &header->remaining_length)) {
         return AWS_OP_ERR;
@@ -152,3 +186,23 @@ int aws_mqtt_fixed_header_decode(struct aws_byte_cursor *cur, struct aws_mqtt_fi
 
     return AWS_OP_SUCCESS;
 }
+
+int aws_mqtt_fixed_header_get_packet_size(struct aws_byte_cursor cur, size_t *packet_size) {
+
+    AWS_ASSERT(packet_size);
+
+    const size_t total_len = cur.len;
+
+    /* Skip packet type and flags */
+    if (!aws_byte_cursor_advance(&cur, 1).ptr) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
+
+    size_t remaining_length = 0;
+    if (s_decode_remaining_length(&cur, &remaining_length)) {
+        return AWS_OP_ERR;
+    }
+
+    *packet_size = (total_len - cur.len) + remaining_length;
+    return AWS_OP_SUCCESS;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/mpsc_queue.h>
+
+/*
+ * Based on Dmitry Vyukov's intrusive MPSC node-based queue.
+ * Producers link themselves in with a single exchange on head, the consumer walks from tail.
+ * The stub node keeps the list non-empty so the consumer never has to touch head to pop the last real node.
+ */
+
+void aws_mqtt_mpsc_queue_init(struct aws_mqtt_mpsc_queue *queue) {
+
+    aws_atomic_init_ptr(&queue->stub.next, NULL);
+    aws_atomic_init_ptr(&queue->head, &queue->stub);
+    queue->tail = &queue->stub;
+}
+
+void aws_mqtt_mpsc_queue_push(struct aws_mqtt_mpsc_queue *queue, struct aws_mqtt_mpsc_queue_node *node) {
+
+    aws_atomic_store_ptr_explicit(&node->next, NULL, aws_memory_order_relaxed);
+
+    /* Sequentially consistent so callers can rely on the push being visible before any check they do after it */
+    struct aws_mqtt_mpsc_queue_node *prev = aws_atomic_exchange_ptr(&queue->head, node);
+
+    /* Between the exchange and this store, the queue is "busy": the consumer can't reach node yet */
+    aws_atomic_store_ptr_explicit(&prev->next, node, aws_memory_order_release);
+}
+
+struct aws_mqtt_mpsc_queue_node *aws_mqtt_mpsc_queue_pop(struct aws_mqtt_mpsc_queue *queue) {
+
+    struct aws_mqtt_mpsc_queue_node *tail = queue->tail;
+    struct aws_mqtt_mpsc_queue_node *next = aws_atomic_load_ptr_explicit(&tail->next, aws_memory_order_acquire);
+
+    if (tail == &queue->stub) {
+        if (!next) {
+            return NULL;
+        }
+        /* Skip past the stub */
+        queue->tail = next;
+        tail = next;
+        next = aws_atomic_load_ptr_explicit(&next->next, aws_memory_order_acquire);
+    }
+
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+
+    if (tail != aws_atomic_load_ptr(&queue->head)) {
+        /* A producer has swapped head but not linked the node yet */
+        return NULL;
+    }
+
+    /* tail is the last node, put the stub back behind it so tail can be handed out */
+    aws_mqtt_mpsc_queue_push(queue, &queue->stub);
+
+    next = aws_atomic_load_ptr_explicit(&tail->next, aws_memory_order_acquire);
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+bool aws_mqtt_mpsc_queue_is_empty(const struct aws_mqtt_mpsc_queue *queue) {
+
+    return queue->tail == &queue->stub && aws_atomic_load_ptr(&queue->head) == &queue->stub;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/packet_framer.h>
+
+#include <aws/mqtt/private/fixed_header.h>
+
+void aws_mqtt_packet_framer_init(struct aws_mqtt_packet_framer *framer, struct aws_allocator *allocator) {
+
+    AWS_ASSERT(framer);
+    AWS_ASSERT(allocator);
+
+    AWS_ZERO_STRUCT(*framer);
+    framer->allocator = allocator;
+}
+
+void aws_mqtt_packet_framer_clean_up(struct aws_mqtt_packet_framer *framer) {
+
+    aws_byte_buf_clean_up(&framer->pending);
+    framer->pending_size = 0;
+}
+
+void aws_mqtt_packet_framer_reset(struct aws_mqtt_packet_framer *framer) {
+
+    framer->pending.len = 0;
+    framer->pending_size = 0;
+}
+
+/* Grow pending to hold at least size bytes, keeping its contents. Grows geometrically, and is never shrunk, so a
+ * stream settles on one buffer big enough for the packets it sees. */
+static int s_pending_reserve(struct aws_mqtt_packet_framer *framer, size_t size) {
+
+    struct aws_byte_buf *pending = &framer->pending;
+    if (pending->capacity >= size) {
+        return AWS_OP_SUCCESS;
+    }
+
+    size_t new_capacity = pending->capacity * 2;
+    if (new_capacity < size) {
+        new_capacity = size;
+    }
+
+    uint8_t *new_buffer = aws_mem_acquire(framer->allocator, new_capacity);
+    if (!new_buffer) {
+        return AWS_OP_ERR;
+    }
+
+    if (pending->len) {
+        memcpy(new_buffer, pending->buffer, pending->len);
+    }
+    if (pending->buffer) {
+        aws_mem_release(pending->allocator, pending->buffer);
+    }
+
+    pending->buffer = new_buffer;
+    pending->capacity = new_capacity;
+    pending->allocator = framer->allocator;
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Stash the start of a packet that didn't fit in the current data. Consumes all of cursor. */
+static int s_pending_begin(struct aws_mqtt_packet_framer *framer, struct aws_byte_cursor *cursor) {
+
+    AWS_ASSERT(framer->pending.len == 0);
+
+    /* If even the fixed header is cut off, the size is found once more bytes arrive */
+    framer->pending_size = 0;
+    if (aws_mqtt_fixed_header_get_packet_size(*cursor, &framer->pending_size)) {
+        aws_reset_error();
+    }
+
+    const size_t initial_size = framer->pending_size > cursor->len ? framer->pending_size : cursor->len;
+    if (s_pending_reserve(framer, initial_size)) {
+        return AWS_OP_ERR;
+    }
+
+    struct aws_byte_cursor chunk = aws_byte_cursor_advance(cursor, cursor->len);
+    aws_byte_buf_write_from_whole_cursor(&framer->pending, chunk);
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Move bytes from cursor into pending until it holds the whole packet, then pass it on. */
+static int s_pending_continue(
+    struct aws_mqtt_packet_framer *framer,
+    struct aws_byte_cursor *cursor,
+    aws_mqtt_packet_framer_on_packet_fn *on_packet,
+    void *userdata) {
+
+    struct aws_byte_buf *pending = &framer->pending;
+
+    /* The fixed header was split, feed it a byte at a time until the remaining length is complete */
+    while (!framer->pending_size && cursor->len) {
+
+        if (s_pending_reserve(framer, pending->len + 1)) {
+            return AWS_OP_ERR;
+        }
+        aws_byte_buf_write_from_whole_cursor(pending, aws_byte_cursor_advance(cursor, 1));
+
+        struct aws_byte_cursor header_cur = aws_byte_cursor_from_buf(pending);
+        if (aws_mqtt_fixed_header_get_packet_size(header_cur, &framer->pending_size)) {
+            if (aws_last_error() != AWS_ERROR_SHORT_BUFFER) {
+                return AWS_OP_ERR;
+            }
+            aws_reset_error();
+        }
+    }
+
+    if (!framer->pending_size) {
+        return AWS_OP_SUCCESS;
+    }
+
+    if (s_pending_reserve(framer, framer->pending_size)) {
+        return AWS_OP_ERR;
+    }
+
+    size_t to_read = framer->pending_size - pending->len;
+    if (to_read > cursor->len) {
+        to_read = cursor->len;
+    }
+    aws_byte_buf_write_from_whole_cursor(pending, aws_byte_cursor_advance(cursor, to_read));
+
+    /* If the packet is still incomplete, wait for more data */
+    if (pending->len < framer->pending_size) {
+        return AWS_OP_SUCCESS;
+    }
+
+    /* Pass on the completed packet, then keep the buffer around for the next one */
+    int result = on_packet(aws_byte_cursor_from_buf(pending), userdata);
+
+    aws_mqtt_packet_framer_reset(framer);
+
+    return result;
+}
+
+int aws_mqtt_packet_framer_process(
+    struct aws_mqtt_packet_framer *framer,
+    struct aws_byte_cursor data,
+    aws_mqtt_packet_framer_on_packet_fn *on_packet,
+    void *userdata) {
+
+    AWS_ASSERT(framer);
+    AWS_ASSERT(on_packet);
+
+    /* If there's a pending packet left over from last time, attempt to complete it. */
+    if (framer->pending.len) {
+        if (s_pending_continue(framer, &data, on_packet, userdata)) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    while (data.len) {
+
+        /* Temp byte cursor so we can decode the header without advancing data. */
+        struct aws_byte_cursor header_decode = data;
+
+        struct aws_mqtt_fixed_header packet_header;
+        AWS_ZERO_STRUCT(packet_header);
+        if (aws_mqtt_fixed_header_decode(&header_decode, &packet_header)) {
+            if (aws_last_error() != AWS_ERROR_SHORT_BUFFER) {
+                return AWS_OP_ERR;
+            }
+
+            /* Data too short, store it and come back later. */
+            aws_reset_error();
+            return s_pending_begin(framer, &data);
+        }
+
+        /* Calculate how much data was read. */
+        const size_t fixed_header_size = data.len - header_decode.len;
+
+        /* Complete packets are passed on straight out of data, without copying */
+        struct aws_byte_cursor packet =
+            aws_byte_cursor_advance(&data, fixed_header_size + packet_header.remaining_length);
+        if (on_packet(packet, userdata)) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/packet_id_allocator.h>
+
+enum { S_MAX_IDS = UINT16_MAX };
+
+/* Index of the lowest clear bit. word must not be all ones. */
+static size_t s_lowest_clear_bit(size_t word) {
+
+    AWS_ASSERT(word != SIZE_MAX);
+
+    size_t free_bits = ~word;
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_ctzll((unsigned long long)free_bits);
+#else
+    size_t bit = 0;
+    while (!(free_bits & 1)) {
+        free_bits >>= 1;
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+/*******************************************************************************
+ * Init
+ ******************************************************************************/
+
+void aws_mqtt_packet_id_allocator_init(struct aws_mqtt_packet_id_allocator *allocator) {
+
+    for (size_t i = 0; i < AWS_MQTT_PACKET_ID_WORD_COUNT; ++i) {
+        aws_atomic_init_int(&allocator->in_use[i], 0);
+    }
+    aws_atomic_init_int(&allocator->next_id, 1);
+    aws_atomic_init_int(&allocator->in_use_count, 0);
+
+    /* 0 is not a valid packet id [MQTT-2.3.1-1], so it is never available */
+    aws_atomic_init_int(&allocator->in_use[0], 1);
+}
+
+/*******************************************************************************
+ * Acquire
+ ******************************************************************************/
+
+/* Try to claim the lowest clear bit of in_use[word_idx] that isn't masked. Returns the id, or 0 if there were none. */
+static uint16_t s_try_claim_in_word(struct aws_mqtt_packet_id_allocator *allocator, size_t word_idx, size_t mask) {
+
+    size_t word = aws_atomic_load_int_explicit(&allocator->in_use[word_idx], aws_memory_order_relaxed);
+
+    while ((word | mask) != SIZE_MAX) {
+        const size_t bit = s_lowest_clear_bit(word | mask);
+
+        if (aws_atomic_compare_exchange_int_explicit(
+                &allocator->in_use[word_idx],
+                &word,
+                word | ((size_t)1 << bit),
+                aws_memory_order_acq_rel,
+                aws_memory_order_relaxed)) {
+
+            return (uint16_t)(word_idx * AWS_MQTT_PACKET_ID_BITS_PER_WORD + bit);
+        }
+        /* Lost a race, word now holds the current value so try again */
+    }
+
+    return 0;
+}
+
+uint16_t aws_mqtt_packet_id_allocator_acquire(struct aws_mqtt_packet_id_allocator *allocator) {
+
+    /* Reserve an id first, so the search below is guaranteed to have something to find */
+    if (aws_atomic_fetch_add(&allocator->in_use_count, 1) >= S_MAX_IDS) {
+        aws_atomic_fetch_sub(&allocator->in_use_count, 1);
+        aws_raise_error(AWS_ERROR_MQTT_NO_PACKET_ID_AVAILABLE);
+        return 0;
+    }
+
+    const size_t start_id = aws_atomic_load_int_explicit(&allocator->next_id, aws_memory_order_relaxed);
+    size_t word_idx = (start_id / AWS_MQTT_PACKET_ID_BITS_PER_WORD) % AWS_MQTT_PACKET_ID_WORD_COUNT;
+
+    /* Skip the ids before next_id in the starting word, they are picked up when the search wraps around */
+    uint16_t id = s_try_claim_in_word(
+        allocator, word_idx, ((size_t)1 << (start_id % AWS_MQTT_PACKET_ID_BITS_PER_WORD)) - 1);
+
+    /* Other threads may be claiming and releasing bits concurrently, so keep going until the reserved id turns up */
+    while (!id) {
+        word_idx = (word_idx + 1) % AWS_MQTT_PACKET_ID_WORD_COUNT;
+        id = s_try_claim_in_word(allocator, word_idx, 0);
+    }
+
+    /* Start the next search after this id, wrapping past 0 */
+    uint16_t next_id = (uint16_t)(id + 1);
+    aws_atomic_store_int_explicit(&allocator->next_id, next_id ? next_id : 1, aws_memory_order_relaxed);
+
+    return id;
+}
+
+/*******************************************************************************
+ * Release
+ ******************************************************************************/
+
+void aws_mqtt_packet_id_allocator_release(struct aws_mqtt_packet_id_allocator *allocator, uint16_t id) {
+
+    AWS_ASSERT(id != 0);
+    AWS_ASSERT(aws_mqtt_packet_id_allocator_is_in_use(allocator, id));
+
+    aws_atomic_fetch_and_explicit(
+        &allocator->in_use[id / AWS_MQTT_PACKET_ID_BITS_PER_WORD],
+        ~((size_t)1 << (id % AWS_MQTT_PACKET_ID_BITS_PER_WORD)),
+        aws_memory_order_acq_rel);
+    aws_atomic_fetch_sub(&allocator->in_use_count, 1);
+}
+
+bool aws_mqtt_packet_id_allocator_is_in_use(const struct aws_mqtt_packet_id_allocator *allocator, uint16_t id) {
+
+    const size_t word = aws_atomic_load_int_explicit(
+        &allocator->in_use[id / AWS_MQTT_PACKET_ID_BITS_PER_WORD], aws_memory_order_relaxed);
+    return (word >> (id % AWS_MQTT_PACKET_ID_BITS_PER_WORD)) & 1;
+}
+
+size_t aws_mqtt_packet_id_allocator_get_in_use_count(const struct aws_mqtt_packet_id_allocator *allocator) {
+
+    return aws_atomic_load_int(&allocator->in_use_count);
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/packet_id_set.h>
+
+static uint64_t s_bit_for(uint16_t id) {
+    return (uint64_t)1 << (id % AWS_MQTT_PACKET_ID_SET_BITS_PER_WORD);
+}
+
+void aws_mqtt_packet_id_set_init(struct aws_mqtt_packet_id_set *set) {
+
+    AWS_ZERO_STRUCT(*set);
+}
+
+bool aws_mqtt_packet_id_set_add(struct aws_mqtt_packet_id_set *set, uint16_t id) {
+
+    uint64_t *word = &set->words[id / AWS_MQTT_PACKET_ID_SET_BITS_PER_WORD];
+    const uint64_t bit = s_bit_for(id);
+
+    if (*word & bit) {
+        return false;
+    }
+
+    *word |= bit;
+    ++set->count;
+    return true;
+}
+
+bool aws_mqtt_packet_id_set_remove(struct aws_mqtt_packet_id_set *set, uint16_t id) {
+
+    uint64_t *word = &set->words[id / AWS_MQTT_PACKET_ID_SET_BITS_PER_WORD];
+    const uint64_t bit = s_bit_for(id);
+
+    if (!(*word & bit)) {
+        return false;
+    }
+
+    *word &= ~bit;
+    --set->count;
+    return true;
+}
+
+bool aws_mqtt_packet_id_set_contains(const struct aws_mqtt_packet_id_set *set, uint16_t id) {
+
+    return (set->words[id / AWS_MQTT_PACKET_ID_SET_BITS_PER_WORD] & s_bit_for(id)) != 0;
+}
+
+size_t aws_mqtt_packet_id_set_get_count(const struct aws_mqtt_packet_id_set *set) {
+
+    return set->count;
+}
+
+void aws_mqtt_packet_id_set_clear(struct aws_mqtt_packet_id_set *set) {
+
+    if (set->count) {
+        AWS_ZERO_STRUCT(*set);
+    }
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/packet_id_table.h>
+
+/*******************************************************************************
+ * Init
+ ******************************************************************************/
+
+void aws_mqtt_packet_id_table_init(
+    struct aws_mqtt_packet_id_table *table,
+    struct aws_allocator *allocator,
+    aws_hash_callback_destroy_fn *destroy_value_fn) {
+
+    AWS_ZERO_STRUCT(*table);
+    table->allocator = allocator;
+    table->destroy_value_fn = destroy_value_fn;
+}
+
+void aws_mqtt_packet_id_table_clean_up(struct aws_mqtt_packet_id_table *table) {
+
+    aws_mqtt_packet_id_table_clear(table);
+}
+
+/*******************************************************************************
+ * Operations
+ ******************************************************************************/
+
+int aws_mqtt_packet_id_table_put(struct aws_mqtt_packet_id_table *table, uint16_t id, void *value) {
+
+    AWS_ASSERT(value);
+
+    struct aws_mqtt_packet_id_table_page **page = &table->pages[id / AWS_MQTT_PACKET_ID_TABLE_PAGE_SIZE];
+    if (!*page) {
+        *page = aws_mem_acquire(table->allocator, sizeof(struct aws_mqtt_packet_id_table_page));
+        if (!*page) {
+            return AWS_OP_ERR;
+        }
+        AWS_ZERO_STRUCT(**page);
+    }
+
+    void **slot = &(*page)->values[id % AWS_MQTT_PACKET_ID_TABLE_PAGE_SIZE];
+    if (!*slot) {
+        ++(*page)->count;
+        ++table->entry_count;
+    }
+    *slot = value;
+
+    return AWS_OP_SUCCESS;
+}
+
+void *aws_mqtt_packet_id_table_remove(struct aws_mqtt_packet_id_table *table, uint16_t id) {
+
+    struct aws_mqtt_packet_id_table_page **page = &table->pages[id / AWS_MQTT_PACKET_ID_TABLE_PAGE_SIZE];
+    if (!*page) {
+        return NULL;
+    }
+
+    void **slot = &(*page)->values[id % AWS_MQTT_PACKET_ID_TABLE_PAGE_SIZE];
+    void *value = *slot;
+    if (value) {
+        *slot = NULL;
+        --table->entry_count;
+
+        /* Give the page back once it's empty so idle connections stay small */
+        if (--(*page)->count == 0) {
+            aws_mem_release(table->allocator, *page);
+            *page = NULL;
+        }
+    }
+
+    return value;
+}
+
+void aws_mqtt_packet_id_table_clear(struct aws_mqtt_packet_id_table *table) {
+
+    for (size_t page_idx = 0; page_idx < AWS_MQTT_PACKET_ID_TABLE_PAGE_COUNT && table->entry_count; ++page_idx) {
+
+        struct aws_mqtt_packet_id_table_page *page = table->pages[page_idx];
+        if (!page) {
+            continue;
+        }
+
+        /* Unlink the page first, so destroy_value_fn sees a consistent table */
+        table->pages[page_idx] = NULL;
+        table->entry_count -= page->count;
+
+        if (table->destroy_value_fn) {
+            for (size_t i = 0; i < AWS_MQTT_PACKET_ID_TABLE_PAGE_SIZE; ++i) {
+                if (page->values[i]) {
+                    table->destroy_value_fn(page->values[i]);
+                }
+            }
+        }
+
+        aws_mem_release(table->allocator, page);
+    }
+
+    AWS_ASSERT(table->entry_count == 0);
+}
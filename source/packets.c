@@ -61,6 +61,9 @@ static int s_decode_buffer(struct aws_byte_cursor *cur, struct aws_byte_cursor *
     }
 
     /* Store the data */
+    if (len > cur->len) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
     *buf = aws_byte_cursor_advance(cur, len);
 
     return AWS_OP_SUCCESS;
@@ -315,7 +318,6 @@ int aws_mqtt_packet_connect_decode(struct aws_byte_cursor *cur, struct aws_mqtt_
     if (s_decode_buffer(cur, &protocol_name)) {
         return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
     }
-    AWS_ASSERT(protocol_name.ptr && protocol_name.len);
     if (protocol_name.len != s_protocol_name.len) {
         return aws_raise_error(AWS_ERROR_MQTT_UNSUPPORTED_PROTOCOL_NAME);
     }
@@ -572,17 +574,22 @@ int aws_mqtt_packet_publish_decode(struct aws_byte_cursor *cur, struct aws_mqtt_
         return AWS_OP_ERR;
     }
 
-    size_t payload_size = packet->fixed_header.remaining_length - s_sizeof_encoded_buffer(&packet->topic_name);
-
     /* Read QoS */
     enum aws_mqtt_qos qos = ((packet->fixed_header.flags >> 1) & 0x3);
 
+    /* The variable header can't run past the end of the packet */
+    const size_t variable_header_size =
+        s_sizeof_encoded_buffer(&packet->topic_name) + (qos > 0 ? sizeof(packet->packet_identifier) : 0);
+    if (variable_header_size > packet->fixed_header.remaining_length) {
+        return aws_raise_error(AWS_ERROR_MQTT_INVALID_REMAINING_LENGTH);
+    }
+    size_t payload_size = packet->fixed_header.remaining_length - variable_header_size;
+
     /* Read packet identifier */
     if (qos > 0) {
         if (!aws_byte_cursor_read_be16(cur, &packet->packet_identifier)) {
             return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
         }
-        payload_size -= sizeof(packet->packet_identifier);
     } else {
         packet->packet_identifier = 0;
     }
@@ -749,6 +756,9 @@ int aws_mqtt_packet_subscribe_decode(struct aws_byte_cursor *cur, struct aws_mqt
     /* Variable Header                                                       */
 
     /* Read packet identifier */
+    if (packet->fixed_header.remaining_length < sizeof(uint16_t)) {
+        return aws_raise_error(AWS_ERROR_MQTT_INVALID_REMAINING_LENGTH);
+    }
     if (!aws_byte_cursor_read_be16(cur, &packet->packet_identifier)) {
         return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
     }
@@ -777,9 +787,17 @@ int aws_mqtt_packet_subscribe_decode(struct aws_byte_cursor *cur, struct aws_mqt
         }
         subscription.qos = eos_byte & 0x3;
 
-        aws_array_list_push_back(&packet->topic_filters, &subscription);
+        /* A filter running past the end of the packet would be read out of whatever follows it */
+        const size_t subscription_size = s_sizeof_encoded_buffer(&subscription.topic_filter) + 1;
+        if (subscription_size > remaining_length) {
+            return aws_raise_error(AWS_ERROR_MQTT_INVALID_REMAINING_LENGTH);
+        }
 
-        remaining_length -= s_sizeof_encoded_buffer(&subscription.topic_filter) + 1;
+        if (aws_array_list_push_back(&packet->topic_filters, &subscription)) {
+            return AWS_OP_ERR;
+        }
+
+        remaining_length -= subscription_size;
     }
 
     return AWS_OP_SUCCESS;
@@ -898,6 +916,9 @@ int aws_mqtt_packet_unsubscribe_decode(struct aws_byte_cursor *cur, struct aws_m
     /* Variable Header                                                       */
 
     /* Read packet identifier */
+    if (packet->fixed_header.remaining_length < sizeof(uint16_t)) {
+        return aws_raise_error(AWS_ERROR_MQTT_INVALID_REMAINING_LENGTH);
+    }
     if (!aws_byte_cursor_read_be16(cur, &packet->packet_identifier)) {
         return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
     }
@@ -912,9 +933,16 @@ int aws_mqtt_packet_unsubscribe_decode(struct aws_byte_cursor *cur, struct aws_m
             return AWS_OP_ERR;
         }
 
-        aws_array_list_push_back(&packet->topic_filters, &topic_filter);
+        const size_t filter_size = s_sizeof_encoded_buffer(&topic_filter);
+        if (filter_size > remaining_length) {
+            return aws_raise_error(AWS_ERROR_MQTT_INVALID_REMAINING_LENGTH);
+        }
+
+        if (aws_array_list_push_back(&packet->topic_filters, &topic_filter)) {
+            return AWS_OP_ERR;
+        }
 
-        remaining_length -= s_sizeof_encoded_buffer(&topic_filter);
+        remaining_length -= filter_size;
     }
 
     return AWS_OP_SUCCESS;
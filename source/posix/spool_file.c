@@ -0,0 +1,96 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/spool.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int s_raise_errno(void) {
+    switch (errno) {
+        case ENOENT:
+        case ENOTDIR:
+        case ENAMETOOLONG:
+            return aws_raise_error(AWS_ERROR_FILE_INVALID_PATH);
+        case ENOMEM:
+            return aws_raise_error(AWS_ERROR_OOM);
+        case EACCES:
+        case EPERM:
+            return aws_raise_error(AWS_ERROR_NO_PERMISSION);
+        default:
+            return aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+    }
+}
+
+int aws_mqtt_spool_file_open(struct aws_mqtt_spool_file *file, const char *path, size_t size) {
+
+    AWS_ASSERT(file);
+    AWS_ASSERT(path);
+
+    AWS_ZERO_STRUCT(*file);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        return s_raise_errno();
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) || ((size_t)file_stat.st_size != size && ftruncate(fd, (off_t)size))) {
+        goto error;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        goto error;
+    }
+
+    /* The mapping keeps the file open */
+    close(fd);
+
+    file->data = data;
+    file->size = size;
+
+    return AWS_OP_SUCCESS;
+
+error:
+    s_raise_errno();
+    close(fd);
+    return AWS_OP_ERR;
+}
+
+void aws_mqtt_spool_file_close(struct aws_mqtt_spool_file *file) {
+
+    if (file->data) {
+        munmap(file->data, file->size);
+    }
+    AWS_ZERO_STRUCT(*file);
+}
+
+int aws_mqtt_spool_file_sync(struct aws_mqtt_spool_file *file, size_t offset, size_t length) {
+
+    AWS_ASSERT(offset + length <= file->size);
+
+    /* msync wants a page aligned start */
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t start = offset - offset % page_size;
+    if (msync(file->data + start, offset + length - start, MS_SYNC)) {
+        return s_raise_errno();
+    }
+
+    return AWS_OP_SUCCESS;
+}
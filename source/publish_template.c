@@ -0,0 +1,123 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/publish_template.h>
+
+/*******************************************************************************
+ * Init
+ ******************************************************************************/
+
+struct aws_mqtt_publish_template *aws_mqtt_publish_template_new(
+    struct aws_allocator *allocator,
+    const struct aws_byte_cursor *topic,
+    enum aws_mqtt_qos qos,
+    bool retain) {
+
+    AWS_ASSERT(allocator);
+    AWS_ASSERT(topic);
+
+    if (!aws_mqtt_is_valid_topic(topic)) {
+        aws_raise_error(AWS_ERROR_MQTT_INVALID_TOPIC);
+        return NULL;
+    }
+
+    if (topic->len > UINT16_MAX) {
+        aws_raise_error(AWS_ERROR_MQTT_BUFFER_TOO_BIG);
+        return NULL;
+    }
+
+    /* The encoded topic lives right after the struct, so it's all one allocation */
+    const size_t encoded_len = sizeof(uint16_t) + topic->len;
+    struct aws_mqtt_publish_template *tmpl =
+        aws_mem_acquire(allocator, sizeof(struct aws_mqtt_publish_template) + encoded_len);
+    if (!tmpl) {
+        return NULL;
+    }
+
+    tmpl->allocator = allocator;
+    tmpl->qos = qos;
+    tmpl->retain = retain;
+
+    struct aws_byte_buf encoded = aws_byte_buf_from_array((uint8_t *)(tmpl + 1), encoded_len);
+    encoded.len = 0;
+    aws_byte_buf_write_be16(&encoded, (uint16_t)topic->len);
+    aws_byte_buf_write(&encoded, topic->ptr, topic->len);
+
+    tmpl->encoded_topic = aws_byte_cursor_from_buf(&encoded);
+    tmpl->topic = aws_byte_cursor_from_array(encoded.buffer + sizeof(uint16_t), topic->len);
+
+    return tmpl;
+}
+
+/*******************************************************************************
+ * Clean Up
+ ******************************************************************************/
+
+void aws_mqtt_publish_template_destroy(struct aws_mqtt_publish_template *tmpl) {
+
+    if (tmpl) {
+        aws_mem_release(tmpl->allocator, tmpl);
+    }
+}
+
+/*******************************************************************************
+ * Encode
+ ******************************************************************************/
+
+void aws_mqtt_publish_template_init_header(
+    const struct aws_mqtt_publish_template *tmpl,
+    bool dup,
+    size_t payload_size,
+    struct aws_mqtt_fixed_header *header) {
+
+    AWS_ASSERT(tmpl);
+    AWS_ASSERT(header);
+
+    header->packet_type = AWS_MQTT_PACKET_PUBLISH;
+    header->remaining_length = tmpl->encoded_topic.len + payload_size;
+    if (tmpl->qos > 0) {
+        header->remaining_length += sizeof(uint16_t);
+    }
+
+    /* [MQTT-2.2.2] */
+    header->flags = (uint8_t)((tmpl->retain & 0x1) | (tmpl->qos & 0x3) << 1 | (dup & 0x1) << 3);
+}
+
+int aws_mqtt_publish_template_encode_headers(
+    struct aws_byte_buf *buf,
+    const struct aws_mqtt_publish_template *tmpl,
+    const struct aws_mqtt_fixed_header *header,
+    uint16_t packet_id) {
+
+    AWS_ASSERT(buf);
+    AWS_ASSERT(tmpl);
+    AWS_ASSERT(header);
+
+    if (aws_mqtt_fixed_header_encode(buf, header)) {
+        return AWS_OP_ERR;
+    }
+
+    if (!aws_byte_buf_write_from_whole_cursor(buf, tmpl->encoded_topic)) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
+
+    if (tmpl->qos > 0) {
+        if (!aws_byte_buf_write_be16(buf, packet_id)) {
+            return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/recycle_pool.h>
+
+/* Laid over the first bytes of every block on the stack */
+struct recycle_pool_free_block {
+    struct recycle_pool_free_block *next;
+};
+
+void aws_mqtt_recycle_pool_init(
+    struct aws_mqtt_recycle_pool *pool,
+    struct aws_allocator *allocator,
+    size_t block_size,
+    size_t max_cached) {
+
+    AWS_ASSERT(pool);
+    AWS_ASSERT(allocator);
+
+    pool->allocator = allocator;
+    pool->block_size = block_size < sizeof(struct recycle_pool_free_block) ? sizeof(struct recycle_pool_free_block)
+                                                                            : block_size;
+    pool->max_cached = max_cached;
+    aws_atomic_init_ptr(&pool->head, NULL);
+    aws_atomic_init_int(&pool->popping, false);
+    aws_atomic_init_int(&pool->cached_count, 0);
+}
+
+void aws_mqtt_recycle_pool_clean_up(struct aws_mqtt_recycle_pool *pool) {
+
+    AWS_ASSERT(pool);
+
+    struct recycle_pool_free_block *block = aws_atomic_exchange_ptr(&pool->head, NULL);
+    while (block) {
+        struct recycle_pool_free_block *next = block->next;
+        aws_mem_release(pool->allocator, block);
+        block = next;
+    }
+    aws_atomic_store_int(&pool->cached_count, 0);
+}
+
+void *aws_mqtt_recycle_pool_acquire(struct aws_mqtt_recycle_pool *pool) {
+
+    AWS_ASSERT(pool);
+
+    /* Someone else is popping, the allocator is cheaper than waiting for them */
+    if (aws_atomic_exchange_int_explicit(&pool->popping, true, aws_memory_order_acquire)) {
+        return aws_mem_acquire(pool->allocator, pool->block_size);
+    }
+
+    /* Nothing but pushes can happen to head until popping is cleared, so head's next can't change under us */
+    struct recycle_pool_free_block *block = aws_atomic_load_ptr_explicit(&pool->head, aws_memory_order_acquire);
+    while (block) {
+        if (aws_atomic_compare_exchange_ptr_explicit(
+                &pool->head, (void **)&block, block->next, aws_memory_order_acquire, aws_memory_order_acquire)) {
+            break;
+        }
+    }
+
+    aws_atomic_store_int_explicit(&pool->popping, false, aws_memory_order_release);
+
+    if (!block) {
+        return aws_mem_acquire(pool->allocator, pool->block_size);
+    }
+
+    aws_atomic_fetch_sub_explicit(&pool->cached_count, 1, aws_memory_order_relaxed);
+    return block;
+}
+
+void aws_mqtt_recycle_pool_release(struct aws_mqtt_recycle_pool *pool, void *block) {
+
+    AWS_ASSERT(pool);
+
+    if (!block) {
+        return;
+    }
+
+    /* Reserve a place on the stack first, so racing releases can't push it past max_cached */
+    if (aws_atomic_fetch_add_explicit(&pool->cached_count, 1, aws_memory_order_relaxed) >= pool->max_cached) {
+        aws_atomic_fetch_sub_explicit(&pool->cached_count, 1, aws_memory_order_relaxed);
+        aws_mem_release(pool->allocator, block);
+        return;
+    }
+
+    struct recycle_pool_free_block *free_block = block;
+    free_block->next = aws_atomic_load_ptr_explicit(&pool->head, aws_memory_order_relaxed);
+    while (!aws_atomic_compare_exchange_ptr_explicit(
+        &pool->head, (void **)&free_block->next, free_block, aws_memory_order_release, aws_memory_order_relaxed)) {
+    }
+}
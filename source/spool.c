@@ -0,0 +1,428 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/spool.h>
+
+#include <aws/common/clock.h>
+#include <aws/common/device_random.h>
+
+/* "MQTTSPL2" */
+static const uint64_t s_file_magic = 0x4d51545453504c32;
+static const uint32_t s_record_magic = 0x5245434f;
+/* Fills the end of the ring when the next record doesn't fit there, so records never wrap */
+static const uint32_t s_pad_magic = 0x50414444;
+
+enum {
+    /* Every record starts on and is sized in multiples of this, so there's always room for a pad's header */
+    S_RECORD_ALIGNMENT = 64,
+};
+
+enum spool_record_state {
+    S_RECORD_QUEUED,
+    S_RECORD_TAKEN,
+    S_RECORD_ACKED,
+};
+
+struct aws_mqtt_spool_file_header {
+    uint64_t magic;
+    uint64_t capacity;
+    /* Random per spool, folded into every checksum so nothing left over from an earlier spool in the file is valid */
+    uint64_t epoch;
+    uint64_t head;
+};
+
+/* Pads are just the fields up to and including attempts */
+struct spool_record {
+    /* Written last, once the rest of the record is in place */
+    uint32_t magic;
+    uint32_t size;
+    uint64_t position;
+    /* Over size, position, and everything from qos on, seeded with the epoch */
+    uint32_t checksum;
+    uint8_t state;
+    uint8_t qos;
+    uint8_t retain;
+    /* Failed sends so far, kept across restarts. Like state, changed in place so not in the checksum. */
+    uint8_t attempts;
+
+    uint16_t topic_len;
+    uint16_t reserved2;
+    uint32_t payload_len;
+    /* Followed by the topic, then the payload */
+};
+
+/* A record's entry in the spool's callbacks */
+struct spool_callbacks {
+    struct aws_allocator *allocator;
+    /* The key */
+    uint64_t position;
+    aws_mqtt_op_complete_fn *on_complete;
+    void *userdata;
+};
+
+static uint64_t s_hash_position(const void *item) {
+    /* Every position is a multiple of the alignment, so the low bits carry nothing */
+    return *(const uint64_t *)item / S_RECORD_ALIGNMENT;
+}
+
+static bool s_position_eq(const void *a, const void *b) {
+    return *(const uint64_t *)a == *(const uint64_t *)b;
+}
+
+static void s_callbacks_destroy(void *value) {
+    struct spool_callbacks *callbacks = value;
+    aws_mem_release(callbacks->allocator, callbacks);
+}
+
+static size_t s_align(size_t size) {
+    return (size + S_RECORD_ALIGNMENT - 1) & ~(size_t)(S_RECORD_ALIGNMENT - 1);
+}
+
+/* FNV-1a */
+static uint32_t s_checksum_update(uint32_t hash, const void *data, size_t len) {
+
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t s_record_checksum(const struct aws_mqtt_spool *spool, const struct spool_record *record) {
+
+    uint32_t hash = s_checksum_update(2166136261u, &spool->header->epoch, sizeof(spool->header->epoch));
+    hash = s_checksum_update(hash, &record->size, sizeof(record->size));
+    hash = s_checksum_update(hash, &record->position, sizeof(record->position));
+    if (record->magic == s_pad_magic) {
+        return hash;
+    }
+
+    hash = s_checksum_update(hash, &record->qos, sizeof(record->qos));
+    hash = s_checksum_update(hash, &record->retain, sizeof(record->retain));
+    hash = s_checksum_update(hash, &record->topic_len, sizeof(record->topic_len));
+    hash = s_checksum_update(hash, &record->payload_len, sizeof(record->payload_len));
+    return s_checksum_update(hash, record + 1, (size_t)record->topic_len + record->payload_len);
+}
+
+static struct spool_record *s_record_at(const struct aws_mqtt_spool *spool, uint64_t position) {
+    return (struct spool_record *)(spool->records + position % spool->capacity);
+}
+
+/* Whether the record at position is one this spool wrote there, rather than garbage or something from a crash */
+static bool s_record_is_valid(const struct aws_mqtt_spool *spool, uint64_t position) {
+
+    const size_t offset = (size_t)(position % spool->capacity);
+    const struct spool_record *record = s_record_at(spool, position);
+
+    if (record->magic != s_record_magic && record->magic != s_pad_magic) {
+        return false;
+    }
+    if (record->position != position || record->size % S_RECORD_ALIGNMENT || record->size > spool->capacity - offset) {
+        return false;
+    }
+    if (position - spool->head + record->size > spool->capacity) {
+        return false;
+    }
+    if (record->magic == s_record_magic &&
+        (record->size < sizeof(struct spool_record) ||
+         (size_t)record->topic_len + record->payload_len > record->size - sizeof(struct spool_record))) {
+        return false;
+    }
+
+    return record->checksum == s_record_checksum(spool, record);
+}
+
+static void s_sync(struct aws_mqtt_spool *spool, const void *start, size_t length) {
+
+    if (spool->sync) {
+        /* If this fails, the worst a crash can do is lose the record, which the checksum catches */
+        aws_mqtt_spool_file_sync(&spool->file, (size_t)((const uint8_t *)start - spool->file.data), length);
+    }
+}
+
+/* Reclaim every acked record at the head */
+static void s_advance_head(struct aws_mqtt_spool *spool) {
+
+    const uint64_t old_head = spool->head;
+    while (spool->head < spool->tail) {
+        const struct spool_record *record = s_record_at(spool, spool->head);
+        if (record->magic == s_record_magic && record->state != S_RECORD_ACKED) {
+            break;
+        }
+        spool->head += record->size;
+    }
+
+    if (spool->next < spool->head) {
+        spool->next = spool->head;
+    }
+    if (spool->head != old_head) {
+        spool->header->head = spool->head;
+        s_sync(spool, spool->header, sizeof(*spool->header));
+    }
+}
+
+static void s_reset(struct aws_mqtt_spool *spool) {
+
+    uint64_t epoch = 0;
+    if (aws_device_random_u64(&epoch)) {
+        aws_high_res_clock_get_ticks(&epoch);
+    }
+
+    spool->header->magic = s_file_magic;
+    spool->header->capacity = spool->capacity;
+    spool->header->epoch = epoch;
+    spool->header->head = 0;
+    s_sync(spool, spool->header, sizeof(*spool->header));
+}
+
+/* Find where the records run out, and make anything taken before a restart available again */
+static void s_recover(struct aws_mqtt_spool *spool) {
+
+    spool->head = spool->header->head;
+    spool->tail = spool->head;
+    spool->count = 0;
+
+    while (spool->tail - spool->head < spool->capacity && s_record_is_valid(spool, spool->tail)) {
+        struct spool_record *record = s_record_at(spool, spool->tail);
+        if (record->magic == s_record_magic) {
+            if (record->state != S_RECORD_ACKED) {
+                record->state = S_RECORD_QUEUED;
+            }
+            if (record->state == S_RECORD_QUEUED) {
+                ++spool->count;
+            }
+        }
+        spool->tail += record->size;
+    }
+
+    spool->next = spool->head;
+    s_advance_head(spool);
+}
+
+int aws_mqtt_spool_open(
+    struct aws_mqtt_spool *spool,
+    struct aws_allocator *allocator,
+    const char *path,
+    size_t size,
+    bool sync) {
+
+    AWS_ASSERT(spool);
+    AWS_ASSERT(allocator);
+    AWS_ASSERT(path);
+
+    AWS_ZERO_STRUCT(*spool);
+
+    /* Room for the header and at least a couple of records */
+    if (size < S_RECORD_ALIGNMENT * 4) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    if (aws_hash_table_init(
+            &spool->callbacks, allocator, 16, s_hash_position, s_position_eq, NULL, s_callbacks_destroy)) {
+        return AWS_OP_ERR;
+    }
+
+    if (aws_mqtt_spool_file_open(&spool->file, path, size)) {
+        aws_hash_table_clean_up(&spool->callbacks);
+        return AWS_OP_ERR;
+    }
+
+    spool->allocator = allocator;
+    spool->header = (struct aws_mqtt_spool_file_header *)spool->file.data;
+    spool->records = spool->file.data + S_RECORD_ALIGNMENT;
+    spool->capacity = (spool->file.size - S_RECORD_ALIGNMENT) & ~(size_t)(S_RECORD_ALIGNMENT - 1);
+    spool->sync = sync;
+
+    if (spool->header->magic != s_file_magic || spool->header->capacity != spool->capacity ||
+        spool->header->head % S_RECORD_ALIGNMENT) {
+        s_reset(spool);
+    }
+
+    s_recover(spool);
+
+    return AWS_OP_SUCCESS;
+}
+
+void aws_mqtt_spool_close(struct aws_mqtt_spool *spool) {
+
+    aws_hash_table_clean_up(&spool->callbacks);
+    aws_mqtt_spool_file_close(&spool->file);
+    AWS_ZERO_STRUCT(*spool);
+}
+
+int aws_mqtt_spool_append(struct aws_mqtt_spool *spool, const struct aws_mqtt_spool_publish *publish) {
+
+    AWS_ASSERT(spool);
+    AWS_ASSERT(publish);
+
+    if (publish->topic.len > UINT16_MAX || publish->payload.len > UINT32_MAX - S_RECORD_ALIGNMENT * 2) {
+        return aws_raise_error(AWS_ERROR_MQTT_SPOOL_FULL);
+    }
+
+    const size_t size = s_align(sizeof(struct spool_record) + publish->topic.len + publish->payload.len);
+    const size_t offset = (size_t)(spool->tail % spool->capacity);
+    const size_t pad_size = offset + size > spool->capacity ? spool->capacity - offset : 0;
+    if (pad_size + size > spool->capacity - (size_t)(spool->tail - spool->head)) {
+        return aws_raise_error(AWS_ERROR_MQTT_SPOOL_FULL);
+    }
+
+    /* Before anything is written, so failing here leaves the spool as it was */
+    if (publish->on_complete) {
+        struct spool_callbacks *callbacks = aws_mem_acquire(spool->allocator, sizeof(struct spool_callbacks));
+        if (!callbacks) {
+            return AWS_OP_ERR;
+        }
+        callbacks->allocator = spool->allocator;
+        callbacks->position = spool->tail + pad_size;
+        callbacks->on_complete = publish->on_complete;
+        callbacks->userdata = publish->userdata;
+        if (aws_hash_table_put(&spool->callbacks, &callbacks->position, callbacks, NULL)) {
+            aws_mem_release(spool->allocator, callbacks);
+            return AWS_OP_ERR;
+        }
+    }
+
+    if (pad_size) {
+        struct spool_record *pad = s_record_at(spool, spool->tail);
+        pad->size = (uint32_t)pad_size;
+        pad->position = spool->tail;
+        pad->magic = s_pad_magic;
+        pad->checksum = s_record_checksum(spool, pad);
+        s_sync(spool, pad, offsetof(struct spool_record, topic_len));
+        spool->tail += pad_size;
+    }
+
+    struct spool_record *record = s_record_at(spool, spool->tail);
+    /* Until the record is complete, it must not pass for one */
+    record->magic = 0;
+    record->size = (uint32_t)size;
+    record->position = spool->tail;
+    record->state = S_RECORD_QUEUED;
+    record->qos = (uint8_t)publish->qos;
+    record->retain = publish->retain;
+    record->attempts = 0;
+    record->topic_len = (uint16_t)publish->topic.len;
+    record->reserved2 = 0;
+    record->payload_len = (uint32_t)publish->payload.len;
+
+    uint8_t *data = (uint8_t *)(record + 1);
+    if (publish->topic.len) {
+        memcpy(data, publish->topic.ptr, publish->topic.len);
+    }
+    if (publish->payload.len) {
+        memcpy(data + publish->topic.len, publish->payload.ptr, publish->payload.len);
+    }
+
+    record->checksum = s_record_checksum(spool, record);
+    record->magic = s_record_magic;
+    s_sync(spool, record, size);
+
+    spool->tail += size;
+    ++spool->count;
+
+    return AWS_OP_SUCCESS;
+}
+
+bool aws_mqtt_spool_take(struct aws_mqtt_spool *spool, struct aws_mqtt_spool_publish *publish) {
+
+    AWS_ASSERT(spool);
+    AWS_ASSERT(publish);
+
+    while (spool->next < spool->tail) {
+        struct spool_record *record = s_record_at(spool, spool->next);
+        const uint64_t position = spool->next;
+        spool->next += record->size;
+
+        if (record->magic != s_record_magic || record->state != S_RECORD_QUEUED) {
+            continue;
+        }
+
+        record->state = S_RECORD_TAKEN;
+
+        const uint8_t *data = (const uint8_t *)(record + 1);
+        publish->position = position;
+        publish->topic = aws_byte_cursor_from_array(data, record->topic_len);
+        publish->payload = aws_byte_cursor_from_array(data + record->topic_len, record->payload_len);
+        publish->qos = (enum aws_mqtt_qos)record->qos;
+        publish->retain = record->retain;
+        publish->on_complete = NULL;
+        publish->userdata = NULL;
+
+        struct aws_hash_element *element = NULL;
+        aws_hash_table_find(&spool->callbacks, &position, &element);
+        if (element) {
+            const struct spool_callbacks *callbacks = element->value;
+            publish->on_complete = callbacks->on_complete;
+            publish->userdata = callbacks->userdata;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+void aws_mqtt_spool_ack(struct aws_mqtt_spool *spool, uint64_t position) {
+
+    AWS_ASSERT(spool);
+    AWS_ASSERT(position >= spool->head && position < spool->tail);
+
+    struct spool_record *record = s_record_at(spool, position);
+    AWS_ASSERT(record->magic == s_record_magic && record->position == position);
+    AWS_ASSERT(record->state == S_RECORD_TAKEN);
+
+    record->state = S_RECORD_ACKED;
+    --spool->count;
+    aws_hash_table_remove(&spool->callbacks, &position, NULL, NULL);
+
+    /* The head may be a pad right in front of this record, so this isn't just for position == head */
+    s_advance_head(spool);
+}
+
+void aws_mqtt_spool_requeue(struct aws_mqtt_spool *spool, uint64_t position) {
+
+    AWS_ASSERT(spool);
+    AWS_ASSERT(position >= spool->head && position < spool->tail);
+
+    struct spool_record *record = s_record_at(spool, position);
+    AWS_ASSERT(record->magic == s_record_magic && record->position == position);
+    AWS_ASSERT(record->state == S_RECORD_TAKEN);
+
+    record->state = S_RECORD_QUEUED;
+    if (position < spool->next) {
+        spool->next = position;
+    }
+}
+
+bool aws_mqtt_spool_fail(struct aws_mqtt_spool *spool, uint64_t position) {
+
+    AWS_ASSERT(spool);
+    AWS_ASSERT(position >= spool->head && position < spool->tail);
+
+    struct spool_record *record = s_record_at(spool, position);
+    AWS_ASSERT(record->magic == s_record_magic && record->position == position);
+
+    if (record->attempts < UINT8_MAX) {
+        ++record->attempts;
+    }
+    if (spool->max_attempts && record->attempts >= spool->max_attempts) {
+        /* Otherwise a record that can never be sent holds up everything behind it for good */
+        aws_mqtt_spool_ack(spool, position);
+        return true;
+    }
+
+    aws_mqtt_spool_requeue(spool, position);
+    return false;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/thread_pool.h>
+
+#include <aws/common/thread.h>
+
+static void s_thread_pool_worker(void *arg) {
+
+    struct aws_mqtt_thread_pool *pool = arg;
+
+    aws_mutex_lock(&pool->lock);
+    for (;;) {
+        if (aws_linked_list_empty(&pool->jobs)) {
+            if (pool->shutting_down) {
+                break;
+            }
+            aws_condition_variable_wait(&pool->signal, &pool->lock);
+            continue;
+        }
+
+        struct aws_mqtt_thread_pool_job *job =
+            AWS_CONTAINER_OF(aws_linked_list_pop_front(&pool->jobs), struct aws_mqtt_thread_pool_job, node);
+
+        /* The job may submit itself again, so it's off the queue before it runs */
+        aws_mutex_unlock(&pool->lock);
+        job->fn(job);
+        aws_mutex_lock(&pool->lock);
+    }
+    aws_mutex_unlock(&pool->lock);
+}
+
+/* Stop and join the first thread_count threads, which must all have been launched */
+static void s_thread_pool_join(struct aws_mqtt_thread_pool *pool, size_t thread_count) {
+
+    aws_mutex_lock(&pool->lock);
+    pool->shutting_down = true;
+    aws_condition_variable_notify_all(&pool->signal);
+    aws_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        aws_thread_join(&pool->threads[i]);
+        aws_thread_clean_up(&pool->threads[i]);
+    }
+}
+
+int aws_mqtt_thread_pool_init(
+    struct aws_mqtt_thread_pool *pool,
+    struct aws_allocator *allocator,
+    size_t thread_count) {
+
+    AWS_ASSERT(pool);
+    AWS_ASSERT(thread_count > 0);
+
+    AWS_ZERO_STRUCT(*pool);
+    pool->allocator = allocator;
+    aws_linked_list_init(&pool->jobs);
+
+    if (aws_mutex_init(&pool->lock)) {
+        return AWS_OP_ERR;
+    }
+
+    if (aws_condition_variable_init(&pool->signal)) {
+        goto failed_signal;
+    }
+
+    pool->threads = aws_mem_acquire(allocator, sizeof(struct aws_thread) * thread_count);
+    if (!pool->threads) {
+        goto failed_threads;
+    }
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        if (aws_thread_init(&pool->threads[i], allocator) ||
+            aws_thread_launch(&pool->threads[i], s_thread_pool_worker, pool, aws_default_thread_options())) {
+
+            aws_thread_clean_up(&pool->threads[i]);
+            s_thread_pool_join(pool, i);
+            goto failed_launch;
+        }
+    }
+    pool->thread_count = thread_count;
+
+    return AWS_OP_SUCCESS;
+
+failed_launch:
+    aws_mem_release(allocator, pool->threads);
+
+failed_threads:
+    aws_condition_variable_clean_up(&pool->signal);
+
+failed_signal:
+    aws_mutex_clean_up(&pool->lock);
+
+    AWS_ZERO_STRUCT(*pool);
+    return AWS_OP_ERR;
+}
+
+void aws_mqtt_thread_pool_clean_up(struct aws_mqtt_thread_pool *pool) {
+
+    AWS_ASSERT(pool);
+
+    s_thread_pool_join(pool, pool->thread_count);
+    AWS_ASSERT(aws_linked_list_empty(&pool->jobs));
+
+    aws_mem_release(pool->allocator, pool->threads);
+    aws_condition_variable_clean_up(&pool->signal);
+    aws_mutex_clean_up(&pool->lock);
+
+    AWS_ZERO_STRUCT(*pool);
+}
+
+void aws_mqtt_thread_pool_submit(struct aws_mqtt_thread_pool *pool, struct aws_mqtt_thread_pool_job *job) {
+
+    AWS_ASSERT(pool);
+    AWS_ASSERT(job && job->fn);
+
+    aws_mutex_lock(&pool->lock);
+    aws_linked_list_push_back(&pool->jobs, &job->node);
+    aws_condition_variable_notify_one(&pool->signal);
+    aws_mutex_unlock(&pool->lock);
+}
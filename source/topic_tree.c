@@ -15,7 +15,8 @@
 
 #include <aws/mqtt/private/topic_tree.h>
 
-#include <aws/io/logging.h>
+#include <aws/mqtt/private/arena.h>
+#include <aws/mqtt/private/logging.h>
 
 #include <aws/common/byte_buf.h>
 #include <aws/common/task_scheduler.h>
@@ -25,9 +26,6 @@
 #    pragma warning(disable : 4204)
 #endif /* _MSC_VER */
 
-AWS_STATIC_STRING_FROM_LITERAL(s_single_level_wildcard, "+");
-AWS_STATIC_STRING_FROM_LITERAL(s_multi_level_wildcard, "#");
-
 /*******************************************************************************
  * Transactions
  ******************************************************************************/
@@ -45,10 +43,8 @@ struct topic_tree_action {
     /* ADD/UPDATE */
     struct aws_byte_cursor topic;
     const struct aws_string *topic_filter;
-    enum aws_mqtt_qos qos;
-    aws_mqtt_publish_received_fn *callback;
-    aws_mqtt_userdata_cleanup_fn *cleanup;
-    void *userdata;
+    /* Allocated up front so commit can't fail, owned by the action until then */
+    struct aws_mqtt_topic_subscriber *subscriber;
 
     /* ADD */
     struct aws_mqtt_topic_node *last_found;
@@ -56,6 +52,9 @@ struct topic_tree_action {
 
     /* REMOVE */
     struct aws_array_list to_remove; /* topic_tree_node* */
+    /* If set, only the subscriber with subscriber_userdata is removed, rather than the whole filter */
+    bool one_subscriber;
+    const void *subscriber_userdata;
 };
 
 size_t aws_mqtt_topic_tree_action_size = sizeof(struct topic_tree_action);
@@ -69,17 +68,18 @@ static struct topic_tree_action *s_topic_tree_action_create(struct aws_array_lis
     AWS_ZERO_STRUCT(empty_action);
     if (aws_array_list_push_back(transaction, &empty_action)) {
 
-        AWS_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "Failed to insert action into transaction, array_list_push_back failed");
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_TOPIC_TREE, "Failed to insert action into transaction, array_list_push_back failed");
         goto push_back_failed;
     }
 
     if (aws_array_list_get_at_ptr(transaction, (void **)&action, aws_array_list_length(transaction) - 1)) {
 
-        AWS_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "Failed to retrieve most recent action from transaction");
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "Failed to retrieve most recent action from transaction");
         goto get_at_failed;
     }
 
-    AWS_LOGF_TRACE(AWS_LS_MQTT_TOPIC_TREE, "action=%p: Created action", (void *)action);
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_TOPIC_TREE, "action=%p: Created action", (void *)action);
 
     return action;
 
@@ -92,7 +92,7 @@ push_back_failed:
 
 static void s_topic_tree_action_destroy(struct topic_tree_action *action) {
 
-    AWS_LOGF_TRACE(AWS_LS_MQTT_TOPIC_TREE, "action=%p: Destroying action", (void *)action);
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_TOPIC_TREE, "action=%p: Destroying action", (void *)action);
 
     if (action->mode == AWS_MQTT_TOPIC_TREE_REMOVE) {
         aws_array_list_clean_up(&action->to_remove);
@@ -109,7 +109,7 @@ static int s_topic_tree_action_to_remove(
     if (action->mode != AWS_MQTT_TOPIC_TREE_REMOVE) {
         if (aws_array_list_init_dynamic(&action->to_remove, allocator, size_hint, sizeof(void *))) {
 
-            AWS_LOGF_ERROR(
+            AWS_MQTT_LOGF_ERROR(
                 AWS_LS_MQTT_TOPIC_TREE, "action=%p: Failed to initialize to_remove list in action", (void *)action);
             return AWS_OP_ERR;
         }
@@ -126,6 +126,204 @@ static bool byte_cursor_eq(const void *a, const void *b) {
     return aws_byte_cursor_eq(cur_a, cur_b);
 }
 
+/*******************************************************************************
+ * Children
+ ******************************************************************************/
+
+static bool s_is_single_level_wildcard(const struct aws_byte_cursor *topic) {
+    return topic->len == 1 && topic->ptr[0] == '+';
+}
+
+static bool s_is_multi_level_wildcard(const struct aws_byte_cursor *topic) {
+    return topic->len == 1 && topic->ptr[0] == '#';
+}
+
+/* Orders by length first, so most comparisons are decided without looking at the bytes */
+static int s_topic_compare(const struct aws_byte_cursor *a, const struct aws_byte_cursor *b) {
+
+    if (a->len != b->len) {
+        return a->len < b->len ? -1 : 1;
+    }
+    return a->len ? memcmp(a->ptr, b->ptr, a->len) : 0;
+}
+
+/* Index of the first inline child that doesn't sort before topic */
+static size_t s_inline_children_lower_bound(
+    const struct aws_mqtt_topic_node *node,
+    const struct aws_byte_cursor *topic) {
+
+    size_t low = 0;
+    size_t high = node->child_count;
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        if (s_topic_compare(&node->inline_children[mid]->topic, topic) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/* Find a child by its exact topic, ignoring the wildcard children */
+static struct aws_mqtt_topic_node *s_topic_node_find_literal_child(
+    const struct aws_mqtt_topic_node *node,
+    const struct aws_byte_cursor *topic) {
+
+    if (node->children_hashed) {
+        struct aws_hash_element *elem = NULL;
+        aws_hash_table_find(&node->subtopics, topic, &elem);
+        return elem ? elem->value : NULL;
+    }
+
+    const size_t idx = s_inline_children_lower_bound(node, topic);
+    if (idx < node->child_count && 0 == s_topic_compare(&node->inline_children[idx]->topic, topic)) {
+        return node->inline_children[idx];
+    }
+    return NULL;
+}
+
+/* Find a child by a part of a topic filter, which may be a wildcard */
+static struct aws_mqtt_topic_node *s_topic_node_find_child(
+    const struct aws_mqtt_topic_node *node,
+    const struct aws_byte_cursor *topic) {
+
+    if (s_is_single_level_wildcard(topic)) {
+        return node->single_level_wildcard;
+    }
+    if (s_is_multi_level_wildcard(topic)) {
+        return node->multi_level_wildcard;
+    }
+    return s_topic_node_find_literal_child(node, topic);
+}
+
+static int s_topic_node_add_child(
+    struct aws_mqtt_topic_node *node,
+    struct aws_mqtt_topic_node *child,
+    struct aws_allocator *allocator) {
+
+    AWS_ASSERT(!s_topic_node_find_child(node, &child->topic));
+
+    if (s_is_single_level_wildcard(&child->topic)) {
+        node->single_level_wildcard = child;
+        return AWS_OP_SUCCESS;
+    }
+    if (s_is_multi_level_wildcard(&child->topic)) {
+        node->multi_level_wildcard = child;
+        return AWS_OP_SUCCESS;
+    }
+
+    if (!node->children_hashed && node->child_count == AWS_MQTT_TOPIC_NODE_INLINE_CHILDREN) {
+        /* Out of inline space, move everyone to the hash table */
+        if (aws_hash_table_init(
+                &node->subtopics,
+                allocator,
+                AWS_MQTT_TOPIC_NODE_INLINE_CHILDREN * 2,
+                aws_hash_byte_cursor_ptr,
+                byte_cursor_eq,
+                NULL,
+                NULL)) {
+
+            AWS_MQTT_LOGF_ERROR(
+                AWS_LS_MQTT_TOPIC_TREE, "node=%p: Failed to initialize subtopics table in topic node", (void *)node);
+            return AWS_OP_ERR;
+        }
+
+        for (size_t i = 0; i < node->child_count; ++i) {
+            struct aws_mqtt_topic_node *inline_child = node->inline_children[i];
+            if (aws_hash_table_put(&node->subtopics, &inline_child->topic, inline_child, NULL)) {
+                aws_hash_table_clean_up(&node->subtopics);
+                return AWS_OP_ERR;
+            }
+        }
+        node->children_hashed = true;
+    }
+
+    if (node->children_hashed) {
+        if (aws_hash_table_put(&node->subtopics, &child->topic, child, NULL)) {
+            return AWS_OP_ERR;
+        }
+    } else {
+        const size_t idx = s_inline_children_lower_bound(node, &child->topic);
+        memmove(
+            &node->inline_children[idx + 1],
+            &node->inline_children[idx],
+            (node->child_count - idx) * sizeof(node->inline_children[0]));
+        node->inline_children[idx] = child;
+    }
+    ++node->child_count;
+
+    return AWS_OP_SUCCESS;
+}
+
+static void s_topic_node_remove_child(struct aws_mqtt_topic_node *node, struct aws_mqtt_topic_node *child) {
+
+    if (child == node->single_level_wildcard) {
+        node->single_level_wildcard = NULL;
+        return;
+    }
+    if (child == node->multi_level_wildcard) {
+        node->multi_level_wildcard = NULL;
+        return;
+    }
+
+    if (node->children_hashed) {
+        aws_hash_table_remove(&node->subtopics, &child->topic, NULL, NULL);
+    } else {
+        const size_t idx = s_inline_children_lower_bound(node, &child->topic);
+        AWS_ASSERT(idx < node->child_count && node->inline_children[idx] == child);
+        memmove(
+            &node->inline_children[idx],
+            &node->inline_children[idx + 1],
+            (node->child_count - idx - 1) * sizeof(node->inline_children[0]));
+    }
+    --node->child_count;
+}
+
+size_t aws_mqtt_topic_node_get_child_count(const struct aws_mqtt_topic_node *node) {
+
+    return node->child_count + (node->single_level_wildcard != NULL) + (node->multi_level_wildcard != NULL);
+}
+
+/* Return false to stop iterating */
+typedef bool(s_topic_node_child_fn)(struct aws_mqtt_topic_node *child, void *userdata);
+
+struct topic_node_foreach_wrapper {
+    s_topic_node_child_fn *fn;
+    void *userdata;
+};
+
+static int s_topic_node_foreach_hash_wrap(void *context, struct aws_hash_element *elem) {
+
+    struct topic_node_foreach_wrapper *wrapper = context;
+    if (!wrapper->fn(elem->value, wrapper->userdata)) {
+        return 0;
+    }
+    return AWS_COMMON_HASH_TABLE_ITER_CONTINUE;
+}
+
+/* Call fn on each child, wildcards first. Children must not be added or removed while iterating. */
+static void s_topic_node_foreach_child(struct aws_mqtt_topic_node *node, s_topic_node_child_fn *fn, void *userdata) {
+
+    if (node->multi_level_wildcard && !fn(node->multi_level_wildcard, userdata)) {
+        return;
+    }
+    if (node->single_level_wildcard && !fn(node->single_level_wildcard, userdata)) {
+        return;
+    }
+
+    if (node->children_hashed) {
+        struct topic_node_foreach_wrapper wrapper = {.fn = fn, .userdata = userdata};
+        aws_hash_table_foreach(&node->subtopics, s_topic_node_foreach_hash_wrap, &wrapper);
+    } else {
+        for (size_t i = 0; i < node->child_count; ++i) {
+            if (!fn(node->inline_children[i], userdata)) {
+                return;
+            }
+        }
+    }
+}
+
 /*******************************************************************************
  * Init
  ******************************************************************************/
@@ -137,14 +335,14 @@ static struct aws_mqtt_topic_node *s_topic_node_new(
 
     struct aws_mqtt_topic_node *node = aws_mem_acquire(allocator, sizeof(struct aws_mqtt_topic_node));
     if (!node) {
-        AWS_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "Failed to allocate new topic node");
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "Failed to allocate new topic node");
         return NULL;
     }
     AWS_ZERO_STRUCT(*node);
     AWS_ASSERT(!topic_filter || full_topic);
 
     if (topic_filter) {
-        AWS_LOGF_TRACE(
+        AWS_MQTT_LOGF_TRACE(
             AWS_LS_MQTT_TOPIC_TREE,
             "node=%p: Creating new node with topic filter " PRInSTR,
             (void *)node,
@@ -156,44 +354,67 @@ static struct aws_mqtt_topic_node *s_topic_node_new(
         node->topic_filter = full_topic;
     }
 
-    /* Init the sub topics map */
-    if (aws_hash_table_init(&node->subtopics, allocator, 0, aws_hash_byte_cursor_ptr, byte_cursor_eq, NULL, NULL)) {
+    return node;
+}
 
-        AWS_LOGF_ERROR(
-            AWS_LS_MQTT_TOPIC_TREE, "node=%p: Failed to initialize subtopics table in topic node", (void *)node);
-        aws_mem_release(allocator, node);
-        return NULL;
+/* Cleans up every subscriber's userdata, and releases the subscribers too unless allocator is NULL */
+static void s_topic_node_clean_up_subscribers(struct aws_mqtt_topic_node *node, struct aws_allocator *allocator) {
+
+    struct aws_mqtt_topic_subscriber *subscriber = node->subscribers;
+    while (subscriber) {
+        struct aws_mqtt_topic_subscriber *next = subscriber->next;
+
+        if (subscriber->cleanup && subscriber->userdata) {
+            subscriber->cleanup(subscriber->userdata);
+        }
+        if (allocator) {
+            aws_mem_release(allocator, subscriber);
+        }
+        subscriber = next;
     }
 
-    return node;
+    node->subscribers = NULL;
+    node->subscriber_count = 0;
+    node->qos = AWS_MQTT_QOS_AT_MOST_ONCE;
+    node->granted = false;
 }
 
-static int s_topic_node_destroy_hash_foreach_wrap(void *context, struct aws_hash_element *elem);
+static bool s_topic_node_destroy_child(struct aws_mqtt_topic_node *child, void *userdata);
 
 static void s_topic_node_destroy(struct aws_mqtt_topic_node *node, struct aws_allocator *allocator) {
 
-    AWS_LOGF_TRACE(AWS_LS_MQTT_TOPIC_TREE, "node=%p: Destroying topic tree node", (void *)node);
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_TOPIC_TREE, "node=%p: Destroying topic tree node", (void *)node);
 
     /* Traverse all children and remove */
-    aws_hash_table_foreach(&node->subtopics, s_topic_node_destroy_hash_foreach_wrap, allocator);
+    s_topic_node_foreach_child(node, s_topic_node_destroy_child, allocator);
 
-    if (node->cleanup && node->userdata) {
-        node->cleanup(node->userdata);
-    }
+    s_topic_node_clean_up_subscribers(node, allocator);
 
     if (node->owns_topic_filter) {
         aws_string_destroy((void *)node->topic_filter);
     }
 
-    aws_hash_table_clean_up(&node->subtopics);
+    if (node->children_hashed) {
+        aws_hash_table_clean_up(&node->subtopics);
+    }
     aws_mem_release(allocator, node);
 }
 
-static int s_topic_node_destroy_hash_foreach_wrap(void *context, struct aws_hash_element *elem) {
+static bool s_topic_node_destroy_child(struct aws_mqtt_topic_node *child, void *userdata) {
+
+    s_topic_node_destroy(child, userdata);
+
+    return true;
+}
+
+/* Only cleans up the subscriptions' userdata, for when the memory is released in bulk afterwards */
+static bool s_topic_node_clean_up_userdata(struct aws_mqtt_topic_node *node, void *userdata) {
+
+    s_topic_node_foreach_child(node, s_topic_node_clean_up_userdata, userdata);
 
-    s_topic_node_destroy(elem->value, context);
+    s_topic_node_clean_up_subscribers(node, NULL);
 
-    return AWS_COMMON_HASH_TABLE_ITER_CONTINUE | AWS_COMMON_HASH_TABLE_ITER_DELETE;
+    return true;
 }
 
 int aws_mqtt_topic_tree_init(struct aws_mqtt_topic_tree *tree, struct aws_allocator *allocator) {
@@ -201,13 +422,44 @@ int aws_mqtt_topic_tree_init(struct aws_mqtt_topic_tree *tree, struct aws_alloca
     AWS_ASSERT(tree);
     AWS_ASSERT(allocator);
 
-    AWS_LOGF_DEBUG(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Creating new topic tree", (void *)tree);
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Creating new topic tree", (void *)tree);
 
     tree->root = s_topic_node_new(allocator, NULL, NULL);
     if (!tree->root) {
         return AWS_OP_ERR;
     }
     tree->allocator = allocator;
+    tree->arena = NULL;
+    tree->generation = 0;
+    tree->match_cache = NULL;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_mqtt_topic_tree_init_arena(struct aws_mqtt_topic_tree *tree, struct aws_allocator *allocator) {
+
+    AWS_ASSERT(tree);
+    AWS_ASSERT(allocator);
+
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Creating new arena backed topic tree", (void *)tree);
+
+    struct aws_mqtt_arena *arena = aws_mem_acquire(allocator, sizeof(struct aws_mqtt_arena));
+    if (!arena) {
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to allocate topic tree arena", (void *)tree);
+        return AWS_OP_ERR;
+    }
+    aws_mqtt_arena_init(arena, allocator);
+
+    tree->root = s_topic_node_new(&arena->allocator, NULL, NULL);
+    if (!tree->root) {
+        aws_mqtt_arena_clean_up(arena);
+        aws_mem_release(allocator, arena);
+        return AWS_OP_ERR;
+    }
+    tree->allocator = &arena->allocator;
+    tree->arena = arena;
+    tree->generation = 0;
+    tree->match_cache = NULL;
 
     return AWS_OP_SUCCESS;
 }
@@ -216,55 +468,104 @@ int aws_mqtt_topic_tree_init(struct aws_mqtt_topic_tree *tree, struct aws_alloca
  * Clean Up
  ******************************************************************************/
 
+static void s_match_cache_destroy(struct aws_mqtt_topic_tree_match_cache *cache);
+
 void aws_mqtt_topic_tree_clean_up(struct aws_mqtt_topic_tree *tree) {
 
     AWS_ASSERT(tree);
 
-    AWS_LOGF_DEBUG(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Cleaning up topic tree", (void *)tree);
+    AWS_MQTT_LOGF_DEBUG(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Cleaning up topic tree", (void *)tree);
 
     if (tree->allocator && tree->root) {
-        s_topic_node_destroy(tree->root, tree->allocator);
+        if (tree->match_cache) {
+            s_match_cache_destroy(tree->match_cache);
+        }
+
+        if (tree->arena) {
+            /* Everything the tree allocated lives in the arena, so there's no need to visit it node by node */
+            s_topic_node_clean_up_userdata(tree->root, NULL);
+
+            struct aws_allocator *backing = tree->arena->backing;
+            aws_mqtt_arena_clean_up(tree->arena);
+            aws_mem_release(backing, tree->arena);
+        } else {
+            s_topic_node_destroy(tree->root, tree->allocator);
+        }
 
         AWS_ZERO_STRUCT(*tree);
     }
 }
 
 bool s_topic_node_is_subscription(const struct aws_mqtt_topic_node *node) {
-    return node->callback;
+    return node->subscribers;
+}
+
+/* Unlink the first subscriber with userdata and clean it up. Returns false if there was none. */
+static bool s_topic_node_remove_subscriber(
+    struct aws_mqtt_topic_node *node,
+    const void *userdata,
+    struct aws_allocator *allocator) {
+
+    struct aws_mqtt_topic_subscriber **link = &node->subscribers;
+    while (*link && (*link)->userdata != userdata) {
+        link = &(*link)->next;
+    }
+
+    struct aws_mqtt_topic_subscriber *subscriber = *link;
+    if (!subscriber) {
+        return false;
+    }
+    *link = subscriber->next;
+    --node->subscriber_count;
+
+    if (subscriber->cleanup && subscriber->userdata) {
+        subscriber->cleanup(subscriber->userdata);
+    }
+    aws_mem_release(allocator, subscriber);
+
+    /* The one leaving may have been the only one asking for the highest QoS */
+    node->qos = AWS_MQTT_QOS_AT_MOST_ONCE;
+    for (subscriber = node->subscribers; subscriber; subscriber = subscriber->next) {
+        if (subscriber->qos > node->qos) {
+            node->qos = subscriber->qos;
+        }
+    }
+
+    return true;
 }
 
 /*******************************************************************************
  * Action Commit
  ******************************************************************************/
 
-/* Searches subtree until a topic_filter with a different pointer value is found. */
-static int s_topic_node_string_finder(void *userdata, struct aws_hash_element *elem) {
+/* Searches subtree until a topic_filter with a different pointer value is found. Returns false once found. */
+static bool s_topic_node_string_finder(struct aws_mqtt_topic_node *node, void *userdata) {
 
     const struct aws_string **topic_filter = userdata;
-    struct aws_mqtt_topic_node *node = elem->value;
 
     /* We've found this node again, search it's children */
     if (*topic_filter == node->topic_filter) {
-        if (0 == aws_hash_table_get_entry_count(&node->subtopics)) {
+        if (0 == aws_mqtt_topic_node_get_child_count(node)) {
             /* If no children, then there must be siblings, so we can use those */
-            return AWS_COMMON_HASH_TABLE_ITER_CONTINUE;
+            return true;
         }
 
-        aws_hash_table_foreach(&node->subtopics, s_topic_node_string_finder, userdata);
+        s_topic_node_foreach_child(node, s_topic_node_string_finder, userdata);
 
         if (*topic_filter == node->topic_filter) {
             /* If the topic filter still hasn't changed, continue iterating */
-            return AWS_COMMON_HASH_TABLE_ITER_CONTINUE;
+            return true;
         }
 
-        AWS_LOGF_TRACE(AWS_LS_MQTT_TOPIC_TREE, "    Found matching topic string, using %s", node->topic_filter->bytes);
+        AWS_MQTT_LOGF_TRACE(
+            AWS_LS_MQTT_TOPIC_TREE, "    Found matching topic string, using %s", node->topic_filter->bytes);
 
-        return 0;
+        return false;
     }
 
-    AWS_LOGF_TRACE(AWS_LS_MQTT_TOPIC_TREE, "    Found matching topic string, using %s", node->topic_filter->bytes);
+    AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_TOPIC_TREE, "    Found matching topic string, using %s", node->topic_filter->bytes);
     *topic_filter = node->topic_filter;
-    return 0;
+    return false;
 }
 
 static void s_topic_tree_action_commit(struct topic_tree_action *action, struct aws_mqtt_topic_tree *tree) {
@@ -276,24 +577,28 @@ static void s_topic_tree_action_commit(struct topic_tree_action *action, struct
         case AWS_MQTT_TOPIC_TREE_ADD:
         case AWS_MQTT_TOPIC_TREE_UPDATE: {
 
-            AWS_LOGF_TRACE(
+            AWS_MQTT_LOGF_TRACE(
                 AWS_LS_MQTT_TOPIC_TREE,
                 "tree=%p action=%p: Committing %s topic tree action",
                 (void *)tree,
                 (void *)action,
                 (action->mode == AWS_MQTT_TOPIC_TREE_ADD) ? "add" : "update");
 
-            /* Destroy old userdata */
-            if (action->node_to_update->cleanup && action->node_to_update->userdata) {
-                /* If there was userdata assigned to this node, pass it out. */
-                action->node_to_update->cleanup(action->node_to_update->userdata);
+            /* Join whoever is subscribed already, after them */
+            struct aws_mqtt_topic_subscriber **link = &action->node_to_update->subscribers;
+            while (*link) {
+                link = &(*link)->next;
             }
+            *link = action->subscriber;
+            if (++action->node_to_update->subscriber_count == 1) {
+                /* Whatever the server granted before was for subscribers that are gone */
+                action->node_to_update->granted = false;
+            }
+            if (action->subscriber->qos > action->node_to_update->qos) {
+                action->node_to_update->qos = action->subscriber->qos;
+            }
+            action->subscriber = NULL;
 
-            /* Update data */
-            action->node_to_update->callback = action->callback;
-            action->node_to_update->cleanup = action->cleanup;
-            action->node_to_update->userdata = action->userdata;
-            action->node_to_update->qos = action->qos;
             if (action->topic.ptr) {
                 action->node_to_update->topic = action->topic;
             }
@@ -306,7 +611,7 @@ static void s_topic_tree_action_commit(struct topic_tree_action *action, struct
 
         case AWS_MQTT_TOPIC_TREE_REMOVE: {
 
-            AWS_LOGF_TRACE(
+            AWS_MQTT_LOGF_TRACE(
                 AWS_LS_MQTT_TOPIC_TREE,
                 "tree=%p action=%p: Committing remove topic tree action",
                 (void *)tree,
@@ -315,20 +620,29 @@ static void s_topic_tree_action_commit(struct topic_tree_action *action, struct
             struct aws_mqtt_topic_node *current = action->node_to_update;
             const size_t sub_parts_len = aws_array_list_length(&action->to_remove) - 1;
 
-            if (current) {
-                /* If found the node, traverse up and remove each with no sub-topics.
-                 * Then update all nodes that were using current's topic_filter for topic. */
+            if (current && action->one_subscriber) {
+                if (!s_topic_node_remove_subscriber(current, action->subscriber_userdata, tree->allocator) ||
+                    s_topic_node_is_subscription(current)) {
 
-                /* "unsubscribe" current. */
-                if (current->cleanup && current->userdata) {
-                    AWS_LOGF_TRACE(AWS_LS_MQTT_TOPIC_TREE, "node=%p: Cleaning up node's userdata", (void *)current);
+                    AWS_MQTT_LOGF_TRACE(
+                        AWS_LS_MQTT_TOPIC_TREE,
+                        "tree=%p node=%p: Node still has %d subscribers, leaving in place",
+                        (void *)tree,
+                        (void *)current,
+                        (int)current->subscriber_count);
 
-                    /* If there was userdata assigned to this node, pass it out. */
-                    current->cleanup(current->userdata);
+                    /* The filter stays as long as anyone is still subscribed to it */
+                    current = NULL;
                 }
-                current->callback = NULL;
-                current->cleanup = NULL;
-                current->userdata = NULL;
+            } else if (current) {
+                /* "unsubscribe" current. */
+                AWS_MQTT_LOGF_TRACE(AWS_LS_MQTT_TOPIC_TREE, "node=%p: Cleaning up node's subscribers", (void *)current);
+                s_topic_node_clean_up_subscribers(current, tree->allocator);
+            }
+
+            if (current) {
+                /* If found the node, traverse up and remove each with no sub-topics.
+                 * Then update all nodes that were using current's topic_filter for topic. */
 
                 /* Set to true if current needs to be cleaned up. */
                 bool destroy_current = false;
@@ -342,14 +656,14 @@ static void s_topic_tree_action_commit(struct topic_tree_action *action, struct
                     aws_array_list_get_at(&action->to_remove, &node, i);
                     AWS_ASSERT(node); /* Must be in bounds */
 
-                    if (!s_topic_node_is_subscription(node) && 0 == aws_hash_table_get_entry_count(&node->subtopics)) {
+                    if (!s_topic_node_is_subscription(node) && 0 == aws_mqtt_topic_node_get_child_count(node)) {
 
                         /* No subscription and no children, this node needs to go. */
                         struct aws_mqtt_topic_node *grandma = NULL;
                         aws_array_list_get_at(&action->to_remove, &grandma, i - 1);
                         AWS_ASSERT(grandma); /* Must be in bounds */
 
-                        AWS_LOGF_TRACE(
+                        AWS_MQTT_LOGF_TRACE(
                             AWS_LS_MQTT_TOPIC_TREE,
                             "tree=%p node=%p: Removing child node %p with topic \"" PRInSTR "\"",
                             (void *)tree,
@@ -357,7 +671,7 @@ static void s_topic_tree_action_commit(struct topic_tree_action *action, struct
                             (void *)node,
                             AWS_BYTE_CURSOR_PRI(node->topic));
 
-                        aws_hash_table_remove(&grandma->subtopics, &node->topic, NULL, NULL);
+                        s_topic_node_remove_child(grandma, node);
 
                         /* Make sure the following loop doesn't hit this node. */
                         --nodes_left;
@@ -371,7 +685,7 @@ static void s_topic_tree_action_commit(struct topic_tree_action *action, struct
                         }
                     } else {
 
-                        AWS_LOGF_TRACE(
+                        AWS_MQTT_LOGF_TRACE(
                             AWS_LS_MQTT_TOPIC_TREE,
                             "tree=%p: Node %p with topic \"" PRInSTR
                             "\" has children or is a subscription, leaving in place",
@@ -411,7 +725,7 @@ static void s_topic_tree_action_commit(struct topic_tree_action *action, struct
                             /* Uh oh, Mom's using my topic string again! Steal it and replace it with a new one, Indiana
                              * Jones style. */
 
-                            AWS_LOGF_TRACE(
+                            AWS_MQTT_LOGF_TRACE(
                                 AWS_LS_MQTT_TOPIC_TREE,
                                 "tree=%p: Found node %p reusing topic filter part, replacing with next child",
                                 (void *)tree,
@@ -423,8 +737,8 @@ static void s_topic_tree_action_commit(struct topic_tree_action *action, struct
                                 new_topic_filter = old_topic_filter;
 
                                 /* Search all subtopics until we find one that isn't current. */
-                                aws_hash_table_foreach(
-                                    &parent->subtopics, s_topic_node_string_finder, (void *)&new_topic_filter);
+                                s_topic_node_foreach_child(
+                                    parent, s_topic_node_string_finder, (void *)&new_topic_filter);
 
                                 /* This would only happen if there is only one topic in subtopics (current's) and
                                  * it has no children (in which case it should have been removed above). */
@@ -466,32 +780,46 @@ static void s_topic_tree_action_roll_back(struct topic_tree_action *action, stru
 
     switch (action->mode) {
         case AWS_MQTT_TOPIC_TREE_ADD: {
-            AWS_LOGF_TRACE(
+            AWS_MQTT_LOGF_TRACE(
                 AWS_LS_MQTT_TOPIC_TREE,
                 "tree=%p action=%p: Rolling back add transaction action",
                 (void *)tree,
                 (void *)action);
 
             /* Remove the first new node from it's parent's map */
-            aws_hash_table_remove(&action->last_found->subtopics, &action->first_created->topic, NULL, NULL);
+            s_topic_node_remove_child(action->last_found, action->first_created);
             /* Recursively destroy all other created nodes */
             s_topic_node_destroy(action->first_created, tree->allocator);
 
             if (action->topic_filter) {
                 aws_string_destroy((void *)action->topic_filter);
             }
+            aws_mem_release(tree->allocator, action->subscriber);
 
             break;
         }
-        case AWS_MQTT_TOPIC_TREE_REMOVE:
         case AWS_MQTT_TOPIC_TREE_UPDATE: {
-            AWS_LOGF_TRACE(
+            AWS_MQTT_LOGF_TRACE(
                 AWS_LS_MQTT_TOPIC_TREE,
-                "tree=%p action=%p: Rolling back remove/update transaction, no changes made",
+                "tree=%p action=%p: Rolling back update transaction, no changes made",
                 (void *)tree,
                 (void *)action);
 
-            /* Aborting a remove or update doesn't require any actions. */
+            /* Nothing in the tree changed, but the topic filter copy and the subscriber are still the action's */
+            if (action->topic_filter) {
+                aws_string_destroy((void *)action->topic_filter);
+            }
+            aws_mem_release(tree->allocator, action->subscriber);
+            break;
+        }
+        case AWS_MQTT_TOPIC_TREE_REMOVE: {
+            AWS_MQTT_LOGF_TRACE(
+                AWS_LS_MQTT_TOPIC_TREE,
+                "tree=%p action=%p: Rolling back remove transaction, no changes made",
+                (void *)tree,
+                (void *)action);
+
+            /* Aborting a remove doesn't require any actions. */
             break;
         }
     }
@@ -517,7 +845,7 @@ int aws_mqtt_topic_tree_transaction_insert(
     AWS_ASSERT(topic_filter);
     AWS_ASSERT(callback);
 
-    AWS_LOGF_DEBUG(
+    AWS_MQTT_LOGF_DEBUG(
         AWS_LS_MQTT_TOPIC_TREE,
         "tree=%p: Inserting topic filter %s into topic tree",
         (void *)tree,
@@ -525,19 +853,41 @@ int aws_mqtt_topic_tree_transaction_insert(
 
     struct aws_mqtt_topic_node *current = tree->root;
 
+    /* The tree's nodes point into their own copy of the filter, which comes out of the arena if there is one */
+    struct aws_string *interned_filter =
+        aws_string_new_from_array(tree->allocator, aws_string_bytes(topic_filter), topic_filter->len);
+    if (!interned_filter) {
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to copy topic filter", (void *)tree);
+        return AWS_OP_ERR;
+    }
+
+    struct aws_mqtt_topic_subscriber *subscriber =
+        aws_mem_acquire(tree->allocator, sizeof(struct aws_mqtt_topic_subscriber));
+    if (!subscriber) {
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to allocate subscriber", (void *)tree);
+        aws_string_destroy(interned_filter);
+        return AWS_OP_ERR;
+    }
+    AWS_ZERO_STRUCT(*subscriber);
+    subscriber->qos = qos;
+    subscriber->callback = callback;
+    subscriber->cleanup = cleanup;
+    subscriber->userdata = userdata;
+
     struct topic_tree_action *action = s_topic_tree_action_create(transaction);
     if (!action) {
+        aws_mem_release(tree->allocator, subscriber);
+        aws_string_destroy(interned_filter);
         return AWS_OP_ERR;
     }
 
     /* Default to update unless a node was added */
     action->mode = AWS_MQTT_TOPIC_TREE_UPDATE;
-    action->qos = qos;
-    action->callback = callback;
-    action->cleanup = cleanup;
-    action->userdata = userdata;
+    action->subscriber = subscriber;
+    /* The action owns the copy until commit, so roll back can free it */
+    action->topic_filter = interned_filter;
 
-    struct aws_byte_cursor topic_filter_cur = aws_byte_cursor_from_string(topic_filter);
+    struct aws_byte_cursor topic_filter_cur = aws_byte_cursor_from_string(interned_filter);
     struct aws_byte_cursor sub_part;
     AWS_ZERO_STRUCT(sub_part);
     struct aws_byte_cursor last_part;
@@ -547,43 +897,40 @@ int aws_mqtt_topic_tree_transaction_insert(
         last_part = sub_part;
 
         /* Add or find mid-node */
-        struct aws_hash_element *elem = NULL;
-        int was_created = 0;
-        aws_hash_table_create(&current->subtopics, &sub_part, &elem, &was_created);
-
-        if (was_created) {
-            if (action->mode == AWS_MQTT_TOPIC_TREE_UPDATE) {
-                /* Store the last found node */
-                action->last_found = current;
-            }
+        struct aws_mqtt_topic_node *child = s_topic_node_find_child(current, &sub_part);
 
+        if (!child) {
             /* Node does not exist, add new one */
-            current = s_topic_node_new(tree->allocator, &sub_part, topic_filter);
-            if (!current) {
+            child = s_topic_node_new(tree->allocator, &sub_part, interned_filter);
+            if (!child) {
                 /* Don't do handle_error logic, the action needs to persist to be rolled back */
                 return AWS_OP_ERR;
             }
 
-            /* Stash in the hash map */
-            elem->key = &current->topic;
-            elem->value = current;
+            if (s_topic_node_add_child(current, child, tree->allocator)) {
+                /* child isn't in the tree, so roll back won't find it */
+                s_topic_node_destroy(child, tree->allocator);
+                return AWS_OP_ERR;
+            }
 
             if (action->mode == AWS_MQTT_TOPIC_TREE_UPDATE) {
-                AWS_LOGF_TRACE(
+                AWS_MQTT_LOGF_TRACE(
                     AWS_LS_MQTT_TOPIC_TREE,
                     "tree=%p: Topic part \"" PRInSTR "\" is new, it and all children will be added as new nodes",
                     (void *)tree,
                     AWS_BYTE_CURSOR_PRI(sub_part));
 
-                /* Store the node we just made, and make sure we don't store again */
+                /* Store the last found node and the node we just made, and make sure we don't store again */
                 action->mode = AWS_MQTT_TOPIC_TREE_ADD;
-                action->first_created = current;
+                action->last_found = current;
+                action->first_created = child;
             }
+            current = child;
         } else {
             AWS_ASSERT(action->mode == AWS_MQTT_TOPIC_TREE_UPDATE); /* Can't have found an existing node while adding */
 
             /* If the node exists, just traverse it */
-            current = elem->value;
+            current = child;
         }
     }
 
@@ -592,19 +939,19 @@ int aws_mqtt_topic_tree_transaction_insert(
     /* Node found (or created), add the topic filter and callbacks */
     if (current->owns_topic_filter) {
 
-        AWS_LOGF_TRACE(
+        AWS_MQTT_LOGF_TRACE(
             AWS_LS_MQTT_TOPIC_TREE,
-            "tree=%p node=%p: Updating existing node that alrady owns its topic_filter, throwing out parameter",
+            "tree=%p node=%p: Updating existing node that alrady owns its topic_filter, throwing out the copy",
             (void *)tree,
             (void *)current);
 
-        /* If the topic filter was already here, this is already a subscription.
-           Free the new topic_filter so all existing byte_cursors remain valid. */
-        aws_string_destroy((void *)topic_filter);
+        /* If the topic filter was already here, this is already a subscription and gets another subscriber.
+           Free the new copy so all existing byte_cursors remain valid. */
+        aws_string_destroy(interned_filter);
+        action->topic_filter = NULL;
     } else {
         /* Node already existed (or was created) but wasn't subscription. */
         action->topic = last_part;
-        action->topic_filter = topic_filter;
     }
 
     return AWS_OP_SUCCESS;
@@ -614,16 +961,18 @@ int aws_mqtt_topic_tree_transaction_insert(
  * Remove
  ******************************************************************************/
 
-int aws_mqtt_topic_tree_transaction_remove(
+static int s_topic_tree_transaction_remove(
     struct aws_mqtt_topic_tree *tree,
     struct aws_array_list *transaction,
-    const struct aws_byte_cursor *topic_filter) {
+    const struct aws_byte_cursor *topic_filter,
+    bool one_subscriber,
+    const void *subscriber_userdata) {
 
     AWS_ASSERT(tree);
     AWS_ASSERT(transaction);
     AWS_ASSERT(topic_filter);
 
-    AWS_LOGF_DEBUG(
+    AWS_MQTT_LOGF_DEBUG(
         AWS_LS_MQTT_TOPIC_TREE,
         "tree=%p: Removing topic filter \"" PRInSTR "\" from topic tree",
         (void *)tree,
@@ -638,24 +987,25 @@ int aws_mqtt_topic_tree_transaction_remove(
     AWS_ZERO_STRUCT(sub_topic_parts);
 
     if (aws_array_list_init_dynamic(&sub_topic_parts, tree->allocator, 1, sizeof(struct aws_byte_cursor))) {
-        AWS_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to initialize topic parts array", (void *)tree);
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to initialize topic parts array", (void *)tree);
         goto handle_error;
     }
 
     if (aws_byte_cursor_split_on_char(topic_filter, '/', &sub_topic_parts)) {
-        AWS_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to split topic filter", (void *)tree);
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to split topic filter", (void *)tree);
         goto handle_error;
     }
     const size_t sub_parts_len = aws_array_list_length(&sub_topic_parts);
     if (!sub_parts_len) {
-        AWS_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to get topic parts length", (void *)tree);
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to get topic parts length", (void *)tree);
         goto handle_error;
     }
     s_topic_tree_action_to_remove(action, tree->allocator, sub_parts_len);
 
     struct aws_mqtt_topic_node *current = tree->root;
     if (aws_array_list_push_back(&action->to_remove, &current)) {
-        AWS_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to insert root node into to_remove list", (void *)tree);
+        AWS_MQTT_LOGF_ERROR(
+            AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to insert root node into to_remove list", (void *)tree);
         goto handle_error;
     }
 
@@ -666,13 +1016,12 @@ int aws_mqtt_topic_tree_transaction_remove(
         aws_array_list_get_at_ptr(&sub_topic_parts, (void **)&sub_part, i);
 
         /* Find mid-node */
-        struct aws_hash_element *elem = NULL;
-        aws_hash_table_find(&current->subtopics, sub_part, &elem);
-        if (elem) {
+        struct aws_mqtt_topic_node *child = s_topic_node_find_child(current, sub_part);
+        if (child) {
             /* If the node exists, just traverse it */
-            current = elem->value;
+            current = child;
             if (aws_array_list_push_back(&action->to_remove, &current)) {
-                AWS_LOGF_ERROR(
+                AWS_MQTT_LOGF_ERROR(
                     AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to insert topic node into to_remove list", (void *)tree);
                 goto handle_error;
             }
@@ -684,6 +1033,8 @@ int aws_mqtt_topic_tree_transaction_remove(
     }
 
     action->node_to_update = current;
+    action->one_subscriber = one_subscriber;
+    action->subscriber_userdata = subscriber_userdata;
 
     aws_array_list_clean_up(&sub_topic_parts);
 
@@ -698,6 +1049,23 @@ handle_error:
     return AWS_OP_ERR;
 }
 
+int aws_mqtt_topic_tree_transaction_remove(
+    struct aws_mqtt_topic_tree *tree,
+    struct aws_array_list *transaction,
+    const struct aws_byte_cursor *topic_filter) {
+
+    return s_topic_tree_transaction_remove(tree, transaction, topic_filter, false, NULL);
+}
+
+int aws_mqtt_topic_tree_transaction_remove_subscriber(
+    struct aws_mqtt_topic_tree *tree,
+    struct aws_array_list *transaction,
+    const struct aws_byte_cursor *topic_filter,
+    const void *userdata) {
+
+    return s_topic_tree_transaction_remove(tree, transaction, topic_filter, true, userdata);
+}
+
 /*******************************************************************************
  * Commit
  ******************************************************************************/
@@ -713,6 +1081,11 @@ void aws_mqtt_topic_tree_transaction_commit(struct aws_mqtt_topic_tree *tree, st
         s_topic_tree_action_commit(action, tree);
     }
     aws_array_list_clear(transaction);
+
+    if (num_actions) {
+        /* Anything matched before this commit may be out of date now */
+        ++tree->generation;
+    }
 }
 
 /*******************************************************************************
@@ -770,54 +1143,443 @@ int aws_mqtt_topic_tree_remove(struct aws_mqtt_topic_tree *tree, const struct aw
     return AWS_OP_SUCCESS;
 }
 
+int aws_mqtt_topic_tree_remove_subscriber(
+    struct aws_mqtt_topic_tree *tree,
+    const struct aws_byte_cursor *topic_filter,
+    const void *userdata) {
+
+    AWS_VARIABLE_LENGTH_ARRAY(uint8_t, transaction_buf, aws_mqtt_topic_tree_action_size);
+    struct aws_array_list transaction;
+    aws_array_list_init_static(&transaction, transaction_buf, 1, aws_mqtt_topic_tree_action_size);
+
+    if (aws_mqtt_topic_tree_transaction_remove_subscriber(tree, &transaction, topic_filter, userdata)) {
+
+        aws_mqtt_topic_tree_transaction_roll_back(tree, &transaction);
+        return AWS_OP_ERR;
+    }
+
+    aws_mqtt_topic_tree_transaction_commit(tree, &transaction);
+    return AWS_OP_SUCCESS;
+}
+
 /*******************************************************************************
- * Publish
+ * Find
  ******************************************************************************/
 
-static void s_topic_tree_publish_do_recurse(
-    const struct aws_byte_cursor *current_sub_part,
-    const struct aws_mqtt_topic_node *current,
-    const struct aws_mqtt_packet_publish *pub) {
+const struct aws_mqtt_topic_node *aws_mqtt_topic_tree_find(
+    const struct aws_mqtt_topic_tree *tree,
+    const struct aws_byte_cursor *topic_filter) {
 
-    struct aws_byte_cursor hash_cur = aws_byte_cursor_from_string(s_multi_level_wildcard);
-    struct aws_byte_cursor plus_cur = aws_byte_cursor_from_string(s_single_level_wildcard);
+    AWS_ASSERT(tree);
+    AWS_ASSERT(topic_filter);
 
-    struct aws_hash_element *elem = NULL;
+    const struct aws_mqtt_topic_node *current = tree->root;
 
-    struct aws_byte_cursor sub_part = *current_sub_part;
-    if (!aws_byte_cursor_next_split(&pub->topic_name, '/', &sub_part)) {
+    struct aws_byte_cursor topic_filter_cur = *topic_filter;
+    struct aws_byte_cursor sub_part;
+    AWS_ZERO_STRUCT(sub_part);
+    while (current && aws_byte_cursor_next_split(&topic_filter_cur, '/', &sub_part)) {
+        current = s_topic_node_find_child(current, &sub_part);
+    }
 
-        /* If this is the last node and is a sub, call it */
-        if (s_topic_node_is_subscription(current)) {
-            current->callback(&pub->topic_name, &pub->payload, current->userdata);
-        }
+    return (current && s_topic_node_is_subscription(current)) ? current : NULL;
+}
+
+void aws_mqtt_topic_tree_set_granted(
+    struct aws_mqtt_topic_tree *tree,
+    const struct aws_byte_cursor *topic_filter,
+    bool granted,
+    enum aws_mqtt_qos granted_qos) {
+
+    /* The node is the tree's own, find only hands it out const */
+    struct aws_mqtt_topic_node *node = (struct aws_mqtt_topic_node *)aws_mqtt_topic_tree_find(tree, topic_filter);
+    if (!node) {
         return;
     }
 
-    /* Check multi-level wildcard */
-    aws_hash_table_find(&current->subtopics, &hash_cur, &elem);
-    if (elem) {
-        /* Match! */
-        struct aws_mqtt_topic_node *multi_wildcard = elem->value;
-        /* Must be a subscription and have no children */
-        AWS_ASSERT(s_topic_node_is_subscription(multi_wildcard));
-        AWS_ASSERT(0 == aws_hash_table_get_entry_count(&multi_wildcard->subtopics));
-        multi_wildcard->callback(&pub->topic_name, &pub->payload, multi_wildcard->userdata);
+    node->granted = granted;
+    node->granted_qos = granted ? granted_qos : AWS_MQTT_QOS_AT_MOST_ONCE;
+}
+
+/*******************************************************************************
+ * Iterate
+ ******************************************************************************/
+
+struct topic_tree_iterate_state {
+    aws_mqtt_topic_tree_visit_fn *visitor;
+    void *user_data;
+    bool stopped;
+};
+
+/* Visits node if it's a subscription, then everything under it. Filters are only as deep as their levels, so the
+ * recursion is too. */
+static bool s_topic_tree_iterate_node(struct aws_mqtt_topic_node *node, void *userdata) {
+
+    struct topic_tree_iterate_state *state = userdata;
+
+    if (s_topic_node_is_subscription(node) && !state->visitor(node, state->user_data)) {
+        state->stopped = true;
+        return false;
     }
 
-    /* Check single level wildcard */
-    aws_hash_table_find(&current->subtopics, &plus_cur, &elem);
-    if (elem) {
-        /* Recurse sub topics */
-        s_topic_tree_publish_do_recurse(&sub_part, elem->value, pub);
+    s_topic_node_foreach_child(node, s_topic_tree_iterate_node, state);
+    return !state->stopped;
+}
+
+void aws_mqtt_topic_tree_iterate(
+    const struct aws_mqtt_topic_tree *tree,
+    aws_mqtt_topic_tree_visit_fn *visitor,
+    void *user_data) {
+
+    AWS_ASSERT(tree);
+    AWS_ASSERT(visitor);
+
+    if (!tree->root) {
+        return;
+    }
+
+    struct topic_tree_iterate_state state = {
+        .visitor = visitor,
+        .user_data = user_data,
+        .stopped = false,
+    };
+    s_topic_tree_iterate_node(tree->root, &state);
+}
+
+/*******************************************************************************
+ * Match
+ ******************************************************************************/
+
+/* Topics with more levels than this are matched using heap memory instead of the stack */
+enum { S_INLINE_TOPIC_LEVELS = 64 };
+
+struct topic_tree_match_frame {
+    const struct aws_mqtt_topic_node *node;
+    /* How many levels of the topic node has matched */
+    size_t level;
+};
+
+int aws_mqtt_topic_tree_visit_matches(
+    const struct aws_mqtt_topic_tree *tree,
+    const struct aws_byte_cursor *topic,
+    aws_mqtt_topic_tree_visit_fn *visitor,
+    void *user_data) {
+
+    AWS_ASSERT(tree);
+    AWS_ASSERT(topic);
+    AWS_ASSERT(visitor);
+
+    size_t level_count = 1;
+    for (size_t i = 0; i < topic->len; ++i) {
+        level_count += topic->ptr[i] == '/';
+    }
+
+    /* Each frame popped pushes at most 2 frames one level deeper, so the stack never holds more than one frame per
+     * level plus one extra */
+    struct aws_byte_cursor inline_levels[S_INLINE_TOPIC_LEVELS];
+    struct topic_tree_match_frame inline_frames[S_INLINE_TOPIC_LEVELS + 1];
+    struct aws_byte_cursor *levels = inline_levels;
+    struct topic_tree_match_frame *frames = inline_frames;
+    void *heap_memory = NULL;
+
+    if (level_count > S_INLINE_TOPIC_LEVELS) {
+        heap_memory = aws_mem_acquire_many(
+            tree->allocator,
+            2,
+            &levels,
+            level_count * sizeof(struct aws_byte_cursor),
+            &frames,
+            (level_count + 1) * sizeof(struct topic_tree_match_frame));
+        if (!heap_memory) {
+            AWS_MQTT_LOGF_ERROR(
+                AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to allocate space to match a deep topic", (void *)tree);
+            return AWS_OP_ERR;
+        }
+    }
+
+    /* Split the topic once, rather than at every node visited */
+    size_t level = 0;
+    size_t level_start = 0;
+    for (size_t i = 0; i < topic->len; ++i) {
+        if (topic->ptr[i] == '/') {
+            levels[level++] = aws_byte_cursor_from_array(topic->ptr + level_start, i - level_start);
+            level_start = i + 1;
+        }
     }
+    levels[level] = aws_byte_cursor_from_array(topic->ptr + level_start, topic->len - level_start);
+
+    size_t frame_count = 0;
+    frames[frame_count].node = tree->root;
+    frames[frame_count].level = 0;
+    ++frame_count;
+
+    while (frame_count) {
+        const struct topic_tree_match_frame frame = frames[--frame_count];
+        const struct aws_mqtt_topic_node *current = frame.node;
+
+        if (frame.level == level_count) {
+            /* If this is the last node and is a sub, it's a match */
+            if (s_topic_node_is_subscription(current) && !visitor(current, user_data)) {
+                break;
+            }
+            continue;
+        }
 
-    /* Check actual topic name */
-    aws_hash_table_find(&current->subtopics, &sub_part, &elem);
-    if (elem) {
-        /* Found the actual topic, recurse to it */
-        s_topic_tree_publish_do_recurse(&sub_part, elem->value, pub);
+        /* Check multi-level wildcard */
+        const struct aws_mqtt_topic_node *multi_wildcard = current->multi_level_wildcard;
+        if (multi_wildcard) {
+            /* Must be a subscription and have no children */
+            AWS_ASSERT(s_topic_node_is_subscription(multi_wildcard));
+            AWS_ASSERT(0 == aws_mqtt_topic_node_get_child_count(multi_wildcard));
+            if (!visitor(multi_wildcard, user_data)) {
+                break;
+            }
+        }
+
+        /* Pushed in reverse, so the single level wildcard's matches come before the actual topic's */
+        const struct aws_mqtt_topic_node *child = s_topic_node_find_literal_child(current, &levels[frame.level]);
+        if (child) {
+            frames[frame_count].node = child;
+            frames[frame_count].level = frame.level + 1;
+            ++frame_count;
+        }
+        if (current->single_level_wildcard) {
+            frames[frame_count].node = current->single_level_wildcard;
+            frames[frame_count].level = frame.level + 1;
+            ++frame_count;
+        }
+        AWS_ASSERT(frame_count <= level_count + 1);
     }
+
+    if (heap_memory) {
+        aws_mem_release(tree->allocator, heap_memory);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+struct topic_tree_collect_state {
+    const struct aws_mqtt_topic_node **matches;
+    size_t max_matches;
+    size_t match_count;
+};
+
+static bool s_topic_tree_collect_visitor(const struct aws_mqtt_topic_node *subscription, void *user_data) {
+
+    struct topic_tree_collect_state *state = user_data;
+    if (state->match_count < state->max_matches) {
+        state->matches[state->match_count] = subscription;
+    }
+    ++state->match_count;
+
+    return true;
+}
+
+int aws_mqtt_topic_tree_collect_matches(
+    const struct aws_mqtt_topic_tree *tree,
+    const struct aws_byte_cursor *topic,
+    const struct aws_mqtt_topic_node **matches,
+    size_t max_matches,
+    size_t *match_count) {
+
+    AWS_ASSERT(matches || !max_matches);
+    AWS_ASSERT(match_count);
+
+    struct topic_tree_collect_state state = {
+        .matches = matches,
+        .max_matches = max_matches,
+        .match_count = 0,
+    };
+
+    if (aws_mqtt_topic_tree_visit_matches(tree, topic, s_topic_tree_collect_visitor, &state)) {
+        return AWS_OP_ERR;
+    }
+
+    *match_count = state.match_count;
+    return AWS_OP_SUCCESS;
+}
+
+/*******************************************************************************
+ * Match Cache
+ ******************************************************************************/
+
+struct aws_mqtt_topic_tree_match_cache {
+    struct aws_allocator *allocator;
+    size_t max_topics;
+    /* aws_byte_cursor * -> topic_match_cache_entry */
+    struct aws_hash_table entries;
+    /* topic_match_cache_entry, most recently used first */
+    struct aws_linked_list lru;
+};
+
+struct topic_match_cache_entry {
+    struct aws_linked_list_node lru_node;
+    /* Points at the bytes just past the entry */
+    struct aws_byte_cursor topic;
+    /* The tree's generation when matches was filled in */
+    uint64_t generation;
+    /* const aws_mqtt_topic_node * */
+    struct aws_array_list matches;
+};
+
+static void s_match_cache_entry_destroy(struct aws_allocator *allocator, struct topic_match_cache_entry *entry) {
+
+    aws_array_list_clean_up(&entry->matches);
+    aws_mem_release(allocator, entry);
+}
+
+static void s_match_cache_evict(struct aws_mqtt_topic_tree_match_cache *cache, struct topic_match_cache_entry *entry) {
+
+    aws_hash_table_remove(&cache->entries, &entry->topic, NULL, NULL);
+    aws_linked_list_remove(&entry->lru_node);
+    s_match_cache_entry_destroy(cache->allocator, entry);
+}
+
+static void s_match_cache_destroy(struct aws_mqtt_topic_tree_match_cache *cache) {
+
+    while (!aws_linked_list_empty(&cache->lru)) {
+        struct aws_linked_list_node *node = aws_linked_list_pop_front(&cache->lru);
+        s_match_cache_entry_destroy(cache->allocator, AWS_CONTAINER_OF(node, struct topic_match_cache_entry, lru_node));
+    }
+    aws_hash_table_clean_up(&cache->entries);
+    aws_mem_release(cache->allocator, cache);
+}
+
+int aws_mqtt_topic_tree_set_match_cache_size(struct aws_mqtt_topic_tree *tree, size_t max_topics) {
+
+    AWS_ASSERT(tree);
+
+    AWS_MQTT_LOGF_DEBUG(
+        AWS_LS_MQTT_TOPIC_TREE,
+        "tree=%p: Setting match cache size to %llu topics",
+        (void *)tree,
+        (unsigned long long)max_topics);
+
+    if (tree->match_cache) {
+        s_match_cache_destroy(tree->match_cache);
+        tree->match_cache = NULL;
+    }
+
+    if (!max_topics) {
+        return AWS_OP_SUCCESS;
+    }
+
+    struct aws_mqtt_topic_tree_match_cache *cache =
+        aws_mem_acquire(tree->allocator, sizeof(struct aws_mqtt_topic_tree_match_cache));
+    if (!cache) {
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to allocate match cache", (void *)tree);
+        return AWS_OP_ERR;
+    }
+    AWS_ZERO_STRUCT(*cache);
+
+    if (aws_hash_table_init(
+            &cache->entries, tree->allocator, max_topics, aws_hash_byte_cursor_ptr, byte_cursor_eq, NULL, NULL)) {
+
+        AWS_MQTT_LOGF_ERROR(AWS_LS_MQTT_TOPIC_TREE, "tree=%p: Failed to initialize match cache table", (void *)tree);
+        aws_mem_release(tree->allocator, cache);
+        return AWS_OP_ERR;
+    }
+    cache->allocator = tree->allocator;
+    cache->max_topics = max_topics;
+    aws_linked_list_init(&cache->lru);
+
+    tree->match_cache = cache;
+
+    return AWS_OP_SUCCESS;
+}
+
+struct match_cache_fill {
+    struct aws_array_list *matches;
+    bool failed;
+};
+
+static bool s_match_cache_fill_visitor(const struct aws_mqtt_topic_node *subscription, void *user_data) {
+
+    struct match_cache_fill *fill = user_data;
+    if (aws_array_list_push_back(fill->matches, &subscription)) {
+        fill->failed = true;
+        return false;
+    }
+    return true;
+}
+
+/* Get the entry for topic with up to date matches, creating it if necessary. Returns NULL if it couldn't be cached. */
+static struct topic_match_cache_entry *s_match_cache_get(
+    const struct aws_mqtt_topic_tree *tree,
+    const struct aws_byte_cursor *topic) {
+
+    struct aws_mqtt_topic_tree_match_cache *cache = tree->match_cache;
+
+    struct aws_hash_element *elem = NULL;
+    aws_hash_table_find(&cache->entries, topic, &elem);
+    struct topic_match_cache_entry *entry = elem ? elem->value : NULL;
+
+    if (entry) {
+        aws_linked_list_remove(&entry->lru_node);
+        aws_linked_list_push_front(&cache->lru, &entry->lru_node);
+
+        if (entry->generation == tree->generation) {
+            return entry;
+        }
+
+        /* Subscriptions changed since this was filled in, the nodes may not even exist anymore */
+        aws_array_list_clear(&entry->matches);
+
+    } else {
+        if (aws_hash_table_get_entry_count(&cache->entries) >= cache->max_topics) {
+            struct aws_linked_list_node *oldest = aws_linked_list_back(&cache->lru);
+            s_match_cache_evict(cache, AWS_CONTAINER_OF(oldest, struct topic_match_cache_entry, lru_node));
+        }
+
+        entry = aws_mem_acquire(cache->allocator, sizeof(struct topic_match_cache_entry) + topic->len);
+        if (!entry) {
+            return NULL;
+        }
+        AWS_ZERO_STRUCT(*entry);
+
+        if (topic->len) {
+            memcpy(entry + 1, topic->ptr, topic->len);
+        }
+        entry->topic = aws_byte_cursor_from_array(entry + 1, topic->len);
+
+        if (aws_array_list_init_dynamic(
+                &entry->matches, cache->allocator, 4, sizeof(const struct aws_mqtt_topic_node *))) {
+            aws_mem_release(cache->allocator, entry);
+            return NULL;
+        }
+        if (aws_hash_table_put(&cache->entries, &entry->topic, entry, NULL)) {
+            s_match_cache_entry_destroy(cache->allocator, entry);
+            return NULL;
+        }
+        aws_linked_list_push_front(&cache->lru, &entry->lru_node);
+    }
+
+    struct match_cache_fill fill = {
+        .matches = &entry->matches,
+        .failed = false,
+    };
+    if (aws_mqtt_topic_tree_visit_matches(tree, &entry->topic, s_match_cache_fill_visitor, &fill) || fill.failed) {
+        s_match_cache_evict(cache, entry);
+        return NULL;
+    }
+    entry->generation = tree->generation;
+
+    return entry;
+}
+
+/*******************************************************************************
+ * Publish
+ ******************************************************************************/
+
+static bool s_topic_tree_publish_visitor(const struct aws_mqtt_topic_node *subscription, void *user_data) {
+
+    const struct aws_mqtt_packet_publish *pub = user_data;
+    for (const struct aws_mqtt_topic_subscriber *subscriber = subscription->subscribers; subscriber;
+         subscriber = subscriber->next) {
+        subscriber->callback(&pub->topic_name, &pub->payload, subscriber->userdata);
+    }
+
+    return true;
 }
 
 int aws_mqtt_topic_tree_publish(const struct aws_mqtt_topic_tree *tree, struct aws_mqtt_packet_publish *pub) {
@@ -825,15 +1587,25 @@ int aws_mqtt_topic_tree_publish(const struct aws_mqtt_topic_tree *tree, struct a
     AWS_ASSERT(tree);
     AWS_ASSERT(pub);
 
-    AWS_LOGF_TRACE(
+    AWS_MQTT_LOGF_TRACE(
         AWS_LS_MQTT_TOPIC_TREE,
         "tree=%p: Publishing on topic " PRInSTR,
         (void *)tree,
         AWS_BYTE_CURSOR_PRI(pub->topic_name));
 
-    struct aws_byte_cursor sub_part;
-    AWS_ZERO_STRUCT(sub_part);
-    s_topic_tree_publish_do_recurse(&sub_part, tree->root, pub);
+    if (tree->match_cache) {
+        const struct topic_match_cache_entry *entry = s_match_cache_get(tree, &pub->topic_name);
+        if (entry) {
+            const size_t match_count = aws_array_list_length(&entry->matches);
+            for (size_t i = 0; i < match_count; ++i) {
+                const struct aws_mqtt_topic_node *subscription = NULL;
+                aws_array_list_get_at(&entry->matches, &subscription, i);
+                s_topic_tree_publish_visitor(subscription, pub);
+            }
+            return AWS_OP_SUCCESS;
+        }
+        /* Couldn't be cached, but walking the tree still works */
+    }
 
-    return AWS_OP_SUCCESS;
+    return aws_mqtt_topic_tree_visit_matches(tree, &pub->topic_name, s_topic_tree_publish_visitor, pub);
 }
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/spool.h>
+
+#include <windows.h>
+
+struct spool_file_handles {
+    HANDLE file;
+    HANDLE mapping;
+};
+
+static int s_raise_last_error(void) {
+    switch (GetLastError()) {
+        case ERROR_FILE_NOT_FOUND:
+        case ERROR_PATH_NOT_FOUND:
+        case ERROR_INVALID_NAME:
+            return aws_raise_error(AWS_ERROR_FILE_INVALID_PATH);
+        case ERROR_ACCESS_DENIED:
+            return aws_raise_error(AWS_ERROR_NO_PERMISSION);
+        case ERROR_NOT_ENOUGH_MEMORY:
+        case ERROR_OUTOFMEMORY:
+            return aws_raise_error(AWS_ERROR_OOM);
+        default:
+            return aws_raise_error(AWS_ERROR_SYS_CALL_FAILURE);
+    }
+}
+
+int aws_mqtt_spool_file_open(struct aws_mqtt_spool_file *file, const char *path, size_t size) {
+
+    AWS_ASSERT(file);
+    AWS_ASSERT(path);
+
+    AWS_ZERO_STRUCT(*file);
+
+    struct spool_file_handles *handles = aws_mem_calloc(aws_default_allocator(), 1, sizeof(struct spool_file_handles));
+    if (!handles) {
+        return AWS_OP_ERR;
+    }
+
+    handles->file =
+        CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handles->file == INVALID_HANDLE_VALUE) {
+        s_raise_last_error();
+        aws_mem_release(aws_default_allocator(), handles);
+        return AWS_OP_ERR;
+    }
+
+    /* Sized up front, a mapping on its own could only ever grow the file */
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(handles->file, &file_size)) {
+        goto error;
+    }
+    if ((ULONGLONG)file_size.QuadPart != (ULONGLONG)size) {
+        LARGE_INTEGER new_size;
+        new_size.QuadPart = (LONGLONG)size;
+        if (!SetFilePointerEx(handles->file, new_size, NULL, FILE_BEGIN) || !SetEndOfFile(handles->file)) {
+            goto error;
+        }
+    }
+
+    const ULONGLONG mapping_size = (ULONGLONG)size;
+    handles->mapping = CreateFileMappingA(
+        handles->file, NULL, PAGE_READWRITE, (DWORD)(mapping_size >> 32), (DWORD)(mapping_size & 0xFFFFFFFF), NULL);
+    if (!handles->mapping) {
+        goto error;
+    }
+
+    void *data = MapViewOfFile(handles->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!data) {
+        goto error;
+    }
+
+    file->data = data;
+    file->size = size;
+    file->impl = handles;
+
+    return AWS_OP_SUCCESS;
+
+error:
+    s_raise_last_error();
+    if (handles->mapping) {
+        CloseHandle(handles->mapping);
+    }
+    CloseHandle(handles->file);
+    aws_mem_release(aws_default_allocator(), handles);
+    return AWS_OP_ERR;
+}
+
+void aws_mqtt_spool_file_close(struct aws_mqtt_spool_file *file) {
+
+    struct spool_file_handles *handles = file->impl;
+    if (handles) {
+        UnmapViewOfFile(file->data);
+        CloseHandle(handles->mapping);
+        CloseHandle(handles->file);
+        aws_mem_release(aws_default_allocator(), handles);
+    }
+    AWS_ZERO_STRUCT(*file);
+}
+
+int aws_mqtt_spool_file_sync(struct aws_mqtt_spool_file *file, size_t offset, size_t length) {
+
+    AWS_ASSERT(offset + length <= file->size);
+
+    struct spool_file_handles *handles = file->impl;
+
+    /* Flushing the view only hands the pages to the system, flushing the file gets them onto the disk */
+    if (!FlushViewOfFile(file->data + offset, length) || !FlushFileBuffers(handles->file)) {
+        return s_raise_last_error();
+    }
+
+    return AWS_OP_SUCCESS;
+}
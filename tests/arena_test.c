@@ -0,0 +1,117 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/arena.h>
+
+#include <aws/testing/aws_test_harness.h>
+
+/* Passes through to the test's allocator, counting the calls */
+struct counting_allocator {
+    struct aws_allocator base;
+    struct aws_allocator *wrapped;
+    size_t acquires;
+    size_t outstanding;
+};
+
+static void *s_counting_acquire(struct aws_allocator *allocator, size_t size) {
+    struct counting_allocator *counting = allocator->impl;
+    void *mem = aws_mem_acquire(counting->wrapped, size);
+    if (mem) {
+        ++counting->acquires;
+        ++counting->outstanding;
+    }
+    return mem;
+}
+
+static void s_counting_release(struct aws_allocator *allocator, void *ptr) {
+    struct counting_allocator *counting = allocator->impl;
+    --counting->outstanding;
+    aws_mem_release(counting->wrapped, ptr);
+}
+
+static void s_counting_allocator_init(struct counting_allocator *counting, struct aws_allocator *wrapped) {
+    AWS_ZERO_STRUCT(*counting);
+    counting->base.mem_acquire = s_counting_acquire;
+    counting->base.mem_release = s_counting_release;
+    counting->base.impl = counting;
+    counting->wrapped = wrapped;
+}
+
+enum { S_BLOCK_COUNT = 1000 };
+
+AWS_TEST_CASE(mqtt_arena_reuse, s_mqtt_arena_reuse_fn)
+static int s_mqtt_arena_reuse_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct counting_allocator backing;
+    s_counting_allocator_init(&backing, allocator);
+
+    struct aws_mqtt_arena arena;
+    aws_mqtt_arena_init(&arena, &backing.base);
+    ASSERT_UINT_EQUALS(0, backing.acquires);
+
+    /* Fill a bunch of small blocks with their index, none may overlap */
+    static uint8_t *s_blocks[S_BLOCK_COUNT];
+    for (size_t i = 0; i < S_BLOCK_COUNT; ++i) {
+        const size_t size = 1 + i % 200;
+        s_blocks[i] = aws_mem_acquire(&arena.allocator, size);
+        ASSERT_NOT_NULL(s_blocks[i]);
+        memset(s_blocks[i], (int)(i & 0xFF), size);
+    }
+    for (size_t i = 0; i < S_BLOCK_COUNT; ++i) {
+        const size_t size = 1 + i % 200;
+        for (size_t j = 0; j < size; ++j) {
+            ASSERT_UINT_EQUALS(i & 0xFF, s_blocks[i][j]);
+        }
+    }
+
+    /* Far fewer trips to the backing allocator than allocations */
+    const size_t pages = backing.acquires;
+    ASSERT_TRUE(pages < S_BLOCK_COUNT / 20);
+
+    /* Released blocks are reused before any new page */
+    for (size_t i = 0; i < S_BLOCK_COUNT; ++i) {
+        aws_mem_release(&arena.allocator, s_blocks[i]);
+    }
+    for (size_t i = 0; i < S_BLOCK_COUNT; ++i) {
+        s_blocks[i] = aws_mem_acquire(&arena.allocator, 1 + i % 200);
+        ASSERT_NOT_NULL(s_blocks[i]);
+    }
+    ASSERT_UINT_EQUALS(pages, backing.acquires);
+
+    /* Growing keeps the contents, whether or not it has to move */
+    uint8_t *grown = aws_mem_acquire(&arena.allocator, 16);
+    ASSERT_NOT_NULL(grown);
+    memset(grown, 0xAB, 16);
+    ASSERT_SUCCESS(aws_mem_realloc(&arena.allocator, (void **)&grown, 16, 30));
+    ASSERT_SUCCESS(aws_mem_realloc(&arena.allocator, (void **)&grown, 30, 4000));
+    for (size_t i = 0; i < 16; ++i) {
+        ASSERT_UINT_EQUALS(0xAB, grown[i]);
+    }
+
+    /* Large allocations go to the backing allocator */
+    void *large = aws_mem_acquire(&arena.allocator, AWS_MQTT_ARENA_PAGE_SIZE * 2);
+    ASSERT_NOT_NULL(large);
+    ASSERT_UINT_EQUALS(pages + 2, backing.acquires);
+    aws_mem_release(&arena.allocator, large);
+    ASSERT_UINT_EQUALS(pages + 1, backing.outstanding);
+
+    /* Clean up releases everything, even what was never released */
+    aws_mqtt_arena_clean_up(&arena);
+    ASSERT_UINT_EQUALS(0, backing.outstanding);
+
+    return AWS_OP_SUCCESS;
+}
@@ -0,0 +1,771 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "loopback_broker.h"
+
+#include <aws/mqtt/client.h>
+#include <aws/mqtt/private/packets.h>
+
+#include <aws/io/channel_bootstrap.h>
+#include <aws/io/event_loop.h>
+#include <aws/io/host_resolver.h>
+#include <aws/io/socket.h>
+
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
+
+#include <aws/testing/aws_test_harness.h>
+
+/* How long anything a test waits for may take */
+static const uint64_t s_timeout_ns = 10000000000;
+/* How long to wait to be fairly sure something isn't going to happen */
+static const uint64_t s_settle_ns = 300000000;
+
+/* Set on the DUP bit of a PUBLISH's fixed header flags */
+enum { S_PUBLISH_DUP_FLAG = 0x8 };
+
+/* A client connected to an in-process loopback broker, and everything its callbacks have seen */
+struct client_test {
+    struct aws_allocator *allocator;
+    struct aws_event_loop_group el_group;
+    struct aws_host_resolver resolver;
+    struct aws_client_bootstrap *bootstrap;
+    struct aws_mqtt_client client;
+    struct loopback_broker *broker;
+    struct aws_mqtt_client_connection *connection;
+    struct aws_socket_options socket_options;
+
+    struct aws_mutex lock;
+    struct aws_condition_variable signal;
+    /* Everything below is protected by lock */
+    size_t connections;
+    int connect_error;
+    size_t interruptions;
+    int interruption_error;
+    size_t resumptions;
+    bool disconnected;
+    size_t subacks;
+    size_t completions;
+    int completion_error;
+    size_t publishes_received;
+    size_t bytes_received;
+    /* While set, publish callbacks wait for it to be cleared */
+    bool block_publishes;
+};
+
+/*******************************************************************************
+ * Callbacks
+ ******************************************************************************/
+
+static void s_on_connection_complete(
+    struct aws_mqtt_client_connection *connection,
+    int error_code,
+    enum aws_mqtt_connect_return_code return_code,
+    bool session_present,
+    void *userdata) {
+
+    (void)connection;
+    (void)session_present;
+
+    struct client_test *test = userdata;
+
+    aws_mutex_lock(&test->lock);
+    ++test->connections;
+    if (error_code || return_code != AWS_MQTT_CONNECT_ACCEPTED) {
+        test->connect_error = error_code ? error_code : AWS_ERROR_UNKNOWN;
+    }
+    aws_condition_variable_notify_all(&test->signal);
+    aws_mutex_unlock(&test->lock);
+}
+
+static void s_on_interrupted(struct aws_mqtt_client_connection *connection, int error_code, void *userdata) {
+
+    (void)connection;
+
+    struct client_test *test = userdata;
+
+    aws_mutex_lock(&test->lock);
+    ++test->interruptions;
+    test->interruption_error = error_code;
+    aws_condition_variable_notify_all(&test->signal);
+    aws_mutex_unlock(&test->lock);
+}
+
+static void s_on_resumed(
+    struct aws_mqtt_client_connection *connection,
+    enum aws_mqtt_connect_return_code return_code,
+    bool session_present,
+    void *userdata) {
+
+    (void)connection;
+    (void)return_code;
+    (void)session_present;
+
+    struct client_test *test = userdata;
+
+    aws_mutex_lock(&test->lock);
+    ++test->resumptions;
+    aws_condition_variable_notify_all(&test->signal);
+    aws_mutex_unlock(&test->lock);
+}
+
+static void s_on_disconnect(struct aws_mqtt_client_connection *connection, void *userdata) {
+
+    (void)connection;
+
+    struct client_test *test = userdata;
+
+    aws_mutex_lock(&test->lock);
+    test->disconnected = true;
+    aws_condition_variable_notify_all(&test->signal);
+    aws_mutex_unlock(&test->lock);
+}
+
+static void s_on_suback(
+    struct aws_mqtt_client_connection *connection,
+    uint16_t packet_id,
+    const struct aws_byte_cursor *topic,
+    enum aws_mqtt_qos qos,
+    int error_code,
+    void *userdata) {
+
+    (void)connection;
+    (void)packet_id;
+    (void)topic;
+    (void)qos;
+
+    struct client_test *test = userdata;
+
+    aws_mutex_lock(&test->lock);
+    ++test->subacks;
+    if (error_code) {
+        test->completion_error = error_code;
+    }
+    aws_condition_variable_notify_all(&test->signal);
+    aws_mutex_unlock(&test->lock);
+}
+
+static void s_on_op_complete(
+    struct aws_mqtt_client_connection *connection,
+    uint16_t packet_id,
+    int error_code,
+    void *userdata) {
+
+    (void)connection;
+    (void)packet_id;
+
+    struct client_test *test = userdata;
+
+    aws_mutex_lock(&test->lock);
+    ++test->completions;
+    if (error_code) {
+        test->completion_error = error_code;
+    }
+    aws_condition_variable_notify_all(&test->signal);
+    aws_mutex_unlock(&test->lock);
+}
+
+static bool s_publishes_unblocked(void *arg) {
+    struct client_test *test = arg;
+    return !test->block_publishes;
+}
+
+static void s_on_publish(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_byte_cursor *topic,
+    const struct aws_byte_cursor *payload,
+    void *userdata) {
+
+    (void)connection;
+    (void)topic;
+
+    struct client_test *test = userdata;
+
+    aws_mutex_lock(&test->lock);
+    ++test->publishes_received;
+    test->bytes_received += payload->len;
+    aws_condition_variable_notify_all(&test->signal);
+    aws_condition_variable_wait_pred(&test->signal, &test->lock, s_publishes_unblocked, test);
+    aws_mutex_unlock(&test->lock);
+}
+
+/* Holds on to every payload, as if it were handed off to be handled later */
+static void s_on_publish_hold(
+    struct aws_mqtt_client_connection *connection,
+    const struct aws_byte_cursor *topic,
+    const struct aws_byte_cursor *payload,
+    void *userdata) {
+
+    aws_mqtt_client_connection_hold_read_window(connection, payload->len);
+    s_on_publish(connection, topic, payload, userdata);
+}
+
+/*******************************************************************************
+ * Helpers
+ ******************************************************************************/
+
+static int s_client_test_init(
+    struct client_test *test,
+    struct aws_allocator *allocator,
+    const struct loopback_broker_behavior *behavior) {
+
+    AWS_ZERO_STRUCT(*test);
+    test->allocator = allocator;
+
+    aws_mqtt_library_init(allocator);
+
+    ASSERT_SUCCESS(aws_mutex_init(&test->lock));
+    ASSERT_SUCCESS(aws_condition_variable_init(&test->signal));
+
+    ASSERT_SUCCESS(aws_event_loop_group_default_init(&test->el_group, allocator, 1));
+    ASSERT_SUCCESS(aws_host_resolver_init_default(&test->resolver, allocator, 8, &test->el_group));
+    test->bootstrap = aws_client_bootstrap_new(allocator, &test->el_group, &test->resolver, NULL);
+    ASSERT_NOT_NULL(test->bootstrap);
+    ASSERT_SUCCESS(aws_mqtt_client_init(&test->client, allocator, test->bootstrap));
+
+    test->broker = loopback_broker_new(allocator, &test->el_group);
+    ASSERT_NOT_NULL(test->broker);
+    struct loopback_broker_behavior recorded = *behavior;
+    recorded.record_packets = true;
+    loopback_broker_set_behavior(test->broker, &recorded);
+
+    test->socket_options.connect_timeout_ms = 3000;
+    test->socket_options.type = AWS_SOCKET_STREAM;
+    test->socket_options.domain = AWS_SOCKET_IPV4;
+
+    test->connection = aws_mqtt_client_connection_new(&test->client);
+    ASSERT_NOT_NULL(test->connection);
+    ASSERT_SUCCESS(aws_mqtt_client_connection_set_connection_interruption_handlers(
+        test->connection, s_on_interrupted, test, s_on_resumed, test));
+
+    return AWS_OP_SUCCESS;
+}
+
+static void s_client_test_clean_up(struct client_test *test) {
+
+    aws_mutex_lock(&test->lock);
+    test->block_publishes = false;
+    aws_condition_variable_notify_all(&test->signal);
+    aws_mutex_unlock(&test->lock);
+
+    if (!aws_mqtt_client_connection_disconnect(test->connection, s_on_disconnect, test)) {
+        aws_mutex_lock(&test->lock);
+        while (!test->disconnected) {
+            aws_condition_variable_wait(&test->signal, &test->lock);
+        }
+        aws_mutex_unlock(&test->lock);
+    }
+    aws_mqtt_client_connection_destroy(test->connection);
+
+    loopback_broker_destroy(test->broker);
+    aws_mqtt_client_clean_up(&test->client);
+    aws_client_bootstrap_release(test->bootstrap);
+    aws_host_resolver_clean_up(&test->resolver);
+    aws_event_loop_group_clean_up(&test->el_group);
+
+    aws_condition_variable_clean_up(&test->signal);
+    aws_mutex_clean_up(&test->lock);
+
+    aws_mqtt_library_clean_up();
+}
+
+struct count_wait {
+    const size_t *counter;
+    size_t target;
+};
+
+static bool s_count_reached(void *arg) {
+    struct count_wait *wait = arg;
+    return *wait->counter >= wait->target;
+}
+
+/* Wait for one of the counters in test to reach target */
+static int s_wait_for_count(struct client_test *test, const size_t *counter, size_t target) {
+
+    struct count_wait wait = {
+        .counter = counter,
+        .target = target,
+    };
+
+    aws_mutex_lock(&test->lock);
+    const int result =
+        aws_condition_variable_wait_for_pred(&test->signal, &test->lock, (int64_t)s_timeout_ns, s_count_reached, &wait);
+    aws_mutex_unlock(&test->lock);
+
+    return result;
+}
+
+/* Read one of the counters in test */
+static size_t s_get_count(struct client_test *test, const size_t *counter) {
+
+    aws_mutex_lock(&test->lock);
+    const size_t count = *counter;
+    aws_mutex_unlock(&test->lock);
+
+    return count;
+}
+
+/* Connect with options, filling in whatever it takes to reach the broker, and wait for the CONNACK */
+static int s_client_test_connect(struct client_test *test, struct aws_mqtt_connection_options *options) {
+
+    options->host_name = aws_byte_cursor_from_c_str("127.0.0.1");
+    options->port = loopback_broker_get_port(test->broker);
+    options->socket_options = &test->socket_options;
+    options->client_id = aws_byte_cursor_from_c_str("aws-c-mqtt-client-test");
+    options->on_connection_complete = s_on_connection_complete;
+    options->user_data = test;
+
+    ASSERT_SUCCESS(aws_mqtt_client_connection_connect(test->connection, options));
+    ASSERT_SUCCESS(s_wait_for_count(test, &test->connections, 1));
+    ASSERT_INT_EQUALS(0, test->connect_error);
+
+    return AWS_OP_SUCCESS;
+}
+
+static int s_client_test_subscribe(
+    struct client_test *test,
+    const char *topic_filter,
+    enum aws_mqtt_qos qos,
+    aws_mqtt_client_publish_received_fn *on_publish) {
+
+    const size_t subacks = s_get_count(test, &test->subacks);
+
+    struct aws_byte_cursor filter = aws_byte_cursor_from_c_str(topic_filter);
+    const uint16_t packet_id =
+        aws_mqtt_client_connection_subscribe(test->connection, &filter, qos, on_publish, test, NULL, s_on_suback, test);
+    ASSERT_TRUE(packet_id);
+    ASSERT_SUCCESS(s_wait_for_count(test, &test->subacks, subacks + 1));
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Have the broker send the client a PUBLISH */
+static int s_broker_send_publish(
+    struct client_test *test,
+    const char *topic,
+    enum aws_mqtt_qos qos,
+    bool dup,
+    uint16_t packet_id,
+    struct aws_byte_cursor payload) {
+
+    struct aws_mqtt_packet_publish publish;
+    ASSERT_SUCCESS(aws_mqtt_packet_publish_init(
+        &publish, false, qos, dup, aws_byte_cursor_from_c_str(topic), packet_id, payload));
+
+    struct aws_byte_buf buf;
+    ASSERT_SUCCESS(aws_byte_buf_init(&buf, test->allocator, 5 + publish.fixed_header.remaining_length));
+    ASSERT_SUCCESS(aws_mqtt_packet_publish_encode(&buf, &publish));
+    ASSERT_SUCCESS(loopback_broker_send(test->broker, aws_byte_cursor_from_buf(&buf)));
+    aws_byte_buf_clean_up(&buf);
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Have the broker send the client a PUBREL */
+static int s_broker_send_pubrel(struct client_test *test, uint16_t packet_id) {
+
+    struct aws_mqtt_packet_ack pubrel;
+    ASSERT_SUCCESS(aws_mqtt_packet_pubrel_init(&pubrel, packet_id));
+
+    uint8_t storage[4];
+    struct aws_byte_buf buf = aws_byte_buf_from_empty_array(storage, sizeof(storage));
+    ASSERT_SUCCESS(aws_mqtt_packet_ack_encode(&buf, &pubrel));
+    ASSERT_SUCCESS(loopback_broker_send(test->broker, aws_byte_cursor_from_buf(&buf)));
+
+    return AWS_OP_SUCCESS;
+}
+
+static int s_wait_for_packets(struct client_test *test, enum aws_mqtt_packet_type type, size_t count) {
+    return loopback_broker_wait_for_packets(test->broker, type, count, s_timeout_ns);
+}
+
+static int s_get_packet(
+    struct client_test *test,
+    enum aws_mqtt_packet_type type,
+    size_t index,
+    struct loopback_broker_packet *packet) {
+    return loopback_broker_get_packet(test->broker, type, index, packet);
+}
+
+/*******************************************************************************
+ * Keep Alive
+ ******************************************************************************/
+
+AWS_TEST_CASE(mqtt_client_keep_alive_timeout, s_mqtt_client_keep_alive_timeout_fn)
+static int s_mqtt_client_keep_alive_timeout_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct loopback_broker_behavior behavior = {
+        .ignore_pingreq = true,
+    };
+    struct client_test test;
+    ASSERT_SUCCESS(s_client_test_init(&test, allocator, &behavior));
+
+    struct aws_mqtt_connection_options options = {
+        .keep_alive_time_secs = 1,
+        .ping_timeout_ms = 500,
+        .clean_session = true,
+    };
+    ASSERT_SUCCESS(s_client_test_connect(&test, &options));
+
+    /* Nothing else is read, so the unanswered ping takes the connection down */
+    ASSERT_SUCCESS(s_wait_for_packets(&test, AWS_MQTT_PACKET_PINGREQ, 1));
+    ASSERT_SUCCESS(s_wait_for_count(&test, &test.interruptions, 1));
+    ASSERT_INT_EQUALS(AWS_ERROR_MQTT_TIMEOUT, test.interruption_error);
+
+    s_client_test_clean_up(&test);
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(mqtt_client_keep_alive_reads_count, s_mqtt_client_keep_alive_reads_count_fn)
+static int s_mqtt_client_keep_alive_reads_count_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct loopback_broker_behavior behavior = {
+        .ignore_pingreq = true,
+    };
+    struct client_test test;
+    ASSERT_SUCCESS(s_client_test_init(&test, allocator, &behavior));
+
+    struct aws_mqtt_connection_options options = {
+        .keep_alive_time_secs = 1,
+        .ping_timeout_ms = 500,
+        .clean_session = true,
+    };
+    ASSERT_SUCCESS(s_client_test_connect(&test, &options));
+    ASSERT_SUCCESS(s_wait_for_packets(&test, AWS_MQTT_PACKET_PINGREQ, 1));
+
+    /* Reads keep coming long past the ping timeout, as if the PINGRESP were stuck behind them */
+    const struct aws_byte_cursor payload = aws_byte_cursor_from_c_str("still here");
+    for (size_t i = 0; i < 10; ++i) {
+        ASSERT_SUCCESS(s_broker_send_publish(&test, "test/keep-alive", AWS_MQTT_QOS_AT_MOST_ONCE, false, 0, payload));
+        aws_thread_current_sleep(200000000);
+    }
+    ASSERT_UINT_EQUALS(0, s_get_count(&test, &test.interruptions));
+
+    /* Once they stop, the ping times out */
+    ASSERT_SUCCESS(s_wait_for_count(&test, &test.interruptions, 1));
+    ASSERT_INT_EQUALS(AWS_ERROR_MQTT_TIMEOUT, test.interruption_error);
+
+    s_client_test_clean_up(&test);
+    return AWS_OP_SUCCESS;
+}
+
+/*******************************************************************************
+ * QoS 2
+ ******************************************************************************/
+
+AWS_TEST_CASE(mqtt_client_qos2_inbound, s_mqtt_client_qos2_inbound_fn)
+static int s_mqtt_client_qos2_inbound_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct loopback_broker_behavior behavior;
+    AWS_ZERO_STRUCT(behavior);
+    struct client_test test;
+    ASSERT_SUCCESS(s_client_test_init(&test, allocator, &behavior));
+
+    struct aws_mqtt_connection_options options = {
+        .clean_session = true,
+    };
+    ASSERT_SUCCESS(s_client_test_connect(&test, &options));
+    ASSERT_SUCCESS(s_client_test_subscribe(&test, "test/qos2", AWS_MQTT_QOS_EXACTLY_ONCE, s_on_publish));
+
+    const uint16_t packet_id = 7;
+    const struct aws_byte_cursor payload = aws_byte_cursor_from_c_str("exactly once");
+    struct loopback_broker_packet packet;
+
+    /* Delivered, then PUBREC */
+    ASSERT_SUCCESS(s_broker_send_publish(&test, "test/qos2", AWS_MQTT_QOS_EXACTLY_ONCE, false, packet_id, payload));
+    ASSERT_SUCCESS(s_wait_for_packets(&test, AWS_MQTT_PACKET_PUBREC, 1));
+    ASSERT_SUCCESS(s_get_packet(&test, AWS_MQTT_PACKET_PUBREC, 0, &packet));
+    ASSERT_UINT_EQUALS(packet_id, packet.packet_id);
+    ASSERT_UINT_EQUALS(1, s_get_count(&test, &test.publishes_received));
+
+    /* A resend before PUBREL only gets another PUBREC */
+    ASSERT_SUCCESS(s_broker_send_publish(&test, "test/qos2", AWS_MQTT_QOS_EXACTLY_ONCE, true, packet_id, payload));
+    ASSERT_SUCCESS(s_wait_for_packets(&test, AWS_MQTT_PACKET_PUBREC, 2));
+    ASSERT_SUCCESS(s_get_packet(&test, AWS_MQTT_PACKET_PUBREC, 1, &packet));
+    ASSERT_UINT_EQUALS(packet_id, packet.packet_id);
+    ASSERT_UINT_EQUALS(1, s_get_count(&test, &test.publishes_received));
+
+    ASSERT_SUCCESS(s_broker_send_pubrel(&test, packet_id));
+    ASSERT_SUCCESS(s_wait_for_packets(&test, AWS_MQTT_PACKET_PUBCOMP, 1));
+    ASSERT_SUCCESS(s_get_packet(&test, AWS_MQTT_PACKET_PUBCOMP, 0, &packet));
+    ASSERT_UINT_EQUALS(packet_id, packet.packet_id);
+
+    /* After PUBCOMP the id is free, and a publish reusing it is a new one */
+    ASSERT_SUCCESS(s_broker_send_publish(&test, "test/qos2", AWS_MQTT_QOS_EXACTLY_ONCE, false, packet_id, payload));
+    ASSERT_SUCCESS(s_wait_for_packets(&test, AWS_MQTT_PACKET_PUBREC, 3));
+    ASSERT_UINT_EQUALS(2, s_get_count(&test, &test.publishes_received));
+
+    s_client_test_clean_up(&test);
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(mqtt_client_qos2_outbound_replay, s_mqtt_client_qos2_outbound_replay_fn)
+static int s_mqtt_client_qos2_outbound_replay_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct loopback_broker_behavior behavior = {
+        .ignore_publishes = true,
+    };
+    struct client_test test;
+    ASSERT_SUCCESS(s_client_test_init(&test, allocator, &behavior));
+
+    struct aws_mqtt_connection_options options = {
+        .clean_session = false,
+    };
+    ASSERT_SUCCESS(s_client_test_connect(&test, &options));
+
+    const struct aws_byte_cursor topic = aws_byte_cursor_from_c_str("test/qos2");
+    const struct aws_byte_cursor payload = aws_byte_cursor_from_c_str("exactly once");
+    const uint16_t packet_id = aws_mqtt_client_connection_publish(
+        test.connection, &topic, AWS_MQTT_QOS_EXACTLY_ONCE, false, &payload, s_on_op_complete, &test);
+    ASSERT_TRUE(packet_id);
+
+    struct loopback_broker_packet packet;
+    ASSERT_SUCCESS(s_wait_for_packets(&test, AWS_MQTT_PACKET_PUBLISH, 1));
+    ASSERT_SUCCESS(s_get_packet(&test, AWS_MQTT_PACKET_PUBLISH, 0, &packet));
+    ASSERT_UINT_EQUALS(packet_id, packet.packet_id);
+    ASSERT_UINT_EQUALS(0, packet.flags & S_PUBLISH_DUP_FLAG);
+
+    /* Unacked when the connection drops, so it's sent again with DUP once the session resumes */
+    behavior.ignore_publishes = false;
+    behavior.session_present = true;
+    behavior.record_packets = true;
+    loopback_broker_set_behavior(test.broker, &behavior);
+    ASSERT_SUCCESS(loopback_broker_close_connection(test.broker));
+    ASSERT_SUCCESS(s_wait_for_count(&test, &test.resumptions, 1));
+
+    ASSERT_SUCCESS(s_wait_for_packets(&test, AWS_MQTT_PACKET_PUBLISH, 2));
+    ASSERT_SUCCESS(s_get_packet(&test, AWS_MQTT_PACKET_PUBLISH, 1, &packet));
+    ASSERT_UINT_EQUALS(packet_id, packet.packet_id);
+    ASSERT_UINT_EQUALS(S_PUBLISH_DUP_FLAG, packet.flags & S_PUBLISH_DUP_FLAG);
+
+    /* PUBREC, PUBREL, PUBCOMP */
+    ASSERT_SUCCESS(s_wait_for_count(&test, &test.completions, 1));
+    ASSERT_INT_EQUALS(0, test.completion_error);
+    ASSERT_SUCCESS(s_get_packet(&test, AWS_MQTT_PACKET_PUBREL, 0, &packet));
+    ASSERT_UINT_EQUALS(packet_id, packet.packet_id);
+    ASSERT_UINT_EQUALS(1, s_get_count(&test, &test.interruptions));
+
+    s_client_test_clean_up(&test);
+    return AWS_OP_SUCCESS;
+}
+
+/*******************************************************************************
+ * In-Flight Window
+ ******************************************************************************/
+
+enum {
+    S_WINDOW_MAX_IN_FLIGHT = 2,
+    S_WINDOW_PUBLISH_COUNT = 5,
+};
+
+AWS_TEST_CASE(mqtt_client_in_flight_window_replay, s_mqtt_client_in_flight_window_replay_fn)
+static int s_mqtt_client_in_flight_window_replay_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct loopback_broker_behavior behavior = {
+        .ignore_publishes = true,
+    };
+    struct client_test test;
+    ASSERT_SUCCESS(s_client_test_init(&test, allocator, &behavior));
+
+    struct aws_mqtt_connection_options options = {
+        .clean_session = false,
+        .max_in_flight_publishes = S_WINDOW_MAX_IN_FLIGHT,
+    };
+    ASSERT_SUCCESS(s_client_test_connect(&test, &options));
+
+    const struct aws_byte_cursor topic = aws_byte_cursor_from_c_str("test/window");
+    const struct aws_byte_cursor payload = aws_byte_cursor_from_c_str("held back");
+    uint16_t packet_ids[S_WINDOW_PUBLISH_COUNT];
+    for (size_t i = 0; i < S_WINDOW_PUBLISH_COUNT; ++i) {
+        packet_ids[i] = aws_mqtt_client_connection_publish(
+            test.connection, &topic, AWS_MQTT_QOS_AT_LEAST_ONCE, false, &payload, s_on_op_complete, &test);
+        ASSERT_TRUE(packet_ids[i]);
+    }
+
+    /* Nothing is acked, so only the first ones go out */
+    ASSERT_SUCCESS(s_wait_for_packets(&test, AWS_MQTT_PACKET_PUBLISH, S_WINDOW_MAX_IN_FLIGHT));
+    aws_thread_current_sleep(s_settle_ns);
+    ASSERT_UINT_EQUALS(S_WINDOW_MAX_IN_FLIGHT, loopback_broker_get_packet_count(test.broker, AWS_MQTT_PACKET_PUBLISH));
+
+    /* The resumed session gets those again first, then the rest as acks open the window */
+    behavior.ignore_publishes = false;
+    behavior.session_present = true;
+    behavior.record_packets = true;
+    loopback_broker_set_behavior(test.broker, &behavior);
+    ASSERT_SUCCESS(loopback_broker_close_connection(test.broker));
+
+    ASSERT_SUCCESS(s_wait_for_count(&test, &test.completions, S_WINDOW_PUBLISH_COUNT));
+    ASSERT_INT_EQUALS(0, test.completion_error);
+    ASSERT_UINT_EQUALS(1, s_get_count(&test, &test.resumptions));
+
+    const size_t sent = S_WINDOW_PUBLISH_COUNT + S_WINDOW_MAX_IN_FLIGHT;
+    ASSERT_UINT_EQUALS(sent, loopback_broker_get_packet_count(test.broker, AWS_MQTT_PACKET_PUBLISH));
+    for (size_t i = 0; i < sent; ++i) {
+        struct loopback_broker_packet packet;
+        ASSERT_SUCCESS(s_get_packet(&test, AWS_MQTT_PACKET_PUBLISH, i, &packet));
+
+        const bool resent = i >= S_WINDOW_MAX_IN_FLIGHT && i < 2 * S_WINDOW_MAX_IN_FLIGHT;
+        ASSERT_UINT_EQUALS(resent ? S_PUBLISH_DUP_FLAG : 0, packet.flags & S_PUBLISH_DUP_FLAG);
+        if (resent) {
+            ASSERT_TRUE(packet.packet_id == packet_ids[0] || packet.packet_id == packet_ids[1]);
+        }
+    }
+
+    s_client_test_clean_up(&test);
+    return AWS_OP_SUCCESS;
+}
+
+/*******************************************************************************
+ * Dispatch
+ ******************************************************************************/
+
+AWS_TEST_CASE(mqtt_client_dispatch_ack_on_complete, s_mqtt_client_dispatch_ack_on_complete_fn)
+static int s_mqtt_client_dispatch_ack_on_complete_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct loopback_broker_behavior behavior;
+    AWS_ZERO_STRUCT(behavior);
+    struct client_test test;
+    ASSERT_SUCCESS(s_client_test_init(&test, allocator, &behavior));
+
+    struct aws_mqtt_dispatch_options dispatch = {
+        .thread_count = 1,
+        .ack_policy = AWS_MQTT_DISPATCH_ACK_ON_COMPLETE,
+    };
+    ASSERT_SUCCESS(aws_mqtt_client_connection_set_dispatch(test.connection, &dispatch));
+
+    struct aws_mqtt_connection_options options = {
+        .clean_session = true,
+    };
+    ASSERT_SUCCESS(s_client_test_connect(&test, &options));
+    ASSERT_SUCCESS(s_client_test_subscribe(&test, "test/dispatch", AWS_MQTT_QOS_EXACTLY_ONCE, s_on_publish));
+
+    const struct aws_byte_cursor payload = aws_byte_cursor_from_c_str("handled slowly");
+    struct loopback_broker_packet packet;
+
+    /* No PUBACK while the callback is still running */
+    aws_mutex_lock(&test.lock);
+    test.block_publishes = true;
+    aws_mutex_unlock(&test.lock);
+    ASSERT_SUCCESS(s_broker_send_publish(&test, "test/dispatch", AWS_MQTT_QOS_AT_LEAST_ONCE, false, 11, payload));
+    ASSERT_SUCCESS(s_wait_for_count(&test, &test.publishes_received, 1));
+    aws_thread_current_sleep(s_settle_ns);
+    ASSERT_UINT_EQUALS(0, loopback_broker_get_packet_count(test.broker, AWS_MQTT_PACKET_PUBACK));
+
+    aws_mutex_lock(&test.lock);
+    test.block_publishes = false;
+    aws_condition_variable_notify_all(&test.signal);
+    aws_mutex_unlock(&test.lock);
+    ASSERT_SUCCESS(s_wait_for_packets(&test, AWS_MQTT_PACKET_PUBACK, 1));
+    ASSERT_SUCCESS(s_get_packet(&test, AWS_MQTT_PACKET_PUBACK, 0, &packet));
+    ASSERT_UINT_EQUALS(11, packet.packet_id);
+
+    /* A QoS 2 resend while the first copy is still being handled doesn't get a PUBREC ahead of it */
+    aws_mutex_lock(&test.lock);
+    test.block_publishes = true;
+    aws_mutex_unlock(&test.lock);
+    ASSERT_SUCCESS(s_broker_send_publish(&test, "test/dispatch", AWS_MQTT_QOS_EXACTLY_ONCE, false, 12, payload));
+    ASSERT_SUCCESS(s_wait_for_count(&test, &test.publishes_received, 2));
+    ASSERT_SUCCESS(s_broker_send_publish(&test, "test/dispatch", AWS_MQTT_QOS_EXACTLY_ONCE, true, 12, payload));
+    aws_thread_current_sleep(s_settle_ns);
+    ASSERT_UINT_EQUALS(0, loopback_broker_get_packet_count(test.broker, AWS_MQTT_PACKET_PUBREC));
+
+    aws_mutex_lock(&test.lock);
+    test.block_publishes = false;
+    aws_condition_variable_notify_all(&test.signal);
+    aws_mutex_unlock(&test.lock);
+    ASSERT_SUCCESS(s_wait_for_packets(&test, AWS_MQTT_PACKET_PUBREC, 1));
+    ASSERT_SUCCESS(s_get_packet(&test, AWS_MQTT_PACKET_PUBREC, 0, &packet));
+    ASSERT_UINT_EQUALS(12, packet.packet_id);
+
+    /* The one PUBREC answers both, and the resend is never delivered */
+    aws_thread_current_sleep(s_settle_ns);
+    ASSERT_UINT_EQUALS(1, loopback_broker_get_packet_count(test.broker, AWS_MQTT_PACKET_PUBREC));
+    ASSERT_UINT_EQUALS(2, s_get_count(&test, &test.publishes_received));
+
+    ASSERT_SUCCESS(s_broker_send_pubrel(&test, 12));
+    ASSERT_SUCCESS(s_wait_for_packets(&test, AWS_MQTT_PACKET_PUBCOMP, 1));
+
+    s_client_test_clean_up(&test);
+    return AWS_OP_SUCCESS;
+}
+
+/*******************************************************************************
+ * Read Window
+ ******************************************************************************/
+
+enum {
+    S_READ_WINDOW_BYTES = 1024,
+    S_READ_WINDOW_PAYLOAD_BYTES = 400,
+    S_READ_WINDOW_PUBLISH_COUNT = 6,
+};
+
+AWS_TEST_CASE(mqtt_client_read_window_hold, s_mqtt_client_read_window_hold_fn)
+static int s_mqtt_client_read_window_hold_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct loopback_broker_behavior behavior;
+    AWS_ZERO_STRUCT(behavior);
+    struct client_test test;
+    ASSERT_SUCCESS(s_client_test_init(&test, allocator, &behavior));
+
+    struct aws_mqtt_connection_options options = {
+        .clean_session = true,
+        .read_window_initial_bytes = S_READ_WINDOW_BYTES,
+        .read_window_max_bytes = S_READ_WINDOW_BYTES,
+    };
+    ASSERT_SUCCESS(s_client_test_connect(&test, &options));
+    ASSERT_SUCCESS(s_client_test_subscribe(&test, "test/read-window", AWS_MQTT_QOS_AT_MOST_ONCE, s_on_publish_hold));
+
+    uint8_t payload_storage[S_READ_WINDOW_PAYLOAD_BYTES];
+    memset(payload_storage, 'w', sizeof(payload_storage));
+    const struct aws_byte_cursor payload = aws_byte_cursor_from_array(payload_storage, sizeof(payload_storage));
+    for (size_t i = 0; i < S_READ_WINDOW_PUBLISH_COUNT; ++i) {
+        ASSERT_SUCCESS(s_broker_send_publish(&test, "test/read-window", AWS_MQTT_QOS_AT_MOST_ONCE, false, 0, payload));
+    }
+
+    /* Only as much as the window allows is read while every payload is held */
+    ASSERT_SUCCESS(s_wait_for_count(&test, &test.publishes_received, 1));
+    aws_thread_current_sleep(s_settle_ns);
+    const size_t received = s_get_count(&test, &test.publishes_received);
+    ASSERT_TRUE(received * S_READ_WINDOW_PAYLOAD_BYTES <= S_READ_WINDOW_BYTES);
+
+    /* Letting go of them opens it up again, over and over until everything is read */
+    size_t released = 0;
+    while (released < S_READ_WINDOW_PUBLISH_COUNT) {
+        ASSERT_SUCCESS(s_wait_for_count(&test, &test.publishes_received, released + 1));
+        const size_t held = s_get_count(&test, &test.publishes_received) - released;
+        ASSERT_SUCCESS(
+            aws_mqtt_client_connection_release_read_window(test.connection, held * S_READ_WINDOW_PAYLOAD_BYTES));
+        released += held;
+    }
+    ASSERT_UINT_EQUALS(S_READ_WINDOW_PUBLISH_COUNT, s_get_count(&test, &test.publishes_received));
+
+    s_client_test_clean_up(&test);
+    return AWS_OP_SUCCESS;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/packets.h>
+
+static bool s_is_within(struct aws_byte_cursor inner, const uint8_t *data, size_t size) {
+    return inner.len == 0 || (inner.ptr >= data && inner.ptr + inner.len <= data + size);
+}
+
+/* Everything a decoded CONNECT points at is inside the input, and what it claims is consistent */
+AWS_EXTERN_C_BEGIN
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+
+    struct aws_byte_cursor cur = aws_byte_cursor_from_array(data, size);
+
+    struct aws_mqtt_packet_connect connect;
+    AWS_ZERO_STRUCT(connect);
+    if (aws_mqtt_packet_connect_decode(&cur, &connect)) {
+        return 0;
+    }
+
+    const size_t consumed = size - cur.len;
+    AWS_FATAL_ASSERT(consumed <= size);
+    AWS_FATAL_ASSERT(s_is_within(connect.client_identifier, data, consumed));
+    AWS_FATAL_ASSERT(s_is_within(connect.will_topic, data, consumed));
+    AWS_FATAL_ASSERT(s_is_within(connect.will_message, data, consumed));
+    AWS_FATAL_ASSERT(s_is_within(connect.username, data, consumed));
+    AWS_FATAL_ASSERT(s_is_within(connect.password, data, consumed));
+
+    AWS_FATAL_ASSERT(connect.has_will || (!connect.will_topic.len && !connect.will_message.len));
+    AWS_FATAL_ASSERT(connect.has_username || !connect.username.len);
+    AWS_FATAL_ASSERT(!connect.has_password || connect.has_username);
+
+    return 0;
+}
+
+AWS_EXTERN_C_END
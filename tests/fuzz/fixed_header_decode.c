@@ -0,0 +1,50 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/fixed_header.h>
+
+/* Decoding must never read past the end of the data, and must agree with the size found by get_packet_size */
+AWS_EXTERN_C_BEGIN
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+
+    struct aws_byte_cursor cur = aws_byte_cursor_from_array(data, size);
+
+    size_t packet_size = 0;
+    const bool has_size = aws_mqtt_fixed_header_get_packet_size(cur, &packet_size) == AWS_OP_SUCCESS;
+
+    struct aws_mqtt_fixed_header header;
+    AWS_ZERO_STRUCT(header);
+    if (aws_mqtt_fixed_header_decode(&cur, &header)) {
+        return 0;
+    }
+
+    const size_t header_size = size - cur.len;
+    AWS_FATAL_ASSERT(header_size >= 2 && header_size <= 5);
+    AWS_FATAL_ASSERT(header.remaining_length <= cur.len);
+    AWS_FATAL_ASSERT(has_size && packet_size == header_size + header.remaining_length);
+    AWS_FATAL_ASSERT(header.packet_type == aws_mqtt_get_packet_type(data));
+
+    /* Whatever was decoded encodes back, in no more bytes than it took */
+    uint8_t encoded[5];
+    struct aws_byte_buf buf = aws_byte_buf_from_empty_array(encoded, sizeof(encoded));
+    AWS_FATAL_ASSERT(aws_mqtt_fixed_header_encode(&buf, &header) == AWS_OP_SUCCESS);
+    AWS_FATAL_ASSERT(buf.len <= header_size);
+    AWS_FATAL_ASSERT(encoded[0] == data[0]);
+
+    return 0;
+}
+
+AWS_EXTERN_C_END
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/packets.h>
+
+static bool s_is_within(struct aws_byte_cursor inner, const uint8_t *data, size_t size) {
+    return inner.len == 0 || (inner.ptr >= data && inner.ptr + inner.len <= data + size);
+}
+
+/* A decoded PUBLISH covers exactly one packet of the input, and survives being encoded and decoded again */
+AWS_EXTERN_C_BEGIN
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+
+    struct aws_byte_cursor cur = aws_byte_cursor_from_array(data, size);
+
+    struct aws_mqtt_packet_publish publish;
+    AWS_ZERO_STRUCT(publish);
+    if (aws_mqtt_packet_publish_decode(&cur, &publish)) {
+        return 0;
+    }
+
+    const size_t consumed = size - cur.len;
+    AWS_FATAL_ASSERT(publish.fixed_header.remaining_length < consumed);
+    AWS_FATAL_ASSERT(consumed - publish.fixed_header.remaining_length <= 5);
+    AWS_FATAL_ASSERT(s_is_within(publish.topic_name, data, consumed));
+    AWS_FATAL_ASSERT(s_is_within(publish.payload, data, consumed));
+
+    /* The remaining length can only shrink, if the input didn't encode it in as few bytes as possible */
+    struct aws_byte_buf buf;
+    AWS_FATAL_ASSERT(aws_byte_buf_init(&buf, aws_default_allocator(), consumed) == AWS_OP_SUCCESS);
+    AWS_FATAL_ASSERT(aws_mqtt_packet_publish_encode(&buf, &publish) == AWS_OP_SUCCESS);
+
+    struct aws_byte_cursor encoded = aws_byte_cursor_from_buf(&buf);
+    struct aws_mqtt_packet_publish decoded;
+    AWS_ZERO_STRUCT(decoded);
+    AWS_FATAL_ASSERT(aws_mqtt_packet_publish_decode(&encoded, &decoded) == AWS_OP_SUCCESS);
+    AWS_FATAL_ASSERT(encoded.len == 0);
+
+    AWS_FATAL_ASSERT(decoded.fixed_header.packet_type == publish.fixed_header.packet_type);
+    AWS_FATAL_ASSERT(decoded.fixed_header.flags == publish.fixed_header.flags);
+    AWS_FATAL_ASSERT(decoded.fixed_header.remaining_length == publish.fixed_header.remaining_length);
+    AWS_FATAL_ASSERT(decoded.packet_identifier == publish.packet_identifier);
+    AWS_FATAL_ASSERT(aws_byte_cursor_eq(&decoded.topic_name, &publish.topic_name));
+    AWS_FATAL_ASSERT(aws_byte_cursor_eq(&decoded.payload, &publish.payload));
+
+    aws_byte_buf_clean_up(&buf);
+
+    return 0;
+}
+
+AWS_EXTERN_C_END
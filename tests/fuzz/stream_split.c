@@ -0,0 +1,109 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/fixed_header.h>
+#include <aws/mqtt/private/packet_framer.h>
+
+/**
+ * Splitting a stream into pieces at arbitrary boundaries must produce the same packets as receiving it in one go.
+ * The first 8 bytes of input pick where the stream is split, the rest is the stream.
+ */
+
+struct framed_stream {
+    /* Every packet passed on, back to back */
+    struct aws_byte_buf packets;
+    size_t packet_count;
+};
+
+static int s_on_packet(struct aws_byte_cursor packet, void *userdata) {
+
+    struct framed_stream *stream = userdata;
+
+    /* Each packet must be exactly one whole packet, which is what the connection goes on to decode */
+    struct aws_byte_cursor header_cur = packet;
+    struct aws_mqtt_fixed_header header;
+    if (aws_mqtt_fixed_header_decode(&header_cur, &header)) {
+        return AWS_OP_ERR;
+    }
+    AWS_FATAL_ASSERT(header_cur.len == header.remaining_length);
+
+    AWS_FATAL_ASSERT(aws_byte_buf_append_dynamic(&stream->packets, &packet) == AWS_OP_SUCCESS);
+    ++stream->packet_count;
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_EXTERN_C_BEGIN
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+
+    struct aws_allocator *allocator = aws_default_allocator();
+
+    uint64_t random_state = 0;
+    struct aws_byte_cursor input = aws_byte_cursor_from_array(data, size);
+    if (!aws_byte_cursor_read_be64(&input, &random_state)) {
+        return 0;
+    }
+    random_state |= 1;
+
+    /* All at once */
+    struct aws_mqtt_packet_framer framer;
+    aws_mqtt_packet_framer_init(&framer, allocator);
+    struct framed_stream whole;
+    AWS_ZERO_STRUCT(whole);
+    AWS_FATAL_ASSERT(aws_byte_buf_init(&whole.packets, allocator, input.len) == AWS_OP_SUCCESS);
+
+    const bool whole_failed = aws_mqtt_packet_framer_process(&framer, input, s_on_packet, &whole) != AWS_OP_SUCCESS;
+    const size_t whole_pending = framer.pending.len;
+    aws_mqtt_packet_framer_clean_up(&framer);
+
+    /* In pieces, mostly small so headers get split too */
+    aws_mqtt_packet_framer_init(&framer, allocator);
+    struct framed_stream split;
+    AWS_ZERO_STRUCT(split);
+    AWS_FATAL_ASSERT(aws_byte_buf_init(&split.packets, allocator, input.len) == AWS_OP_SUCCESS);
+
+    bool split_failed = false;
+    while (input.len && !split_failed) {
+        /* xorshift64 */
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 7;
+        random_state ^= random_state << 17;
+
+        size_t piece_size = (random_state & 0x3) == 0 ? (size_t)(random_state >> 8) % 1024 : (random_state >> 8) % 8;
+        piece_size = piece_size ? piece_size : 1;
+        if (piece_size > input.len) {
+            piece_size = input.len;
+        }
+
+        struct aws_byte_cursor piece = aws_byte_cursor_advance(&input, piece_size);
+        split_failed = aws_mqtt_packet_framer_process(&framer, piece, s_on_packet, &split) != AWS_OP_SUCCESS;
+    }
+
+    /* The same packets up to the same point, and the same malformed packet ends both. Only the partial packet left
+     * once a stream fails can differ, since the split stream may have stashed it before reaching the bad header. */
+    AWS_FATAL_ASSERT(split_failed == whole_failed);
+    AWS_FATAL_ASSERT(split.packet_count == whole.packet_count);
+    AWS_FATAL_ASSERT(aws_byte_buf_eq(&split.packets, &whole.packets));
+    AWS_FATAL_ASSERT(whole_failed || framer.pending.len == whole_pending);
+
+    aws_mqtt_packet_framer_clean_up(&framer);
+    aws_byte_buf_clean_up(&split.packets);
+    aws_byte_buf_clean_up(&whole.packets);
+
+    return 0;
+}
+
+AWS_EXTERN_C_END
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/packets.h>
+
+static bool s_is_within(struct aws_byte_cursor inner, const uint8_t *data, size_t size) {
+    return inner.len == 0 || (inner.ptr >= data && inner.ptr + inner.len <= data + size);
+}
+
+/* A decoded SUBSCRIBE covers exactly one packet of the input, and survives being encoded and decoded again */
+AWS_EXTERN_C_BEGIN
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+
+    struct aws_allocator *allocator = aws_default_allocator();
+    struct aws_byte_cursor cur = aws_byte_cursor_from_array(data, size);
+
+    struct aws_mqtt_packet_subscribe subscribe;
+    AWS_FATAL_ASSERT(aws_mqtt_packet_subscribe_init(&subscribe, allocator, 0) == AWS_OP_SUCCESS);
+    if (aws_mqtt_packet_subscribe_decode(&cur, &subscribe)) {
+        aws_mqtt_packet_subscribe_clean_up(&subscribe);
+        return 0;
+    }
+
+    const size_t consumed = size - cur.len;
+    AWS_FATAL_ASSERT(subscribe.fixed_header.remaining_length < consumed);
+    AWS_FATAL_ASSERT(consumed - subscribe.fixed_header.remaining_length <= 5);
+
+    const size_t filter_count = aws_array_list_length(&subscribe.topic_filters);
+    for (size_t i = 0; i < filter_count; ++i) {
+        struct aws_mqtt_subscription *subscription = NULL;
+        aws_array_list_get_at_ptr(&subscribe.topic_filters, (void **)&subscription, i);
+        AWS_FATAL_ASSERT(s_is_within(subscription->topic_filter, data, consumed));
+        AWS_FATAL_ASSERT(subscription->qos <= AWS_MQTT_QOS_EXACTLY_ONCE);
+    }
+
+    struct aws_byte_buf buf;
+    AWS_FATAL_ASSERT(aws_byte_buf_init(&buf, allocator, consumed) == AWS_OP_SUCCESS);
+    AWS_FATAL_ASSERT(aws_mqtt_packet_subscribe_encode(&buf, &subscribe) == AWS_OP_SUCCESS);
+
+    struct aws_byte_cursor encoded = aws_byte_cursor_from_buf(&buf);
+    struct aws_mqtt_packet_subscribe decoded;
+    AWS_FATAL_ASSERT(aws_mqtt_packet_subscribe_init(&decoded, allocator, 0) == AWS_OP_SUCCESS);
+    AWS_FATAL_ASSERT(aws_mqtt_packet_subscribe_decode(&encoded, &decoded) == AWS_OP_SUCCESS);
+    AWS_FATAL_ASSERT(encoded.len == 0);
+
+    AWS_FATAL_ASSERT(decoded.packet_identifier == subscribe.packet_identifier);
+    AWS_FATAL_ASSERT(aws_array_list_length(&decoded.topic_filters) == filter_count);
+    for (size_t i = 0; i < filter_count; ++i) {
+        struct aws_mqtt_subscription *expected = NULL;
+        struct aws_mqtt_subscription *actual = NULL;
+        aws_array_list_get_at_ptr(&subscribe.topic_filters, (void **)&expected, i);
+        aws_array_list_get_at_ptr(&decoded.topic_filters, (void **)&actual, i);
+        AWS_FATAL_ASSERT(aws_byte_cursor_eq(&expected->topic_filter, &actual->topic_filter));
+        AWS_FATAL_ASSERT(expected->qos == actual->qos);
+    }
+
+    aws_mqtt_packet_subscribe_clean_up(&decoded);
+    aws_byte_buf_clean_up(&buf);
+    aws_mqtt_packet_subscribe_clean_up(&subscribe);
+
+    return 0;
+}
+
+AWS_EXTERN_C_END
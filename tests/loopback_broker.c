@@ -0,0 +1,736 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "loopback_broker.h"
+
+#include <aws/mqtt/private/fixed_header.h>
+#include <aws/mqtt/private/packets.h>
+
+#include <aws/io/channel.h>
+#include <aws/io/channel_bootstrap.h>
+#include <aws/io/socket.h>
+
+#include <aws/common/array_list.h>
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
+
+#include <stdio.h>
+
+/* Ports tried, in order, until one can be listened on */
+enum {
+    S_FIRST_PORT = 18830,
+    S_PORT_ATTEMPTS = 64,
+};
+
+struct broker_session;
+
+struct loopback_broker {
+    struct aws_allocator *allocator;
+    struct aws_server_bootstrap *bootstrap;
+    struct aws_socket *listener;
+    uint16_t port;
+
+    struct aws_mutex lock;
+    struct aws_condition_variable signal;
+    /* Everything below is protected by lock */
+    struct loopback_broker_behavior behavior;
+    /* loopback_broker_packet, in the order received */
+    struct aws_array_list packets;
+    /* The last connection accepted, until its channel is destroyed */
+    struct broker_session *session;
+};
+
+/* One per accepted connection, freed with its channel */
+struct broker_session {
+    struct aws_allocator *allocator;
+    struct loopback_broker *broker;
+    struct aws_channel_handler handler;
+    struct aws_channel_slot *slot;
+
+    /* The broker's behavior, as of the message being read */
+    struct loopback_broker_behavior behavior;
+
+    /* Bytes of a packet that didn't fit in the last message */
+    struct aws_byte_buf pending;
+    /* Replies to everything in the current message, written in one go at the end of it */
+    struct aws_byte_buf out;
+
+    size_t subscription_count;
+};
+
+/*******************************************************************************
+ * Replies
+ ******************************************************************************/
+
+static int s_reserve(struct broker_session *session, size_t additional) {
+    return aws_byte_buf_reserve(&session->out, session->out.len + additional);
+}
+
+static int s_reply_ack(
+    struct broker_session *session,
+    int (*init_fn)(struct aws_mqtt_packet_ack *, uint16_t),
+    uint16_t id) {
+
+    struct aws_mqtt_packet_ack ack;
+    init_fn(&ack, id);
+
+    if (s_reserve(session, 4)) {
+        return AWS_OP_ERR;
+    }
+    return aws_mqtt_packet_ack_encode(&session->out, &ack);
+}
+
+static int s_handle_connect(struct broker_session *session) {
+
+    struct aws_mqtt_packet_connack connack;
+    aws_mqtt_packet_connack_init(&connack, session->behavior.session_present, AWS_MQTT_CONNECT_ACCEPTED);
+
+    if (s_reserve(session, 4)) {
+        return AWS_OP_ERR;
+    }
+    return aws_mqtt_packet_connack_encode(&session->out, &connack);
+}
+
+static int s_handle_publish(struct broker_session *session, struct aws_byte_cursor packet) {
+
+    struct aws_mqtt_packet_publish publish;
+    if (aws_mqtt_packet_publish_decode(&packet, &publish)) {
+        return AWS_OP_ERR;
+    }
+
+    const enum aws_mqtt_qos qos = (enum aws_mqtt_qos)((publish.fixed_header.flags >> 1) & 0x3);
+    if (session->behavior.ignore_publishes) {
+        /* Nothing to ack */
+    } else if (qos == AWS_MQTT_QOS_AT_LEAST_ONCE) {
+        if (s_reply_ack(session, aws_mqtt_packet_puback_init, publish.packet_identifier)) {
+            return AWS_OP_ERR;
+        }
+    } else if (qos == AWS_MQTT_QOS_EXACTLY_ONCE) {
+        if (s_reply_ack(session, aws_mqtt_packet_pubrec_init, publish.packet_identifier)) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    if (!session->subscription_count) {
+        return AWS_OP_SUCCESS;
+    }
+
+    /* Deliver it back at QoS 0, so there's no ack to wait for from the client */
+    struct aws_mqtt_packet_publish echo;
+    aws_mqtt_packet_publish_init(
+        &echo, false, AWS_MQTT_QOS_AT_MOST_ONCE, false, publish.topic_name, 0, publish.payload);
+
+    /* Fixed header is at most 5 bytes */
+    if (s_reserve(session, 5 + echo.fixed_header.remaining_length)) {
+        return AWS_OP_ERR;
+    }
+    return aws_mqtt_packet_publish_encode(&session->out, &echo);
+}
+
+static int s_handle_pubrel(struct broker_session *session, struct aws_byte_cursor packet) {
+
+    struct aws_mqtt_packet_ack pubrel;
+    if (aws_mqtt_packet_ack_decode(&packet, &pubrel)) {
+        return AWS_OP_ERR;
+    }
+    return s_reply_ack(session, aws_mqtt_packet_pubcomp_init, pubrel.packet_identifier);
+}
+
+static int s_handle_subscribe(struct broker_session *session, struct aws_byte_cursor packet) {
+
+    struct aws_mqtt_packet_subscribe subscribe;
+    if (aws_mqtt_packet_subscribe_init(&subscribe, session->allocator, 0)) {
+        return AWS_OP_ERR;
+    }
+
+    int result = AWS_OP_ERR;
+    if (aws_mqtt_packet_subscribe_decode(&packet, &subscribe)) {
+        goto clean_up;
+    }
+
+    /* The library's ack packet has no room for return codes, so SUBACK is written by hand, granting every QoS */
+    const size_t topic_count = aws_array_list_length(&subscribe.topic_filters);
+    struct aws_mqtt_fixed_header header = {
+        .packet_type = AWS_MQTT_PACKET_SUBACK,
+        .remaining_length = 2 + topic_count,
+    };
+    if (s_reserve(session, 5 + header.remaining_length) ||
+        aws_mqtt_fixed_header_encode(&session->out, &header) ||
+        !aws_byte_buf_write_be16(&session->out, subscribe.packet_identifier)) {
+        goto clean_up;
+    }
+    for (size_t i = 0; i < topic_count; ++i) {
+        struct aws_mqtt_subscription *subscription = NULL;
+        aws_array_list_get_at_ptr(&subscribe.topic_filters, (void **)&subscription, i);
+        aws_byte_buf_write_u8(&session->out, (uint8_t)subscription->qos);
+    }
+
+    session->subscription_count += topic_count;
+    result = AWS_OP_SUCCESS;
+
+clean_up:
+    aws_mqtt_packet_subscribe_clean_up(&subscribe);
+    return result;
+}
+
+static int s_handle_unsubscribe(struct broker_session *session, struct aws_byte_cursor packet) {
+
+    struct aws_mqtt_packet_unsubscribe unsubscribe;
+    if (aws_mqtt_packet_unsubscribe_init(&unsubscribe, session->allocator, 0)) {
+        return AWS_OP_ERR;
+    }
+
+    int result = AWS_OP_ERR;
+    if (aws_mqtt_packet_unsubscribe_decode(&packet, &unsubscribe)) {
+        goto clean_up;
+    }
+
+    const size_t topic_count = aws_array_list_length(&unsubscribe.topic_filters);
+    if (topic_count < session->subscription_count) {
+        session->subscription_count -= topic_count;
+    } else {
+        session->subscription_count = 0;
+    }
+    result = s_reply_ack(session, aws_mqtt_packet_unsuback_init, unsubscribe.packet_identifier);
+
+clean_up:
+    aws_mqtt_packet_unsubscribe_clean_up(&unsubscribe);
+    return result;
+}
+
+static int s_handle_pingreq(struct broker_session *session) {
+
+    if (session->behavior.ignore_pingreq) {
+        return AWS_OP_SUCCESS;
+    }
+
+    struct aws_mqtt_packet_connection pingresp;
+    aws_mqtt_packet_pingresp_init(&pingresp);
+
+    if (s_reserve(session, 2)) {
+        return AWS_OP_ERR;
+    }
+    return aws_mqtt_packet_connection_encode(&session->out, &pingresp);
+}
+
+/* Keep the type, flags and id of a packet for loopback_broker_get_packet */
+static int s_record_packet(struct broker_session *session, struct aws_byte_cursor packet) {
+
+    struct aws_mqtt_fixed_header header;
+    struct aws_byte_cursor variable_header = packet;
+    if (aws_mqtt_fixed_header_decode(&variable_header, &header)) {
+        return AWS_OP_ERR;
+    }
+
+    struct loopback_broker_packet record = {
+        .type = header.packet_type,
+        .flags = header.flags,
+    };
+    if (header.packet_type == AWS_MQTT_PACKET_PUBLISH) {
+        struct aws_mqtt_packet_publish publish;
+        if (aws_mqtt_packet_publish_decode(&packet, &publish)) {
+            return AWS_OP_ERR;
+        }
+        record.packet_id = publish.packet_identifier;
+    } else if (header.packet_type >= AWS_MQTT_PACKET_PUBACK && header.packet_type <= AWS_MQTT_PACKET_UNSUBACK) {
+        /* Everything from PUBACK to UNSUBACK starts with its id */
+        if (!aws_byte_cursor_read_be16(&variable_header, &record.packet_id)) {
+            return aws_raise_error(AWS_ERROR_MQTT_INVALID_PACKET_TYPE);
+        }
+    }
+
+    struct loopback_broker *broker = session->broker;
+    aws_mutex_lock(&broker->lock);
+    const int result = aws_array_list_push_back(&broker->packets, &record);
+    aws_condition_variable_notify_all(&broker->signal);
+    aws_mutex_unlock(&broker->lock);
+
+    return result;
+}
+
+static int s_handle_packet(struct broker_session *session, struct aws_byte_cursor packet) {
+
+    if (session->behavior.record_packets && s_record_packet(session, packet)) {
+        return AWS_OP_ERR;
+    }
+
+    switch (aws_mqtt_get_packet_type(packet.ptr)) {
+        case AWS_MQTT_PACKET_CONNECT:
+            return s_handle_connect(session);
+        case AWS_MQTT_PACKET_PUBLISH:
+            return s_handle_publish(session, packet);
+        case AWS_MQTT_PACKET_PUBREL:
+            return s_handle_pubrel(session, packet);
+        case AWS_MQTT_PACKET_SUBSCRIBE:
+            return s_handle_subscribe(session, packet);
+        case AWS_MQTT_PACKET_UNSUBSCRIBE:
+            return s_handle_unsubscribe(session, packet);
+        case AWS_MQTT_PACKET_PINGREQ:
+            return s_handle_pingreq(session);
+        default:
+            /* PUBACK/PUBREC/PUBCOMP only answer what a test sent with loopback_broker_send, which handles them
+             * itself. DISCONNECT is followed by the socket closing, which takes care of itself. */
+            return AWS_OP_SUCCESS;
+    }
+}
+
+/* Write out everything in session->out, a message at a time */
+static int s_flush_replies(struct broker_session *session) {
+
+    struct aws_byte_cursor to_send = aws_byte_cursor_from_buf(&session->out);
+    while (to_send.len) {
+        struct aws_io_message *message = aws_channel_acquire_message_from_pool(
+            session->slot->channel, AWS_IO_MESSAGE_APPLICATION_DATA, to_send.len);
+        if (!message) {
+            return AWS_OP_ERR;
+        }
+
+        const size_t capacity = message->message_data.capacity;
+        const size_t chunk_size = to_send.len < capacity ? to_send.len : capacity;
+        struct aws_byte_cursor chunk = aws_byte_cursor_advance(&to_send, chunk_size);
+        aws_byte_buf_write_from_whole_cursor(&message->message_data, chunk);
+
+        if (aws_channel_slot_send_message(session->slot, message, AWS_CHANNEL_DIR_WRITE)) {
+            aws_mem_release(message->allocator, message);
+            return AWS_OP_ERR;
+        }
+    }
+
+    session->out.len = 0;
+    return AWS_OP_SUCCESS;
+}
+
+/*******************************************************************************
+ * Channel Handler
+ ******************************************************************************/
+
+static int s_process_read_message(
+    struct aws_channel_handler *handler,
+    struct aws_channel_slot *slot,
+    struct aws_io_message *message) {
+
+    struct broker_session *session = handler->impl;
+    const size_t message_len = message->message_data.len;
+
+    aws_mutex_lock(&session->broker->lock);
+    session->behavior = session->broker->behavior;
+    aws_mutex_unlock(&session->broker->lock);
+
+    /* Packets split across messages are put back together in pending, the rest are read in place */
+    struct aws_byte_cursor data = aws_byte_cursor_from_buf(&message->message_data);
+    if (session->pending.len) {
+        if (aws_byte_buf_append_dynamic(&session->pending, &data)) {
+            goto error;
+        }
+        data = aws_byte_cursor_from_buf(&session->pending);
+    }
+
+    while (data.len) {
+        size_t packet_size = 0;
+        if (aws_mqtt_fixed_header_get_packet_size(data, &packet_size)) {
+            if (aws_last_error() != AWS_ERROR_SHORT_BUFFER) {
+                goto error;
+            }
+            aws_reset_error();
+            break;
+        }
+        if (packet_size > data.len) {
+            break;
+        }
+
+        if (s_handle_packet(session, aws_byte_cursor_advance(&data, packet_size))) {
+            goto error;
+        }
+    }
+
+    /* Keep whatever is left of an incomplete packet */
+    if (session->pending.len) {
+        memmove(session->pending.buffer, data.ptr, data.len);
+        session->pending.len = data.len;
+    } else if (data.len && aws_byte_buf_append_dynamic(&session->pending, &data)) {
+        goto error;
+    }
+
+    aws_mem_release(message->allocator, message);
+
+    if (s_flush_replies(session)) {
+        return AWS_OP_ERR;
+    }
+    aws_channel_slot_increment_read_window(slot, message_len);
+
+    return AWS_OP_SUCCESS;
+
+error:
+    aws_mem_release(message->allocator, message);
+    return AWS_OP_ERR;
+}
+
+static int s_shutdown(
+    struct aws_channel_handler *handler,
+    struct aws_channel_slot *slot,
+    enum aws_channel_direction dir,
+    int error_code,
+    bool free_scarce_resources_immediately) {
+
+    (void)handler;
+
+    return aws_channel_slot_on_handler_shutdown_complete(slot, dir, error_code, free_scarce_resources_immediately);
+}
+
+static size_t s_initial_window_size(struct aws_channel_handler *handler) {
+    (void)handler;
+    return SIZE_MAX;
+}
+
+static size_t s_message_overhead(struct aws_channel_handler *handler) {
+    (void)handler;
+    return 0;
+}
+
+static void s_destroy(struct aws_channel_handler *handler) {
+
+    struct broker_session *session = handler->impl;
+
+    /* The channel goes with it, so nothing can be scheduled on it from here on */
+    struct loopback_broker *broker = session->broker;
+    aws_mutex_lock(&broker->lock);
+    if (broker->session == session) {
+        broker->session = NULL;
+    }
+    aws_mutex_unlock(&broker->lock);
+
+    aws_byte_buf_clean_up(&session->pending);
+    aws_byte_buf_clean_up(&session->out);
+    aws_mem_release(session->allocator, session);
+}
+
+static struct aws_channel_handler_vtable s_session_vtable = {
+    .process_read_message = &s_process_read_message,
+    .process_write_message = NULL,
+    .increment_read_window = NULL,
+    .shutdown = &s_shutdown,
+    .initial_window_size = &s_initial_window_size,
+    .message_overhead = &s_message_overhead,
+    .destroy = &s_destroy,
+};
+
+/*******************************************************************************
+ * Listener
+ ******************************************************************************/
+
+static void s_on_accept_channel_setup(
+    struct aws_server_bootstrap *bootstrap,
+    int error_code,
+    struct aws_channel *channel,
+    void *user_data) {
+
+    (void)bootstrap;
+
+    struct loopback_broker *broker = user_data;
+    if (error_code) {
+        return;
+    }
+
+    struct broker_session *session = aws_mem_acquire(broker->allocator, sizeof(struct broker_session));
+    if (!session) {
+        goto error;
+    }
+    AWS_ZERO_STRUCT(*session);
+    session->allocator = broker->allocator;
+    session->broker = broker;
+    session->handler.alloc = broker->allocator;
+    session->handler.vtable = &s_session_vtable;
+    session->handler.impl = session;
+
+    if (aws_byte_buf_init(&session->pending, broker->allocator, 256) ||
+        aws_byte_buf_init(&session->out, broker->allocator, 4096)) {
+        goto error;
+    }
+
+    session->slot = aws_channel_slot_new(channel);
+    if (!session->slot) {
+        goto error;
+    }
+    aws_channel_slot_insert_end(channel, session->slot);
+    aws_channel_slot_set_handler(session->slot, &session->handler);
+
+    aws_mutex_lock(&broker->lock);
+    broker->session = session;
+    aws_mutex_unlock(&broker->lock);
+
+    return;
+
+error:
+    if (session) {
+        aws_byte_buf_clean_up(&session->pending);
+        aws_byte_buf_clean_up(&session->out);
+        aws_mem_release(broker->allocator, session);
+    }
+    aws_channel_shutdown(channel, aws_last_error());
+}
+
+static void s_on_accept_channel_shutdown(
+    struct aws_server_bootstrap *bootstrap,
+    int error_code,
+    struct aws_channel *channel,
+    void *user_data) {
+
+    (void)bootstrap;
+    (void)error_code;
+    (void)channel;
+    (void)user_data;
+
+    /* The session is freed by the channel, along with its handler */
+}
+
+struct loopback_broker *loopback_broker_new(struct aws_allocator *allocator, struct aws_event_loop_group *el_group) {
+
+    struct loopback_broker *broker = aws_mem_acquire(allocator, sizeof(struct loopback_broker));
+    if (!broker) {
+        return NULL;
+    }
+    AWS_ZERO_STRUCT(*broker);
+    broker->allocator = allocator;
+
+    if (aws_mutex_init(&broker->lock)) {
+        goto error_lock;
+    }
+    if (aws_condition_variable_init(&broker->signal)) {
+        goto error_signal;
+    }
+    if (aws_array_list_init_dynamic(&broker->packets, allocator, 64, sizeof(struct loopback_broker_packet))) {
+        goto error_packets;
+    }
+
+    broker->bootstrap = aws_server_bootstrap_new(allocator, el_group);
+    if (!broker->bootstrap) {
+        goto error;
+    }
+
+    struct aws_socket_options options;
+    AWS_ZERO_STRUCT(options);
+    options.type = AWS_SOCKET_STREAM;
+    options.domain = AWS_SOCKET_IPV4;
+    options.connect_timeout_ms = 3000;
+
+    struct aws_socket_endpoint endpoint;
+    AWS_ZERO_STRUCT(endpoint);
+    snprintf(endpoint.address, sizeof(endpoint.address), "127.0.0.1");
+
+    for (uint16_t attempt = 0; attempt < S_PORT_ATTEMPTS && !broker->listener; ++attempt) {
+        endpoint.port = (uint16_t)(S_FIRST_PORT + attempt);
+        broker->listener = aws_server_bootstrap_new_socket_listener(
+            broker->bootstrap, &endpoint, &options, s_on_accept_channel_setup, s_on_accept_channel_shutdown, broker);
+    }
+    if (!broker->listener) {
+        fprintf(stderr, "loopback broker: no port to listen on from %d\n", S_FIRST_PORT);
+        goto error;
+    }
+    broker->port = endpoint.port;
+
+    return broker;
+
+error:
+    if (broker->bootstrap) {
+        aws_server_bootstrap_release(broker->bootstrap);
+    }
+    aws_array_list_clean_up(&broker->packets);
+error_packets:
+    aws_condition_variable_clean_up(&broker->signal);
+error_signal:
+    aws_mutex_clean_up(&broker->lock);
+error_lock:
+    aws_mem_release(allocator, broker);
+    return NULL;
+}
+
+void loopback_broker_destroy(struct loopback_broker *broker) {
+
+    aws_server_bootstrap_destroy_socket_listener(broker->bootstrap, broker->listener);
+    aws_server_bootstrap_release(broker->bootstrap);
+    aws_array_list_clean_up(&broker->packets);
+    aws_condition_variable_clean_up(&broker->signal);
+    aws_mutex_clean_up(&broker->lock);
+    aws_mem_release(broker->allocator, broker);
+}
+
+uint16_t loopback_broker_get_port(const struct loopback_broker *broker) {
+    return broker->port;
+}
+
+/*******************************************************************************
+ * Test Controls
+ ******************************************************************************/
+
+void loopback_broker_set_behavior(struct loopback_broker *broker, const struct loopback_broker_behavior *behavior) {
+
+    aws_mutex_lock(&broker->lock);
+    broker->behavior = *behavior;
+    aws_mutex_unlock(&broker->lock);
+}
+
+/* Only with the lock held */
+static size_t s_count_packets(const struct loopback_broker *broker, enum aws_mqtt_packet_type type) {
+
+    size_t count = 0;
+    const size_t length = aws_array_list_length(&broker->packets);
+    for (size_t i = 0; i < length; ++i) {
+        struct loopback_broker_packet *packet = NULL;
+        aws_array_list_get_at_ptr(&broker->packets, (void **)&packet, i);
+        count += packet->type == type;
+    }
+    return count;
+}
+
+size_t loopback_broker_get_packet_count(struct loopback_broker *broker, enum aws_mqtt_packet_type type) {
+
+    aws_mutex_lock(&broker->lock);
+    const size_t count = s_count_packets(broker, type);
+    aws_mutex_unlock(&broker->lock);
+
+    return count;
+}
+
+int loopback_broker_get_packet(
+    struct loopback_broker *broker,
+    enum aws_mqtt_packet_type type,
+    size_t index,
+    struct loopback_broker_packet *packet) {
+
+    bool found = false;
+
+    aws_mutex_lock(&broker->lock);
+    const size_t length = aws_array_list_length(&broker->packets);
+    for (size_t i = 0; i < length && !found; ++i) {
+        struct loopback_broker_packet *recorded = NULL;
+        aws_array_list_get_at_ptr(&broker->packets, (void **)&recorded, i);
+        if (recorded->type == type && index-- == 0) {
+            *packet = *recorded;
+            found = true;
+        }
+    }
+    aws_mutex_unlock(&broker->lock);
+
+    return found ? AWS_OP_SUCCESS : aws_raise_error(AWS_ERROR_INVALID_INDEX);
+}
+
+struct packets_wait {
+    struct loopback_broker *broker;
+    enum aws_mqtt_packet_type type;
+    size_t count;
+};
+
+static bool s_packets_received(void *arg) {
+    struct packets_wait *wait = arg;
+    return s_count_packets(wait->broker, wait->type) >= wait->count;
+}
+
+int loopback_broker_wait_for_packets(
+    struct loopback_broker *broker,
+    enum aws_mqtt_packet_type type,
+    size_t count,
+    uint64_t timeout_ns) {
+
+    struct packets_wait wait = {
+        .broker = broker,
+        .type = type,
+        .count = count,
+    };
+
+    aws_mutex_lock(&broker->lock);
+    const int result = aws_condition_variable_wait_for_pred(
+        &broker->signal, &broker->lock, (int64_t)timeout_ns, s_packets_received, &wait);
+    aws_mutex_unlock(&broker->lock);
+
+    return result;
+}
+
+/* Runs on the session's channel, which cancels it if it shuts down first */
+struct broker_session_task {
+    struct aws_channel_task task;
+    struct aws_allocator *allocator;
+    struct broker_session *session;
+    /* Hang up instead of sending */
+    bool close;
+    struct aws_byte_buf data;
+};
+
+static void s_session_task(struct aws_channel_task *channel_task, void *arg, enum aws_task_status status) {
+
+    struct broker_session_task *task = arg;
+    struct broker_session *session = task->session;
+    (void)channel_task;
+
+    if (status == AWS_TASK_STATUS_RUN_READY) {
+        if (task->close) {
+            aws_channel_shutdown(session->slot->channel, AWS_OP_SUCCESS);
+        } else {
+            /* Replies are all written by the end of every message read, so out is free to use */
+            struct aws_byte_cursor data = aws_byte_cursor_from_buf(&task->data);
+            if (aws_byte_buf_append_dynamic(&session->out, &data) || s_flush_replies(session)) {
+                session->out.len = 0;
+                aws_channel_shutdown(session->slot->channel, aws_last_error());
+            }
+        }
+    }
+
+    aws_byte_buf_clean_up(&task->data);
+    aws_mem_release(task->allocator, task);
+}
+
+static int s_schedule_session_task(struct loopback_broker *broker, bool close, struct aws_byte_cursor data) {
+
+    struct broker_session_task *task = aws_mem_acquire(broker->allocator, sizeof(struct broker_session_task));
+    if (!task) {
+        return AWS_OP_ERR;
+    }
+    AWS_ZERO_STRUCT(*task);
+    task->allocator = broker->allocator;
+    task->close = close;
+    struct aws_byte_buf data_buf = aws_byte_buf_from_array(data.ptr, data.len);
+    if (data.len && aws_byte_buf_init_copy(&task->data, broker->allocator, &data_buf)) {
+        aws_mem_release(broker->allocator, task);
+        return AWS_OP_ERR;
+    }
+    aws_channel_task_init(&task->task, s_session_task, task);
+
+    /* Under the lock, so the session's channel can't be destroyed meanwhile */
+    aws_mutex_lock(&broker->lock);
+    struct broker_session *session = broker->session;
+    if (session) {
+        task->session = session;
+        aws_channel_schedule_task_now(session->slot->channel, &task->task);
+    }
+    aws_mutex_unlock(&broker->lock);
+
+    if (!session) {
+        aws_byte_buf_clean_up(&task->data);
+        aws_mem_release(broker->allocator, task);
+        return aws_raise_error(AWS_ERROR_INVALID_STATE);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int loopback_broker_send(struct loopback_broker *broker, struct aws_byte_cursor data) {
+    return s_schedule_session_task(broker, false, data);
+}
+
+int loopback_broker_close_connection(struct loopback_broker *broker) {
+
+    struct aws_byte_cursor nothing;
+    AWS_ZERO_STRUCT(nothing);
+    return s_schedule_session_task(broker, true, nothing);
+}
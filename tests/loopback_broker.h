@@ -0,0 +1,88 @@
+#ifndef AWS_MQTT_TESTS_LOOPBACK_BROKER_H
+#define AWS_MQTT_TESTS_LOOPBACK_BROKER_H
+
+
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/fixed_header.h>
+
+struct aws_event_loop_group;
+struct loopback_broker;
+
+/* Changes to how the broker answers, all off by default */
+struct loopback_broker_behavior {
+    /* Say in CONNACK that a session was resumed */
+    bool session_present;
+    /* Leave PINGREQ unanswered */
+    bool ignore_pingreq;
+    /* Leave the client's QoS 1 and 2 publishes unacked. PUBREL is still answered. */
+    bool ignore_publishes;
+    /* Keep every packet received, see loopback_broker_get_packet */
+    bool record_packets;
+};
+
+/* A packet received from the client */
+struct loopback_broker_packet {
+    enum aws_mqtt_packet_type type;
+    uint8_t flags;
+    /* 0 if the packet has none */
+    uint16_t packet_id;
+};
+
+/**
+ * Just enough of an MQTT server to drive the client as hard as it can go, listening on 127.0.0.1.
+ *
+ * Every CONNECT is accepted without a session, and every PUBLISH, PUBREL, SUBSCRIBE, UNSUBSCRIBE and PINGREQ is
+ * answered straight away. No state is kept across connections. Once a connection has subscribed to anything, each
+ * PUBLISH it sends is also sent back to it at QoS 0, whatever the topic, so the client's read path and subscription
+ * tree get exercised too. Tests can change that with loopback_broker_set_behavior, and send the client whatever
+ * they like with loopback_broker_send.
+ */
+struct loopback_broker *loopback_broker_new(struct aws_allocator *allocator, struct aws_event_loop_group *el_group);
+
+/* Stop listening and free the broker. Every connection to it must have been closed first. */
+void loopback_broker_destroy(struct loopback_broker *broker);
+
+/* The port the broker is listening on */
+uint16_t loopback_broker_get_port(const struct loopback_broker *broker);
+
+/* Applies from the next message read from the client on. Safe to call from any thread. */
+void loopback_broker_set_behavior(struct loopback_broker *broker, const struct loopback_broker_behavior *behavior);
+
+/* Packets of type recorded so far */
+size_t loopback_broker_get_packet_count(struct loopback_broker *broker, enum aws_mqtt_packet_type type);
+
+/* The index'th packet of type recorded, or AWS_OP_ERR if there haven't been that many */
+int loopback_broker_get_packet(
+    struct loopback_broker *broker,
+    enum aws_mqtt_packet_type type,
+    size_t index,
+    struct loopback_broker_packet *packet);
+
+/* Wait up to timeout_ns for count packets of type to have been recorded. AWS_OP_ERR if they weren't. */
+int loopback_broker_wait_for_packets(
+    struct loopback_broker *broker,
+    enum aws_mqtt_packet_type type,
+    size_t count,
+    uint64_t timeout_ns);
+
+/* Write encoded packets to the connected client. AWS_OP_ERR if no client is connected. */
+int loopback_broker_send(struct loopback_broker *broker, struct aws_byte_cursor data);
+
+/* Hang up on the connected client, which sees the connection drop. AWS_OP_ERR if no client is connected. */
+int loopback_broker_close_connection(struct loopback_broker *broker);
+
+#endif /* AWS_MQTT_TESTS_LOOPBACK_BROKER_H */
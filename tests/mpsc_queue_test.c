@@ -0,0 +1,135 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/mpsc_queue.h>
+
+#include <aws/common/thread.h>
+
+#include <aws/testing/aws_test_harness.h>
+
+struct test_item {
+    struct aws_mqtt_mpsc_queue_node node;
+    size_t producer;
+    size_t sequence;
+};
+
+AWS_TEST_CASE(mqtt_mpsc_queue_fifo, s_mqtt_mpsc_queue_fifo_fn)
+static int s_mqtt_mpsc_queue_fifo_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)allocator;
+    (void)ctx;
+
+    struct aws_mqtt_mpsc_queue queue;
+    aws_mqtt_mpsc_queue_init(&queue);
+
+    ASSERT_TRUE(aws_mqtt_mpsc_queue_is_empty(&queue));
+    ASSERT_NULL(aws_mqtt_mpsc_queue_pop(&queue));
+
+    struct test_item items[3];
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(items); ++i) {
+        items[i].sequence = i;
+        aws_mqtt_mpsc_queue_push(&queue, &items[i].node);
+        ASSERT_FALSE(aws_mqtt_mpsc_queue_is_empty(&queue));
+    }
+
+    ASSERT_PTR_EQUALS(&items[0].node, aws_mqtt_mpsc_queue_pop(&queue));
+
+    /* Interleave pushes and pops, including pushing a node that was just popped */
+    aws_mqtt_mpsc_queue_push(&queue, &items[0].node);
+    ASSERT_PTR_EQUALS(&items[1].node, aws_mqtt_mpsc_queue_pop(&queue));
+    ASSERT_PTR_EQUALS(&items[2].node, aws_mqtt_mpsc_queue_pop(&queue));
+    ASSERT_PTR_EQUALS(&items[0].node, aws_mqtt_mpsc_queue_pop(&queue));
+
+    ASSERT_NULL(aws_mqtt_mpsc_queue_pop(&queue));
+    ASSERT_TRUE(aws_mqtt_mpsc_queue_is_empty(&queue));
+
+    return AWS_OP_SUCCESS;
+}
+
+enum {
+    PRODUCER_COUNT = 8,
+    ITEMS_PER_PRODUCER = 10000,
+};
+
+struct producer_data {
+    struct aws_mqtt_mpsc_queue *queue;
+    struct test_item *items;
+};
+
+static void s_producer_fn(void *arg) {
+
+    struct producer_data *data = arg;
+
+    for (size_t i = 0; i < ITEMS_PER_PRODUCER; ++i) {
+        aws_mqtt_mpsc_queue_push(data->queue, &data->items[i].node);
+    }
+}
+
+AWS_TEST_CASE(mqtt_mpsc_queue_multiple_producers, s_mqtt_mpsc_queue_multiple_producers_fn)
+static int s_mqtt_mpsc_queue_multiple_producers_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct aws_mqtt_mpsc_queue queue;
+    aws_mqtt_mpsc_queue_init(&queue);
+
+    struct test_item *items =
+        aws_mem_acquire(allocator, sizeof(struct test_item) * PRODUCER_COUNT * ITEMS_PER_PRODUCER);
+    ASSERT_NOT_NULL(items);
+
+    struct producer_data data[PRODUCER_COUNT];
+    struct aws_thread threads[PRODUCER_COUNT];
+    size_t next_expected[PRODUCER_COUNT];
+
+    for (size_t p = 0; p < PRODUCER_COUNT; ++p) {
+        data[p].queue = &queue;
+        data[p].items = &items[p * ITEMS_PER_PRODUCER];
+        for (size_t i = 0; i < ITEMS_PER_PRODUCER; ++i) {
+            data[p].items[i].producer = p;
+            data[p].items[i].sequence = i;
+        }
+        next_expected[p] = 0;
+    }
+
+    for (size_t p = 0; p < PRODUCER_COUNT; ++p) {
+        ASSERT_SUCCESS(aws_thread_init(&threads[p], allocator));
+        ASSERT_SUCCESS(aws_thread_launch(&threads[p], s_producer_fn, &data[p], NULL));
+    }
+
+    /* Consume while the producers are running. Each producer's items must come out in the order it pushed them. */
+    size_t popped = 0;
+    while (popped < PRODUCER_COUNT * ITEMS_PER_PRODUCER) {
+        struct aws_mqtt_mpsc_queue_node *node = aws_mqtt_mpsc_queue_pop(&queue);
+        if (!node) {
+            continue;
+        }
+        struct test_item *item = AWS_CONTAINER_OF(node, struct test_item, node);
+        ASSERT_UINT_EQUALS(next_expected[item->producer], item->sequence);
+        ++next_expected[item->producer];
+        ++popped;
+    }
+
+    for (size_t p = 0; p < PRODUCER_COUNT; ++p) {
+        ASSERT_SUCCESS(aws_thread_join(&threads[p]));
+        aws_thread_clean_up(&threads[p]);
+    }
+
+    ASSERT_NULL(aws_mqtt_mpsc_queue_pop(&queue));
+    ASSERT_TRUE(aws_mqtt_mpsc_queue_is_empty(&queue));
+
+    aws_mem_release(allocator, items);
+
+    return AWS_OP_SUCCESS;
+}
@@ -539,6 +539,123 @@ PACKET_TEST_CONNETION(PINGRESP, pingresp)
 PACKET_TEST_CONNETION(DISCONNECT, disconnect)
 #undef PACKET_TEST_CONNETION
 
+/*****************************************************************************/
+/* Packet Size                                                               */
+
+AWS_TEST_CASE(mqtt_fixed_header_packet_size, s_mqtt_fixed_header_packet_size_fn)
+static int s_mqtt_fixed_header_packet_size_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)allocator;
+    (void)ctx;
+
+    size_t packet_size = 0;
+
+    /* PUBLISH with a remaining length of 321 (2 byte encoding), only part of the body present */
+    uint8_t publish[] = {AWS_MQTT_PACKET_PUBLISH << 4, 0xC1, 0x02, 0x00, 0x01};
+    struct aws_byte_cursor cur = aws_byte_cursor_from_array(publish, sizeof(publish));
+    ASSERT_SUCCESS(aws_mqtt_fixed_header_get_packet_size(cur, &packet_size));
+    ASSERT_UINT_EQUALS(3 + 321, packet_size);
+
+    /* Header split before and inside the remaining length */
+    for (size_t len = 0; len < 3; ++len) {
+        cur = aws_byte_cursor_from_array(publish, len);
+        ASSERT_ERROR(AWS_ERROR_SHORT_BUFFER, aws_mqtt_fixed_header_get_packet_size(cur, &packet_size));
+    }
+
+    /* Packet with no body */
+    uint8_t pingresp[] = {AWS_MQTT_PACKET_PINGRESP << 4, 0x00};
+    cur = aws_byte_cursor_from_array(pingresp, sizeof(pingresp));
+    ASSERT_SUCCESS(aws_mqtt_fixed_header_get_packet_size(cur, &packet_size));
+    ASSERT_UINT_EQUALS(2, packet_size);
+
+    /* Continuation bit set on the 4th length byte */
+    uint8_t malformed[] = {AWS_MQTT_PACKET_PUBLISH << 4, 0xFF, 0xFF, 0xFF, 0xFF};
+    cur = aws_byte_cursor_from_array(malformed, sizeof(malformed));
+    ASSERT_ERROR(AWS_ERROR_MQTT_INVALID_REMAINING_LENGTH, aws_mqtt_fixed_header_get_packet_size(cur, &packet_size));
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(mqtt_fixed_header_remaining_length, s_mqtt_fixed_header_remaining_length_fn)
+static int s_mqtt_fixed_header_remaining_length_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)allocator;
+    (void)ctx;
+
+    /* The smallest and largest value of each encoded size [MQTT-2.2.3] */
+    const size_t lengths[] = {0, 127, 128, 16383, 16384, 2097151, 2097152, 268435455};
+    const size_t encoded_sizes[] = {1, 1, 2, 2, 3, 3, 4, 4};
+
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(lengths); ++i) {
+        struct aws_mqtt_fixed_header header = {
+            .packet_type = AWS_MQTT_PACKET_PUBLISH,
+            .remaining_length = lengths[i],
+        };
+
+        /* Extra bytes after the header, so the length is decoded both with and without room to read ahead */
+        uint8_t encoded[5 + 4];
+        memset(encoded, 0xFF, sizeof(encoded));
+        struct aws_byte_buf buf = aws_byte_buf_from_array(encoded, sizeof(encoded));
+        buf.len = 0;
+        ASSERT_SUCCESS(aws_mqtt_fixed_header_encode(&buf, &header));
+        ASSERT_UINT_EQUALS(1 + encoded_sizes[i], buf.len);
+
+        for (size_t extra = 0; extra <= 4; ++extra) {
+            size_t packet_size = 0;
+            struct aws_byte_cursor cur = aws_byte_cursor_from_array(encoded, buf.len + extra);
+            ASSERT_SUCCESS(aws_mqtt_fixed_header_get_packet_size(cur, &packet_size));
+            ASSERT_UINT_EQUALS(1 + encoded_sizes[i] + lengths[i], packet_size);
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(mqtt_packet_decode_malformed, s_mqtt_packet_decode_malformed_fn)
+static int s_mqtt_packet_decode_malformed_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    /* Reserved packet type */
+    struct aws_mqtt_fixed_header header;
+    uint8_t reserved_type[] = {0xF0, 0x00};
+    struct aws_byte_cursor cur = aws_byte_cursor_from_array(reserved_type, sizeof(reserved_type));
+    ASSERT_ERROR(AWS_ERROR_MQTT_INVALID_PACKET_TYPE, aws_mqtt_fixed_header_decode(&cur, &header));
+
+    /* Topic length runs past the end of the packet */
+    struct aws_mqtt_packet_publish publish;
+    uint8_t publish_topic[] = {AWS_MQTT_PACKET_PUBLISH << 4, 0x04, 0x00, 0x08, 'a', '/'};
+    cur = aws_byte_cursor_from_array(publish_topic, sizeof(publish_topic));
+    ASSERT_ERROR(AWS_ERROR_SHORT_BUFFER, aws_mqtt_packet_publish_decode(&cur, &publish));
+
+    /* Topic and packet id are longer than the remaining length, with the next packet following */
+    uint8_t publish_length[] = {(AWS_MQTT_PACKET_PUBLISH << 4) | 0x2, 0x03, 0x00, 0x01, 'a', 0x00, 0x01, 0xC0, 0x00};
+    cur = aws_byte_cursor_from_array(publish_length, sizeof(publish_length));
+    ASSERT_ERROR(AWS_ERROR_MQTT_INVALID_REMAINING_LENGTH, aws_mqtt_packet_publish_decode(&cur, &publish));
+
+    /* Remaining length too short for the packet id */
+    struct aws_mqtt_packet_subscribe subscribe;
+    ASSERT_SUCCESS(aws_mqtt_packet_subscribe_init(&subscribe, allocator, 0));
+    uint8_t subscribe_id[] = {(AWS_MQTT_PACKET_SUBSCRIBE << 4) | 0x2, 0x01, 0x00, 0xC0, 0x00};
+    cur = aws_byte_cursor_from_array(subscribe_id, sizeof(subscribe_id));
+    ASSERT_ERROR(AWS_ERROR_MQTT_INVALID_REMAINING_LENGTH, aws_mqtt_packet_subscribe_decode(&cur, &subscribe));
+
+    /* Last filter runs past the end of the packet, into the PINGREQ after it */
+    uint8_t subscribe_filter[] = {
+        (AWS_MQTT_PACKET_SUBSCRIBE << 4) | 0x2, 0x05, 0x00, 0x01, 0x00, 0x02, 'a', 'b', 0x00, 0xC0, 0x00};
+    cur = aws_byte_cursor_from_array(subscribe_filter, sizeof(subscribe_filter));
+    ASSERT_ERROR(AWS_ERROR_MQTT_INVALID_REMAINING_LENGTH, aws_mqtt_packet_subscribe_decode(&cur, &subscribe));
+    aws_mqtt_packet_subscribe_clean_up(&subscribe);
+
+    /* Empty protocol name */
+    struct aws_mqtt_packet_connect connect;
+    uint8_t connect_name[] = {AWS_MQTT_PACKET_CONNECT << 4, 0x02, 0x00, 0x00};
+    cur = aws_byte_cursor_from_array(connect_name, sizeof(connect_name));
+    ASSERT_ERROR(AWS_ERROR_MQTT_UNSUPPORTED_PROTOCOL_NAME, aws_mqtt_packet_connect_decode(&cur, &connect));
+
+    return AWS_OP_SUCCESS;
+}
+
 #ifdef _MSC_VER
 #    pragma warning(pop)
 #endif
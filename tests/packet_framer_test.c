@@ -0,0 +1,139 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/packet_framer.h>
+
+#include <aws/mqtt/private/packets.h>
+
+#include <aws/testing/aws_test_harness.h>
+
+struct framed_packets {
+    struct aws_byte_cursor packets[8];
+    size_t count;
+    /* Copies, since split packets are only valid during the callback */
+    uint8_t storage[8][160];
+};
+
+static int s_on_packet(struct aws_byte_cursor packet, void *userdata) {
+
+    struct framed_packets *framed = userdata;
+    if (framed->count == AWS_ARRAY_SIZE(framed->packets) || packet.len > sizeof(framed->storage[0])) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    memcpy(framed->storage[framed->count], packet.ptr, packet.len);
+    framed->packets[framed->count] = aws_byte_cursor_from_array(framed->storage[framed->count], packet.len);
+    ++framed->count;
+
+    return AWS_OP_SUCCESS;
+}
+
+/* PUBLISH, PINGRESP, PUBLISH with a 2 byte remaining length */
+static uint8_t s_stream[3 + 2 + 3 + 130];
+static const size_t s_packet_sizes[] = {3, 2, 3 + 130};
+
+static void s_stream_init(void) {
+
+    memset(s_stream, 'x', sizeof(s_stream));
+    uint8_t *pos = s_stream;
+    *pos++ = AWS_MQTT_PACKET_PUBLISH << 4;
+    *pos++ = 0x01;
+    *pos++ = 'a';
+    *pos++ = AWS_MQTT_PACKET_PINGRESP << 4;
+    *pos++ = 0x00;
+    *pos++ = AWS_MQTT_PACKET_PUBLISH << 4;
+    *pos++ = 0x82;
+    *pos++ = 0x01;
+}
+
+AWS_TEST_CASE(mqtt_packet_framer_split, s_mqtt_packet_framer_split_fn)
+static int s_mqtt_packet_framer_split_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    s_stream_init();
+
+    struct aws_mqtt_packet_framer framer;
+    aws_mqtt_packet_framer_init(&framer, allocator);
+
+    /* Every piece size, down to a byte at a time, so every packet and header gets split somewhere */
+    for (size_t piece_size = sizeof(s_stream); piece_size > 0; --piece_size) {
+
+        struct framed_packets framed;
+        AWS_ZERO_STRUCT(framed);
+
+        struct aws_byte_cursor stream = aws_byte_cursor_from_array(s_stream, sizeof(s_stream));
+        while (stream.len) {
+            const size_t len = piece_size < stream.len ? piece_size : stream.len;
+            ASSERT_SUCCESS(
+                aws_mqtt_packet_framer_process(&framer, aws_byte_cursor_advance(&stream, len), s_on_packet, &framed));
+        }
+        ASSERT_UINT_EQUALS(0, framer.pending.len);
+
+        ASSERT_UINT_EQUALS(AWS_ARRAY_SIZE(s_packet_sizes), framed.count);
+        const uint8_t *expected = s_stream;
+        for (size_t i = 0; i < framed.count; ++i) {
+            ASSERT_BIN_ARRAYS_EQUALS(expected, s_packet_sizes[i], framed.packets[i].ptr, framed.packets[i].len);
+            expected += s_packet_sizes[i];
+        }
+    }
+
+    /* A partial packet is dropped by reset */
+    struct framed_packets framed;
+    AWS_ZERO_STRUCT(framed);
+    ASSERT_SUCCESS(
+        aws_mqtt_packet_framer_process(&framer, aws_byte_cursor_from_array(s_stream, 4), s_on_packet, &framed));
+    ASSERT_UINT_EQUALS(1, framed.count);
+    ASSERT_UINT_EQUALS(1, framer.pending.len);
+    aws_mqtt_packet_framer_reset(&framer);
+    ASSERT_UINT_EQUALS(0, framer.pending.len);
+
+    aws_mqtt_packet_framer_clean_up(&framer);
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(mqtt_packet_framer_malformed, s_mqtt_packet_framer_malformed_fn)
+static int s_mqtt_packet_framer_malformed_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct aws_mqtt_packet_framer framer;
+    aws_mqtt_packet_framer_init(&framer, allocator);
+    struct framed_packets framed;
+    AWS_ZERO_STRUCT(framed);
+
+    /* Remaining length with a 5th byte, split inside the length */
+    uint8_t malformed[] = {AWS_MQTT_PACKET_PUBLISH << 4, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+    ASSERT_SUCCESS(
+        aws_mqtt_packet_framer_process(&framer, aws_byte_cursor_from_array(malformed, 3), s_on_packet, &framed));
+    ASSERT_ERROR(
+        AWS_ERROR_MQTT_INVALID_REMAINING_LENGTH,
+        aws_mqtt_packet_framer_process(
+            &framer, aws_byte_cursor_from_array(malformed + 3, sizeof(malformed) - 3), s_on_packet, &framed));
+    aws_mqtt_packet_framer_reset(&framer);
+
+    /* Reserved packet type after a good packet */
+    uint8_t reserved[] = {AWS_MQTT_PACKET_PINGRESP << 4, 0x00, 0x00, 0x00};
+    ASSERT_ERROR(
+        AWS_ERROR_MQTT_INVALID_PACKET_TYPE,
+        aws_mqtt_packet_framer_process(
+            &framer, aws_byte_cursor_from_array(reserved, sizeof(reserved)), s_on_packet, &framed));
+    ASSERT_UINT_EQUALS(1, framed.count);
+
+    aws_mqtt_packet_framer_clean_up(&framer);
+
+    return AWS_OP_SUCCESS;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/packet_id_allocator.h>
+
+#include <aws/common/thread.h>
+
+#include <aws/testing/aws_test_harness.h>
+
+AWS_TEST_CASE(mqtt_packet_id_allocator_no_immediate_reuse, s_mqtt_packet_id_allocator_no_immediate_reuse_fn)
+static int s_mqtt_packet_id_allocator_no_immediate_reuse_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)allocator;
+    (void)ctx;
+
+    struct aws_mqtt_packet_id_allocator ids;
+    aws_mqtt_packet_id_allocator_init(&ids);
+
+    ASSERT_UINT_EQUALS(1, aws_mqtt_packet_id_allocator_acquire(&ids));
+    ASSERT_UINT_EQUALS(2, aws_mqtt_packet_id_allocator_acquire(&ids));
+    ASSERT_UINT_EQUALS(3, aws_mqtt_packet_id_allocator_acquire(&ids));
+
+    /* A released id must not be handed straight back out */
+    aws_mqtt_packet_id_allocator_release(&ids, 2);
+    ASSERT_FALSE(aws_mqtt_packet_id_allocator_is_in_use(&ids, 2));
+    ASSERT_UINT_EQUALS(4, aws_mqtt_packet_id_allocator_acquire(&ids));
+
+    /* Crossing a word boundary */
+    for (uint16_t expected = 5; expected < 200; ++expected) {
+        ASSERT_UINT_EQUALS(expected, aws_mqtt_packet_id_allocator_acquire(&ids));
+    }
+    ASSERT_UINT_EQUALS(198, aws_mqtt_packet_id_allocator_get_in_use_count(&ids));
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(mqtt_packet_id_allocator_wrap_around, s_mqtt_packet_id_allocator_wrap_around_fn)
+static int s_mqtt_packet_id_allocator_wrap_around_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)allocator;
+    (void)ctx;
+
+    struct aws_mqtt_packet_id_allocator ids;
+    aws_mqtt_packet_id_allocator_init(&ids);
+
+    /* Use every id */
+    for (uint32_t expected = 1; expected <= UINT16_MAX; ++expected) {
+        ASSERT_UINT_EQUALS(expected, aws_mqtt_packet_id_allocator_acquire(&ids));
+    }
+
+    /* Exhausted */
+    ASSERT_UINT_EQUALS(0, aws_mqtt_packet_id_allocator_acquire(&ids));
+    ASSERT_INT_EQUALS(AWS_ERROR_MQTT_NO_PACKET_ID_AVAILABLE, aws_last_error());
+
+    /* Freed ids are found after wrapping past 0, in order */
+    aws_mqtt_packet_id_allocator_release(&ids, 4000);
+    aws_mqtt_packet_id_allocator_release(&ids, 70);
+    ASSERT_UINT_EQUALS(70, aws_mqtt_packet_id_allocator_acquire(&ids));
+    ASSERT_UINT_EQUALS(4000, aws_mqtt_packet_id_allocator_acquire(&ids));
+
+    /* The top id is usable and 0 is always skipped */
+    aws_mqtt_packet_id_allocator_release(&ids, UINT16_MAX);
+    aws_mqtt_packet_id_allocator_release(&ids, 1);
+    aws_atomic_store_int(&ids.next_id, UINT16_MAX);
+    ASSERT_UINT_EQUALS(UINT16_MAX, aws_mqtt_packet_id_allocator_acquire(&ids));
+    ASSERT_UINT_EQUALS(1, aws_mqtt_packet_id_allocator_acquire(&ids));
+
+    return AWS_OP_SUCCESS;
+}
+
+enum {
+    CONTENTION_THREAD_COUNT = 8,
+    CONTENTION_IDS_PER_THREAD = 4000,
+};
+
+struct contention_thread_data {
+    struct aws_mqtt_packet_id_allocator *ids;
+    uint16_t acquired[CONTENTION_IDS_PER_THREAD];
+};
+
+static void s_contention_thread_fn(void *arg) {
+
+    struct contention_thread_data *data = arg;
+
+    for (size_t i = 0; i < CONTENTION_IDS_PER_THREAD; ++i) {
+        data->acquired[i] = aws_mqtt_packet_id_allocator_acquire(data->ids);
+    }
+    /* Give half back so releases race with the other threads' acquires */
+    for (size_t i = 0; i < CONTENTION_IDS_PER_THREAD; i += 2) {
+        aws_mqtt_packet_id_allocator_release(data->ids, data->acquired[i]);
+        data->acquired[i] = 0;
+    }
+}
+
+AWS_TEST_CASE(mqtt_packet_id_allocator_contention, s_mqtt_packet_id_allocator_contention_fn)
+static int s_mqtt_packet_id_allocator_contention_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct aws_mqtt_packet_id_allocator ids;
+    aws_mqtt_packet_id_allocator_init(&ids);
+
+    static struct contention_thread_data s_data[CONTENTION_THREAD_COUNT];
+    struct aws_thread threads[CONTENTION_THREAD_COUNT];
+
+    for (size_t i = 0; i < CONTENTION_THREAD_COUNT; ++i) {
+        s_data[i].ids = &ids;
+        ASSERT_SUCCESS(aws_thread_init(&threads[i], allocator));
+        ASSERT_SUCCESS(aws_thread_launch(&threads[i], s_contention_thread_fn, &s_data[i], NULL));
+    }
+    for (size_t i = 0; i < CONTENTION_THREAD_COUNT; ++i) {
+        ASSERT_SUCCESS(aws_thread_join(&threads[i]));
+        aws_thread_clean_up(&threads[i]);
+    }
+
+    /* Every id still held must have been handed to exactly one thread */
+    static uint8_t s_owners[UINT16_MAX + 1];
+    size_t held = 0;
+    for (size_t i = 0; i < CONTENTION_THREAD_COUNT; ++i) {
+        for (size_t j = 1; j < CONTENTION_IDS_PER_THREAD; j += 2) {
+            const uint16_t id = s_data[i].acquired[j];
+            ASSERT_TRUE(id != 0);
+            ASSERT_UINT_EQUALS(0, s_owners[id]);
+            ASSERT_TRUE(aws_mqtt_packet_id_allocator_is_in_use(&ids, id));
+            s_owners[id] = 1;
+            ++held;
+        }
+    }
+    ASSERT_UINT_EQUALS(held, aws_mqtt_packet_id_allocator_get_in_use_count(&ids));
+
+    return AWS_OP_SUCCESS;
+}
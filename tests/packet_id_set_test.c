@@ -0,0 +1,59 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/packet_id_set.h>
+
+#include <aws/testing/aws_test_harness.h>
+
+AWS_TEST_CASE(mqtt_packet_id_set_operations, s_mqtt_packet_id_set_operations_fn)
+static int s_mqtt_packet_id_set_operations_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)allocator;
+    (void)ctx;
+
+    static struct aws_mqtt_packet_id_set s_set;
+    aws_mqtt_packet_id_set_init(&s_set);
+    ASSERT_UINT_EQUALS(0, aws_mqtt_packet_id_set_get_count(&s_set));
+
+    /* Adding twice only counts once, like a retransmitted PUBLISH */
+    ASSERT_TRUE(aws_mqtt_packet_id_set_add(&s_set, 1));
+    ASSERT_FALSE(aws_mqtt_packet_id_set_add(&s_set, 1));
+    ASSERT_TRUE(aws_mqtt_packet_id_set_add(&s_set, 64));
+    ASSERT_TRUE(aws_mqtt_packet_id_set_add(&s_set, UINT16_MAX));
+    ASSERT_UINT_EQUALS(3, aws_mqtt_packet_id_set_get_count(&s_set));
+
+    ASSERT_TRUE(aws_mqtt_packet_id_set_contains(&s_set, 1));
+    ASSERT_TRUE(aws_mqtt_packet_id_set_contains(&s_set, 64));
+    ASSERT_TRUE(aws_mqtt_packet_id_set_contains(&s_set, UINT16_MAX));
+    ASSERT_FALSE(aws_mqtt_packet_id_set_contains(&s_set, 63));
+    ASSERT_FALSE(aws_mqtt_packet_id_set_contains(&s_set, 65));
+
+    /* Removing leaves the neighbouring bits alone */
+    ASSERT_TRUE(aws_mqtt_packet_id_set_remove(&s_set, 64));
+    ASSERT_FALSE(aws_mqtt_packet_id_set_remove(&s_set, 64));
+    ASSERT_FALSE(aws_mqtt_packet_id_set_contains(&s_set, 64));
+    ASSERT_TRUE(aws_mqtt_packet_id_set_contains(&s_set, 1));
+    ASSERT_UINT_EQUALS(2, aws_mqtt_packet_id_set_get_count(&s_set));
+
+    /* A removed id can be added again */
+    ASSERT_TRUE(aws_mqtt_packet_id_set_add(&s_set, 64));
+
+    aws_mqtt_packet_id_set_clear(&s_set);
+    ASSERT_UINT_EQUALS(0, aws_mqtt_packet_id_set_get_count(&s_set));
+    ASSERT_FALSE(aws_mqtt_packet_id_set_contains(&s_set, 1));
+    ASSERT_FALSE(aws_mqtt_packet_id_set_contains(&s_set, UINT16_MAX));
+
+    return AWS_OP_SUCCESS;
+}
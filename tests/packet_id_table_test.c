@@ -0,0 +1,72 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/packet_id_table.h>
+
+#include <aws/testing/aws_test_harness.h>
+
+static size_t s_destroyed_count = 0;
+static void s_on_value_destroy(void *value) {
+    (void)value;
+    ++s_destroyed_count;
+}
+
+AWS_TEST_CASE(mqtt_packet_id_table_operations, s_mqtt_packet_id_table_operations_fn)
+static int s_mqtt_packet_id_table_operations_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    int values[4];
+
+    struct aws_mqtt_packet_id_table table;
+    aws_mqtt_packet_id_table_init(&table, allocator, &s_on_value_destroy);
+
+    ASSERT_NULL(aws_mqtt_packet_id_table_find(&table, 1));
+    ASSERT_NULL(aws_mqtt_packet_id_table_remove(&table, 1));
+
+    ASSERT_SUCCESS(aws_mqtt_packet_id_table_put(&table, 1, &values[0]));
+    ASSERT_SUCCESS(aws_mqtt_packet_id_table_put(&table, 2, &values[1]));
+    ASSERT_SUCCESS(aws_mqtt_packet_id_table_put(&table, 300, &values[2]));
+    ASSERT_SUCCESS(aws_mqtt_packet_id_table_put(&table, UINT16_MAX, &values[3]));
+    ASSERT_UINT_EQUALS(4, aws_mqtt_packet_id_table_get_entry_count(&table));
+
+    ASSERT_PTR_EQUALS(&values[0], aws_mqtt_packet_id_table_find(&table, 1));
+    ASSERT_PTR_EQUALS(&values[2], aws_mqtt_packet_id_table_find(&table, 300));
+    ASSERT_PTR_EQUALS(&values[3], aws_mqtt_packet_id_table_find(&table, UINT16_MAX));
+    ASSERT_NULL(aws_mqtt_packet_id_table_find(&table, 3));
+
+    /* Replacing doesn't change the count */
+    ASSERT_SUCCESS(aws_mqtt_packet_id_table_put(&table, 2, &values[0]));
+    ASSERT_UINT_EQUALS(4, aws_mqtt_packet_id_table_get_entry_count(&table));
+
+    /* Removing the last entry on a page frees it */
+    ASSERT_PTR_EQUALS(&values[2], aws_mqtt_packet_id_table_remove(&table, 300));
+    ASSERT_NULL(table.pages[300 / AWS_MQTT_PACKET_ID_TABLE_PAGE_SIZE]);
+    ASSERT_NULL(aws_mqtt_packet_id_table_find(&table, 300));
+    ASSERT_UINT_EQUALS(3, aws_mqtt_packet_id_table_get_entry_count(&table));
+    ASSERT_UINT_EQUALS(0, s_destroyed_count);
+
+    aws_mqtt_packet_id_table_clear(&table);
+    ASSERT_UINT_EQUALS(3, s_destroyed_count);
+    ASSERT_UINT_EQUALS(0, aws_mqtt_packet_id_table_get_entry_count(&table));
+    ASSERT_NULL(aws_mqtt_packet_id_table_find(&table, 1));
+
+    /* Still usable after a clear */
+    ASSERT_SUCCESS(aws_mqtt_packet_id_table_put(&table, 7, &values[1]));
+    aws_mqtt_packet_id_table_clean_up(&table);
+    ASSERT_UINT_EQUALS(4, s_destroyed_count);
+
+    return AWS_OP_SUCCESS;
+}
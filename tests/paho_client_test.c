@@ -192,34 +192,19 @@ static void s_mqtt_on_disconnect(struct aws_mqtt_client_connection *connection,
     aws_mutex_unlock(args->mutex);
 }
 
-int main(int argc, char **argv) {
-    (void)argc;
-    (void)argv;
-
-    AWS_TEST_ALLOCATOR_INIT(paho_client);
-
-    struct aws_mutex mutex = AWS_MUTEX_INIT;
-    struct aws_condition_variable condition_variable = AWS_CONDITION_VARIABLE_INIT;
-
-    /* Populate the payload */
-    struct aws_byte_buf payload_buf = aws_byte_buf_from_empty_array(s_payload, PAYLOAD_LEN);
-    aws_device_random_buffer(&payload_buf);
+/* Runs the whole exchange once. If tuned, with write batching, the publish match cache and the in-flight window on. */
+static int s_run_client(struct connection_args *args, bool tuned) {
 
     struct aws_byte_cursor subscribe_topic_cur = aws_byte_cursor_from_string(s_subscribe_topic);
-
-    struct connection_args args;
-    AWS_ZERO_STRUCT(args);
-    args.allocator = &paho_client_allocator;
-    args.mutex = &mutex;
-    args.condition_variable = &condition_variable;
+    args->retained_packet_recieved = false;
 
     struct aws_event_loop_group el_group;
-    ASSERT_SUCCESS(aws_event_loop_group_default_init(&el_group, args.allocator, 1));
+    ASSERT_SUCCESS(aws_event_loop_group_default_init(&el_group, args->allocator, 1));
 
     struct aws_host_resolver resolver;
-    ASSERT_SUCCESS(aws_host_resolver_init_default(&resolver, args.allocator, 8, &el_group));
+    ASSERT_SUCCESS(aws_host_resolver_init_default(&resolver, args->allocator, 8, &el_group));
 
-    struct aws_client_bootstrap *bootstrap = aws_client_bootstrap_new(args.allocator, &el_group, &resolver, NULL);
+    struct aws_client_bootstrap *bootstrap = aws_client_bootstrap_new(args->allocator, &el_group, &resolver, NULL);
 
     struct aws_socket_options options;
     AWS_ZERO_STRUCT(options);
@@ -228,14 +213,14 @@ int main(int argc, char **argv) {
     options.domain = AWS_SOCKET_IPV4;
 
     struct aws_mqtt_client client;
-    ASSERT_SUCCESS(aws_mqtt_client_init(&client, args.allocator, bootstrap));
+    ASSERT_SUCCESS(aws_mqtt_client_init(&client, args->allocator, bootstrap));
 
     struct aws_byte_cursor host_name_cur = aws_byte_cursor_from_string(s_hostname);
-    args.connection = aws_mqtt_client_connection_new(&client);
-    ASSERT_NOT_NULL(args.connection);
+    args->connection = aws_mqtt_client_connection_new(&client);
+    ASSERT_NOT_NULL(args->connection);
 
     aws_mqtt_client_connection_set_connection_interruption_handlers(
-        args.connection, s_mqtt_on_interrupted, NULL, s_mqtt_on_resumed, NULL);
+        args->connection, s_mqtt_on_interrupted, NULL, s_mqtt_on_resumed, NULL);
 
     struct aws_mqtt_connection_options conn_options = {
         .host_name = host_name_cur,
@@ -246,51 +231,58 @@ int main(int argc, char **argv) {
         .keep_alive_time_secs = 0,
         .ping_timeout_ms = 0,
         .on_connection_complete = s_mqtt_on_connection_complete,
-        .user_data = &args,
+        .user_data = args,
         .clean_session = true,
     };
 
-    ASSERT_SUCCESS(aws_mqtt_client_connection_connect(args.connection, &conn_options));
+    if (tuned) {
+        conn_options.write_batch_max_bytes = 4096;
+        conn_options.write_batch_max_delay_ms = 1;
+        conn_options.publish_match_cache_size = 16;
+        conn_options.max_in_flight_publishes = 8;
+    }
+
+    ASSERT_SUCCESS(aws_mqtt_client_connection_connect(args->connection, &conn_options));
 
     /* Wait for connack */
-    aws_mutex_lock(&mutex);
-    ASSERT_SUCCESS(aws_condition_variable_wait(&condition_variable, &mutex));
-    aws_mutex_unlock(&mutex);
+    aws_mutex_lock(args->mutex);
+    ASSERT_SUCCESS(aws_condition_variable_wait(args->condition_variable, args->mutex));
+    aws_mutex_unlock(args->mutex);
 
     printf("1 done\n");
 
     struct aws_byte_cursor payload_cur = aws_byte_cursor_from_array(s_payload, PAYLOAD_LEN);
     aws_mqtt_client_connection_publish(
-        args.connection, &subscribe_topic_cur, AWS_MQTT_QOS_EXACTLY_ONCE, true, &payload_cur, &s_mqtt_on_puback, &args);
+        args->connection, &subscribe_topic_cur, AWS_MQTT_QOS_EXACTLY_ONCE, true, &payload_cur, &s_mqtt_on_puback, args);
 
     /* Wait for puback */
-    aws_mutex_lock(&mutex);
-    ASSERT_SUCCESS(aws_condition_variable_wait(&condition_variable, &mutex));
-    aws_mutex_unlock(&mutex);
+    aws_mutex_lock(args->mutex);
+    ASSERT_SUCCESS(aws_condition_variable_wait(args->condition_variable, args->mutex));
+    aws_mutex_unlock(args->mutex);
 
     printf("2 done\n");
 
-    aws_mqtt_client_connection_disconnect(args.connection, s_mqtt_on_disconnect, &args);
+    aws_mqtt_client_connection_disconnect(args->connection, s_mqtt_on_disconnect, args);
 
     /* Wait for disconnack */
-    aws_mutex_lock(&mutex);
-    ASSERT_SUCCESS(aws_condition_variable_wait(&condition_variable, &mutex));
-    aws_mutex_unlock(&mutex);
+    aws_mutex_lock(args->mutex);
+    ASSERT_SUCCESS(aws_condition_variable_wait(args->condition_variable, args->mutex));
+    aws_mutex_unlock(args->mutex);
 
     printf("3 done\n");
 
-    ASSERT_SUCCESS(aws_mqtt_client_connection_reconnect(args.connection, s_mqtt_on_connection_complete, &args));
+    ASSERT_SUCCESS(aws_mqtt_client_connection_reconnect(args->connection, s_mqtt_on_connection_complete, args));
 
     /* Wait for connack */
-    aws_mutex_lock(&mutex);
-    ASSERT_SUCCESS(aws_condition_variable_wait(&condition_variable, &mutex));
-    aws_mutex_unlock(&mutex);
+    aws_mutex_lock(args->mutex);
+    ASSERT_SUCCESS(aws_condition_variable_wait(args->condition_variable, args->mutex));
+    aws_mutex_unlock(args->mutex);
 
     printf("1 done\n");
 
     /* Subscribe (no on_suback, the on_message received will trigger the cv) */
     aws_mqtt_client_connection_subscribe(
-        args.connection,
+        args->connection,
         &subscribe_topic_cur,
         AWS_MQTT_QOS_EXACTLY_ONCE,
         &s_on_packet_recieved,
@@ -300,46 +292,72 @@ int main(int argc, char **argv) {
         NULL);
 
     /* Wait for PUBLISH */
-    aws_mutex_lock(&mutex);
-    ASSERT_SUCCESS(aws_condition_variable_wait(&condition_variable, &mutex));
-    aws_mutex_unlock(&mutex);
+    aws_mutex_lock(args->mutex);
+    ASSERT_SUCCESS(aws_condition_variable_wait(args->condition_variable, args->mutex));
+    aws_mutex_unlock(args->mutex);
 
     printf("2 done\n");
 
-    ASSERT_TRUE(args.retained_packet_recieved);
+    ASSERT_TRUE(args->retained_packet_recieved);
 
     struct aws_byte_cursor topic_filter =
         aws_byte_cursor_from_array(aws_string_bytes(s_subscribe_topic), s_subscribe_topic->len);
-    aws_mqtt_client_connection_unsubscribe(args.connection, &topic_filter, &s_mqtt_on_unsuback, &args);
+    aws_mqtt_client_connection_unsubscribe(args->connection, &topic_filter, &s_mqtt_on_unsuback, args);
 
     /* Wait for UNSUBACK */
-    aws_mutex_lock(&mutex);
-    ASSERT_SUCCESS(aws_condition_variable_wait(&condition_variable, &mutex));
-    aws_mutex_unlock(&mutex);
+    aws_mutex_lock(args->mutex);
+    ASSERT_SUCCESS(aws_condition_variable_wait(args->condition_variable, args->mutex));
+    aws_mutex_unlock(args->mutex);
 
     printf("3 done\n");
 
     sleep(4);
 
-    size_t outstanding_reqs = aws_hash_table_get_entry_count(&args.connection->outstanding_requests.table);
+    size_t outstanding_reqs = aws_mqtt_packet_id_table_get_entry_count(&args->connection->outstanding_requests);
     ASSERT_UINT_EQUALS(0, outstanding_reqs);
 
-    size_t outstanding_subs = aws_hash_table_get_entry_count(&args.connection->subscriptions.root->subtopics);
+    size_t outstanding_subs = aws_mqtt_topic_node_get_child_count(args->connection->subscriptions.root);
     ASSERT_UINT_EQUALS(0, outstanding_subs);
 
-    aws_mqtt_client_connection_disconnect(args.connection, s_mqtt_on_disconnect, &args);
+    aws_mqtt_client_connection_disconnect(args->connection, s_mqtt_on_disconnect, args);
 
-    aws_mutex_lock(&mutex);
-    ASSERT_SUCCESS(aws_condition_variable_wait(&condition_variable, &mutex));
-    aws_mutex_unlock(&mutex);
+    aws_mutex_lock(args->mutex);
+    ASSERT_SUCCESS(aws_condition_variable_wait(args->condition_variable, args->mutex));
+    aws_mutex_unlock(args->mutex);
 
-    aws_mqtt_client_connection_destroy(args.connection);
-    args.connection = NULL;
+    aws_mqtt_client_connection_destroy(args->connection);
+    args->connection = NULL;
 
     aws_client_bootstrap_release(bootstrap);
     aws_host_resolver_clean_up(&resolver);
     aws_event_loop_group_clean_up(&el_group);
 
+    return AWS_OP_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    AWS_TEST_ALLOCATOR_INIT(paho_client);
+
+    struct aws_mutex mutex = AWS_MUTEX_INIT;
+    struct aws_condition_variable condition_variable = AWS_CONDITION_VARIABLE_INIT;
+
+    /* Populate the payload */
+    struct aws_byte_buf payload_buf = aws_byte_buf_from_empty_array(s_payload, PAYLOAD_LEN);
+    aws_device_random_buffer(&payload_buf);
+
+    struct connection_args args;
+    AWS_ZERO_STRUCT(args);
+    args.allocator = &paho_client_allocator;
+    args.mutex = &mutex;
+    args.condition_variable = &condition_variable;
+
+    /* Once with the default options, then again with the optional ones on */
+    ASSERT_SUCCESS(s_run_client(&args, false));
+    ASSERT_SUCCESS(s_run_client(&args, true));
+
     ASSERT_UINT_EQUALS(paho_client_alloc_impl.freed, paho_client_alloc_impl.allocated);
 
     return AWS_OP_SUCCESS;
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/publish_template.h>
+
+#include <aws/mqtt/private/packets.h>
+
+#include <aws/testing/aws_test_harness.h>
+
+static const char *s_topic = "a/b/c";
+
+/* Headers encoded from a template must be byte for byte what the regular encoder writes */
+static int s_check_matches_packet(
+    struct aws_allocator *allocator,
+    enum aws_mqtt_qos qos,
+    bool retain,
+    bool dup,
+    uint16_t packet_id,
+    size_t payload_size) {
+
+    struct aws_byte_cursor topic = aws_byte_cursor_from_c_str(s_topic);
+
+    struct aws_mqtt_publish_template *tmpl = aws_mqtt_publish_template_new(allocator, &topic, qos, retain);
+    ASSERT_NOT_NULL(tmpl);
+    ASSERT_TRUE(aws_byte_cursor_eq(&topic, &tmpl->topic));
+
+    struct aws_mqtt_packet_publish publish;
+    ASSERT_SUCCESS(aws_mqtt_packet_publish_init(
+        &publish, retain, qos, dup, topic, packet_id, aws_byte_cursor_from_array(NULL, 0)));
+    publish.fixed_header.remaining_length += payload_size;
+
+    struct aws_mqtt_fixed_header header;
+    aws_mqtt_publish_template_init_header(tmpl, dup, payload_size, &header);
+    ASSERT_INT_EQUALS(publish.fixed_header.packet_type, header.packet_type);
+    ASSERT_UINT_EQUALS(publish.fixed_header.flags, header.flags);
+    ASSERT_UINT_EQUALS(publish.fixed_header.remaining_length, header.remaining_length);
+
+    struct aws_byte_buf expected;
+    struct aws_byte_buf actual;
+    ASSERT_SUCCESS(aws_byte_buf_init(&expected, allocator, 64));
+    ASSERT_SUCCESS(aws_byte_buf_init(&actual, allocator, 64));
+
+    ASSERT_SUCCESS(aws_mqtt_packet_publish_encode_headers(&expected, &publish));
+    ASSERT_SUCCESS(aws_mqtt_publish_template_encode_headers(&actual, tmpl, &header, packet_id));
+    ASSERT_BIN_ARRAYS_EQUALS(expected.buffer, expected.len, actual.buffer, actual.len);
+
+    aws_byte_buf_clean_up(&expected);
+    aws_byte_buf_clean_up(&actual);
+    aws_mqtt_publish_template_destroy(tmpl);
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(mqtt_publish_template_encode, s_mqtt_publish_template_encode_fn)
+static int s_mqtt_publish_template_encode_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    ASSERT_SUCCESS(s_check_matches_packet(allocator, AWS_MQTT_QOS_AT_MOST_ONCE, false, false, 0, 10));
+    ASSERT_SUCCESS(s_check_matches_packet(allocator, AWS_MQTT_QOS_AT_LEAST_ONCE, true, false, 7, 0));
+    ASSERT_SUCCESS(s_check_matches_packet(allocator, AWS_MQTT_QOS_EXACTLY_ONCE, false, true, 0x1234, 200));
+
+    /* Big enough for a multi byte remaining length */
+    ASSERT_SUCCESS(s_check_matches_packet(allocator, AWS_MQTT_QOS_AT_LEAST_ONCE, false, false, 9, 3000000));
+
+    /* Topics are validated up front */
+    struct aws_byte_cursor wildcard = aws_byte_cursor_from_c_str("a/+/c");
+    ASSERT_NULL(aws_mqtt_publish_template_new(allocator, &wildcard, AWS_MQTT_QOS_AT_MOST_ONCE, false));
+    ASSERT_INT_EQUALS(AWS_ERROR_MQTT_INVALID_TOPIC, aws_last_error());
+
+    return AWS_OP_SUCCESS;
+}
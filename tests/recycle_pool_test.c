@@ -0,0 +1,133 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/recycle_pool.h>
+
+#include <aws/common/thread.h>
+
+#include <aws/testing/aws_test_harness.h>
+
+AWS_TEST_CASE(mqtt_recycle_pool_reuse, s_mqtt_recycle_pool_reuse_fn)
+static int s_mqtt_recycle_pool_reuse_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct aws_mqtt_recycle_pool pool;
+    aws_mqtt_recycle_pool_init(&pool, allocator, 48, 2);
+
+    void *first = aws_mqtt_recycle_pool_acquire(&pool);
+    void *second = aws_mqtt_recycle_pool_acquire(&pool);
+    void *third = aws_mqtt_recycle_pool_acquire(&pool);
+    ASSERT_NOT_NULL(first);
+    ASSERT_NOT_NULL(second);
+    ASSERT_NOT_NULL(third);
+    memset(first, 0xAB, 48);
+
+    /* Only max_cached are kept, the last one goes straight back to the allocator */
+    aws_mqtt_recycle_pool_release(&pool, first);
+    aws_mqtt_recycle_pool_release(&pool, second);
+    aws_mqtt_recycle_pool_release(&pool, third);
+    ASSERT_UINT_EQUALS(2, aws_atomic_load_int(&pool.cached_count));
+
+    /* Most recently released first */
+    ASSERT_PTR_EQUALS(second, aws_mqtt_recycle_pool_acquire(&pool));
+    ASSERT_PTR_EQUALS(first, aws_mqtt_recycle_pool_acquire(&pool));
+    ASSERT_UINT_EQUALS(0, aws_atomic_load_int(&pool.cached_count));
+
+    /* Empty again, so the next one is new */
+    void *fourth = aws_mqtt_recycle_pool_acquire(&pool);
+    ASSERT_NOT_NULL(fourth);
+    ASSERT_TRUE(fourth != first && fourth != second);
+
+    aws_mqtt_recycle_pool_release(&pool, first);
+    aws_mqtt_recycle_pool_release(&pool, second);
+
+    /* Clean up frees what's cached, blocks still out can go straight to the allocator */
+    aws_mqtt_recycle_pool_clean_up(&pool);
+    aws_mem_release(allocator, fourth);
+
+    return AWS_OP_SUCCESS;
+}
+
+enum {
+    RECYCLE_THREAD_COUNT = 8,
+    RECYCLE_ROUNDS_PER_THREAD = 20000,
+    RECYCLE_BLOCKS_HELD = 4,
+};
+
+struct recycle_thread_data {
+    struct aws_mqtt_recycle_pool *pool;
+    size_t id;
+    size_t corrupted;
+};
+
+static void s_recycle_thread_fn(void *arg) {
+
+    struct recycle_thread_data *data = arg;
+
+    for (size_t round = 0; round < RECYCLE_ROUNDS_PER_THREAD; ++round) {
+        size_t *held[RECYCLE_BLOCKS_HELD];
+        for (size_t i = 0; i < RECYCLE_BLOCKS_HELD; ++i) {
+            held[i] = aws_mqtt_recycle_pool_acquire(data->pool);
+            /* Tag every word, if another thread was handed the same block it'll overwrite them */
+            for (size_t word = 0; word < 4; ++word) {
+                held[i][word] = data->id;
+            }
+        }
+        for (size_t i = 0; i < RECYCLE_BLOCKS_HELD; ++i) {
+            for (size_t word = 0; word < 4; ++word) {
+                if (held[i][word] != data->id) {
+                    ++data->corrupted;
+                }
+            }
+            aws_mqtt_recycle_pool_release(data->pool, held[i]);
+        }
+    }
+}
+
+AWS_TEST_CASE(mqtt_recycle_pool_contention, s_mqtt_recycle_pool_contention_fn)
+static int s_mqtt_recycle_pool_contention_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct aws_mqtt_recycle_pool pool;
+    aws_mqtt_recycle_pool_init(&pool, allocator, 4 * sizeof(size_t), RECYCLE_THREAD_COUNT * RECYCLE_BLOCKS_HELD / 2);
+
+    struct recycle_thread_data data[RECYCLE_THREAD_COUNT];
+    struct aws_thread threads[RECYCLE_THREAD_COUNT];
+
+    for (size_t i = 0; i < RECYCLE_THREAD_COUNT; ++i) {
+        data[i].pool = &pool;
+        data[i].id = i + 1;
+        data[i].corrupted = 0;
+        ASSERT_SUCCESS(aws_thread_init(&threads[i], allocator));
+        ASSERT_SUCCESS(aws_thread_launch(&threads[i], s_recycle_thread_fn, &data[i], NULL));
+    }
+    for (size_t i = 0; i < RECYCLE_THREAD_COUNT; ++i) {
+        ASSERT_SUCCESS(aws_thread_join(&threads[i]));
+        aws_thread_clean_up(&threads[i]);
+    }
+
+    /* No block was ever held by two threads at once */
+    for (size_t i = 0; i < RECYCLE_THREAD_COUNT; ++i) {
+        ASSERT_UINT_EQUALS(0, data[i].corrupted);
+    }
+    ASSERT_TRUE(aws_atomic_load_int(&pool.cached_count) <= pool.max_cached);
+
+    /* The test allocator fails the test if anything cached leaks */
+    aws_mqtt_recycle_pool_clean_up(&pool);
+
+    return AWS_OP_SUCCESS;
+}
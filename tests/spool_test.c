@@ -0,0 +1,287 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/spool.h>
+
+#include <aws/testing/aws_test_harness.h>
+
+#include <stdio.h>
+
+static const char *s_spool_path = "aws_mqtt_spool_test.spool";
+
+static void s_on_complete(
+    struct aws_mqtt_client_connection *connection,
+    uint16_t packet_id,
+    int error_code,
+    void *userdata) {
+
+    (void)connection;
+    (void)packet_id;
+    (void)error_code;
+    (void)userdata;
+}
+
+static int s_append(struct aws_mqtt_spool *spool, const char *topic, const char *payload) {
+
+    struct aws_mqtt_spool_publish publish = {
+        .topic = aws_byte_cursor_from_c_str(topic),
+        .payload = aws_byte_cursor_from_c_str(payload),
+        .qos = AWS_MQTT_QOS_AT_LEAST_ONCE,
+        .on_complete = s_on_complete,
+        .userdata = spool,
+    };
+    return aws_mqtt_spool_append(spool, &publish);
+}
+
+static int s_take(struct aws_mqtt_spool *spool, const char *payload, uint64_t *position) {
+
+    struct aws_mqtt_spool_publish publish;
+    ASSERT_TRUE(aws_mqtt_spool_take(spool, &publish));
+    ASSERT_BIN_ARRAYS_EQUALS(payload, strlen(payload), publish.payload.ptr, publish.payload.len);
+    ASSERT_UINT_EQUALS(AWS_MQTT_QOS_AT_LEAST_ONCE, publish.qos);
+    /* Either the callbacks it was appended with, or none if it was recovered */
+    ASSERT_TRUE(publish.on_complete == s_on_complete || publish.on_complete == NULL);
+    ASSERT_PTR_EQUALS(publish.on_complete ? spool : NULL, publish.userdata);
+    *position = publish.position;
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(mqtt_spool_ring, s_mqtt_spool_ring_fn)
+static int s_mqtt_spool_ring_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    remove(s_spool_path);
+
+    /* Room for 8 of the records below, at 64 bytes each */
+    struct aws_mqtt_spool spool;
+    ASSERT_SUCCESS(aws_mqtt_spool_open(&spool, allocator, s_spool_path, 64 + 8 * 64, false));
+    ASSERT_UINT_EQUALS(0, spool.count);
+
+    char payload[32];
+    for (int i = 0; i < 8; ++i) {
+        snprintf(payload, sizeof(payload), "payload %d", i);
+        ASSERT_SUCCESS(s_append(&spool, "a/b", payload));
+    }
+    ASSERT_ERROR(AWS_ERROR_MQTT_SPOOL_FULL, s_append(&spool, "a/b", "one too many"));
+
+    /* Taken in the order they were appended, with the callbacks they were appended with */
+    uint64_t positions[8];
+    for (int i = 0; i < 8; ++i) {
+        snprintf(payload, sizeof(payload), "payload %d", i);
+        ASSERT_SUCCESS(s_take(&spool, payload, &positions[i]));
+    }
+    ASSERT_UINT_EQUALS(8, aws_hash_table_get_entry_count(&spool.callbacks));
+    struct aws_mqtt_spool_publish publish;
+    ASSERT_FALSE(aws_mqtt_spool_take(&spool, &publish));
+
+    /* Space only comes back once everything before it is acked */
+    aws_mqtt_spool_ack(&spool, positions[1]);
+    ASSERT_ERROR(AWS_ERROR_MQTT_SPOOL_FULL, s_append(&spool, "a/b", "payload 8"));
+    aws_mqtt_spool_ack(&spool, positions[0]);
+    ASSERT_UINT_EQUALS(6, spool.count);
+
+    /* A requeued record is taken again before anything newer */
+    aws_mqtt_spool_requeue(&spool, positions[3]);
+    ASSERT_SUCCESS(s_append(&spool, "a/b", "payload 8"));
+    ASSERT_SUCCESS(s_take(&spool, "payload 3", &positions[3]));
+    ASSERT_SUCCESS(s_take(&spool, "payload 8", &positions[0]));
+
+    aws_mqtt_spool_ack(&spool, positions[0]);
+    for (int i = 2; i < 8; ++i) {
+        aws_mqtt_spool_ack(&spool, positions[i]);
+    }
+    ASSERT_UINT_EQUALS(0, spool.count);
+    ASSERT_UINT_EQUALS(spool.tail, spool.head);
+    ASSERT_UINT_EQUALS(0, aws_hash_table_get_entry_count(&spool.callbacks));
+
+    /* 256 bytes each, so the second doesn't fit between the first and the end of the file, and wraps around */
+    char big_payload[200];
+    memset(big_payload, 'x', sizeof(big_payload) - 1);
+    big_payload[sizeof(big_payload) - 1] = '\0';
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_SUCCESS(s_append(&spool, "a/b", big_payload));
+        ASSERT_SUCCESS(s_take(&spool, big_payload, &positions[i]));
+        aws_mqtt_spool_ack(&spool, positions[i]);
+    }
+    const uint64_t wrapped_offset = positions[1] % spool.capacity;
+    ASSERT_UINT_EQUALS(0, wrapped_offset);
+    ASSERT_UINT_EQUALS(0, spool.count);
+    ASSERT_UINT_EQUALS(spool.tail, spool.head);
+
+    aws_mqtt_spool_close(&spool);
+    remove(s_spool_path);
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(mqtt_spool_recovery, s_mqtt_spool_recovery_fn)
+static int s_mqtt_spool_recovery_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    remove(s_spool_path);
+
+    struct aws_mqtt_spool spool;
+    ASSERT_SUCCESS(aws_mqtt_spool_open(&spool, allocator, s_spool_path, 4096, true));
+
+    ASSERT_SUCCESS(s_append(&spool, "a/b", "payload 0"));
+    ASSERT_SUCCESS(s_append(&spool, "a/b", "payload 1"));
+    ASSERT_SUCCESS(s_append(&spool, "a/b", "payload 2"));
+    ASSERT_SUCCESS(s_append(&spool, "a/b", "payload 3"));
+
+    uint64_t positions[2];
+    ASSERT_SUCCESS(s_take(&spool, "payload 0", &positions[0]));
+    ASSERT_SUCCESS(s_take(&spool, "payload 1", &positions[1]));
+    aws_mqtt_spool_ack(&spool, positions[0]);
+
+    /* The last record is torn, as if the process died while writing it */
+    struct aws_mqtt_spool_publish publish;
+    ASSERT_TRUE(aws_mqtt_spool_take(&spool, &publish));
+    ASSERT_TRUE(aws_mqtt_spool_take(&spool, &publish));
+    ((uint8_t *)publish.payload.ptr)[0] ^= 0xFF;
+    aws_mqtt_spool_close(&spool);
+
+    /* Everything not acked comes back, taken or not, without the callbacks of the process that appended it */
+    ASSERT_SUCCESS(aws_mqtt_spool_open(&spool, allocator, s_spool_path, 4096, false));
+    ASSERT_UINT_EQUALS(2, spool.count);
+    ASSERT_TRUE(aws_mqtt_spool_take(&spool, &publish));
+    ASSERT_BIN_ARRAYS_EQUALS("payload 1", 9, publish.payload.ptr, publish.payload.len);
+    ASSERT_NULL(publish.on_complete);
+    ASSERT_NULL(publish.userdata);
+    ASSERT_SUCCESS(s_take(&spool, "payload 2", &positions[0]));
+    ASSERT_FALSE(aws_mqtt_spool_take(&spool, &publish));
+
+    /* Anything appended since still has its own */
+    ASSERT_SUCCESS(s_append(&spool, "a/b", "payload 4"));
+    ASSERT_TRUE(aws_mqtt_spool_take(&spool, &publish));
+    ASSERT_BIN_ARRAYS_EQUALS("payload 4", 9, publish.payload.ptr, publish.payload.len);
+    ASSERT_TRUE(publish.on_complete == s_on_complete);
+    ASSERT_PTR_EQUALS(&spool, publish.userdata);
+    aws_mqtt_spool_close(&spool);
+
+    /* A different size starts over */
+    ASSERT_SUCCESS(aws_mqtt_spool_open(&spool, allocator, s_spool_path, 8192, false));
+    ASSERT_UINT_EQUALS(0, spool.count);
+    ASSERT_FALSE(aws_mqtt_spool_take(&spool, &publish));
+    aws_mqtt_spool_close(&spool);
+
+    remove(s_spool_path);
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(mqtt_spool_attempts, s_mqtt_spool_attempts_fn)
+static int s_mqtt_spool_attempts_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    remove(s_spool_path);
+
+    struct aws_mqtt_spool spool;
+    ASSERT_SUCCESS(aws_mqtt_spool_open(&spool, allocator, s_spool_path, 4096, false));
+    spool.max_attempts = 2;
+
+    ASSERT_SUCCESS(s_append(&spool, "a/b", "payload 0"));
+    ASSERT_SUCCESS(s_append(&spool, "a/b", "payload 1"));
+    ASSERT_SUCCESS(s_append(&spool, "a/b", "payload 2"));
+
+    /* A failed record goes back in front, until it's failed max_attempts times */
+    uint64_t positions[3];
+    ASSERT_SUCCESS(s_take(&spool, "payload 0", &positions[0]));
+    ASSERT_FALSE(aws_mqtt_spool_fail(&spool, positions[0]));
+    ASSERT_SUCCESS(s_take(&spool, "payload 0", &positions[0]));
+    ASSERT_TRUE(aws_mqtt_spool_fail(&spool, positions[0]));
+    ASSERT_UINT_EQUALS(2, spool.count);
+    ASSERT_UINT_EQUALS(2, aws_hash_table_get_entry_count(&spool.callbacks));
+
+    /* Requeueing doesn't count */
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_SUCCESS(s_take(&spool, "payload 1", &positions[1]));
+        aws_mqtt_spool_requeue(&spool, positions[1]);
+    }
+    ASSERT_SUCCESS(s_take(&spool, "payload 1", &positions[1]));
+    ASSERT_FALSE(aws_mqtt_spool_fail(&spool, positions[1]));
+    aws_mqtt_spool_close(&spool);
+
+    /* Attempts are kept in the file */
+    ASSERT_SUCCESS(aws_mqtt_spool_open(&spool, allocator, s_spool_path, 4096, false));
+    spool.max_attempts = 2;
+    ASSERT_UINT_EQUALS(2, spool.count);
+    ASSERT_SUCCESS(s_take(&spool, "payload 1", &positions[1]));
+    ASSERT_TRUE(aws_mqtt_spool_fail(&spool, positions[1]));
+    ASSERT_SUCCESS(s_take(&spool, "payload 2", &positions[2]));
+    aws_mqtt_spool_ack(&spool, positions[2]);
+    ASSERT_UINT_EQUALS(0, spool.count);
+    ASSERT_UINT_EQUALS(spool.tail, spool.head);
+    aws_mqtt_spool_close(&spool);
+
+    remove(s_spool_path);
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(mqtt_spool_disconnect, s_mqtt_spool_disconnect_fn)
+static int s_mqtt_spool_disconnect_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    remove(s_spool_path);
+
+    struct aws_mqtt_spool spool;
+    ASSERT_SUCCESS(aws_mqtt_spool_open(&spool, allocator, s_spool_path, 4096, false));
+    spool.max_attempts = 2;
+
+    ASSERT_SUCCESS(s_append(&spool, "a/b", "payload 0"));
+    ASSERT_SUCCESS(s_append(&spool, "a/b", "payload 1"));
+    ASSERT_SUCCESS(s_append(&spool, "a/b", "payload 2"));
+
+    /* Everything is in flight when the connection goes, and is dropped in whatever order the requests are */
+    uint64_t positions[3];
+    ASSERT_SUCCESS(s_take(&spool, "payload 0", &positions[0]));
+    ASSERT_SUCCESS(s_take(&spool, "payload 1", &positions[1]));
+    ASSERT_SUCCESS(s_take(&spool, "payload 2", &positions[2]));
+    struct aws_mqtt_spool_publish publish;
+    ASSERT_FALSE(aws_mqtt_spool_take(&spool, &publish));
+    aws_mqtt_spool_requeue(&spool, positions[2]);
+    aws_mqtt_spool_requeue(&spool, positions[0]);
+    aws_mqtt_spool_requeue(&spool, positions[1]);
+    ASSERT_UINT_EQUALS(3, spool.count);
+
+    /* Once reconnected, it's all sent again in the original order with the original callbacks */
+    for (int i = 0; i < 3; ++i) {
+        char payload[32];
+        snprintf(payload, sizeof(payload), "payload %d", i);
+        ASSERT_TRUE(aws_mqtt_spool_take(&spool, &publish));
+        ASSERT_BIN_ARRAYS_EQUALS(payload, strlen(payload), publish.payload.ptr, publish.payload.len);
+        ASSERT_TRUE(publish.on_complete == s_on_complete);
+        ASSERT_PTR_EQUALS(&spool, publish.userdata);
+        positions[i] = publish.position;
+    }
+
+    /* The disconnect didn't count against any of them */
+    ASSERT_FALSE(aws_mqtt_spool_fail(&spool, positions[0]));
+    aws_mqtt_spool_ack(&spool, positions[1]);
+    aws_mqtt_spool_ack(&spool, positions[2]);
+    ASSERT_SUCCESS(s_take(&spool, "payload 0", &positions[0]));
+    aws_mqtt_spool_ack(&spool, positions[0]);
+    ASSERT_UINT_EQUALS(0, spool.count);
+    ASSERT_UINT_EQUALS(spool.tail, spool.head);
+    aws_mqtt_spool_close(&spool);
+
+    remove(s_spool_path);
+
+    return AWS_OP_SUCCESS;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2010-2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <aws/mqtt/private/thread_pool.h>
+
+#include <aws/common/atomics.h>
+
+#include <aws/testing/aws_test_harness.h>
+
+struct counting_job {
+    struct aws_mqtt_thread_pool_job job;
+    struct aws_atomic_var *counter;
+};
+
+static void s_count_job(struct aws_mqtt_thread_pool_job *job) {
+    struct counting_job *counting = AWS_CONTAINER_OF(job, struct counting_job, job);
+    aws_atomic_fetch_add(counting->counter, 1);
+}
+
+enum { S_JOB_COUNT = 1000 };
+
+AWS_TEST_CASE(mqtt_thread_pool_runs_jobs, s_mqtt_thread_pool_runs_jobs_fn)
+static int s_mqtt_thread_pool_runs_jobs_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    struct aws_mqtt_thread_pool pool;
+    ASSERT_SUCCESS(aws_mqtt_thread_pool_init(&pool, allocator, 4));
+
+    struct aws_atomic_var counter;
+    aws_atomic_init_int(&counter, 0);
+
+    static struct counting_job s_jobs[S_JOB_COUNT];
+    for (size_t i = 0; i < S_JOB_COUNT; ++i) {
+        s_jobs[i].job.fn = s_count_job;
+        s_jobs[i].counter = &counter;
+        aws_mqtt_thread_pool_submit(&pool, &s_jobs[i].job);
+    }
+
+    /* Clean up runs whatever is still queued before the threads stop */
+    aws_mqtt_thread_pool_clean_up(&pool);
+    ASSERT_UINT_EQUALS(S_JOB_COUNT, aws_atomic_load_int(&counter));
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Records the order it runs in, and submits itself again until it has run runs_left more times */
+struct resubmitting_job {
+    struct aws_mqtt_thread_pool_job job;
+    struct aws_mqtt_thread_pool *pool;
+    size_t id;
+    size_t runs_left;
+    size_t *order;
+    size_t *order_len;
+};
+
+static void s_resubmitting_job(struct aws_mqtt_thread_pool_job *job) {
+    struct resubmitting_job *resubmitting = AWS_CONTAINER_OF(job, struct resubmitting_job, job);
+
+    resubmitting->order[(*resubmitting->order_len)++] = resubmitting->id;
+    if (resubmitting->runs_left) {
+        --resubmitting->runs_left;
+        aws_mqtt_thread_pool_submit(resubmitting->pool, job);
+    }
+}
+
+AWS_TEST_CASE(mqtt_thread_pool_resubmit, s_mqtt_thread_pool_resubmit_fn)
+static int s_mqtt_thread_pool_resubmit_fn(struct aws_allocator *allocator, void *ctx) {
+
+    (void)ctx;
+
+    /* One thread, so jobs run strictly in the order they're queued */
+    struct aws_mqtt_thread_pool pool;
+    ASSERT_SUCCESS(aws_mqtt_thread_pool_init(&pool, allocator, 1));
+
+    size_t order[6];
+    size_t order_len = 0;
+
+    struct resubmitting_job jobs[2];
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(jobs); ++i) {
+        jobs[i].job.fn = s_resubmitting_job;
+        jobs[i].pool = &pool;
+        jobs[i].id = i;
+        jobs[i].runs_left = 2;
+        jobs[i].order = order;
+        jobs[i].order_len = &order_len;
+    }
+
+    aws_mqtt_thread_pool_submit(&pool, &jobs[0].job);
+    aws_mqtt_thread_pool_submit(&pool, &jobs[1].job);
+
+    /* Resubmissions made while shutting down still run */
+    aws_mqtt_thread_pool_clean_up(&pool);
+
+    ASSERT_UINT_EQUALS(AWS_ARRAY_SIZE(order), order_len);
+    size_t runs[2] = {0, 0};
+    for (size_t i = 0; i < order_len; ++i) {
+        ++runs[order[i]];
+    }
+    ASSERT_UINT_EQUALS(3, runs[0]);
+    ASSERT_UINT_EQUALS(3, runs[1]);
+    /* Each job's first run comes before its resubmissions */
+    ASSERT_UINT_EQUALS(0, order[0]);
+
+    return AWS_OP_SUCCESS;
+}
@@ -49,6 +49,7 @@ static int s_check_multi_topic_match(
     for (size_t i = 0; i < sub_filters_len; ++i) {
         struct aws_string *topic_filter = aws_string_new_from_c_str(allocator, sub_filters[i]);
         aws_mqtt_topic_tree_insert(&tree, topic_filter, AWS_MQTT_QOS_AT_MOST_ONCE, &on_publish, NULL, NULL);
+        aws_string_destroy(topic_filter);
     }
 
     struct aws_byte_cursor filter_cursor = aws_byte_cursor_from_array(pub_topic, strlen(pub_topic));
@@ -136,11 +137,9 @@ static int s_mqtt_topic_tree_unsubscribe_fn(struct aws_allocator *allocator, voi
 
     ASSERT_SUCCESS(aws_mqtt_topic_tree_insert(&tree, topic_a_a_a, AWS_MQTT_QOS_AT_MOST_ONCE, &on_publish, NULL, NULL));
     ASSERT_SUCCESS(aws_mqtt_topic_tree_remove(&tree, &s_topic_a_a_a));
-    /* Re-create, it was nuked by remove. */
-    topic_a_a_a = aws_string_new_from_array(allocator, s_topic_a_a_a.ptr, s_topic_a_a_a.len);
 
     /* Ensure that the intermediate 'a' node was removed as well. */
-    ASSERT_UINT_EQUALS(0, aws_hash_table_get_entry_count(&tree.root->subtopics));
+    ASSERT_UINT_EQUALS(0, aws_mqtt_topic_node_get_child_count(tree.root));
 
     /* Put it back so we can test removal of a partial tree. */
     /* Bonus points: test transactions here */
@@ -172,6 +171,11 @@ static int s_mqtt_topic_tree_unsubscribe_fn(struct aws_allocator *allocator, voi
 
     aws_mqtt_topic_tree_clean_up(&tree);
 
+    /* The tree only ever held copies */
+    aws_string_destroy(topic_a_a);
+    aws_string_destroy(topic_a_a_a);
+    aws_string_destroy(topic_a_a_b);
+
     return AWS_OP_SUCCESS;
 }
 
@@ -193,10 +197,7 @@ static int s_mqtt_topic_tree_transactions_fn(struct aws_allocator *allocator, vo
     aws_mqtt_topic_tree_transaction_roll_back(&tree, &transaction);
 
     /* Ensure that the intermediate 'a' node was removed as well. */
-    ASSERT_UINT_EQUALS(0, aws_hash_table_get_entry_count(&tree.root->subtopics));
-
-    /* Re-create, it was nuked by roll_back. */
-    topic_a_a = aws_string_new_from_array(allocator, s_topic_a_a.ptr, s_topic_a_a.len);
+    ASSERT_UINT_EQUALS(0, aws_mqtt_topic_node_get_child_count(tree.root));
 
     /* Insert(commit), remove, roll back the removal */
     ASSERT_SUCCESS(aws_mqtt_topic_tree_insert(&tree, topic_a_a, AWS_MQTT_QOS_AT_MOST_ONCE, &on_publish, NULL, NULL));
@@ -210,11 +211,505 @@ static int s_mqtt_topic_tree_transactions_fn(struct aws_allocator *allocator, vo
     ASSERT_SUCCESS(aws_mqtt_topic_tree_publish(&tree, &publish));
     ASSERT_INT_EQUALS(times_called, 1);
 
+    aws_mqtt_topic_tree_clean_up(&tree);
+    aws_string_destroy(topic_a_a);
+
+    return AWS_OP_SUCCESS;
+}
+
+enum { S_FANOUT_CHILDREN = 5 * AWS_MQTT_TOPIC_NODE_INLINE_CHILDREN };
+
+/* Publishes to fanout/<i> and returns the number of subscriptions that matched */
+static int s_publish_fanout(struct aws_mqtt_topic_tree *tree, size_t i) {
+
+    char topic[32];
+    snprintf(topic, sizeof(topic), "fanout/%zu", i);
+
+    struct aws_mqtt_packet_publish publish;
+    aws_mqtt_packet_publish_init(
+        &publish,
+        false,
+        AWS_MQTT_QOS_AT_MOST_ONCE,
+        false,
+        aws_byte_cursor_from_c_str(topic),
+        1,
+        s_empty_cursor);
+
+    times_called = 0;
+    aws_mqtt_topic_tree_publish(tree, &publish);
+    return times_called;
+}
+
+AWS_TEST_CASE(mqtt_topic_tree_wide_fanout, s_mqtt_topic_tree_wide_fanout_fn)
+static int s_mqtt_topic_tree_wide_fanout_fn(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    struct aws_mqtt_topic_tree tree;
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_init(&tree, allocator));
+
+    /* Enough siblings to outgrow the inline children, plus both wildcards */
+    char filter[32];
+    for (size_t i = 0; i < S_FANOUT_CHILDREN; ++i) {
+        snprintf(filter, sizeof(filter), "fanout/%zu", i);
+        struct aws_string *topic_filter = aws_string_new_from_c_str(allocator, filter);
+        ASSERT_SUCCESS(
+            aws_mqtt_topic_tree_insert(&tree, topic_filter, AWS_MQTT_QOS_AT_MOST_ONCE, &on_publish, NULL, NULL));
+        aws_string_destroy(topic_filter);
+    }
+    const char *wildcards[] = {"fanout/+", "fanout/#"};
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(wildcards); ++i) {
+        struct aws_string *topic_filter = aws_string_new_from_c_str(allocator, wildcards[i]);
+        ASSERT_SUCCESS(
+            aws_mqtt_topic_tree_insert(&tree, topic_filter, AWS_MQTT_QOS_AT_MOST_ONCE, &on_publish, NULL, NULL));
+        aws_string_destroy(topic_filter);
+    }
+
+    for (size_t i = 0; i < S_FANOUT_CHILDREN; ++i) {
+        ASSERT_INT_EQUALS(3, s_publish_fanout(&tree, i));
+    }
+    ASSERT_INT_EQUALS(2, s_publish_fanout(&tree, S_FANOUT_CHILDREN));
+
+    /* Remove every other literal subscription */
+    for (size_t i = 0; i < S_FANOUT_CHILDREN; i += 2) {
+        snprintf(filter, sizeof(filter), "fanout/%zu", i);
+        struct aws_byte_cursor filter_cur = aws_byte_cursor_from_c_str(filter);
+        ASSERT_SUCCESS(aws_mqtt_topic_tree_remove(&tree, &filter_cur));
+    }
+    for (size_t i = 0; i < S_FANOUT_CHILDREN; ++i) {
+        const int expected = (i & 1) ? 3 : 2;
+        ASSERT_INT_EQUALS(expected, s_publish_fanout(&tree, i));
+    }
+
+    /* Remove everything else, the tree should be empty again */
+    for (size_t i = 1; i < S_FANOUT_CHILDREN; i += 2) {
+        snprintf(filter, sizeof(filter), "fanout/%zu", i);
+        struct aws_byte_cursor filter_cur = aws_byte_cursor_from_c_str(filter);
+        ASSERT_SUCCESS(aws_mqtt_topic_tree_remove(&tree, &filter_cur));
+    }
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(wildcards); ++i) {
+        struct aws_byte_cursor filter_cur = aws_byte_cursor_from_c_str(wildcards[i]);
+        ASSERT_SUCCESS(aws_mqtt_topic_tree_remove(&tree, &filter_cur));
+    }
+    ASSERT_UINT_EQUALS(0, aws_mqtt_topic_node_get_child_count(tree.root));
+
+    aws_mqtt_topic_tree_clean_up(&tree);
+
+    return AWS_OP_SUCCESS;
+}
+
+static int s_cleanups_called = 0;
+static void s_on_cleanup(void *userdata) {
+
+    int *cleanups_called = userdata;
+    (*cleanups_called)++;
+}
+
+AWS_TEST_CASE(mqtt_topic_tree_arena, s_mqtt_topic_tree_arena_fn)
+static int s_mqtt_topic_tree_arena_fn(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    struct aws_mqtt_topic_tree tree;
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_init_arena(&tree, allocator));
+
+    /* Wide enough that some nodes switch to hash tables, which then live in the arena too */
+    char filter[32];
+    for (size_t i = 0; i < S_FANOUT_CHILDREN; ++i) {
+        snprintf(filter, sizeof(filter), "fanout/%zu", i);
+        struct aws_string *topic_filter = aws_string_new_from_c_str(allocator, filter);
+        ASSERT_SUCCESS(aws_mqtt_topic_tree_insert(
+            &tree, topic_filter, AWS_MQTT_QOS_AT_MOST_ONCE, &on_publish, &s_on_cleanup, &s_cleanups_called));
+        aws_string_destroy(topic_filter);
+
+        snprintf(filter, sizeof(filter), "fanout/%zu/+", i);
+        topic_filter = aws_string_new_from_c_str(allocator, filter);
+        ASSERT_SUCCESS(aws_mqtt_topic_tree_insert(
+            &tree, topic_filter, AWS_MQTT_QOS_AT_MOST_ONCE, &on_publish, &s_on_cleanup, &s_cleanups_called));
+        aws_string_destroy(topic_filter);
+    }
+
+    for (size_t i = 0; i < S_FANOUT_CHILDREN; ++i) {
+        ASSERT_INT_EQUALS(1, s_publish_fanout(&tree, i));
+    }
+
+    /* Removing still hands nodes back to the arena one at a time */
+    s_cleanups_called = 0;
+    for (size_t i = 0; i < S_FANOUT_CHILDREN; i += 2) {
+        snprintf(filter, sizeof(filter), "fanout/%zu/+", i);
+        struct aws_byte_cursor filter_cur = aws_byte_cursor_from_c_str(filter);
+        ASSERT_SUCCESS(aws_mqtt_topic_tree_remove(&tree, &filter_cur));
+    }
+    ASSERT_INT_EQUALS(S_FANOUT_CHILDREN / 2, s_cleanups_called);
+    ASSERT_INT_EQUALS(1, s_publish_fanout(&tree, 0));
+
+    /* Bulk release still cleans up every remaining subscription's userdata */
+    s_cleanups_called = 0;
+    aws_mqtt_topic_tree_clean_up(&tree);
+    ASSERT_INT_EQUALS(S_FANOUT_CHILDREN + S_FANOUT_CHILDREN / 2, s_cleanups_called);
+
+    return AWS_OP_SUCCESS;
+}
+
+static int s_insert_filter(struct aws_allocator *allocator, struct aws_mqtt_topic_tree *tree, const char *filter) {
+
+    struct aws_string *topic_filter = aws_string_new_from_c_str(allocator, filter);
+    ASSERT_NOT_NULL(topic_filter);
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_insert(tree, topic_filter, AWS_MQTT_QOS_AT_MOST_ONCE, &on_publish, NULL, NULL));
+    aws_string_destroy(topic_filter);
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(mqtt_topic_tree_collect_matches, s_mqtt_topic_tree_collect_matches_fn)
+static int s_mqtt_topic_tree_collect_matches_fn(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    struct aws_mqtt_topic_tree tree;
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_init(&tree, allocator));
+
+    const char *filters[] = {"a/b/c", "a/+/c", "a/#", "+/b/+", "#"};
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(filters); ++i) {
+        ASSERT_SUCCESS(s_insert_filter(allocator, &tree, filters[i]));
+    }
+
+    /* Same order publish calls the callbacks in: '#' first, then '+', then the literal topic */
+    const char *expected[] = {"#", "+/b/+", "a/#", "a/+/c", "a/b/c"};
+    const struct aws_mqtt_topic_node *matches[AWS_ARRAY_SIZE(expected)];
+    size_t match_count = 0;
+    struct aws_byte_cursor topic = aws_byte_cursor_from_c_str("a/b/c");
+    ASSERT_SUCCESS(
+        aws_mqtt_topic_tree_collect_matches(&tree, &topic, matches, AWS_ARRAY_SIZE(matches), &match_count));
+    ASSERT_UINT_EQUALS(AWS_ARRAY_SIZE(expected), match_count);
+    for (size_t i = 0; i < match_count; ++i) {
+        ASSERT_BIN_ARRAYS_EQUALS(
+            expected[i],
+            strlen(expected[i]),
+            aws_string_bytes(matches[i]->topic_filter),
+            matches[i]->topic_filter->len);
+    }
+
+    /* Only as many as fit are stored, but all are counted */
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_collect_matches(&tree, &topic, matches, 2, &match_count));
+    ASSERT_UINT_EQUALS(AWS_ARRAY_SIZE(expected), match_count);
+    ASSERT_PTR_EQUALS(tree.root->multi_level_wildcard, matches[0]);
+
+    topic = aws_byte_cursor_from_c_str("z/z");
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_collect_matches(&tree, &topic, NULL, 0, &match_count));
+    ASSERT_UINT_EQUALS(1, match_count);
+
     aws_mqtt_topic_tree_clean_up(&tree);
 
     return AWS_OP_SUCCESS;
 }
 
+struct iterate_state {
+    size_t visited;
+    size_t stop_after;
+    bool seen[6];
+};
+
+static const char *s_iterate_filters[] = {"a/b/c", "a/+/c", "a/#", "+/b/+", "#", "a"};
+
+static bool s_iterate_visitor(const struct aws_mqtt_topic_node *subscription, void *user_data) {
+
+    struct iterate_state *state = user_data;
+
+    struct aws_byte_cursor visited = aws_byte_cursor_from_string(subscription->topic_filter);
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(s_iterate_filters); ++i) {
+        struct aws_byte_cursor filter = aws_byte_cursor_from_c_str(s_iterate_filters[i]);
+        if (aws_byte_cursor_eq(&visited, &filter)) {
+            /* Each subscription exactly once */
+            if (state->seen[i]) {
+                return false;
+            }
+            state->seen[i] = true;
+        }
+    }
+
+    return ++state->visited != state->stop_after;
+}
+
+AWS_TEST_CASE(mqtt_topic_tree_iterate, s_mqtt_topic_tree_iterate_fn)
+static int s_mqtt_topic_tree_iterate_fn(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    struct aws_mqtt_topic_tree tree;
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_init(&tree, allocator));
+
+    struct iterate_state state = {.visited = 0, .stop_after = 0};
+    aws_mqtt_topic_tree_iterate(&tree, s_iterate_visitor, &state);
+    ASSERT_UINT_EQUALS(0, state.visited);
+
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(s_iterate_filters); ++i) {
+        ASSERT_SUCCESS(s_insert_filter(allocator, &tree, s_iterate_filters[i]));
+    }
+
+    /* "a/b" is only a node on the way to "a/b/c", not a subscription */
+    aws_mqtt_topic_tree_iterate(&tree, s_iterate_visitor, &state);
+    ASSERT_UINT_EQUALS(AWS_ARRAY_SIZE(s_iterate_filters), state.visited);
+    for (size_t i = 0; i < AWS_ARRAY_SIZE(s_iterate_filters); ++i) {
+        ASSERT_TRUE(state.seen[i]);
+    }
+
+    /* Stops as soon as the visitor says so */
+    AWS_ZERO_STRUCT(state);
+    state.stop_after = 2;
+    aws_mqtt_topic_tree_iterate(&tree, s_iterate_visitor, &state);
+    ASSERT_UINT_EQUALS(2, state.visited);
+
+    aws_mqtt_topic_tree_clean_up(&tree);
+
+    return AWS_OP_SUCCESS;
+}
+
+AWS_TEST_CASE(mqtt_topic_tree_deep_topic, s_mqtt_topic_tree_deep_topic_fn)
+static int s_mqtt_topic_tree_deep_topic_fn(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    struct aws_mqtt_topic_tree tree;
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_init(&tree, allocator));
+
+    /* More levels than are matched on the stack */
+    char deep[2 * 500];
+    for (size_t i = 0; i < 500; ++i) {
+        deep[2 * i] = 'x';
+        deep[2 * i + 1] = '/';
+    }
+    deep[sizeof(deep) - 1] = '\0';
+
+    ASSERT_SUCCESS(s_insert_filter(allocator, &tree, deep));
+    ASSERT_SUCCESS(s_insert_filter(allocator, &tree, "x/x/#"));
+    ASSERT_SUCCESS(s_insert_filter(allocator, &tree, "x/+/x/+/+/+/+/#"));
+
+    struct aws_mqtt_packet_publish publish;
+    aws_mqtt_packet_publish_init(
+        &publish, false, AWS_MQTT_QOS_AT_MOST_ONCE, false, aws_byte_cursor_from_c_str(deep), 1, s_empty_cursor);
+
+    times_called = 0;
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_publish(&tree, &publish));
+    ASSERT_INT_EQUALS(3, times_called);
+
+    /* One level short only matches the wildcards */
+    publish.topic_name.len -= 2;
+    times_called = 0;
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_publish(&tree, &publish));
+    ASSERT_INT_EQUALS(2, times_called);
+
+    aws_mqtt_topic_tree_clean_up(&tree);
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Publishes to topic and returns the number of subscriptions that matched */
+static int s_publish_count(struct aws_mqtt_topic_tree *tree, const char *topic) {
+
+    struct aws_mqtt_packet_publish publish;
+    aws_mqtt_packet_publish_init(
+        &publish, false, AWS_MQTT_QOS_AT_MOST_ONCE, false, aws_byte_cursor_from_c_str(topic), 1, s_empty_cursor);
+
+    times_called = 0;
+    aws_mqtt_topic_tree_publish(tree, &publish);
+    return times_called;
+}
+
+AWS_TEST_CASE(mqtt_topic_tree_match_cache, s_mqtt_topic_tree_match_cache_fn)
+static int s_mqtt_topic_tree_match_cache_fn(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    struct aws_mqtt_topic_tree tree;
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_init(&tree, allocator));
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_set_match_cache_size(&tree, 2));
+
+    ASSERT_SUCCESS(s_insert_filter(allocator, &tree, "a/+"));
+    ASSERT_INT_EQUALS(1, s_publish_count(&tree, "a/b"));
+    ASSERT_INT_EQUALS(1, s_publish_count(&tree, "a/b"));
+
+    /* A new subscription invalidates what was cached */
+    ASSERT_SUCCESS(s_insert_filter(allocator, &tree, "a/b"));
+    ASSERT_INT_EQUALS(2, s_publish_count(&tree, "a/b"));
+
+    /* Push a/b out of the cache and bring it back */
+    ASSERT_INT_EQUALS(1, s_publish_count(&tree, "a/c"));
+    ASSERT_INT_EQUALS(1, s_publish_count(&tree, "a/d"));
+    ASSERT_INT_EQUALS(2, s_publish_count(&tree, "a/b"));
+    ASSERT_INT_EQUALS(0, s_publish_count(&tree, "b"));
+
+    /* Cached nodes are destroyed by the removal, they must not be called */
+    struct aws_byte_cursor filter = aws_byte_cursor_from_c_str("a/+");
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_remove(&tree, &filter));
+    ASSERT_INT_EQUALS(1, s_publish_count(&tree, "a/b"));
+    filter = aws_byte_cursor_from_c_str("a/b");
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_remove(&tree, &filter));
+    ASSERT_INT_EQUALS(0, s_publish_count(&tree, "a/b"));
+
+    /* Resizing and disabling drop the entries */
+    ASSERT_SUCCESS(s_insert_filter(allocator, &tree, "#"));
+    ASSERT_INT_EQUALS(1, s_publish_count(&tree, "a/b"));
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_set_match_cache_size(&tree, 1));
+    ASSERT_INT_EQUALS(1, s_publish_count(&tree, "a/b"));
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_set_match_cache_size(&tree, 0));
+    ASSERT_NULL(tree.match_cache);
+    ASSERT_INT_EQUALS(1, s_publish_count(&tree, "a/b"));
+
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_set_match_cache_size(&tree, 4));
+    ASSERT_INT_EQUALS(1, s_publish_count(&tree, "a/b"));
+    aws_mqtt_topic_tree_clean_up(&tree);
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Counts how often each subscriber was called, and cleaned up */
+struct shared_subscriber {
+    int times_called;
+    int cleanups;
+};
+
+static void s_on_shared_publish(
+    const struct aws_byte_cursor *topic,
+    const struct aws_byte_cursor *payload,
+    void *user_data) {
+
+    (void)topic;
+    (void)payload;
+
+    struct shared_subscriber *subscriber = user_data;
+    subscriber->times_called++;
+}
+
+static void s_on_shared_cleanup(void *userdata) {
+
+    struct shared_subscriber *subscriber = userdata;
+    subscriber->cleanups++;
+}
+
+static int s_insert_shared(
+    struct aws_mqtt_topic_tree *tree,
+    const struct aws_string *topic_filter,
+    enum aws_mqtt_qos qos,
+    struct shared_subscriber *subscriber) {
+
+    return aws_mqtt_topic_tree_insert(tree, topic_filter, qos, &s_on_shared_publish, &s_on_shared_cleanup, subscriber);
+}
+
+AWS_TEST_CASE(mqtt_topic_tree_shared_filter, s_mqtt_topic_tree_shared_filter_fn)
+static int s_mqtt_topic_tree_shared_filter_fn(struct aws_allocator *allocator, void *ctx) {
+    (void)ctx;
+
+    struct aws_mqtt_topic_tree tree;
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_init(&tree, allocator));
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_set_match_cache_size(&tree, 4));
+
+    struct shared_subscriber subscribers[4];
+    AWS_ZERO_ARRAY(subscribers);
+
+    struct aws_string *topic_filter = aws_string_new_from_c_str(allocator, "fleet/+/telemetry");
+    struct aws_byte_cursor filter = aws_byte_cursor_from_string(topic_filter);
+    struct aws_mqtt_packet_publish publish;
+    aws_mqtt_packet_publish_init(
+        &publish,
+        false,
+        AWS_MQTT_QOS_AT_MOST_ONCE,
+        false,
+        aws_byte_cursor_from_c_str("fleet/truck42/telemetry"),
+        1,
+        s_empty_cursor);
+
+    /* Inserting the same filter again adds a subscriber instead of replacing the one there */
+    ASSERT_SUCCESS(s_insert_shared(&tree, topic_filter, AWS_MQTT_QOS_AT_MOST_ONCE, &subscribers[0]));
+    ASSERT_SUCCESS(s_insert_shared(&tree, topic_filter, AWS_MQTT_QOS_EXACTLY_ONCE, &subscribers[1]));
+    ASSERT_SUCCESS(s_insert_shared(&tree, topic_filter, AWS_MQTT_QOS_AT_LEAST_ONCE, &subscribers[2]));
+
+    const struct aws_mqtt_topic_node *node = aws_mqtt_topic_tree_find(&tree, &filter);
+    ASSERT_NOT_NULL(node);
+    ASSERT_UINT_EQUALS(3, node->subscriber_count);
+    ASSERT_INT_EQUALS(AWS_MQTT_QOS_EXACTLY_ONCE, node->qos);
+    ASSERT_PTR_EQUALS(&subscribers[0], node->subscribers->userdata);
+
+    /* Nothing's granted until the connection says so, and a refusal takes it back */
+    ASSERT_FALSE(node->granted);
+    aws_mqtt_topic_tree_set_granted(&tree, &filter, true, AWS_MQTT_QOS_AT_LEAST_ONCE);
+    ASSERT_TRUE(node->granted);
+    ASSERT_INT_EQUALS(AWS_MQTT_QOS_AT_LEAST_ONCE, node->granted_qos);
+    aws_mqtt_topic_tree_set_granted(&tree, &filter, false, AWS_MQTT_QOS_EXACTLY_ONCE);
+    ASSERT_FALSE(node->granted);
+    aws_mqtt_topic_tree_set_granted(&tree, &filter, true, AWS_MQTT_QOS_AT_LEAST_ONCE);
+
+    /* One match for the filter, every subscriber called */
+    size_t match_count = 0;
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_collect_matches(&tree, &publish.topic_name, NULL, 0, &match_count));
+    ASSERT_UINT_EQUALS(1, match_count);
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_publish(&tree, &publish));
+    for (size_t i = 0; i < 3; ++i) {
+        ASSERT_INT_EQUALS(1, subscribers[i].times_called);
+    }
+
+    /* Rolling back another subscriber leaves the ones there alone */
+    AWS_VARIABLE_LENGTH_ARRAY(uint8_t, transaction_buf, aws_mqtt_topic_tree_action_size);
+    struct aws_array_list transaction;
+    aws_array_list_init_static(&transaction, transaction_buf, 1, aws_mqtt_topic_tree_action_size);
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_transaction_insert(
+        &tree,
+        &transaction,
+        topic_filter,
+        AWS_MQTT_QOS_AT_MOST_ONCE,
+        &s_on_shared_publish,
+        &s_on_shared_cleanup,
+        &subscribers[3]));
+    aws_mqtt_topic_tree_transaction_roll_back(&tree, &transaction);
+    ASSERT_UINT_EQUALS(3, node->subscriber_count);
+    ASSERT_INT_EQUALS(0, subscribers[3].cleanups);
+
+    /* The one asking for the highest QoS leaves */
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_remove_subscriber(&tree, &filter, &subscribers[1]));
+    ASSERT_INT_EQUALS(1, subscribers[1].cleanups);
+    node = aws_mqtt_topic_tree_find(&tree, &filter);
+    ASSERT_NOT_NULL(node);
+    ASSERT_UINT_EQUALS(2, node->subscriber_count);
+    ASSERT_INT_EQUALS(AWS_MQTT_QOS_AT_LEAST_ONCE, node->qos);
+
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_publish(&tree, &publish));
+    ASSERT_INT_EQUALS(2, subscribers[0].times_called);
+    ASSERT_INT_EQUALS(1, subscribers[1].times_called);
+    ASSERT_INT_EQUALS(2, subscribers[2].times_called);
+    ASSERT_TRUE(node->granted);
+
+    /* Someone who never subscribed leaving changes nothing */
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_remove_subscriber(&tree, &filter, &subscribers[3]));
+    ASSERT_UINT_EQUALS(2, node->subscriber_count);
+
+    /* The filter goes with its last subscriber */
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_remove_subscriber(&tree, &filter, &subscribers[0]));
+    ASSERT_NOT_NULL(aws_mqtt_topic_tree_find(&tree, &filter));
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_remove_subscriber(&tree, &filter, &subscribers[2]));
+    ASSERT_NULL(aws_mqtt_topic_tree_find(&tree, &filter));
+    ASSERT_UINT_EQUALS(0, aws_mqtt_topic_node_get_child_count(tree.root));
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_publish(&tree, &publish));
+    ASSERT_INT_EQUALS(2, subscribers[0].times_called);
+    ASSERT_INT_EQUALS(2, subscribers[2].times_called);
+
+    /* Removing the whole filter cleans up everyone subscribed to it. What was granted went with them. */
+    ASSERT_SUCCESS(s_insert_shared(&tree, topic_filter, AWS_MQTT_QOS_AT_MOST_ONCE, &subscribers[0]));
+    ASSERT_SUCCESS(s_insert_shared(&tree, topic_filter, AWS_MQTT_QOS_AT_MOST_ONCE, &subscribers[1]));
+    node = aws_mqtt_topic_tree_find(&tree, &filter);
+    ASSERT_NOT_NULL(node);
+    ASSERT_FALSE(node->granted);
+    ASSERT_SUCCESS(aws_mqtt_topic_tree_remove(&tree, &filter));
+    ASSERT_INT_EQUALS(2, subscribers[0].cleanups);
+    ASSERT_INT_EQUALS(2, subscribers[1].cleanups);
+    ASSERT_INT_EQUALS(1, subscribers[2].cleanups);
+    ASSERT_UINT_EQUALS(0, aws_mqtt_topic_node_get_child_count(tree.root));
+
+    /* Only filters that were actually subscribed to are found */
+    ASSERT_SUCCESS(s_insert_shared(&tree, topic_filter, AWS_MQTT_QOS_AT_MOST_ONCE, &subscribers[3]));
+    struct aws_byte_cursor partial = aws_byte_cursor_from_c_str("fleet/+");
+    ASSERT_NULL(aws_mqtt_topic_tree_find(&tree, &partial));
+
+    aws_mqtt_topic_tree_clean_up(&tree);
+    ASSERT_INT_EQUALS(1, subscribers[3].cleanups);
+    aws_string_destroy(topic_filter);
+
+    return AWS_OP_SUCCESS;
+}
+
 AWS_TEST_CASE(mqtt_topic_validation, s_mqtt_topic_validation_fn)
 static int s_mqtt_topic_validation_fn(struct aws_allocator *allocator, void *ctx) {
     (void)allocator;
@@ -237,6 +732,39 @@ static int s_mqtt_topic_validation_fn(struct aws_allocator *allocator, void *ctx
     ASSERT_TOPIC_VALIDITY(TRUE, "+/tennis/#");
     ASSERT_TOPIC_VALIDITY(TRUE, "sport/+/player1");
     ASSERT_TOPIC_VALIDITY(FALSE, "sport+");
+    ASSERT_TOPIC_VALIDITY(FALSE, "+sport");
+    ASSERT_TOPIC_VALIDITY(FALSE, "#/");
+    ASSERT_TOPIC_VALIDITY(TRUE, "/+/");
+
+    /* Longer than one 16 byte chunk, with wildcards on either side of the chunk boundaries */
+    ASSERT_TOPIC_VALIDITY(TRUE, "0123456789abcde/+/0123456789abcdef/#");
+    ASSERT_TOPIC_VALIDITY(TRUE, "0123456789abcdef0123456789abcde/+");
+    ASSERT_TOPIC_VALIDITY(FALSE, "0123456789abcdef+/0123456789abcdef");
+    ASSERT_TOPIC_VALIDITY(FALSE, "0123456789abcde/+0123456789abcdef");
+    ASSERT_TOPIC_VALIDITY(FALSE, "0123456789abcdef0123456789abcdef/#/a");
+
+#define ASSERT_TOPIC_NAME_VALIDITY(expected, topic)                                                                    \
+    do {                                                                                                               \
+        struct aws_byte_cursor topic_cursor;                                                                           \
+        topic_cursor.ptr = (uint8_t *)(topic);                                                                         \
+        topic_cursor.len = strlen(topic);                                                                              \
+        ASSERT_##expected(aws_mqtt_is_valid_topic(&topic_cursor));                                                     \
+    } while (false)
+
+    ASSERT_TOPIC_NAME_VALIDITY(TRUE, "sport/tennis/player1");
+    ASSERT_TOPIC_NAME_VALIDITY(TRUE, "/");
+    ASSERT_TOPIC_NAME_VALIDITY(FALSE, "sport/+/player1");
+    ASSERT_TOPIC_NAME_VALIDITY(FALSE, "sport/tennis/#");
+    ASSERT_TOPIC_NAME_VALIDITY(TRUE, "0123456789abcdef0123456789abcdef0123456789abcdef");
+    ASSERT_TOPIC_NAME_VALIDITY(FALSE, "0123456789abcdef0123456789abcdef0123456789abcde#");
+
+    /* Embedded NUL past the first chunk */
+    uint8_t with_nul[40];
+    memset(with_nul, 'a', sizeof(with_nul));
+    with_nul[33] = 0;
+    struct aws_byte_cursor nul_cursor = aws_byte_cursor_from_array(with_nul, sizeof(with_nul));
+    ASSERT_FALSE(aws_mqtt_is_valid_topic(&nul_cursor));
+    ASSERT_FALSE(aws_mqtt_is_valid_topic_filter(&nul_cursor));
 
     return AWS_OP_SUCCESS;
 }